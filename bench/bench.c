@@ -0,0 +1,465 @@
+/*
+ * This file is part of COFFE
+ * Copyright (C) 2018 Goran Jelic-Cizmek
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+    micro benchmarks of the hot spots of COFFE; each one prints
+    its name, the number of calls, the time taken, the throughput
+    (calls per second) and a checksum of the results, which bench/run.sh
+    compares against the baseline so speedups changing the results are caught
+**/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <gsl/gsl_spline2d.h>
+#include <fftw3.h>
+
+#include "common.h"
+#include "errors.h"
+#include "coffe.h"
+#include "functions.h"
+#include "offload.h"
+#include "twofast.h"
+
+#ifndef COFFE_BENCH_MU
+#define COFFE_BENCH_MU 21 // points in mu of the correlation function benchmarks
+#endif
+
+#ifndef COFFE_BENCH_SEP
+#define COFFE_BENCH_SEP 20 // points in the separation of the correlation function benchmarks
+#endif
+
+#ifndef COFFE_BENCH_X
+#define COFFE_BENCH_X 10 // points per line of sight integral
+#endif
+
+#ifndef COFFE_BENCH_OFFLOAD_TOLERANCE
+#define COFFE_BENCH_OFFLOAD_TOLERANCE 1e-3 // largest relative difference of the offload tables to the splines
+#endif
+
+#ifndef COFFE_BENCH_PIXELS
+#define COFFE_BENCH_PIXELS 40 // pixels of the covariance benchmark
+#endif
+
+
+static void bench_report(
+    const char *name,
+    size_t calls,
+    double time,
+    double checksum
+)
+{
+    printf(
+        "%-28s %12zu %12.6f %14.6e %+.15e\n",
+        name, calls, time, time > 0 ? calls/time : 0, checksum
+    );
+    fflush(stdout);
+}
+
+
+/**
+    evaluations of the spline of the power spectrum
+**/
+
+static void bench_interp_spline(
+    struct coffe_parameters_t *par,
+    size_t repeat
+)
+{
+    const size_t npoints = 1000;
+    double k[npoints];
+    for (size_t i = 0; i<npoints; ++i){
+        k[i] = par->k_min*pow(par->k_max/par->k_min, (double)i/(npoints - 1));
+    }
+
+    double checksum = 0;
+    const double start = coffe_profile_time();
+    for (size_t n = 0; n<repeat; ++n){
+        for (size_t i = 0; i<npoints; ++i){
+            checksum += interp_spline(&par->power_spectrum, k[i]);
+        }
+    }
+    const double time = coffe_profile_time() - start;
+    bench_report("interp_spline", repeat*npoints, time, checksum/repeat);
+}
+
+
+/**
+    the FFTlog integrals I^n_l as in coffe_integrals_init
+**/
+
+static void bench_twofast_1bessel(
+    struct coffe_parameters_t *par,
+    size_t repeat
+)
+{
+    const size_t npoints = (size_t)par->bessel_bins;
+    double *x = (double *)coffe_malloc(sizeof(double)*npoints);
+    double *y = (double *)fftw_malloc(sizeof(double)*npoints);
+    const int l[] = {0, 1, 2, 3, 4};
+    const size_t len = sizeof(l)/sizeof(l[0]);
+
+    double checksum = 0;
+    const double start = coffe_profile_time();
+    for (size_t n = 0; n<repeat; ++n){
+        for (size_t i = 0; i<len; ++i){
+            twofast_1bessel(
+                x, y, npoints,
+                par->power_spectrum_norm.spline->x,
+                par->power_spectrum_norm.spline->y,
+                par->power_spectrum_norm.spline->size,
+                l[i], 0,
+                COFFE_H0, par->k_min_norm,
+                par->k_min_norm, par->k_max_norm, par->fftw_flag
+            );
+            if (n == 0) checksum += y[npoints/2];
+        }
+    }
+    const double time = coffe_profile_time() - start;
+    bench_report("twofast_1bessel", repeat*len, time, checksum);
+
+    free(x);
+    fftw_free(y);
+}
+
+
+/**
+    the correlation function kernels on a grid of mu, separations and
+    points along the line of sight
+**/
+
+static void bench_functions(
+    struct coffe_parameters_t *par,
+    struct coffe_background_t *bg,
+    struct coffe_integrals_t *integral,
+    size_t repeat
+)
+{
+    double mu[COFFE_BENCH_MU], sep[COFFE_BENCH_SEP], x[COFFE_BENCH_X];
+    for (size_t i = 0; i<COFFE_BENCH_MU; ++i){
+        mu[i] = -1 + 2.*i/(COFFE_BENCH_MU - 1);
+    }
+    for (size_t i = 0; i<COFFE_BENCH_SEP; ++i){
+        sep[i] = (10 + 190.*i/(COFFE_BENCH_SEP - 1))*COFFE_H0;
+    }
+    for (size_t i = 0; i<COFFE_BENCH_X; ++i){
+        x[i] = (i + 0.5)/COFFE_BENCH_X;
+    }
+
+    double checksum = 0;
+    double start = coffe_profile_time();
+    for (size_t n = 0; n<repeat; ++n){
+        for (size_t i = 0; i<COFFE_BENCH_MU; ++i){
+            for (size_t j = 0; j<COFFE_BENCH_SEP; ++j){
+                checksum += functions_nonintegrated(
+                    par, bg, integral, par->z_mean, mu[i], sep[j]
+                );
+            }
+        }
+    }
+    double time = coffe_profile_time() - start;
+    bench_report(
+        "functions_nonintegrated",
+        repeat*COFFE_BENCH_MU*COFFE_BENCH_SEP, time, checksum/repeat
+    );
+
+    checksum = 0;
+    start = coffe_profile_time();
+    for (size_t n = 0; n<repeat; ++n){
+        for (size_t i = 0; i<COFFE_BENCH_MU; ++i){
+            for (size_t j = 0; j<COFFE_BENCH_SEP; ++j){
+                for (size_t k = 0; k<COFFE_BENCH_X; ++k){
+                    checksum += functions_single_integrated(
+                        par, bg, integral, par->z_mean, mu[i], sep[j], x[k]
+                    );
+                }
+            }
+        }
+    }
+    time = coffe_profile_time() - start;
+    bench_report(
+        "functions_single_integrated",
+        repeat*COFFE_BENCH_MU*COFFE_BENCH_SEP*COFFE_BENCH_X, time, checksum/repeat
+    );
+
+    checksum = 0;
+    start = coffe_profile_time();
+    for (size_t n = 0; n<repeat; ++n){
+        for (size_t i = 0; i<COFFE_BENCH_MU; ++i){
+            for (size_t j = 0; j<COFFE_BENCH_SEP; ++j){
+                for (size_t k1 = 0; k1<COFFE_BENCH_X; ++k1){
+                    for (size_t k2 = 0; k2<COFFE_BENCH_X; ++k2){
+                        checksum += functions_double_integrated(
+                            par, bg, integral, par->z_mean,
+                            mu[i], sep[j], x[k1], x[k2]
+                        );
+                    }
+                }
+            }
+        }
+    }
+    time = coffe_profile_time() - start;
+    bench_report(
+        "functions_double_integrated",
+        repeat*COFFE_BENCH_MU*COFFE_BENCH_SEP*COFFE_BENCH_X*COFFE_BENCH_X,
+        time, checksum/repeat
+    );
+
+    /* the same points, one batch per separation, as the integrators hand them out */
+    const size_t len = COFFE_BENCH_MU*COFFE_BENCH_X*COFFE_BENCH_X;
+    double *z_mean = (double *)coffe_malloc(sizeof(double)*len);
+    double *mu_batch = (double *)coffe_malloc(sizeof(double)*len);
+    double *x1 = (double *)coffe_malloc(sizeof(double)*len);
+    double *x2 = (double *)coffe_malloc(sizeof(double)*len);
+    double *result = (double *)coffe_malloc(sizeof(double)*len);
+    for (size_t i = 0; i<COFFE_BENCH_MU; ++i){
+        for (size_t k1 = 0; k1<COFFE_BENCH_X; ++k1){
+            for (size_t k2 = 0; k2<COFFE_BENCH_X; ++k2){
+                const size_t m = (i*COFFE_BENCH_X + k1)*COFFE_BENCH_X + k2;
+                z_mean[m] = par->z_mean;
+                mu_batch[m] = mu[i];
+                x1[m] = x[k1];
+                x2[m] = x[k2];
+            }
+        }
+    }
+
+    checksum = 0;
+    start = coffe_profile_time();
+    for (size_t n = 0; n<repeat; ++n){
+        for (size_t j = 0; j<COFFE_BENCH_SEP; ++j){
+            /* the first COFFE_BENCH_X points of each mu are the single integrated grid */
+            for (size_t i = 0; i<COFFE_BENCH_MU; ++i){
+                const size_t m = i*COFFE_BENCH_X*COFFE_BENCH_X;
+                functions_single_integrated_batch(
+                    par, bg, integral, sep[j], COFFE_BENCH_X,
+                    &z_mean[m], &mu_batch[m], &x2[m], &result[m]
+                );
+                for (size_t k = 0; k<COFFE_BENCH_X; ++k) checksum += result[m + k];
+            }
+        }
+    }
+    time = coffe_profile_time() - start;
+    bench_report(
+        "functions_single_integrated_batch",
+        repeat*COFFE_BENCH_MU*COFFE_BENCH_SEP*COFFE_BENCH_X, time, checksum/repeat
+    );
+
+    checksum = 0;
+    start = coffe_profile_time();
+    for (size_t n = 0; n<repeat; ++n){
+        for (size_t j = 0; j<COFFE_BENCH_SEP; ++j){
+            functions_double_integrated_batch(
+                par, bg, integral, sep[j], len,
+                z_mean, mu_batch, x1, x2, result
+            );
+            for (size_t m = 0; m<len; ++m) checksum += result[m];
+        }
+    }
+    time = coffe_profile_time() - start;
+    bench_report(
+        "functions_double_integrated_batch",
+        repeat*COFFE_BENCH_SEP*len, time, checksum/repeat
+    );
+
+    free(z_mean);
+    free(mu_batch);
+    free(x1);
+    free(x2);
+    free(result);
+}
+
+
+#ifdef HAVE_OFFLOAD
+/**
+    the double integrated terms from the tables of the offload backend,
+    evaluated on the host, against the splines; returns EXIT_FAILURE if they
+    differ by more than COFFE_BENCH_OFFLOAD_TOLERANCE
+**/
+
+static int bench_offload(
+    struct coffe_parameters_t *par,
+    struct coffe_background_t *bg,
+    struct coffe_integrals_t *integral,
+    size_t repeat
+)
+{
+    if (par->double_terms.len == 0) return EXIT_SUCCESS;
+    coffe_offload_init(par, bg, integral);
+
+    const size_t len = COFFE_BENCH_MU*COFFE_BENCH_X*COFFE_BENCH_X;
+    double *mu = (double *)coffe_malloc(sizeof(double)*len);
+    double *x1 = (double *)coffe_malloc(sizeof(double)*len);
+    double *x2 = (double *)coffe_malloc(sizeof(double)*len);
+    double *result = (double *)coffe_malloc(sizeof(double)*len);
+    for (size_t i = 0; i<COFFE_BENCH_MU; ++i){
+        for (size_t k1 = 0; k1<COFFE_BENCH_X; ++k1){
+            for (size_t k2 = 0; k2<COFFE_BENCH_X; ++k2){
+                const size_t m = (i*COFFE_BENCH_X + k1)*COFFE_BENCH_X + k2;
+                mu[m] = -1 + 2.*i/(COFFE_BENCH_MU - 1);
+                x1[m] = (k1 + 0.5)/COFFE_BENCH_X;
+                x2[m] = (k2 + 0.5)/COFFE_BENCH_X;
+            }
+        }
+    }
+
+    int status = EXIT_SUCCESS;
+    double checksum = 0, largest = 0;
+    const double start = coffe_profile_time();
+    for (size_t n = 0; n<repeat && status == EXIT_SUCCESS; ++n){
+        for (size_t j = 0; j<COFFE_BENCH_SEP; ++j){
+            const double sep = (10 + 190.*j/(COFFE_BENCH_SEP - 1))*COFFE_H0;
+            double difference;
+            if (coffe_offload_compare(
+                par, bg, integral, par->z_mean, sep,
+                len, mu, x1, x2, result, &difference
+            ) != EXIT_SUCCESS){
+                status = EXIT_FAILURE;
+                break;
+            }
+            largest = fmax(largest, difference);
+            for (size_t m = 0; m<len; ++m) checksum += result[m];
+        }
+    }
+    const double time = coffe_profile_time() - start;
+
+    if (status != EXIT_SUCCESS){
+        fprintf(stderr, "WARNING: the offload tables are not available\n");
+    }
+    else{
+        bench_report(
+            "offload_point_host",
+            repeat*COFFE_BENCH_SEP*len, time, checksum/repeat
+        );
+        if (!(largest <= COFFE_BENCH_OFFLOAD_TOLERANCE)){
+            fprintf(stderr,
+                "ERROR: the offload tables differ from the splines by %e (tolerance %e)\n",
+                largest, COFFE_BENCH_OFFLOAD_TOLERANCE);
+            status = EXIT_FAILURE;
+        }
+    }
+
+    free(mu);
+    free(x1);
+    free(x2);
+    free(result);
+    coffe_offload_free();
+    return status;
+}
+#endif
+
+
+/**
+    the integrals D_l1l2 and G_l1l2 of the covariance of multipoles
+**/
+
+static void bench_covariance_integrals(
+    struct coffe_parameters_t *par,
+    size_t repeat
+)
+{
+    const int l[] = {0, 2, 4};
+    const size_t l_len = sizeof(l)/sizeof(l[0]);
+    const size_t npixels = COFFE_BENCH_PIXELS;
+    const double pixelsize = 5.;
+
+    const size_t len = par->power_spectrum.spline->size;
+    double *pk2 = (double *)coffe_malloc(sizeof(double)*len);
+    for (size_t i = 0; i<len; ++i){
+        pk2[i] = pow(par->power_spectrum.spline->y[i], 2);
+    }
+    struct coffe_interpolation integrand_pk2;
+    init_spline(
+        &integrand_pk2, par->power_spectrum.spline->x, pk2, len, 5
+    );
+    free(pk2);
+
+    double *integral_pk[l_len*l_len], *integral_pk2[l_len*l_len];
+    for (size_t i = 0; i<l_len*l_len; ++i){
+        integral_pk[i] = (double *)coffe_malloc(sizeof(double)*npixels*npixels);
+        integral_pk2[i] = (double *)coffe_malloc(sizeof(double)*npixels*npixels);
+    }
+
+    const double start = coffe_profile_time();
+    for (size_t n = 0; n<repeat; ++n){
+        coffe_covariance_integrals(
+            par, &par->power_spectrum, &integrand_pk2,
+            l, l_len, npixels, pixelsize,
+            integral_pk, integral_pk2
+        );
+    }
+    const double time = coffe_profile_time() - start;
+
+    /* relative to the diagonal, so the checksum is of order unity */
+    double checksum = 0;
+    for (size_t i = 0; i<l_len*l_len; ++i){
+        for (size_t m = 0; m<npixels*npixels; ++m){
+            checksum += integral_pk[i][m]/fabs(integral_pk[0][0]);
+        }
+    }
+    bench_report("covariance_integrals", repeat, time, checksum);
+
+    for (size_t i = 0; i<l_len*l_len; ++i){
+        free(integral_pk[i]);
+        free(integral_pk2[i]);
+    }
+    free_spline(&integrand_pk2);
+}
+
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2){
+        printf("Usage: coffe-bench [SETTINGSFILE] [NUMTHREADS] [REPEAT]\n");
+        return EXIT_SUCCESS;
+    }
+    const int nthreads = argc > 2 ? atoi(argv[2]) : 1;
+    const size_t repeat = argc > 3 ? (size_t)atol(argv[3]) : 10;
+    if (nthreads <= 0 || repeat == 0){
+        print_error_verbose(PROG_VALUE_ERROR, "NUMTHREADS or REPEAT");
+        return EXIT_FAILURE;
+    }
+
+    struct coffe_context_t *ctx =
+        (struct coffe_context_t *)coffe_malloc(sizeof(struct coffe_context_t));
+    coffe_context_init(ctx, argv[1], nthreads);
+
+    /* only the tables are needed, no results */
+    coffe_background_init(&ctx->par, &ctx->bg);
+    coffe_integrals_init(&ctx->par, &ctx->bg, ctx->integral);
+    ctx->computed |= COFFE_STAGE_BACKGROUND | COFFE_STAGE_INTEGRALS;
+    ctx->stale = 0;
+
+    printf("# %-26s %12s %12s %14s %s\n",
+        "name", "calls", "time[s]", "calls/s", "checksum");
+    bench_interp_spline(&ctx->par, 1000*repeat);
+    bench_twofast_1bessel(&ctx->par, repeat);
+    bench_functions(&ctx->par, &ctx->bg, ctx->integral, repeat);
+    bench_covariance_integrals(&ctx->par, repeat);
+#ifdef HAVE_OFFLOAD
+    const int status = bench_offload(&ctx->par, &ctx->bg, ctx->integral, repeat);
+#else
+    const int status = EXIT_SUCCESS;
+#endif
+
+    coffe_context_free(ctx);
+    free(ctx);
+
+    return status;
+}
@@ -0,0 +1,209 @@
+#!/bin/sh
+#
+# This file is part of COFFE
+# Copyright (C) 2018 Goran Jelic-Cizmek
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <http://www.gnu.org/licenses/>.
+#
+# the benchmark suite: the micro benchmarks of coffe-bench and one reference
+# run for each output_type, all derived from settings.cfg; the results are
+# compared against the reference outputs committed in bench/reference/, which
+# are only read, and the timings against the ones of the previous runs on this
+# machine, stored in bench_results/baseline/ of the build directory
+#
+# the reference runs use a deterministic integration method (3 or 4), so
+# their results only depend on the code, not on the random numbers; the
+# references are made with one thread
+#
+# usage: run.sh SRCDIR COFFE COFFE_BENCH
+#
+# environment:
+#   COFFE_BENCH_THREADS    number of threads (default 1)
+#   COFFE_BENCH_METHOD     integration_method of the reference runs, 3 or 4 (default 4)
+#   COFFE_BENCH_TOLERANCE  relative tolerance of the results (default 1e-6)
+#   COFFE_BENCH_UPDATE     if 1, store the current timings as the new baseline
+#   COFFE_BENCH_REFERENCE  if 1, write the current results as new references into
+#                          bench_results/reference/, to be copied to bench/reference/
+
+if [ $# -ne 3 ]; then
+    echo "Usage: $0 SRCDIR COFFE COFFE_BENCH" >&2
+    exit 1
+fi
+
+srcdir=$(cd "$1" && pwd)
+coffe=$2
+coffe_bench=$3
+threads=${COFFE_BENCH_THREADS:-1}
+method=${COFFE_BENCH_METHOD:-4}
+tolerance=${COFFE_BENCH_TOLERANCE:-1e-6}
+update=${COFFE_BENCH_UPDATE:-0}
+new_reference=${COFFE_BENCH_REFERENCE:-0}
+results="bench_results"
+baseline="$results/baseline"
+
+case "$method" in
+    3|4) ;;
+    *)
+        echo "$0: COFFE_BENCH_METHOD must be 3 or 4 (deterministic)" >&2
+        exit 1
+        ;;
+esac
+
+if [ "$new_reference" = "1" ]; then
+    reference="$results/reference/method$method"
+    if [ "$threads" != "1" ]; then
+        echo "$0: the references are made with one thread (COFFE_BENCH_THREADS=1)" >&2
+        exit 1
+    fi
+else
+    reference="$srcdir/bench/reference/method$method"
+fi
+
+mkdir -p "$results" "$baseline" || exit 1
+if [ "$new_reference" = "1" ]; then
+    mkdir -p "$reference" || exit 1
+fi
+failed=0
+
+# settings.cfg with the given output_type, absolute input paths and the results
+# in $results/ prefixed by type<output_type>_
+settings()
+{
+    sed \
+        -e "s|^output_type *=.*|output_type = $1;|" \
+        -e "s|^output_path *=.*|output_path = \"$results/\";|" \
+        -e "s|^output_prefix *=.*|output_prefix = \"type$1_\";|" \
+        -e "s|^integration_method *=.*|integration_method = $method;|" \
+        -e "s|^input_separations *=.*|input_separations = \"$srcdir/separations.dat\";|" \
+        -e "s|^input_power_spectrum *=.*|input_power_spectrum = \"$srcdir/PkL_CLASS.dat\";|" \
+        "$srcdir/settings.cfg"
+}
+
+# compares two files of numbers, ignoring comments; fails if any of the
+# numbers differs by more than the relative tolerance
+compare()
+{
+    awk -v tol="$tolerance" '
+        function abs(x){ return x < 0 ? -x : x }
+        FNR == NR {
+            if ($0 !~ /^#/) ref[++nref] = $0
+            next
+        }
+        $0 !~ /^#/ {
+            ++n
+            if (n > nref){ bad = 1; exit }
+            nf = split(ref[n], value)
+            if (nf != NF){ bad = 1; exit }
+            for (i = 1; i <= NF; ++i){
+                scale = abs(value[i]) > abs($i) ? abs(value[i]) : abs($i)
+                if (abs(value[i] - $i) > tol*scale + 1e-300){
+                    printf "    line %d, column %d: %s (baseline %s)\n", n, i, $i, value[i]
+                    bad = 1
+                    exit
+                }
+            }
+        }
+        END { if (bad || n != nref) exit 1 }
+    ' "$1" "$2"
+}
+
+# the wall time of the whole run from a profile report
+walltime()
+{
+    sed -n 's/.*"total": {"wall": \([0-9.eE+-]*\),.*/\1/p' "$1"
+}
+
+# reports (and possibly stores) the time of a benchmark against the baseline
+# of this machine
+throughput()
+{
+    name=$1
+    time=$2
+    stored="$baseline/$name.time"
+    if [ "$update" = "1" ] || [ ! -f "$stored" ]; then
+        echo "$time" > "$stored"
+        printf "%-28s %12s s (baseline stored)\n" "$name" "$time"
+    else
+        awk -v name="$name" -v time="$time" '{
+            printf "%-28s %12s s (baseline %s s, speedup %.3f)\n", \
+                name, time, $1, time > 0 ? $1/time : 0
+        }' "$stored"
+    fi
+}
+
+# checks a result file against its reference, or stores it as the new one;
+# a missing reference is a failure, it is never made up from the current run
+accuracy()
+{
+    file=$1
+    stored="$reference/$(basename "$file")"
+    if [ "$new_reference" = "1" ]; then
+        cp "$file" "$stored"
+    elif [ ! -f "$stored" ]; then
+        echo "    FAILED: no reference for $(basename "$file") in $reference"
+        failed=1
+    elif ! compare "$stored" "$file"; then
+        echo "    FAILED: $(basename "$file") differs from the reference"
+        failed=1
+    fi
+}
+
+echo "# micro benchmarks"
+settings 2 \
+    | sed -e 's|^correlation_contributions *=.*|correlation_contributions = ["den", "rsd", "d1", "d2", "g1", "g2", "g3", "g4", "g5", "len"];|' \
+    > "$results/micro.cfg"
+if ! "$coffe_bench" "$results/micro.cfg" "$threads" > "$results/micro.txt"; then
+    echo "FAILED: $coffe_bench"
+    exit 1
+fi
+cat "$results/micro.txt"
+# only the checksums are compared against the reference, the throughput
+# against the baseline of this machine
+awk '$0 !~ /^#/ {print $1, $5}' "$results/micro.txt" > "$results/micro.sum"
+accuracy "$results/micro.sum"
+if [ "$update" = "1" ] || [ ! -f "$baseline/micro.txt" ]; then
+    cp "$results/micro.txt" "$baseline/micro.txt"
+else
+    awk 'FNR == NR { if ($0 !~ /^#/) rate[$1] = $4; next }
+        $0 !~ /^#/ && ($1 in rate) && rate[$1] > 0 {
+            printf "%-28s speedup %.3f\n", $1, $4/rate[$1]
+        }' "$baseline/micro.txt" "$results/micro.txt"
+fi
+
+echo "# reference runs"
+for type in 0 1 2 3 4 5 6; do
+    rm -f "$results"/type${type}_*
+    settings $type > "$results/type$type.cfg"
+    if ! "$coffe" -s "$results/type$type.cfg" -n "$threads" > "$results/type$type.log" 2>&1; then
+        echo "FAILED: output_type = $type, see $results/type$type.log"
+        failed=1
+        continue
+    fi
+    throughput "output_type_$type" "$(walltime "$results/type${type}_profile.json")"
+    for file in "$results"/type${type}_*; do
+        case "$file" in
+            *profile.json|*.cfg|*.tiles) ;;
+            *) accuracy "$file" ;;
+        esac
+    done
+done
+
+if [ "$new_reference" = "1" ]; then
+    echo "# new references written to $reference, copy them to $srcdir/bench/reference/method$method"
+fi
+if [ $failed -ne 0 ]; then
+    echo "# some of the benchmarks FAILED"
+    exit 1
+fi
+echo "# all the benchmarks agree with the reference"
@@ -29,6 +29,7 @@
 #include "integrals.h"
 #include "functions.h"
 #include "average_multipoles.h"
+#include "checkpoint.h"
 
 #ifdef HAVE_CUBA
 #include "cuba.h"
@@ -45,7 +46,8 @@ struct average_multipoles_params
     struct coffe_parameters_t *par;
     struct coffe_integrals_t *integral;
     double sep;
-    int l;
+    const int *l; /* the multipoles */
+    size_t index; /* which of the above the integrand is for */
 };
 
 
@@ -110,7 +112,7 @@ static int average_multipoles_check_range(
 static int average_multipoles_nonintegrated_integrand(
     const int *ndim, const cubareal var[],
     const int *ncomp, cubareal value[],
-    void *p
+    void *p, const int *nvec
 )
 #else
 static double average_multipoles_nonintegrated_integrand(
@@ -135,51 +137,59 @@ static double average_multipoles_nonintegrated_integrand(
             interp_spline(&bg->comoving_distance, par->z_max) - sep/2.
         );
 
-    double z = (z2 - z1)*var[0] + z1;
-    double mu = 2*var[1] - 1;
-
 #ifdef HAVE_CUBA
-    if (params->l == 0){
-        value[0] = functions_nonintegrated(
-            par, bg, integral, z, mu, sep
-        )
-       /interp_spline(&bg->conformal_Hz, z)/(1 + z);
-        return EXIT_SUCCESS;
+    /*
+        Cuba hands over *nvec points at once, each with *ndim coordinates,
+        and expects the *ncomp multipoles of each of them
+    */
+    double z[*nvec], mu[*nvec], temp[*nvec];
+    for (int i = 0; i<*nvec; ++i){
+        z[i] = (z2 - z1)*var[i*(*ndim)] + z1;
+        mu[i] = 2*var[i*(*ndim) + 1] - 1;
     }
-    else{
-        value[0] = functions_nonintegrated(
-            par, bg, integral, z, mu, sep
-        )
-       *gsl_sf_legendre_Pl(params->l, mu)
-       /interp_spline(&bg->conformal_Hz, z)/(1 + z);
-        return EXIT_SUCCESS;
-    }
-#else
-    if (params->l == 0){
-        return functions_nonintegrated(
-            par, bg, integral, z, mu, sep
-        )
-       /interp_spline(&bg->conformal_Hz, z)/(1 + z);
+    for (int i = 0; i<*nvec; ++i){
+        temp[i] = functions_nonintegrated(par, bg, integral, z[i], mu[i], sep);
     }
-    else{
-        return functions_nonintegrated(
-            par, bg, integral, z, mu, sep
-        )
-       *gsl_sf_legendre_Pl(params->l, mu)
-       /interp_spline(&bg->conformal_Hz, z)/(1 + z);
+    double legendre[(*ncomp)*(*nvec)];
+    coffe_legendre_array(params->l, *ncomp, mu, *nvec, legendre);
+    for (int i = 0; i<*nvec; ++i){
+        temp[i] /= interp_spline(&bg->conformal_Hz, z[i])*(1 + z[i]);
+        for (int j = 0; j<*ncomp; ++j){
+            value[i*(*ncomp) + j] = temp[i]*legendre[j*(*nvec) + i];
+        }
     }
+    return EXIT_SUCCESS;
+#else
+    double z = (z2 - z1)*var[0] + z1;
+    double mu = 2*var[1] - 1;
+    double legendre = 1;
+    coffe_legendre(&params->l[params->index], 1, mu, &legendre);
+    return functions_nonintegrated(
+        par, bg, integral, z, mu, sep
+    )
+   *legendre
+   /interp_spline(&bg->conformal_Hz, z)/(1 + z);
 #endif
 }
 
 
-/* computes the average multipole of non-integrated terms for given l and separation */
+/**
+    computes all the <l_len> redshift averaged multipoles <l> of the nonintegrated
+    terms at separation <sep>; when the integration method allows it (Cuba,
+    or the GSL methods with points fixed in advance), from one integration
+**/
 
-static double average_multipoles_nonintegrated(
+static int average_multipoles_nonintegrated(
     struct coffe_parameters_t *par,
     struct coffe_background_t *bg,
     struct coffe_integrals_t *integral,
     double sep,
-    int l
+    const int *l,
+    size_t l_len,
+    const struct coffe_gauss_rule *rule,
+    const struct coffe_effort *effort,
+    double *result,
+    double *error
 )
 {
     const int dims = 2;
@@ -190,137 +200,106 @@ static double average_multipoles_nonintegrated(
     test.integral = integral;
     test.sep = sep;
     test.l = l;
+    test.index = 0;
 
-    int flag = 0;
-    int len = par->correlation_sources_len*(par->correlation_sources_len + 1)/2;
-    for (int i = 0; i<len; ++i){
-        if (
-            strcmp(par->corr_terms[i], "00") == 0 ||
-            strcmp(par->corr_terms[i], "11") == 0 ||
-            strcmp(par->corr_terms[i], "22") == 0 ||
-            strcmp(par->corr_terms[i], "33") == 0 ||
-            strcmp(par->corr_terms[i], "44") == 0 ||
-            strcmp(par->corr_terms[i], "55") == 0 ||
-            strcmp(par->corr_terms[i], "66") == 0 ||
-            strcmp(par->corr_terms[i], "01") == 0 ||
-            strcmp(par->corr_terms[i], "10") == 0 ||
-            strcmp(par->corr_terms[i], "02") == 0 ||
-            strcmp(par->corr_terms[i], "20") == 0 ||
-            strcmp(par->corr_terms[i], "03") == 0 ||
-            strcmp(par->corr_terms[i], "30") == 0 ||
-            strcmp(par->corr_terms[i], "04") == 0 ||
-            strcmp(par->corr_terms[i], "40") == 0 ||
-            strcmp(par->corr_terms[i], "05") == 0 ||
-            strcmp(par->corr_terms[i], "50") == 0 ||
-            strcmp(par->corr_terms[i], "06") == 0 ||
-            strcmp(par->corr_terms[i], "60") == 0 ||
-            strcmp(par->corr_terms[i], "12") == 0 ||
-            strcmp(par->corr_terms[i], "21") == 0 ||
-            strcmp(par->corr_terms[i], "13") == 0 ||
-            strcmp(par->corr_terms[i], "31") == 0 ||
-            strcmp(par->corr_terms[i], "14") == 0 ||
-            strcmp(par->corr_terms[i], "41") == 0 ||
-            strcmp(par->corr_terms[i], "15") == 0 ||
-            strcmp(par->corr_terms[i], "51") == 0 ||
-            strcmp(par->corr_terms[i], "16") == 0 ||
-            strcmp(par->corr_terms[i], "61") == 0 ||
-            strcmp(par->corr_terms[i], "23") == 0 ||
-            strcmp(par->corr_terms[i], "32") == 0 ||
-            strcmp(par->corr_terms[i], "24") == 0 ||
-            strcmp(par->corr_terms[i], "42") == 0 ||
-            strcmp(par->corr_terms[i], "25") == 0 ||
-            strcmp(par->corr_terms[i], "52") == 0 ||
-            strcmp(par->corr_terms[i], "26") == 0 ||
-            strcmp(par->corr_terms[i], "62") == 0 ||
-            strcmp(par->corr_terms[i], "34") == 0 ||
-            strcmp(par->corr_terms[i], "43") == 0 ||
-            strcmp(par->corr_terms[i], "35") == 0 ||
-            strcmp(par->corr_terms[i], "53") == 0 ||
-            strcmp(par->corr_terms[i], "36") == 0 ||
-            strcmp(par->corr_terms[i], "63") == 0 ||
-            strcmp(par->corr_terms[i], "45") == 0 ||
-            strcmp(par->corr_terms[i], "54") == 0 ||
-            strcmp(par->corr_terms[i], "46") == 0 ||
-            strcmp(par->corr_terms[i], "64") == 0 ||
-            strcmp(par->corr_terms[i], "56") == 0 ||
-            strcmp(par->corr_terms[i], "65") == 0
-        ) ++flag;
+    for (size_t i = 0; i<l_len; ++i){
+        result[i] = 0;
+        error[i] = 0;
+    }
+    if (par->nonintegrated_terms.len == 0) return EXIT_SUCCESS;
+
+    /* the tolerance applies to the normalized multipoles */
+    const double norm = 1./interp_spline(&bg->D1, 0)/interp_spline(&bg->D1, 0);
+    struct coffe_effort scaled = *effort;
+    scaled.epsabs = HUGE_VAL;
+    for (size_t i = 0; i<l_len; ++i){
+        scaled.epsabs = fmin(scaled.epsabs, effort->epsabs/((2*l[i] + 1)*norm));
     }
-    if (flag == 0) return 0;
 
 #ifdef HAVE_CUBA
+    (void)rule;
     int nregions, neval, fail;
-    double result[1], error[1], prob[1];
-    Cuhre(dims, 1,
-        average_multipoles_nonintegrated_integrand,
+    double prob[l_len];
+    Cuhre(dims, l_len,
+        (integrand_t)average_multipoles_nonintegrated_integrand,
         (void *)&test, 1,
-        1e-3, 0, 0,
-        1, par->integration_bins, 7,
+        scaled.epsrel, scaled.epsabs, 0,
+        1, scaled.calls_max, 7,
         NULL, NULL,
         &nregions, &neval, &fail, result, error, prob
     );
-    return (2*l + 1)*result[0]
-    /interp_spline(&bg->D1, 0)/interp_spline(&bg->D1, 0);
 #else
     gsl_monte_function integrand;
     integrand.f = &average_multipoles_nonintegrated_integrand;
     integrand.dim = dims;
     integrand.params = &test;
-    gsl_rng *random;
-    gsl_rng_env_setup();
-    const gsl_rng_type *T = gsl_rng_default;
-    random = gsl_rng_alloc(T);
-    double result, error;
-    double lower[dims];
-    double upper[dims];
-    for (int i = 0; i<dims; ++i){
-        lower[i] = 0.0;
-        upper[i] = 1.0;
+
+    /* the multipoles are applied by the integrator if it can share the points */
+    const int monopole = 0;
+    if (integrate_multipoles_available(par->integration_method)) test.l = &monopole;
+    integrate_multipoles_adaptive(
+        &integrand, par->integration_method, &scaled,
+        rule, 1, l, l_len, &test.index, result, error
+    );
+#endif
+    for (size_t i = 0; i<l_len; ++i){
+        result[i] *= (2*l[i] + 1)*norm;
+        error[i] *= (2*l[i] + 1)*norm;
     }
-    switch (par->integration_method){
-        case 0:{
-            gsl_monte_plain_state *state =
-                gsl_monte_plain_alloc(dims);
-            gsl_monte_plain_integrate(
-                &integrand, lower, upper,
-                dims, par->integration_bins, random,
-                state,
-                &result, &error
-            );
-            gsl_monte_plain_free(state);
-            break;
-        }
-        case 1:{
-            gsl_monte_miser_state *state =
-                gsl_monte_miser_alloc(dims);
-            gsl_monte_miser_integrate(
-                &integrand, lower, upper,
-                dims, par->integration_bins, random,
-                state,
-                &result, &error
-            );
-            gsl_monte_miser_free(state);
-            break;
-        }
-        case 2:{
-            gsl_monte_vegas_state *state =
-                gsl_monte_vegas_alloc(dims);
-            gsl_monte_vegas_integrate(
-                &integrand, lower, upper,
-                dims, par->integration_bins, random,
-                state,
-                &result, &error
-            );
-            gsl_monte_vegas_free(state);
-            break;
-        }
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    computes all the redshift averaged multipoles <rule->l> of the nonintegrated
+    terms at separation <sep> from the projection onto the 1D rule <rule>,
+    which is also used for the integral in z; there is no error estimate
+**/
+
+static int average_multipoles_nonintegrated_projected(
+    struct coffe_parameters_t *par,
+    struct coffe_background_t *bg,
+    struct coffe_integrals_t *integral,
+    double sep,
+    const struct coffe_gauss_rule *rule,
+    double *result,
+    double *error
+)
+{
+    const size_t l_len = rule->l_len;
+    for (size_t i = 0; i<l_len; ++i){
+        result[i] = 0;
+        error[i] = 0;
     }
+    if (par->nonintegrated_terms.len == 0) return EXIT_SUCCESS;
 
-    gsl_rng_free(random);
+    double z1 =
+        interp_spline(
+            &bg->z_as_chi,
+            interp_spline(&bg->comoving_distance, par->z_min) + sep/2.
+        );
+    double z2 =
+        interp_spline(
+            &bg->z_as_chi,
+            interp_spline(&bg->comoving_distance, par->z_max) - sep/2.
+        );
 
-    return (2*l + 1)*result
-    /interp_spline(&bg->D1, 0)/interp_spline(&bg->D1, 0);
-#endif
+    double value[l_len];
+    for (size_t n = 0; n<rule->order; ++n){
+        const double z = (z2 - z1)*rule->x[n] + z1;
+        functions_nonintegrated_multipoles(par, bg, integral, z, sep, rule, value);
+        const double weight =
+            rule->w[n]/interp_spline(&bg->conformal_Hz, z)/(1 + z);
+        for (size_t i = 0; i<l_len; ++i){
+            result[i] += weight*value[i];
+        }
+    }
+
+    const double norm = 1./interp_spline(&bg->D1, 0)/interp_spline(&bg->D1, 0);
+    for (size_t i = 0; i<l_len; ++i){
+        result[i] *= norm;
+    }
+    return EXIT_SUCCESS;
 }
 
 
@@ -330,7 +309,7 @@ static double average_multipoles_nonintegrated(
 static int average_multipoles_single_integrated_integrand(
     const int *ndim, const cubareal var[],
     const int *ncomp, cubareal value[],
-    void *p
+    void *p, const int *nvec
 )
 #else
 static double average_multipoles_single_integrated_integrand(
@@ -355,52 +334,61 @@ static double average_multipoles_single_integrated_integrand(
             interp_spline(&bg->comoving_distance, par->z_max) - sep/2.
         );
 
-    double z = (z2 - z1)*var[0] + z1;
-    double mu = 2*var[1] - 1;
-    double x = var[2];
-
 #ifdef HAVE_CUBA
-    if (params->l == 0){
-        value[0] = functions_single_integrated(
-            par, bg, integral, z, mu, sep, x
-        )
-       /interp_spline(&bg->conformal_Hz, z)/(1 + z);
-        return EXIT_SUCCESS;
+    /*
+        Cuba hands over *nvec points at once, each with *ndim coordinates,
+        and expects the *ncomp multipoles of each of them
+    */
+    double z[*nvec], mu[*nvec], x[*nvec], temp[*nvec];
+    for (int i = 0; i<*nvec; ++i){
+        z[i] = (z2 - z1)*var[i*(*ndim)] + z1;
+        mu[i] = 2*var[i*(*ndim) + 1] - 1;
+        x[i] = var[i*(*ndim) + 2];
     }
-    else{
-        value[0] = functions_single_integrated(
-            par, bg, integral, z, mu, sep, x
-        )
-       *gsl_sf_legendre_Pl(params->l, mu)
-       /interp_spline(&bg->conformal_Hz, z)/(1 + z);
-        return EXIT_SUCCESS;
+    functions_single_integrated_batch(
+        par, bg, integral, sep, *nvec, z, mu, x, temp
+    );
+    double legendre[(*ncomp)*(*nvec)];
+    coffe_legendre_array(params->l, *ncomp, mu, *nvec, legendre);
+    for (int i = 0; i<*nvec; ++i){
+        temp[i] /= interp_spline(&bg->conformal_Hz, z[i])*(1 + z[i]);
+        for (int j = 0; j<*ncomp; ++j){
+            value[i*(*ncomp) + j] = temp[i]*legendre[j*(*nvec) + i];
+        }
     }
+    return EXIT_SUCCESS;
 #else
-    if (params->l == 0){
-        return functions_single_integrated(
-            par, bg, integral, z, mu, sep, x
-        )
-       /interp_spline(&bg->conformal_Hz, z)/(1 + z);
-    }
-    else{
-        return functions_single_integrated(
-            par, bg, integral, z, mu, sep, x
-        )
-       *gsl_sf_legendre_Pl(params->l, mu)
-       /interp_spline(&bg->conformal_Hz, z)/(1 + z);
-    }
+    double z = (z2 - z1)*var[0] + z1;
+    double mu = 2*var[1] - 1;
+    double x = var[2];
+    double legendre = 1;
+    coffe_legendre(&params->l[params->index], 1, mu, &legendre);
+    return functions_single_integrated(
+        par, bg, integral, z, mu, sep, x
+    )
+   *legendre
+   /interp_spline(&bg->conformal_Hz, z)/(1 + z);
 #endif
 }
 
 
-/* computes the average multipole of single integrated terms for given l and separation */
+/**
+    computes all the <l_len> redshift averaged multipoles <l> of the single integrated
+    terms at separation <sep>; when the integration method allows it (Cuba,
+    or the GSL methods with points fixed in advance), from one integration
+**/
 
-static double average_multipoles_single_integrated(
+static int average_multipoles_single_integrated(
     struct coffe_parameters_t *par,
     struct coffe_background_t *bg,
     struct coffe_integrals_t *integral,
     double sep,
-    int l
+    const int *l,
+    size_t l_len,
+    const struct coffe_gauss_rule *rule,
+    const struct coffe_effort *effort,
+    double *result,
+    double *error
 )
 {
     const int dims = 3;
@@ -411,125 +399,53 @@ static double average_multipoles_single_integrated(
     test.integral = integral;
     test.sep = sep;
     test.l = l;
+    test.index = 0;
 
-    int flag = 0;
-    int len = par->correlation_sources_len*(par->correlation_sources_len + 1)/2;
-    for (int i = 0; i<len; ++i){
-        if (
-            strcmp(par->corr_terms[i], "17") == 0 ||
-            strcmp(par->corr_terms[i], "71") == 0 ||
-            strcmp(par->corr_terms[i], "18") == 0 ||
-            strcmp(par->corr_terms[i], "81") == 0 ||
-            strcmp(par->corr_terms[i], "19") == 0 ||
-            strcmp(par->corr_terms[i], "91") == 0 ||
-            strcmp(par->corr_terms[i], "27") == 0 ||
-            strcmp(par->corr_terms[i], "72") == 0 ||
-            strcmp(par->corr_terms[i], "28") == 0 ||
-            strcmp(par->corr_terms[i], "82") == 0 ||
-            strcmp(par->corr_terms[i], "29") == 0 ||
-            strcmp(par->corr_terms[i], "92") == 0 ||
-            strcmp(par->corr_terms[i], "37") == 0 ||
-            strcmp(par->corr_terms[i], "73") == 0 ||
-            strcmp(par->corr_terms[i], "38") == 0 ||
-            strcmp(par->corr_terms[i], "83") == 0 ||
-            strcmp(par->corr_terms[i], "39") == 0 ||
-            strcmp(par->corr_terms[i], "93") == 0 ||
-            strcmp(par->corr_terms[i], "47") == 0 ||
-            strcmp(par->corr_terms[i], "74") == 0 ||
-            strcmp(par->corr_terms[i], "48") == 0 ||
-            strcmp(par->corr_terms[i], "84") == 0 ||
-            strcmp(par->corr_terms[i], "49") == 0 ||
-            strcmp(par->corr_terms[i], "94") == 0 ||
-            strcmp(par->corr_terms[i], "57") == 0 ||
-            strcmp(par->corr_terms[i], "75") == 0 ||
-            strcmp(par->corr_terms[i], "58") == 0 ||
-            strcmp(par->corr_terms[i], "85") == 0 ||
-            strcmp(par->corr_terms[i], "59") == 0 ||
-            strcmp(par->corr_terms[i], "95") == 0 ||
-            strcmp(par->corr_terms[i], "67") == 0 ||
-            strcmp(par->corr_terms[i], "76") == 0 ||
-            strcmp(par->corr_terms[i], "68") == 0 ||
-            strcmp(par->corr_terms[i], "86") == 0 ||
-            strcmp(par->corr_terms[i], "69") == 0 ||
-            strcmp(par->corr_terms[i], "96") == 0
-        ) ++flag;
+    for (size_t i = 0; i<l_len; ++i){
+        result[i] = 0;
+        error[i] = 0;
+    }
+    if (par->single_terms.len == 0) return EXIT_SUCCESS;
+
+    /* the tolerance applies to the normalized multipoles */
+    const double norm = 1./interp_spline(&bg->D1, 0)/interp_spline(&bg->D1, 0);
+    struct coffe_effort scaled = *effort;
+    scaled.epsabs = HUGE_VAL;
+    for (size_t i = 0; i<l_len; ++i){
+        scaled.epsabs = fmin(scaled.epsabs, effort->epsabs/((2*l[i] + 1)*norm));
     }
-    if (flag == 0) return 0;
 
 #ifdef HAVE_CUBA
+    (void)rule;
     int nregions, neval, fail;
-    double result[1], error[1], prob[1];
-    Cuhre(dims, 1,
-        average_multipoles_single_integrated_integrand,
-        (void *)&test, 1,
-        5e-4, 0, 0,
-        1, par->integration_bins, 7,
+    double prob[l_len];
+    Cuhre(dims, l_len,
+        (integrand_t)average_multipoles_single_integrated_integrand,
+        (void *)&test, COFFE_NVEC,
+        scaled.epsrel, scaled.epsabs, 0,
+        1, scaled.calls_max, 7,
         NULL, NULL,
         &nregions, &neval, &fail, result, error, prob
     );
-    return (2*l + 1)*result[0]
-    /interp_spline(&bg->D1, 0)/interp_spline(&bg->D1, 0);
 #else
     gsl_monte_function integrand;
     integrand.f = &average_multipoles_single_integrated_integrand;
     integrand.dim = dims;
     integrand.params = &test;
-    gsl_rng *random;
-    gsl_rng_env_setup();
-    const gsl_rng_type *T = gsl_rng_default;
-    random = gsl_rng_alloc(T);
-    double result, error;
-    double lower[dims];
-    double upper[dims];
-    for (int i = 0; i<dims; ++i){
-        lower[i] = 0.0;
-        upper[i] = 1.0;
-    }
 
-    switch (par->integration_method){
-        case 0:{
-            gsl_monte_plain_state *state =
-                gsl_monte_plain_alloc(dims);
-            gsl_monte_plain_integrate(
-                &integrand, lower, upper,
-                dims, par->integration_bins, random,
-                state,
-                &result, &error
-            );
-            gsl_monte_plain_free(state);
-            break;
-        }
-        case 1:{
-            gsl_monte_miser_state *state =
-                gsl_monte_miser_alloc(dims);
-            gsl_monte_miser_integrate(
-                &integrand, lower, upper,
-                dims, par->integration_bins, random,
-                state,
-                &result, &error
-            );
-            gsl_monte_miser_free(state);
-            break;
-        }
-        case 2:{
-            gsl_monte_vegas_state *state =
-                gsl_monte_vegas_alloc(dims);
-            gsl_monte_vegas_integrate(
-                &integrand, lower, upper,
-                dims, par->integration_bins, random,
-                state,
-                &result, &error
-            );
-            gsl_monte_vegas_free(state);
-            break;
-        }
-    }
-
-    gsl_rng_free(random);
-
-    return (2*l + 1)*result
-    /interp_spline(&bg->D1, 0)/interp_spline(&bg->D1, 0);
+    /* the multipoles are applied by the integrator if it can share the points */
+    const int monopole = 0;
+    if (integrate_multipoles_available(par->integration_method)) test.l = &monopole;
+    integrate_multipoles_adaptive(
+        &integrand, par->integration_method, &scaled,
+        rule, 1, l, l_len, &test.index, result, error
+    );
 #endif
+    for (size_t i = 0; i<l_len; ++i){
+        result[i] *= (2*l[i] + 1)*norm;
+        error[i] *= (2*l[i] + 1)*norm;
+    }
+    return EXIT_SUCCESS;
 }
 
 
@@ -539,7 +455,7 @@ static double average_multipoles_single_integrated(
 static int average_multipoles_double_integrated_integrand(
     const int *ndim, const cubareal var[],
     const int *ncomp, cubareal value[],
-    void *p
+    void *p, const int *nvec
 )
 #else
 static double average_multipoles_double_integrated_integrand(
@@ -564,52 +480,107 @@ static double average_multipoles_double_integrated_integrand(
             interp_spline(&bg->comoving_distance, par->z_max) - sep/2.
         );
 
-    double z = (z2 - z1)*var[0] + z1;
-    double mu = 2*var[1] - 1;
-    double x1 = var[2], x2 = var[3];
-
 #ifdef HAVE_CUBA
-    if (params->l == 0){
-        value[0] = functions_double_integrated(
-            par, bg, integral, z, mu, sep, x1, x2
-        )
-       /interp_spline(&bg->conformal_Hz, z)/(1 + z);
-        return EXIT_SUCCESS;
+    /*
+        Cuba hands over *nvec points at once, each with *ndim coordinates,
+        and expects the *ncomp multipoles of each of them
+    */
+    double z[*nvec], mu[*nvec], x1[*nvec], x2[*nvec], temp[*nvec];
+    for (int i = 0; i<*nvec; ++i){
+        z[i] = (z2 - z1)*var[i*(*ndim)] + z1;
+        mu[i] = 2*var[i*(*ndim) + 1] - 1;
+        x1[i] = var[i*(*ndim) + 2];
+        x2[i] = var[i*(*ndim) + 3];
     }
-    else{
-        value[0] = functions_double_integrated(
-            par, bg, integral, z, mu, sep, x1, x2
-        )
-       *gsl_sf_legendre_Pl(params->l, mu)
-       /interp_spline(&bg->conformal_Hz, z)/(1 + z);
-        return EXIT_SUCCESS;
+    functions_double_integrated_batch(
+        par, bg, integral, sep, *nvec, z, mu, x1, x2, temp
+    );
+    double legendre[(*ncomp)*(*nvec)];
+    coffe_legendre_array(params->l, *ncomp, mu, *nvec, legendre);
+    for (int i = 0; i<*nvec; ++i){
+        temp[i] /= interp_spline(&bg->conformal_Hz, z[i])*(1 + z[i]);
+        for (int j = 0; j<*ncomp; ++j){
+            value[i*(*ncomp) + j] = temp[i]*legendre[j*(*nvec) + i];
+        }
     }
+    return EXIT_SUCCESS;
 #else
-    if (params->l == 0){
-        return functions_double_integrated(
-            par, bg, integral, z, mu, sep, x1, x2
-        )
-       /interp_spline(&bg->conformal_Hz, z)/(1 + z);
-    }
-    else{
-        return functions_double_integrated(
-            par, bg, integral, z, mu, sep, x1, x2
-        )
-       *gsl_sf_legendre_Pl(params->l, mu)
-       /interp_spline(&bg->conformal_Hz, z)/(1 + z);
-    }
+    double z = (z2 - z1)*var[0] + z1;
+    double mu = 2*var[1] - 1;
+    double x1 = var[2], x2 = var[3];
+    double legendre = 1;
+    coffe_legendre(&params->l[params->index], 1, mu, &legendre);
+    return functions_double_integrated(
+        par, bg, integral, z, mu, sep, x1, x2
+    )
+   *legendre
+   /interp_spline(&bg->conformal_Hz, z)/(1 + z);
 #endif
 }
 
 
-/* computes the average multipole of double integrated terms for given l and separation */
+#ifndef HAVE_CUBA
+/**
+    the above at <n> points at once, without the multipoles
+    (which are applied by the integrator)
+**/
+
+static int average_multipoles_double_integrated_batch(
+    const double *var, size_t n, size_t dim, void *p, double *value
+)
+{
+    struct average_multipoles_params *params = (struct average_multipoles_params *) p;
+    struct coffe_parameters_t *par = params->par;
+    struct coffe_background_t *bg = params->bg;
+    double sep = params->sep;
+
+    double z1 =
+        interp_spline(
+            &bg->z_as_chi,
+            interp_spline(&bg->comoving_distance, par->z_min) + sep/2.
+        );
+    double z2 =
+        interp_spline(
+            &bg->z_as_chi,
+            interp_spline(&bg->comoving_distance, par->z_max) - sep/2.
+        );
 
-static double average_multipoles_double_integrated(
+    double *z = (double *)coffe_malloc(sizeof(double)*4*n);
+    double *mu = z + n, *x1 = z + 2*n, *x2 = z + 3*n;
+    for (size_t i = 0; i<n; ++i){
+        z[i] = (z2 - z1)*var[i*dim] + z1;
+        mu[i] = 2*var[i*dim + 1] - 1;
+        x1[i] = var[i*dim + 2];
+        x2[i] = var[i*dim + 3];
+    }
+    functions_double_integrated_batch(
+        par, bg, params->integral, sep, n, z, mu, x1, x2, value
+    );
+    for (size_t i = 0; i<n; ++i){
+        value[i] = value[i]/interp_spline(&bg->conformal_Hz, z[i])/(1 + z[i]);
+    }
+    free(z);
+    return EXIT_SUCCESS;
+}
+#endif
+
+/**
+    computes all the <l_len> redshift averaged multipoles <l> of the double integrated
+    terms at separation <sep>; when the integration method allows it (Cuba,
+    or the GSL methods with points fixed in advance), from one integration
+**/
+
+static int average_multipoles_double_integrated(
     struct coffe_parameters_t *par,
     struct coffe_background_t *bg,
     struct coffe_integrals_t *integral,
     double sep,
-    int l
+    const int *l,
+    size_t l_len,
+    const struct coffe_gauss_rule *rule,
+    const struct coffe_effort *effort,
+    double *result,
+    double *error
 )
 {
     const int dims = 4;
@@ -620,98 +591,115 @@ static double average_multipoles_double_integrated(
     test.integral = integral;
     test.sep = sep;
     test.l = l;
+    test.index = 0;
 
-    int flag = 0;
-    int len = par->correlation_sources_len*(par->correlation_sources_len + 1)/2;
-    for (int i = 0; i<len; ++i){
-        if (
-            strcmp(par->corr_terms[i], "77") == 0 || // g4-g4
-            strcmp(par->corr_terms[i], "88") == 0 || // g5-g5
-            strcmp(par->corr_terms[i], "99") == 0 || // len-len
-            strcmp(par->corr_terms[i], "78") == 0 || // g4-g5
-            strcmp(par->corr_terms[i], "87") == 0 || // g5-g4
-            strcmp(par->corr_terms[i], "79") == 0 || // g4-len
-            strcmp(par->corr_terms[i], "97") == 0 || // len-g4
-            strcmp(par->corr_terms[i], "89") == 0 || // g5-len
-            strcmp(par->corr_terms[i], "98") == 0    // len-g5
-        ) ++flag;
+    for (size_t i = 0; i<l_len; ++i){
+        result[i] = 0;
+        error[i] = 0;
+    }
+    if (par->double_terms.len == 0) return EXIT_SUCCESS;
+
+    /* the tolerance applies to the normalized multipoles */
+    const double norm = 1./interp_spline(&bg->D1, 0)/interp_spline(&bg->D1, 0);
+    struct coffe_effort scaled = *effort;
+    scaled.epsabs = HUGE_VAL;
+    for (size_t i = 0; i<l_len; ++i){
+        scaled.epsabs = fmin(scaled.epsabs, effort->epsabs/((2*l[i] + 1)*norm));
     }
-    if (flag == 0) return 0;
 
 #ifdef HAVE_CUBA
+    (void)rule;
     int nregions, neval, fail;
-    double result[1], error[1], prob[1];
-    Cuhre(dims, 1,
-        average_multipoles_double_integrated_integrand,
-        (void *)&test, 1,
-        5e-4, 0, 0,
-        1, par->integration_bins, 7,
+    double prob[l_len];
+    Cuhre(dims, l_len,
+        (integrand_t)average_multipoles_double_integrated_integrand,
+        (void *)&test, COFFE_NVEC,
+        scaled.epsrel, scaled.epsabs, 0,
+        1, scaled.calls_max, 7,
         NULL, NULL,
         &nregions, &neval, &fail, result, error, prob
     );
-    return (2*l + 1)*result[0]
-    /interp_spline(&bg->D1, 0)/interp_spline(&bg->D1, 0);
 #else
     gsl_monte_function integrand;
     integrand.f = &average_multipoles_double_integrated_integrand;
     integrand.dim = dims;
     integrand.params = &test;
-    gsl_rng *random;
-    gsl_rng_env_setup();
-    const gsl_rng_type *T = gsl_rng_default;
-    random = gsl_rng_alloc(T);
-    double result, error;
-    double lower[dims];
-    double upper[dims];
-    for (int i = 0; i<dims; ++i){
-        lower[i] = 0.0;
-        upper[i] = 1.0;
+
+    /* with the points fixed in advance they are evaluated in batches, applying the multipoles */
+    if (integrate_multipoles_available(par->integration_method)){
+        const struct coffe_batch_function batch = {
+            &average_multipoles_double_integrated_batch, dims, &test
+        };
+        integrate_multipoles_adaptive_batch(
+            &batch, par->integration_method, &scaled,
+            rule, 1, l, l_len, result, error
+        );
+    }
+    else{
+        integrate_multipoles_adaptive(
+            &integrand, par->integration_method, &scaled,
+            rule, 1, l, l_len, &test.index, result, error
+        );
     }
+#endif
+    for (size_t i = 0; i<l_len; ++i){
+        result[i] *= (2*l[i] + 1)*norm;
+        error[i] *= (2*l[i] + 1)*norm;
+    }
+    return EXIT_SUCCESS;
+}
 
-    switch (par->integration_method){
-        case 0:{
-            gsl_monte_plain_state *state =
-                gsl_monte_plain_alloc(dims);
-            gsl_monte_plain_integrate(
-                &integrand, lower, upper,
-                dims, par->integration_bins, random,
-                state,
-                &result, &error
-            );
-            gsl_monte_plain_free(state);
+
+/**
+    computes the redshift averaged multipoles of one kind of terms:
+    0 for nonintegrated, 1 for single and 2 for double integrated
+**/
+
+static int average_multipoles_term(
+    struct coffe_parameters_t *par,
+    struct coffe_background_t *bg,
+    struct coffe_integrals_t *integral,
+    int kind,
+    double sep,
+    const int *l,
+    size_t l_len,
+    const struct coffe_gauss_rule *rule,
+    const struct coffe_effort *effort,
+    double *result,
+    double *error
+)
+{
+    const double start = coffe_profile_time();
+    int status;
+    switch (kind){
+        case 0:
+            if (par->nonintegrated_projection > 0){
+                status = average_multipoles_nonintegrated_projected(
+                    par, bg, integral, sep, rule, result, error
+                );
+            }
+            else{
+                status = average_multipoles_nonintegrated(
+                    par, bg, integral, sep, l, l_len, rule, effort, result, error
+                );
+            }
             break;
-        }
-        case 1:{
-            gsl_monte_miser_state *state =
-                gsl_monte_miser_alloc(dims);
-            gsl_monte_miser_integrate(
-                &integrand, lower, upper,
-                dims, par->integration_bins, random,
-                state,
-                &result, &error
+        case 1:
+            status = average_multipoles_single_integrated(
+                par, bg, integral, sep, l, l_len, rule, effort, result, error
             );
-            gsl_monte_miser_free(state);
             break;
-        }
-        case 2:{
-            gsl_monte_vegas_state *state =
-                gsl_monte_vegas_alloc(dims);
-            gsl_monte_vegas_integrate(
-                &integrand, lower, upper,
-                dims, par->integration_bins, random,
-                state,
-                &result, &error
+        case 2:
+            status = average_multipoles_double_integrated(
+                par, bg, integral, sep, l, l_len, rule, effort, result, error
             );
-            gsl_monte_vegas_free(state);
             break;
-        }
+        default:
+            return EXIT_FAILURE;
     }
-
-    gsl_rng_free(random);
-
-    return (2*l + 1)*result
-    /interp_spline(&bg->D1, 0)/interp_spline(&bg->D1, 0);
-#endif
+    /* the kinds are in the same order as the classes of the profiler */
+    coffe_profile_task(kind, start);
+    return status;
 }
 
 
@@ -727,9 +715,8 @@ int coffe_average_multipoles_init(
 #endif
     if (par->output_type == 3){
         ramp->flag = 1;
-        clock_t start, end;
         printf("Calculating the redshift averaged multipoles...\n");
-        start = clock();
+        coffe_profile_start(COFFE_PROFILE_AVERAGE_MULTIPOLES);
 
         gsl_error_handler_t *default_handler =
             gsl_set_error_handler_off();
@@ -739,6 +726,21 @@ int coffe_average_multipoles_init(
             par->multipole_values_len,
             par->sep_len
         );
+        alloc_double_matrix(
+            &ramp->error_nonintegrated,
+            par->multipole_values_len,
+            par->sep_len
+        );
+        alloc_double_matrix(
+            &ramp->error_single,
+            par->multipole_values_len,
+            par->sep_len
+        );
+        alloc_double_matrix(
+            &ramp->error_double,
+            par->multipole_values_len,
+            par->sep_len
+        );
         ramp->l = (int *)coffe_malloc(sizeof(int)*par->multipole_values_len);
         for (int i = 0; i<par->multipole_values_len; ++i){
             ramp->l[i] = (int)par->multipole_values[i];
@@ -755,41 +757,215 @@ int coffe_average_multipoles_init(
             par->z_min, par->z_max, bg
         );
 
-        #pragma omp parallel for num_threads(par->nthreads) collapse(2)
-        for (size_t i = 0; i<ramp->l_len; ++i){
-            for (size_t j = 0; j<ramp->sep_len; ++j){
-                ramp->result[i][j] =
-                    average_multipoles_nonintegrated(
-                        par, bg, integral,
-                        ramp->sep[j]*COFFE_H0, ramp->l[i]
-                    );
+        /*
+            the Gauss-Legendre rules in 2, 3 and 4 dimensions, mu being the second one,
+            and the one of the projected nonintegrated terms, in mu and in z
+        */
+        struct coffe_gauss_rule rule[5] = {{0}};
+#ifndef HAVE_CUBA
+        if (par->integration_method == 4){
+            for (size_t dims = 2; dims<=4; ++dims){
+                init_gauss_rule(
+                    &rule[dims], dims, par->integration_bins, 1,
+                    ramp->l, ramp->l_len
+                );
             }
         }
-        #pragma omp parallel for num_threads(par->nthreads) collapse(2)
-        for (size_t i = 0; i<ramp->l_len; ++i){
-            for (size_t j = 0; j<ramp->sep_len; ++j){
-                ramp->result[i][j] +=
-                    average_multipoles_single_integrated(
-                        par, bg, integral,
-                        ramp->sep[j]*COFFE_H0, ramp->l[i]
-                    );
+#endif
+        if (par->nonintegrated_projection > 0){
+            init_gauss_rule(
+                &rule[1], 1, par->nonintegrated_projection, 0,
+                ramp->l, ramp->l_len
+            );
+        }
+        const struct coffe_gauss_rule *kind_rule[3] = {
+            par->nonintegrated_projection > 0 ? &rule[1] : &rule[2], &rule[3], &rule[4]
+        };
+
+        /*
+            all the contributions as one task graph; the double integrated
+            ones are by far the most expensive, so they are spawned first,
+            largest separation first, and the cheaper ones fill in the gaps;
+            the kinds of terms are 0 (nonintegrated), 1 (single), 2 (double)
+        */
+        const size_t len = ramp->sep_len*ramp->l_len;
+        double *value[3], *error[3];
+        struct coffe_effort effort[3];
+        for (int kind = 0; kind<3; ++kind){
+            value[kind] = (double *)coffe_malloc(sizeof(double)*len);
+            error[kind] = (double *)coffe_malloc(sizeof(double)*len);
+            /* zero unless computed, so the results of all the processes can be summed */
+            memset(value[kind], 0, sizeof(double)*len);
+            memset(error[kind], 0, sizeof(double)*len);
+            effort[kind] = coffe_effort_first(par, kind == 0 ? 1e-3 : 5e-4);
+        }
+        size_t *order = (size_t *)coffe_malloc(sizeof(size_t)*ramp->sep_len);
+        coffe_order_descending(ramp->sep, ramp->sep_len, order);
+
+        /*
+            each task takes the next job of its kind when it starts running,
+            so with several processes the jobs go to whichever is free first
+        */
+        struct coffe_mpi_counter_t counter[3];
+        for (int kind = 0; kind<3; ++kind){
+            coffe_mpi_counter_init(&counter[kind], ramp->sep_len);
+        }
+
+        /* the kinds of jobs of the checkpoint are the above ones, and then the refined ones */
+        const size_t cells[6] = {
+            ramp->sep_len, ramp->sep_len, ramp->sep_len,
+            ramp->sep_len, ramp->sep_len, ramp->sep_len
+        };
+        struct coffe_checkpoint_t cp;
+        coffe_checkpoint_init(
+            par, "redshift averaged multipoles", "avg_multipoles.checkpoint",
+            coffe_checkpoint_key(par, 1, bg, integral), 6, cells, ramp->l_len, &cp
+        );
+        coffe_checkpoint_phase(&cp, 3*len);
+
+        #pragma omp parallel num_threads(par->nthreads)
+        #pragma omp single
+        {
+            for (int kind = 2; kind>=0; --kind){
+                for (size_t n = 0; n<ramp->sep_len; ++n){
+                    #pragma omp task firstprivate(kind)
+                    {
+                        const size_t k = coffe_mpi_counter_next(&counter[kind]);
+                        if (k < ramp->sep_len){
+                            const size_t j = order[k];
+                            double *result = &value[kind][j*ramp->l_len];
+                            double *result_error = &error[kind][j*ramp->l_len];
+                            if (!coffe_checkpoint_restore(
+                                &cp, kind, j, ramp->l_len, result, result_error
+                            )){
+                                average_multipoles_term(
+                                    par, bg, integral, kind,
+                                    ramp->sep[j]*COFFE_H0, ramp->l, ramp->l_len,
+                                    kind_rule[kind], &effort[kind],
+                                    result, result_error
+                                );
+                                coffe_checkpoint_store(
+                                    &cp, kind, j, ramp->l_len, result, result_error
+                                );
+                            }
+                        }
+                    }
+                }
             }
         }
-        #pragma omp parallel for num_threads(par->nthreads) collapse(2)
-        for (size_t i = 0; i<ramp->l_len; ++i){
+        for (int kind = 0; kind<3; ++kind){
+            coffe_mpi_counter_free(&counter[kind]);
+            coffe_mpi_sum(value[kind], len);
+            coffe_mpi_sum(error[kind], len);
+        }
+
+        /*
+            with a target accuracy, the above were only estimates; the terms
+            whose error matters for the total at their separation are refined
+        */
+        if (par->integration_accuracy > 0){
+            struct coffe_effort *refine = (struct coffe_effort *)
+                coffe_malloc(sizeof(struct coffe_effort)*ramp->sep_len);
             for (size_t j = 0; j<ramp->sep_len; ++j){
-                ramp->result[i][j] +=
-                    average_multipoles_double_integrated(
-                        par, bg, integral,
-                        ramp->sep[j]*COFFE_H0, ramp->l[i]
+                double total[ramp->l_len];
+                for (size_t i = 0; i<ramp->l_len; ++i){
+                    total[i] = value[0][j*ramp->l_len + i]
+                        + value[1][j*ramp->l_len + i] + value[2][j*ramp->l_len + i];
+                }
+                refine[j] = coffe_effort_refine(
+                    par, coffe_error_budget(par, total, ramp->l_len, 3)
+                );
+            }
+
+            /*
+                the terms to refine, in the same order as above; they are zeroed
+                everywhere and the rest everywhere but in the first process,
+                so summing over the processes gives back the result
+            */
+            size_t *redo[3], redo_len[3] = {0, 0, 0};
+            const int rank = coffe_mpi_rank();
+            for (int kind = 0; kind<3; ++kind){
+                redo[kind] = (size_t *)coffe_malloc(sizeof(size_t)*ramp->sep_len);
+                for (size_t k = 0; k<ramp->sep_len; ++k){
+                    const size_t j = order[k];
+                    const int converged = coffe_effort_converged(
+                        &refine[j], &value[kind][j*ramp->l_len],
+                        &error[kind][j*ramp->l_len], ramp->l_len
                     );
+                    if (!converged) redo[kind][redo_len[kind]++] = j;
+                    if (!converged || rank != 0){
+                        memset(&value[kind][j*ramp->l_len], 0, sizeof(double)*ramp->l_len);
+                        memset(&error[kind][j*ramp->l_len], 0, sizeof(double)*ramp->l_len);
+                    }
+                }
+                coffe_mpi_counter_init(&counter[kind], redo_len[kind]);
+            }
+            coffe_checkpoint_phase(
+                &cp, (redo_len[0] + redo_len[1] + redo_len[2])*ramp->l_len
+            );
+
+            #pragma omp parallel num_threads(par->nthreads)
+            #pragma omp single
+            {
+                for (int kind = 2; kind>=0; --kind){
+                    for (size_t n = 0; n<redo_len[kind]; ++n){
+                        #pragma omp task firstprivate(kind)
+                        {
+                            const size_t k = coffe_mpi_counter_next(&counter[kind]);
+                            if (k < redo_len[kind]){
+                                const size_t j = redo[kind][k];
+                                double *result = &value[kind][j*ramp->l_len];
+                                double *result_error = &error[kind][j*ramp->l_len];
+                                if (!coffe_checkpoint_restore(
+                                    &cp, 3 + kind, j, ramp->l_len, result, result_error
+                                )){
+                                    average_multipoles_term(
+                                        par, bg, integral, kind,
+                                        ramp->sep[j]*COFFE_H0, ramp->l, ramp->l_len,
+                                        kind_rule[kind], &refine[j],
+                                        result, result_error
+                                    );
+                                    coffe_checkpoint_store(
+                                        &cp, 3 + kind, j, ramp->l_len, result, result_error
+                                    );
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+            for (int kind = 0; kind<3; ++kind){
+                coffe_mpi_counter_free(&counter[kind]);
+                coffe_mpi_sum(value[kind], len);
+                coffe_mpi_sum(error[kind], len);
+                free(redo[kind]);
             }
+            free(refine);
+        }
+
+        for (size_t j = 0; j<ramp->sep_len; ++j){
+            for (size_t i = 0; i<ramp->l_len; ++i){
+                const size_t index = j*ramp->l_len + i;
+                ramp->result[i*ramp->sep_len + j] =
+                    value[0][index] + value[1][index] + value[2][index];
+                ramp->error_nonintegrated[i*ramp->sep_len + j] = error[0][index];
+                ramp->error_single[i*ramp->sep_len + j] = error[1][index];
+                ramp->error_double[i*ramp->sep_len + j] = error[2][index];
+            }
+        }
+        coffe_checkpoint_free(&cp);
+        for (int kind = 0; kind<3; ++kind){
+            free(value[kind]);
+            free(error[kind]);
+        }
+        free(order);
+        for (size_t dims = 1; dims<=4; ++dims){
+            free_gauss_rule(&rule[dims]);
         }
 
-        end = clock();
 
         printf("Redshift averaged multipoles calculated in %.2f s\n",
-            (double)(end - start) / CLOCKS_PER_SEC);
+            coffe_profile_stop(COFFE_PROFILE_AVERAGE_MULTIPOLES));
 
         gsl_set_error_handler(default_handler);
     }
@@ -802,10 +978,10 @@ int coffe_average_multipoles_free(
 )
 {
     if (ramp->flag){
-        for (size_t i = 0; i<ramp->l_len; ++i){
-            free(ramp->result[i]);
-        }
         free(ramp->result);
+        free(ramp->error_nonintegrated);
+        free(ramp->error_single);
+        free(ramp->error_double);
         free(ramp->l);
         free(ramp->sep);
         ramp->flag = 0;
@@ -21,7 +21,8 @@
 
 struct coffe_average_multipoles_t
 {
-    double **result;
+    double *result; /* result[i*sep_len + j] is the multipole l[i] at sep[j] */
+    double *error_nonintegrated, *error_single, *error_double; /* estimated errors of the terms, stored as the result */
     double *sep;
     size_t sep_len;
     int *l;
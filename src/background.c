@@ -17,6 +17,7 @@
 */
 
 #include <stdio.h>
+#include <math.h>
 #include <time.h>
 #include <gsl/gsl_integration.h>
 #include <gsl/gsl_errno.h>
@@ -26,19 +27,33 @@
 #include "common.h"
 #include "background.h"
 
+#ifndef COFFE_BACKGROUND_ZMAX
+#define COFFE_BACKGROUND_ZMAX 15. // largest redshift of the background
+#endif
+
+#ifndef COFFE_BACKGROUND_AINITIAL
+#define COFFE_BACKGROUND_AINITIAL 0.05 // scale factor where the growth rate is set to the matter dominated one
+#endif
+
+#ifndef COFFE_BACKGROUND_WBINS
+#define COFFE_BACKGROUND_WBINS 1024 // intervals of the table of the integral of w(z)/(1 + z)
+#endif
+
+#ifndef COFFE_BACKGROUND_ORDER
+#define COFFE_BACKGROUND_ORDER 8 // Gauss-Legendre points per interval of the cumulative integrals
+#endif
+
 struct integration_params
 {
+    struct coffe_parameters_t *par; /* for w(z) */
+
     double Omega0_m; /* omega parameter for (total) matter */
 
     double Omega0_gamma; /* omega parameter of photons */
 
     double Omega0_de; /* present omega parameter for dark energy-like component */
 
-    struct coffe_interpolation w; /* interpolator of w(z) */
-
-    struct coffe_interpolation wint; /* result of exp(3*int((1 + w(z))/(1 + z))) */
-
-    struct coffe_interpolation xint; /* result of Omega0_m/(1 - Omega0_m)*exp(-3*int(w(a)/a)) */
+    struct coffe_interpolation wcum; /* int_0^z w(z)/(1 + z), from 0 to 1/a_initial - 1 */
 };
 
 
@@ -58,12 +73,8 @@ struct temp_background
 
     double *D1; /* growth rate D_1(a) */
 
-    double *D1_prime; /* derivative of D_1(a) wrt D1'(rphys)*rphys, dimensionless ('=d/drphys)*/
-
     double *f; /* growth function f=d(log D)/d(log a) */
 
-    double *g; /* growth function g=(1+z)*D_1 */
-
     double *G1, *G2;
 
     double *comoving_distance; /* comoving distance (dimensionless) */
@@ -71,6 +82,50 @@ struct temp_background
 };
 
 
+/**
+    Omega0_m/(1 - Omega0_m)*exp(-3*int(w(a)/a)), the ratio of the matter
+    and dark energy densities (without radiation)
+**/
+
+static double background_x(
+    struct integration_params *par,
+    double z
+)
+{
+    return par->Omega0_m/(1 - par->Omega0_m)*exp(-3*interp_spline(&par->wcum, z));
+}
+
+
+/**
+    exp(3*int((1 + w(z))/(1 + z))), the dark energy density in units of today's
+**/
+
+static double background_wint(
+    struct integration_params *par,
+    double z
+)
+{
+    return pow(1 + z, 3)*exp(3*interp_spline(&par->wcum, z));
+}
+
+
+/**
+    H(z) in units of H0
+**/
+
+static double background_E(
+    struct integration_params *par,
+    double z
+)
+{
+    return sqrt(
+        par->Omega0_m*pow(1 + z, 3)
+       +par->Omega0_gamma*pow(1 + z, 4)
+       +par->Omega0_de*background_wint(par, z)
+    );
+}
+
+
 /**
     differential equation for the growth rate D_1
 **/
@@ -84,8 +139,8 @@ static int growth_rate_ode(
 {
     struct integration_params *par = (struct integration_params *) params;
     double z = 1./a - 1;
-    double w = interp_spline(&par->w, z);
-    double x = interp_spline(&par->xint, z);
+    double w = common_wfunction(par->par, z);
+    double x = background_x(par, z);
 
     f[0] = y[1];
     f[1] = -3./2*(1 - w/(1 + x))*y[1]/a
@@ -111,10 +166,10 @@ static int growth_rate_jac(
     gsl_matrix_view dfdy_mat =
         gsl_matrix_view_array(dfdy, 2, 2);
     double z = 1./a - 1;
-    double w = interp_spline(&par->w, z);
-    double x = interp_spline(&par->xint, z);
-    double x_der =
-        gsl_spline_eval_deriv(par->xint.spline, z, par->xint.accel);
+    double w = common_wfunction(par->par, z);
+    double x = background_x(par, z);
+    /* dx/dz, since d(int w/(1 + z))/dz = w/(1 + z) */
+    double x_der = -3*x*w/(1 + z);
     gsl_matrix *m = &dfdy_mat.matrix;
     gsl_matrix_set(m, 0, 0, 0.0);
     gsl_matrix_set(m, 0, 1, 1.0);
@@ -131,7 +186,7 @@ static int growth_rate_jac(
 
 
 /**
-    integrand of (1 + w)/(1 + z)
+    integrand of int_0^z w(z)/(1 + z)
 **/
 
 static double integrand_w(
@@ -140,92 +195,103 @@ static double integrand_w(
 )
 {
     struct integration_params *par = (struct integration_params *) p;
-    return (1 + interp_spline(&par->w, z))/(1 + z);
+    return common_wfunction(par->par, z)/(1 + z);
 }
 
+
 /**
-    integrand w(a)/a
+    integrand of the comoving distance
 **/
 
-static double integrand_x(
-    double a,
+static double integrand_comoving(
+    double z,
     void *p
 )
 {
-    struct integration_params *par = (struct integration_params *) p;
-    double result = interp_spline(&par->w, 1/a - 1)/a;
-    return result;
+    return 1./background_E((struct integration_params *) p, z);
 }
 
 
-static double integral_w(
-    struct integration_params *par,
-    double z
-)
-{
-    double prec = 1E-5, result, error;
-    gsl_integration_workspace *space =
-        gsl_integration_workspace_alloc(COFFE_MAX_INTSPACE);
-
-    gsl_function integrand;
-    integrand.function = &integrand_w;
-    integrand.params = par;
-
-    gsl_integration_qag(
-        &integrand, 0., z, 0, prec,
-        COFFE_MAX_INTSPACE,
-        GSL_INTEG_GAUSS61, space,
-        &result, &error
-    );
-    gsl_integration_workspace_free(space);
-    return exp(3*result);
-}
-
+/**
+    the cumulative integral of <integrand> on the <len> points <x>,
+    starting from <result>[0], with a fixed Gauss-Legendre rule
+    on each interval, so the whole grid takes one sweep
+**/
 
-static double integral_x(
-    struct integration_params *par,
-    double z
+static void background_cumulative(
+    gsl_function *integrand,
+    const double *x,
+    size_t len,
+    const gsl_integration_glfixed_table *table,
+    double *result
 )
 {
-    double prec = 1E-5, result, error;
-    gsl_integration_workspace *space =
-        gsl_integration_workspace_alloc(COFFE_MAX_INTSPACE);
-
-    gsl_function integrand;
-    integrand.function = &integrand_x;
-    integrand.params = par;
-
-    gsl_integration_qag(
-        &integrand, 1/(1 + z), 1., 0, prec,
-        COFFE_MAX_INTSPACE,
-        GSL_INTEG_GAUSS61, space,
-        &result, &error
-    );
-    gsl_integration_workspace_free(space);
-    return result;
+    for (size_t i = 1; i<len; ++i){
+        result[i] = result[i - 1]
+           +gsl_integration_glfixed(integrand, x[i - 1], x[i], table);
+    }
 }
 
 
 /**
-    integrand of the comoving distance
+    the largest redshift the output needs the background at; the
+    separations are restricted to the redshift bins, so with some
+    room for the tables it's at most twice the upper edge of the bins
 **/
 
-static double integrand_comoving(
-    double z,
-    void *p
+static double background_z_max(
+    struct coffe_parameters_t *par
 )
 {
-    struct integration_params *par = (struct integration_params *) p;
-    double integrand = 1./pow(
-        par->Omega0_m*pow(1 + z, 3)
-       +par->Omega0_gamma*pow(1 + z, 4)
-       +par->Omega0_de*interp_spline(&par->wint, z),
-        1./2);
-    return integrand;
+    if (par->background_z_max > 0){
+        return fmin(par->background_z_max, COFFE_BACKGROUND_ZMAX);
+    }
+
+    double z_max = 0;
+    switch (par->output_type){
+        case 0:
+        case 1:
+        case 2:
+        case 6:
+            z_max = par->z_mean + par->deltaz;
+            break;
+        case 3:
+            z_max = par->z_max;
+            break;
+        case 4:
+            for (int i = 0; i<par->covariance_z_mean_len; ++i){
+                z_max = fmax(z_max, par->covariance_z_mean[i] + par->covariance_deltaz[i]);
+            }
+            break;
+        case 5:
+            for (int i = 0; i<par->covariance_zmax_len; ++i){
+                z_max = fmax(z_max, par->covariance_zmax[i]);
+            }
+            break;
+        default:
+            return COFFE_BACKGROUND_ZMAX;
+    }
+    for (int i = 0; i<par->batch_len; ++i){
+        if (par->output_type == 3){
+            z_max = fmax(z_max, par->batch_z_max[i]);
+        }
+        else{
+            z_max = fmax(
+                z_max,
+                par->batch_z_mean[i]
+               +(par->output_type == 1 || par->output_type == 2 ? par->batch_deltaz[i] : par->deltaz)
+            );
+        }
+    }
+    return fmin(2*z_max + 0.5, COFFE_BACKGROUND_ZMAX);
 }
 
+
 /**
-    computes and stores all the background functions
+    computes and stores all the background functions; the integrals
+    of w and of the comoving distance are done cumulatively, and the
+    growth rate in one pass of the differential equation, on a uniform
+    grid up to the largest redshift the output needs
 **/
 
 int coffe_background_init(
@@ -233,74 +299,87 @@ int coffe_background_init(
     struct coffe_background_t *bg
 )
 {
-    clock_t start, end;
     printf("Initializing the background...\n");
-    start = clock();
+    coffe_profile_start(COFFE_PROFILE_BACKGROUND);
 
     gsl_error_handler_t *default_handler =
         gsl_set_error_handler_off();
 
+    const size_t bins = (size_t)par->background_bins;
     struct temp_background *temp_bg =
         (struct temp_background *)coffe_malloc(sizeof(struct temp_background));
-    temp_bg->z = (double *)coffe_malloc(sizeof(double)*par->background_bins);
-    temp_bg->a = (double *)coffe_malloc(sizeof(double)*par->background_bins);
-    temp_bg->Hz = (double *)coffe_malloc(sizeof(double)*par->background_bins);
-    temp_bg->conformal_Hz = (double *)coffe_malloc(sizeof(double)*par->background_bins);
-    temp_bg->conformal_Hz_prime = (double *)coffe_malloc(sizeof(double)*par->background_bins);
-    temp_bg->D1 = (double *)coffe_malloc(sizeof(double)*par->background_bins);
-    temp_bg->g = (double *)coffe_malloc(sizeof(double)*par->background_bins);
-    temp_bg->f = (double *)coffe_malloc(sizeof(double)*par->background_bins);
-    temp_bg->G1 = (double *)coffe_malloc(sizeof(double)*par->background_bins);
-    temp_bg->G2 = (double *)coffe_malloc(sizeof(double)*par->background_bins);
-    temp_bg->comoving_distance = (double *)coffe_malloc(sizeof(double)*par->background_bins);
+    temp_bg->z = (double *)coffe_malloc(sizeof(double)*bins);
+    temp_bg->a = (double *)coffe_malloc(sizeof(double)*bins);
+    temp_bg->Hz = (double *)coffe_malloc(sizeof(double)*bins);
+    temp_bg->conformal_Hz = (double *)coffe_malloc(sizeof(double)*bins);
+    temp_bg->conformal_Hz_prime = (double *)coffe_malloc(sizeof(double)*bins);
+    temp_bg->D1 = (double *)coffe_malloc(sizeof(double)*bins);
+    temp_bg->f = (double *)coffe_malloc(sizeof(double)*bins);
+    temp_bg->G1 = (double *)coffe_malloc(sizeof(double)*bins);
+    temp_bg->G2 = (double *)coffe_malloc(sizeof(double)*bins);
+    temp_bg->comoving_distance = (double *)coffe_malloc(sizeof(double)*bins);
 
     struct integration_params ipar;
+    ipar.par = par;
     ipar.Omega0_m = par->Omega0_m;
     ipar.Omega0_gamma = par->Omega0_gamma;
     ipar.Omega0_de = par->Omega0_de;
+
+    gsl_integration_glfixed_table *table =
+        gsl_integration_glfixed_table_alloc(COFFE_BACKGROUND_ORDER);
+
+    /* int_0^z w/(1 + z), up to where the growth rate starts */
     {
-        double z, z_max = 100.;
-        const size_t bins = 16384;
-        double *z_array = (double *)coffe_malloc(sizeof(double)*(bins + 1));
-
-        double *w_array = (double *)coffe_malloc(sizeof(double)*(bins + 1));
-        for (size_t i = 0; i <= bins; ++i){
-            z = z_max*i/(double)bins;
-            z_array[i] = z;
-            w_array[i] = common_wfunction(par, z);
+        const size_t len = COFFE_BACKGROUND_WBINS + 1;
+        const double z_initial = 1./COFFE_BACKGROUND_AINITIAL - 1;
+        double *z_array = (double *)coffe_malloc(sizeof(double)*len);
+        double *wcum_array = (double *)coffe_malloc(sizeof(double)*len);
+        for (size_t i = 0; i<len; ++i){
+            z_array[i] = z_initial*i/(double)(len - 1);
         }
-        init_spline(&ipar.w, z_array, w_array, bins + 1, 1);
-        free(w_array);
-
-        double *wint_array = (double *)coffe_malloc(sizeof(double)*(bins + 1));
-        for (size_t i = 0; i <= bins; ++i){
-            z = z_max*i/(double)bins;
-            z_array[i] = z;
-            wint_array[i] = integral_w(&ipar, z);
-        }
-        init_spline(&ipar.wint, z_array, wint_array, bins + 1, 1);
-        free(wint_array);
-
-        double *xint_array = (double *)coffe_malloc(sizeof(double)*(bins + 1));
-        for (size_t i = 0; i <= bins; ++i){
-            z = z_max*i/(double)bins;
-            if (i != 0){
-                z_array[i] = z;
-                xint_array[i] = ipar.Omega0_m/(1 - ipar.Omega0_m)*exp(-3*integral_x(&ipar, z));
-            }
-            else{
-                z_array[i] = 0;
-                xint_array[i] = ipar.Omega0_m/(1 - ipar.Omega0_m);
-            }
-        }
-        init_spline(&ipar.xint, z_array, xint_array, bins + 1, 1);
-        free(xint_array);
-
+        gsl_function integrand;
+        integrand.function = &integrand_w;
+        integrand.params = &ipar;
+        wcum_array[0] = 0;
+        background_cumulative(&integrand, z_array, len, table, wcum_array);
+        init_spline(&ipar.wcum, z_array, wcum_array, len, 3);
         free(z_array);
+        free(wcum_array);
+    }
+
+    const double z_max = background_z_max(par);
+    for (size_t i = 0; i<bins; ++i){
+        const double z = z_max*i/(double)(bins - 1);
+        const double w = common_wfunction(par, z);
+        const double wint = background_wint(&ipar, z);
+
+        (temp_bg->z)[i] = z;
+        (temp_bg->a)[i] = 1./(1. + z);
+        (temp_bg->Hz)[i] = background_E(&ipar, z); // in units H0
+        (temp_bg->conformal_Hz)[i] = (temp_bg->a)[i]*(temp_bg->Hz)[i]; // in units H0
+        (temp_bg->conformal_Hz_prime)[i] = -(
+            pow(1 + z, 3)*(2*(1 + z)*par->Omega0_gamma + par->Omega0_m)
+           +(1 + 3*w)*par->Omega0_de*wint
+        )/pow(1 + z, 2)/2.; // in units H0^2
+    }
+
+    /* the comoving distance (dimensionless), interval by interval */
+    {
+        gsl_function integrand;
+        integrand.function = &integrand_comoving;
+        integrand.params = &ipar;
+        temp_bg->comoving_distance[0] = 0;
+        background_cumulative(
+            &integrand, temp_bg->z, bins, table, temp_bg->comoving_distance
+        );
     }
+    gsl_integration_glfixed_table_free(table);
 
-    double temp_comoving_result, temp_error;
-    double a_initial, z, w, wint;
+    /*
+        the growth rate in one pass, from a_initial (with the initial
+        values of D_1 and D_1' in matter domination) to today, stopping
+        at every point of the grid
+    */
     gsl_odeiv_system sys =
         {growth_rate_ode, growth_rate_jac, 2, &ipar};
 
@@ -310,64 +389,32 @@ int coffe_background_init(
     gsl_odeiv_step *step =
         gsl_odeiv_step_alloc(step_type, 2);
     gsl_odeiv_control *control =
-        gsl_odeiv_control_y_new(1E-6, 0.0);
+        gsl_odeiv_control_y_new(1E-8, 0.0);
     gsl_odeiv_evolve *evolve =
         gsl_odeiv_evolve_alloc(2);
 
-    gsl_integration_workspace *space =
-        gsl_integration_workspace_alloc(COFFE_MAX_INTSPACE);
-
-    gsl_function comoving_integral;
-    comoving_integral.function = &integrand_comoving;
-    comoving_integral.params = &ipar;
-
-    /* initial values for the differential equation (D_1 and D_1') */
-    double initial_values[2] = {0.05, 1.0};
-
-    double h = 1E-6, prec = 1E-5;
-
-    for (int i = 0; i<par->background_bins; ++i){
-        a_initial = 0.05;
-        initial_values[0] = 0.05;
-        initial_values[1] = 1.0;
-
-        z = 15.*i/(double)(par->background_bins - 1);
-
-        w = interp_spline(&ipar.w, z);
-        wint = interp_spline(&ipar.wint, z);
+    double a_current = COFFE_BACKGROUND_AINITIAL;
+    double values[2] = {COFFE_BACKGROUND_AINITIAL, 1.0};
+    double h = 1E-6;
 
-        (temp_bg->z)[i] = z;
-        (temp_bg->a)[i] = 1./(1. + z);
-        (temp_bg->Hz)[i] = sqrt(
-             par->Omega0_m*pow(1 + z, 3)
-            +par->Omega0_gamma*pow(1 + z, 4)
-            +par->Omega0_de*wint); // in units H0
-        (temp_bg->conformal_Hz)[i] = (temp_bg->a)[i]*(temp_bg->Hz)[i]; // in units H0
-        (temp_bg->conformal_Hz_prime)[i] = -(
-            pow(1 + z, 3)*(2*(1 + z)*par->Omega0_gamma + par->Omega0_m)
-           +(1 + 3*w)*par->Omega0_de*wint
-        )/pow(1 + z, 2)/2.; // in units H0^2
-
-        while (a_initial < (temp_bg->a)[i]){
+    for (size_t n = bins; n-- > 0;){
+        while (a_current < (temp_bg->a)[n]){
             gsl_odeiv_evolve_apply(
                 evolve, control, step,
-                &sys, &a_initial, (temp_bg->a)[i],
-                &h, initial_values
+                &sys, &a_current, (temp_bg->a)[n],
+                &h, values
             );
         }
+        (temp_bg->D1)[n] = values[0];
+        (temp_bg->f)[n] = values[1]*(temp_bg->a)[n]/(temp_bg->D1)[n];
+    }
 
-        (temp_bg->D1)[i] = initial_values[0];
-        (temp_bg->g)[i] = (1 + z)*(temp_bg->D1)[i];
-        (temp_bg->f)[i] = initial_values[1]*(temp_bg->a)[i]/(temp_bg->D1)[i];
-
-        gsl_integration_qag(
-            &comoving_integral, 0., z, 0, prec,
-            COFFE_MAX_INTSPACE,
-            GSL_INTEG_GAUSS61, space,
-            &temp_comoving_result, &temp_error
-        );
+    gsl_odeiv_step_free(step);
+    gsl_odeiv_control_free(control);
+    gsl_odeiv_evolve_free(evolve);
 
-        (temp_bg->comoving_distance)[i] = temp_comoving_result; // dimensionless
+    for (size_t i = 0; i<bins; ++i){
+        const double z = (temp_bg->z)[i];
         if (z > 1E-10){
             (temp_bg->G1)[i] =
                 (temp_bg->conformal_Hz_prime)[i]
@@ -411,13 +458,6 @@ int coffe_background_init(
         par->background_bins,
         par->interp_method
     );
-    init_spline(
-        &bg->Hz,
-        temp_bg->z,
-        temp_bg->Hz,
-        par->background_bins,
-        par->interp_method
-    );
     init_spline(
         &bg->conformal_Hz,
         temp_bg->z,
@@ -425,13 +465,6 @@ int coffe_background_init(
         par->background_bins,
         par->interp_method
     );
-    init_spline(
-        &bg->conformal_Hz_prime,
-        temp_bg->z,
-        temp_bg->conformal_Hz_prime,
-        par->background_bins,
-        par->interp_method
-    );
     init_spline(
         &bg->D1,
         temp_bg->z,
@@ -477,50 +510,212 @@ int coffe_background_init(
         par->interp_method
     );
 
+    /* the splines only the output needs are made from the samples when asked for */
+    bg->z = temp_bg->z;
+    bg->samples[COFFE_BACKGROUND_HZ] = temp_bg->Hz;
+    bg->samples[COFFE_BACKGROUND_CONFORMAL_HZ_PRIME] = temp_bg->conformal_Hz_prime;
+    bg->len = bins;
+    bg->interp_method = par->interp_method;
+    bg->built = 0;
+
+    /* tables for fast lookup, using the same (uniform) grid as the splines */
+    bg->fast = par->fast_interpolation;
+    if (bg->fast){
+        struct coffe_interpolation *fields[] = {
+            &bg->a, &bg->conformal_Hz, &bg->D1, &bg->f, &bg->G1, &bg->G2
+        };
+        init_uniform_table(
+            &bg->table, fields,
+            sizeof(fields)/sizeof(fields[0]),
+            temp_bg->z[0], temp_bg->z[par->background_bins - 1],
+            par->background_bins - 1
+        );
+        struct coffe_interpolation *field_z[] = {&bg->z_as_chi};
+        init_uniform_table(
+            &bg->z_as_chi_table, field_z, 1,
+            temp_bg->comoving_distance[0],
+            temp_bg->comoving_distance[par->background_bins - 1],
+            par->background_bins - 1
+        );
+    }
+
     /* memory cleanup */
-    free(temp_bg->z);
     free(temp_bg->a);
-    free(temp_bg->Hz);
     free(temp_bg->conformal_Hz);
-    free(temp_bg->conformal_Hz_prime);
     free(temp_bg->D1);
-    free(temp_bg->g);
     free(temp_bg->f);
     free(temp_bg->G1);
     free(temp_bg->G2);
     free(temp_bg->comoving_distance);
     free(temp_bg);
-    gsl_odeiv_step_free(step);
-    gsl_odeiv_control_free(control);
-    gsl_odeiv_evolve_free(evolve);
-    gsl_integration_workspace_free(space);
-    gsl_spline_free(ipar.w.spline), gsl_interp_accel_free(ipar.w.accel);
-    gsl_spline_free(ipar.wint.spline), gsl_interp_accel_free(ipar.wint.accel);
-    gsl_spline_free(ipar.xint.spline), gsl_interp_accel_free(ipar.xint.accel);
+    free_spline(&ipar.wcum);
 
     gsl_set_error_handler(default_handler);
 
-    end = clock();
     printf("Background initialized in %.2f s\n",
-        (double)(end - start) / CLOCKS_PER_SEC);
+        coffe_profile_stop(COFFE_PROFILE_BACKGROUND));
 
     return EXIT_SUCCESS;
 }
 
+
+/**
+    the spline <field> (COFFE_BACKGROUND_HZ or COFFE_BACKGROUND_CONFORMAL_HZ_PRIME),
+    which is built from the samples the first time it is asked for
+**/
+
+struct coffe_interpolation *coffe_background_lazy(
+    struct coffe_background_t *bg,
+    int field
+)
+{
+    struct coffe_interpolation *interp[COFFE_BACKGROUND_LAZY] = {
+        &bg->Hz, &bg->conformal_Hz_prime
+    };
+    #pragma omp critical(coffe_background_lazy)
+    {
+        if (!(bg->built & (1u << field))){
+            init_spline(
+                interp[field], bg->z, bg->samples[field],
+                bg->len, bg->interp_method
+            );
+            bg->built |= 1u << field;
+        }
+    }
+    return interp[field];
+}
+
 int coffe_background_free(
     struct coffe_background_t *bg
 )
 {
     free_spline(&bg->z_as_chi);
     free_spline(&bg->a);
-    free_spline(&bg->Hz);
     free_spline(&bg->conformal_Hz);
-    free_spline(&bg->conformal_Hz_prime);
     free_spline(&bg->D1);
-    free_spline(&bg->g);
     free_spline(&bg->f);
     free_spline(&bg->G1);
     free_spline(&bg->G2);
     free_spline(&bg->comoving_distance);
+    if (bg->built & (1u << COFFE_BACKGROUND_HZ)) free_spline(&bg->Hz);
+    if (bg->built & (1u << COFFE_BACKGROUND_CONFORMAL_HZ_PRIME)) free_spline(&bg->conformal_Hz_prime);
+    for (int i = 0; i<COFFE_BACKGROUND_LAZY; ++i){
+        free(bg->samples[i]);
+    }
+    free(bg->z);
+    if (bg->fast){
+        free_uniform_table(&bg->table);
+        free_uniform_table(&bg->z_as_chi_table);
+    }
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    evaluates all the quantities in coffe_background_point at redshift z,
+    with a single table lookup if fast interpolation is enabled
+**/
+
+int coffe_background_eval(
+    struct coffe_background_t *bg,
+    double z,
+    struct coffe_background_point *point
+)
+{
+    if (bg->fast){
+        double values[6];
+        interp_uniform_table(&bg->table, z, values);
+        point->a = values[0];
+        point->conformal_Hz = values[1];
+        point->D1 = values[2];
+        point->f = values[3];
+        point->G1 = values[4];
+        point->G2 = values[5];
+    }
+    else{
+        point->a = interp_spline(&bg->a, z);
+        point->conformal_Hz = interp_spline(&bg->conformal_Hz, z);
+        point->D1 = interp_spline(&bg->D1, z);
+        point->f = interp_spline(&bg->f, z);
+        point->G1 = interp_spline(&bg->G1, z);
+        point->G2 = interp_spline(&bg->G2, z);
+    }
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    redshift as a function of (dimensionless) comoving distance
+**/
+
+double coffe_background_z(
+    struct coffe_background_t *bg,
+    double chi
+)
+{
+    if (bg->fast){
+        double z;
+        interp_uniform_table(&bg->z_as_chi_table, chi, &z);
+        return z;
+    }
+    return interp_spline(&bg->z_as_chi, chi);
+}
+
+
+/**
+    coffe_background_eval at the <n> redshifts <z>
+**/
+
+int coffe_background_eval_array(
+    struct coffe_background_t *bg,
+    size_t n,
+    const double *z,
+    struct coffe_background_point *point
+)
+{
+    if (bg->fast){
+        /* in blocks, so the values fit on the stack */
+        double values[6*64];
+        for (size_t start = 0; start<n; start += 64){
+            const size_t m = start + 64 < n ? 64 : n - start;
+            interp_uniform_table_array(&bg->table, m, &z[start], values);
+            for (size_t i = 0; i<m; ++i){
+                point[start + i].a = values[6*i];
+                point[start + i].conformal_Hz = values[6*i + 1];
+                point[start + i].D1 = values[6*i + 2];
+                point[start + i].f = values[6*i + 3];
+                point[start + i].G1 = values[6*i + 4];
+                point[start + i].G2 = values[6*i + 5];
+            }
+        }
+    }
+    else{
+        for (size_t i = 0; i<n; ++i){
+            coffe_background_eval(bg, z[i], &point[i]);
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    coffe_background_z at the <n> distances <chi>
+**/
+
+int coffe_background_z_array(
+    struct coffe_background_t *bg,
+    size_t n,
+    const double *chi,
+    double *z
+)
+{
+    if (bg->fast){
+        interp_uniform_table_array(&bg->z_as_chi_table, n, chi, z);
+    }
+    else{
+        for (size_t i = 0; i<n; ++i){
+            z[i] = interp_spline(&bg->z_as_chi, chi[i]);
+        }
+    }
     return EXIT_SUCCESS;
 }
@@ -19,6 +19,10 @@
 #ifndef COFFE_BACKGROUND_H
 #define COFFE_BACKGROUND_H
 
+/* the splines which are only built when first asked for, see coffe_background_lazy */
+#define COFFE_BACKGROUND_HZ 0
+#define COFFE_BACKGROUND_CONFORMAL_HZ_PRIME 1
+#define COFFE_BACKGROUND_LAZY 2
 
 struct coffe_background_t
 {
@@ -26,11 +30,11 @@ struct coffe_background_t
 
     struct coffe_interpolation a; /* scale factor (normalized so that now a=1) */
 
-    struct coffe_interpolation Hz; /* hubble parameter H(z) */
+    struct coffe_interpolation Hz; /* hubble parameter H(z), built on first use */
 
     struct coffe_interpolation conformal_Hz; /* conformal hubble parameter */
 
-    struct coffe_interpolation conformal_Hz_prime; /* derivative of conformal hubble parameter wrt conformal time */
+    struct coffe_interpolation conformal_Hz_prime; /* derivative of conformal hubble parameter wrt conformal time, built on first use */
 
     struct coffe_interpolation D1; /* growth rate D_1(a) */
 
@@ -38,15 +42,71 @@ struct coffe_background_t
 
     struct coffe_interpolation f; /* growth function f=d(log D)/d(log a) */
 
-    struct coffe_interpolation g; /* growth function g=(1+z)*D_1 */
-
     struct coffe_interpolation G1, G2;
 
     struct coffe_interpolation comoving_distance; /* comoving distance, dimensionless */
 
+    struct coffe_uniform_table table; /* uniform cubic table of the quantities in coffe_background_point */
+
+    struct coffe_uniform_table z_as_chi_table; /* uniform cubic table of z_as_chi */
+
+    int fast; /* whether the above tables are used */
+
+    double *z, *samples[COFFE_BACKGROUND_LAZY]; /* the grid in z, and the samples of the splines built on first use */
+
+    size_t len;
+
+    int interp_method;
+
+    unsigned int built; /* which of the splines built on first use exist */
+
+};
+
+
+/**
+    the background quantities needed by the integrands,
+    all evaluated at the same redshift
+**/
+
+struct coffe_background_point
+{
+    double a, conformal_Hz, D1, f, G1, G2;
 };
 
 
+int coffe_background_eval(
+    struct coffe_background_t *bg,
+    double z,
+    struct coffe_background_point *point
+);
+
+double coffe_background_z(
+    struct coffe_background_t *bg,
+    double chi
+);
+
+/* coffe_background_eval at the <n> redshifts <z> */
+int coffe_background_eval_array(
+    struct coffe_background_t *bg,
+    size_t n,
+    const double *z,
+    struct coffe_background_point *point
+);
+
+/* coffe_background_z at the <n> distances <chi> */
+int coffe_background_z_array(
+    struct coffe_background_t *bg,
+    size_t n,
+    const double *chi,
+    double *z
+);
+
+struct coffe_interpolation *coffe_background_lazy(
+    struct coffe_background_t *bg,
+    int field
+);
+
+
 int coffe_background_init(
     struct coffe_parameters_t *par,
     struct coffe_background_t *bg
@@ -0,0 +1,491 @@
+/*
+ * This file is part of COFFE
+ * Copyright (C) 2018 Goran Jelic-Cizmek
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "errors.h"
+#include "background.h"
+#include "integrals.h"
+#include "corrfunc.h"
+#include "multipoles.h"
+#include "average_multipoles.h"
+#include "covariance.h"
+#include "output.h"
+#include "checkpoint.h"
+
+#ifndef COFFE_CHECKPOINT_MAGIC
+#define COFFE_CHECKPOINT_MAGIC "COFFECKP" // first 8 bytes of the checkpoints
+#endif
+
+#ifndef COFFE_CHECKPOINT_VERSION
+#define COFFE_CHECKPOINT_VERSION 1 // bump when the results change for the same settings
+#endif
+
+
+static uint64_t checkpoint_hash_spline(
+    const struct coffe_interpolation *interp,
+    uint64_t hash
+)
+{
+    if (interp->spline == NULL) return hash;
+    hash = coffe_hash(interp->spline->x, sizeof(double)*interp->spline->size, hash);
+    hash = coffe_hash(interp->spline->y, sizeof(double)*interp->spline->size, hash);
+    return hash;
+}
+
+
+static uint64_t checkpoint_hash_terms(
+    const struct coffe_corr_terms *terms,
+    uint64_t hash
+)
+{
+    hash = coffe_hash(&terms->len, sizeof(int), hash);
+    return coffe_hash(terms->value, sizeof(int)*terms->len, hash);
+}
+
+
+/**
+    the samples of the background, the biases and the I^n_l
+    are hashed instead of the cosmology and the power spectrum
+    they were computed from, together with the settings of the
+    multipoles themselves
+**/
+
+uint64_t coffe_checkpoint_key(
+    struct coffe_parameters_t *par,
+    size_t nbins,
+    struct coffe_background_t *bg,
+    struct coffe_integrals_t *integral
+)
+{
+    const int version = COFFE_CHECKPOINT_VERSION;
+#ifdef HAVE_CUBA
+    const int cuba = 1;
+#else
+    const int cuba = 0;
+#endif
+    uint64_t hash = COFFE_HASH_INIT;
+    hash = coffe_hash(&version, sizeof(version), hash);
+    hash = coffe_hash(&cuba, sizeof(cuba), hash);
+    hash = coffe_hash(&nbins, sizeof(nbins), hash);
+
+    const struct coffe_interpolation *background[] = {
+        &bg->z_as_chi, &bg->a, &bg->conformal_Hz, &bg->D1, &bg->f,
+        &bg->G1, &bg->G2, &bg->comoving_distance
+    };
+    for (size_t i = 0; i<sizeof(background)/sizeof(background[0]); ++i){
+        hash = checkpoint_hash_spline(background[i], hash);
+    }
+    hash = coffe_hash(&bg->fast, sizeof(int), hash);
+
+    for (int j = 0; j<9; ++j){
+        const int n = par[0].nonzero_terms[j].n, l = par[0].nonzero_terms[j].l;
+        hash = coffe_hash(&n, sizeof(int), hash);
+        hash = coffe_hash(&l, sizeof(int), hash);
+        if (n == -1) continue;
+        hash = checkpoint_hash_spline(&integral[j].result, hash);
+        if (n == 4 && l == 0){
+            hash = checkpoint_hash_spline(&integral[j].renormalization0, hash);
+            const gsl_spline2d *result2d = integral[j].renormalization.spline;
+            if (result2d != NULL){
+                hash = coffe_hash(
+                    result2d->zarr,
+                    sizeof(double)*result2d->interp_object.xsize*result2d->interp_object.ysize,
+                    hash
+                );
+            }
+        }
+    }
+
+    for (size_t b = 0; b<nbins; ++b){
+        const struct coffe_parameters_t *p = &par[b];
+        const struct coffe_interpolation *bias[] = {
+            &p->matter_bias1, &p->matter_bias2,
+            &p->magnification_bias1, &p->magnification_bias2,
+            &p->evolution_bias1, &p->evolution_bias2
+        };
+        for (size_t i = 0; i<sizeof(bias)/sizeof(bias[0]); ++i){
+            hash = checkpoint_hash_spline(bias[i], hash);
+        }
+        hash = checkpoint_hash_terms(&p->nonintegrated_terms, hash);
+        hash = checkpoint_hash_terms(&p->single_terms, hash);
+        hash = checkpoint_hash_terms(&p->double_terms, hash);
+        hash = coffe_hash(&p->output_type, sizeof(int), hash);
+        hash = coffe_hash(&p->multipole_values_len, sizeof(int), hash);
+        hash = coffe_hash(p->multipole_values, sizeof(int)*p->multipole_values_len, hash);
+        hash = coffe_hash(&p->sep_len, sizeof(size_t), hash);
+        hash = coffe_hash(p->sep, sizeof(double)*p->sep_len, hash);
+        const double real[] = {
+            p->z_mean, p->deltaz, p->z_min, p->z_max, p->Omega0_m,
+            p->integration_accuracy, p->flatsky_threshold
+        };
+        hash = coffe_hash(real, sizeof(real), hash);
+        const int integer[] = {
+            p->integration_method, p->integration_bins, p->nonintegrated_projection
+        };
+        hash = coffe_hash(integer, sizeof(integer), hash);
+    }
+    return hash;
+}
+
+
+/**
+    writes the header of a checkpoint and, if <jobs> is set, the jobs restored
+    so far into <filename>, via a temporary file so it is never left half written
+**/
+
+static int checkpoint_write(
+    const char *filename,
+    uint64_t key,
+    struct coffe_checkpoint_t *cp,
+    int jobs
+)
+{
+    char temp[COFFE_MAX_STRLEN + 16];
+    FILE *file = open_temporary(filename, temp, sizeof(temp));
+    if (file == NULL) return EXIT_FAILURE;
+
+    int error = 0;
+    error |= fwrite(COFFE_CHECKPOINT_MAGIC, 1, 8, file) != 8;
+    error |= fwrite(&key, sizeof(key), 1, file) != 1;
+    for (size_t kind = 0; kind<cp->kinds && jobs && !error; ++kind){
+        for (size_t job = cp->offset[kind]; job<cp->offset[kind + 1] && !error; ++job){
+            if (cp->count[job] == 0) continue;
+            const uint64_t record[3] = {kind, job - cp->offset[kind], cp->count[job]};
+            error |= fwrite(record, sizeof(record), 1, file) != 1;
+            error |= fwrite(
+                &cp->values[2*cp->len*job], sizeof(double), cp->count[job], file
+            ) != cp->count[job];
+            error |= fwrite(
+                &cp->values[(2*job + 1)*cp->len], sizeof(double), cp->count[job], file
+            ) != cp->count[job];
+        }
+    }
+    error |= fclose(file) != 0;
+
+    if (error || rename(temp, filename) != 0){
+        remove(temp);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    reads the jobs of the checkpoint <filename>, provided it was written
+    with the same key; a record cut off by a crash ends the reading,
+    so everything before it is still used
+**/
+
+static int checkpoint_read(
+    const char *filename,
+    uint64_t key,
+    struct coffe_checkpoint_t *cp,
+    size_t *restored
+)
+{
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) return EXIT_FAILURE;
+
+    char magic[8];
+    uint64_t file_key;
+    if (
+        fread(magic, 1, 8, file) != 8 ||
+        memcmp(magic, COFFE_CHECKPOINT_MAGIC, 8) != 0 ||
+        fread(&file_key, sizeof(file_key), 1, file) != 1 ||
+        file_key != key
+    ){
+        fclose(file);
+        return EXIT_FAILURE;
+    }
+
+    double *buffer = (double *)coffe_malloc(sizeof(double)*2*cp->len);
+    uint64_t record[3];
+    *restored = 0;
+    while (fread(record, sizeof(record), 1, file) == 1){
+        const uint64_t kind = record[0], cell = record[1], count = record[2];
+        if (
+            kind >= cp->kinds ||
+            cell >= cp->offset[kind + 1] - cp->offset[kind] ||
+            count == 0 || count > cp->len ||
+            fread(buffer, sizeof(double), 2*count, file) != 2*count
+        ) break;
+        const size_t job = cp->offset[kind] + cell;
+        *restored += cp->count[job] == 0;
+        cp->count[job] = count;
+        memcpy(&cp->values[2*cp->len*job], buffer, sizeof(double)*count);
+        memcpy(&cp->values[(2*job + 1)*cp->len], &buffer[count], sizeof(double)*count);
+    }
+    free(buffer);
+    fclose(file);
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    the checkpoint of process <rank>: the first process uses <path>
+    itself, the others <path>.<rank>
+**/
+
+static void checkpoint_path(
+    const char *path,
+    int rank,
+    char *result
+)
+{
+    if (rank == 0) snprintf(result, COFFE_MAX_STRLEN, "%s", path);
+    else snprintf(result, COFFE_MAX_STRLEN, "%s.%d", path, rank);
+}
+
+
+int coffe_checkpoint_init(
+    struct coffe_parameters_t *par,
+    const char *name,
+    const char *filename,
+    uint64_t key,
+    size_t kinds,
+    const size_t *cells,
+    size_t len,
+    struct coffe_checkpoint_t *cp
+)
+{
+    memset(cp, 0, sizeof(struct coffe_checkpoint_t));
+    cp->name = name;
+    cp->interval = par->progress_interval;
+    cp->start = cp->last = coffe_profile_time();
+    if (!par->checkpoint) return EXIT_SUCCESS;
+
+    cp->kinds = kinds;
+    cp->len = len;
+    cp->offset = (size_t *)coffe_malloc(sizeof(size_t)*(kinds + 1));
+    cp->offset[0] = 0;
+    for (size_t kind = 0; kind<kinds; ++kind){
+        cp->offset[kind + 1] = cp->offset[kind] + cells[kind];
+    }
+    const size_t jobs = cp->offset[kinds];
+    cp->count = (size_t *)coffe_malloc(sizeof(size_t)*(jobs + 1));
+    memset(cp->count, 0, sizeof(size_t)*(jobs + 1));
+    cp->values = (double *)coffe_malloc(sizeof(double)*2*len*(jobs + 1));
+
+    /**
+        with several MPI processes, the jobs are handed out on the fly, so
+        every process appends the ones it finished to a checkpoint of its own;
+        all of them read all the checkpoints of the previous run (which may
+        have had a different number of processes), and the first one then
+        merges them into its own and removes the rest
+    **/
+    const int rank = coffe_mpi_rank();
+    char path[COFFE_MAX_STRLEN], own[COFFE_MAX_STRLEN];
+    coffe_output_filename(par, filename, path);
+    size_t restored = 0;
+    for (int previous = 0; ; ++previous){
+        char other[COFFE_MAX_STRLEN];
+        checkpoint_path(path, previous, other);
+        size_t count = 0;
+        if (checkpoint_read(other, key, cp, &count) == EXIT_SUCCESS){
+            restored += count;
+            continue;
+        }
+        FILE *file = fopen(other, "rb");
+        if (file == NULL) break;
+        fclose(file);
+        if (rank == 0){
+            fprintf(
+                stderr,
+                "WARNING: %s does not match the settings, "
+                "not resuming the %s from it!\n",
+                other, name
+            );
+        }
+    }
+    if (restored > 0 && rank == 0){
+        printf("Resuming the %s, %zu of %zu jobs already done\n",
+            name, restored, jobs
+        );
+    }
+    coffe_mpi_barrier();
+
+    /* rewritten without any record cut off at the end, and then appended to */
+    checkpoint_path(path, rank, own);
+    int error = 0;
+    if (rank == 0){
+        error |= checkpoint_write(own, key, cp, 1) != EXIT_SUCCESS;
+        for (int previous = 1; ; ++previous){
+            char other[COFFE_MAX_STRLEN];
+            checkpoint_path(path, previous, other);
+            if (remove(other) != 0) break;
+        }
+    }
+    coffe_mpi_barrier();
+    if (rank != 0){
+        error |= checkpoint_write(own, key, cp, 0) != EXIT_SUCCESS;
+    }
+    if (error || (cp->file = fopen(own, "ab")) == NULL){
+        print_error_verbose(PROG_WRITE_ERROR, own);
+        exit(EXIT_FAILURE);
+    }
+    return EXIT_SUCCESS;
+}
+
+
+int coffe_checkpoint_phase(
+    struct coffe_checkpoint_t *cp,
+    size_t total
+)
+{
+    cp->total = total;
+    cp->finished = 0;
+    cp->restored = 0;
+    cp->start = cp->last = coffe_profile_time();
+    if (cp->interval > 0){
+        if (cp->counting){
+            coffe_mpi_counter_free(&cp->progress[0]);
+            coffe_mpi_counter_free(&cp->progress[1]);
+        }
+        coffe_mpi_counter_init(&cp->progress[0], total);
+        coffe_mpi_counter_init(&cp->progress[1], total);
+        cp->counting = 1;
+    }
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    counts <cells> more finished cells (<restored> of them
+    from the checkpoint), and reports them if it is time to;
+    the restored ones do not count towards the estimate of the rest;
+    the counts are shared by all the MPI processes, the first one reporting
+**/
+
+static void checkpoint_progress(
+    struct coffe_checkpoint_t *cp,
+    size_t cells,
+    int restored
+)
+{
+    if (cp->interval <= 0) return;
+    cp->finished = coffe_mpi_counter_add(&cp->progress[0], cells);
+    if (restored) cp->restored = coffe_mpi_counter_add(&cp->progress[1], cells);
+    if (coffe_mpi_rank() != 0) return;
+    const double now = coffe_profile_time();
+    if (now - cp->last < cp->interval) return;
+    cp->last = now;
+    cp->restored = coffe_mpi_counter_add(&cp->progress[1], 0);
+    const size_t computed = cp->finished - cp->restored;
+    if (computed == 0) return;
+    const size_t rest = cp->total > cp->finished ? cp->total - cp->finished : 0;
+    const double left = (now - cp->start)*(double)rest/(double)computed;
+    printf("%s: %zu of %zu cells done, about %.0f s left\n",
+        cp->name, cp->finished, cp->total, left
+    );
+    fflush(stdout);
+}
+
+
+int coffe_checkpoint_restore(
+    struct coffe_checkpoint_t *cp,
+    size_t kind,
+    size_t cell,
+    size_t count,
+    double *value,
+    double *error
+)
+{
+    if (cp->file == NULL) return 0;
+    const size_t job = cp->offset[kind] + cell;
+    if (cp->count[job] != count) return 0;
+    memcpy(value, &cp->values[2*cp->len*job], sizeof(double)*count);
+    if (error != NULL){
+        memcpy(error, &cp->values[(2*job + 1)*cp->len], sizeof(double)*count);
+    }
+    #pragma omp critical (coffe_checkpoint)
+    checkpoint_progress(cp, count, 1);
+    return 1;
+}
+
+
+/**
+    every record is the kind, the cell and the number of values
+    (as uint64), then the values and the errors (as doubles);
+    it is flushed right away, so a crash loses at most this one
+**/
+
+int coffe_checkpoint_store(
+    struct coffe_checkpoint_t *cp,
+    size_t kind,
+    size_t cell,
+    size_t count,
+    const double *value,
+    const double *error
+)
+{
+    #pragma omp critical (coffe_checkpoint)
+    {
+        checkpoint_progress(cp, count, 0);
+        if (cp->file != NULL){
+            const uint64_t record[3] = {kind, cell, count};
+            int failed = fwrite(record, sizeof(record), 1, cp->file) != 1;
+            failed |= fwrite(value, sizeof(double), count, cp->file) != count;
+            for (size_t i = 0; i<count && !failed; ++i){
+                const double temp = error != NULL ? error[i] : 0;
+                failed |= fwrite(&temp, sizeof(double), 1, cp->file) != 1;
+            }
+            failed |= fflush(cp->file) != 0;
+            if (failed){
+                fprintf(
+                    stderr,
+                    "WARNING: cannot write to the checkpoint of the %s, "
+                    "disabling it!\n",
+                    cp->name
+                );
+                fclose(cp->file);
+                cp->file = NULL;
+            }
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+
+int coffe_checkpoint_free(
+    struct coffe_checkpoint_t *cp
+)
+{
+    if (cp->file != NULL){
+        if (fclose(cp->file) != 0){
+            fprintf(stderr, "WARNING: cannot close the checkpoint of the %s!\n", cp->name);
+        }
+        cp->file = NULL;
+    }
+    if (cp->counting){
+        coffe_mpi_counter_free(&cp->progress[0]);
+        coffe_mpi_counter_free(&cp->progress[1]);
+        cp->counting = 0;
+    }
+    free(cp->offset);
+    free(cp->count);
+    free(cp->values);
+    cp->offset = NULL;
+    cp->count = NULL;
+    cp->values = NULL;
+    return EXIT_SUCCESS;
+}
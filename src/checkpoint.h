@@ -0,0 +1,97 @@
+/*
+ * This file is part of COFFE
+ * Copyright (C) 2018 Goran Jelic-Cizmek
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+    the progress of the (redshift averaged) multipoles: the finished cells
+    (one multipole at one separation, of one kind of terms) are reported
+    every progress_interval seconds, and with checkpoint = 1 each finished
+    job is appended to a binary file, so that a rerun with the same settings
+    hash restores it instead of computing it again; with several MPI
+    processes, the counts are shared and each process has a file of its own
+**/
+
+#ifndef COFFE_CHECKPOINT_H
+#define COFFE_CHECKPOINT_H
+
+struct coffe_checkpoint_t
+{
+    const char *name; /* of the computation, for the reports */
+    double interval; /* seconds between the reports, 0 for none */
+    double start, last; /* when the current phase started, and the last report */
+    size_t total, finished, restored; /* cells of the current phase */
+    struct coffe_mpi_counter_t progress[2]; /* the finished and restored cells of all the processes */
+    int counting; /* whether the counters are initialized */
+
+    FILE *file; /* the finished jobs are appended here, NULL if not checkpointing */
+    size_t kinds, len; /* kinds of jobs, and the most values of a job */
+    size_t *offset; /* the jobs of kind k are offset[k], ..., offset[k + 1] - 1 */
+    size_t *count; /* values of the job offset[kind] + cell restored, 0 if none */
+    double *values; /* its values and then its errors, from 2*len*(offset[kind] + cell) */
+};
+
+/* the hash of everything the multipoles of the <nbins> settings in <par> depend on */
+uint64_t coffe_checkpoint_key(
+    struct coffe_parameters_t *par,
+    size_t nbins,
+    struct coffe_background_t *bg,
+    struct coffe_integrals_t *integral
+);
+
+/* opens the checkpoint <filename> for the jobs 0, ..., cells[k] - 1 of each of the <kinds> */
+int coffe_checkpoint_init(
+    struct coffe_parameters_t *par,
+    const char *name,
+    const char *filename,
+    uint64_t key,
+    size_t kinds,
+    const size_t *cells,
+    size_t len,
+    struct coffe_checkpoint_t *cp
+);
+
+/* starts reporting a phase of <total> cells */
+int coffe_checkpoint_phase(
+    struct coffe_checkpoint_t *cp,
+    size_t total
+);
+
+/* copies the <count> values (and errors) of a restored job, returns whether there was one */
+int coffe_checkpoint_restore(
+    struct coffe_checkpoint_t *cp,
+    size_t kind,
+    size_t cell,
+    size_t count,
+    double *value,
+    double *error
+);
+
+/* records the <count> values (and errors, if not NULL) of a finished job */
+int coffe_checkpoint_store(
+    struct coffe_checkpoint_t *cp,
+    size_t kind,
+    size_t cell,
+    size_t count,
+    const double *value,
+    const double *error
+);
+
+int coffe_checkpoint_free(
+    struct coffe_checkpoint_t *cp
+);
+
+#endif
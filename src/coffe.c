@@ -0,0 +1,669 @@
+/*
+ * This file is part of COFFE
+ * Copyright (C) 2018 Goran Jelic-Cizmek
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gsl/gsl_spline2d.h>
+#include <libconfig.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "common.h"
+#include "errors.h"
+#include "parser.h"
+#include "coffe.h"
+#include "output.h"
+#include "offload.h"
+
+
+/**
+    parses the settings file <settings_file> into the context <ctx>,
+    which will use <nthreads> threads; nothing is computed yet
+**/
+
+int coffe_context_init(
+    struct coffe_context_t *ctx,
+    char *settings_file,
+    int nthreads
+)
+{
+    /* everything unused must look freed to the free functions */
+    memset(ctx, 0, sizeof(struct coffe_context_t));
+
+    if (nthreads <= 0){
+        print_error_verbose(PROG_VALUE_ERROR, "NUMTHREADS");
+        return EXIT_FAILURE;
+    }
+    ctx->par.nthreads = nthreads;
+#ifdef _OPENMP
+    /* the interpolators allocate one accelerator per thread */
+    omp_set_num_threads(ctx->par.nthreads);
+#endif
+
+    /* the profiler runs from here until the context is freed */
+    coffe_profile_init(nthreads);
+    coffe_profile_start(COFFE_PROFILE_TOTAL);
+
+    coffe_parser_init(settings_file, &ctx->par);
+    ctx->stale = COFFE_STAGE_ALL;
+
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    marks the <stages> (any combination of COFFE_STAGE_*) for recomputation;
+    the results always follow the background, and the correlation functions
+    and multipoles the integrals, but the integrals are only recomputed with
+    the background if COFFE_STAGE_INTEGRALS is also given, i.e. when the
+    distances or the power spectrum changed
+**/
+
+int coffe_context_invalidate(
+    struct coffe_context_t *ctx,
+    int stages
+)
+{
+    ctx->stale |= stages & COFFE_STAGE_ALL;
+    return EXIT_SUCCESS;
+}
+
+
+/* the stages computing the correlation functions and multipoles */
+#define COFFE_STAGE_CORRELATION \
+    (COFFE_STAGE_CORRFUNC | COFFE_STAGE_MULTIPOLES | COFFE_STAGE_AVERAGE_MULTIPOLES)
+
+
+/**
+    (re)computes the correlation <stages> of <ctx>
+**/
+
+static int coffe_context_correlation(
+    struct coffe_context_t *ctx,
+    int stages
+)
+{
+    struct coffe_parameters_t *par = &ctx->par;
+
+    /* the tables depend on the biases, so they are made for every computation */
+    coffe_offload_init(par, &ctx->bg, ctx->integral);
+
+    if (stages & COFFE_STAGE_CORRFUNC){
+        coffe_corrfunc_ang_free(&ctx->cf_ang);
+        coffe_corrfunc_free(&ctx->cf);
+        coffe_corrfunc2d_free(&ctx->cf2d);
+        coffe_corrfunc_init(
+            par, &ctx->bg, ctx->integral, &ctx->cf_ang, &ctx->cf, &ctx->cf2d
+        );
+    }
+
+    if (stages & COFFE_STAGE_MULTIPOLES){
+        coffe_multipoles_free(&ctx->mp);
+        coffe_multipoles_init(par, &ctx->bg, ctx->integral, &ctx->mp);
+    }
+
+    if (stages & COFFE_STAGE_AVERAGE_MULTIPOLES){
+        coffe_average_multipoles_free(&ctx->ramp);
+        coffe_average_multipoles_init(par, &ctx->bg, ctx->integral, &ctx->ramp);
+    }
+
+    coffe_offload_free();
+
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    points <rows> to the correlation result of the current output type,
+    stored as rows of length <len>, and returns their number; 0 if the
+    output type has no correlation result
+**/
+
+static size_t coffe_context_rows(
+    struct coffe_context_t *ctx,
+    double **rows,
+    size_t *len
+)
+{
+    switch (ctx->par.output_type){
+        case 0:
+            *rows = ctx->cf_ang.result;
+            *len = ctx->cf_ang.theta_len;
+            return 1;
+        case 1:
+            *rows = ctx->cf.result;
+            *len = ctx->cf.sep_len;
+            return ctx->cf.mu_len;
+        case 2:
+            *rows = ctx->mp.result;
+            *len = ctx->mp.sep_len;
+            return ctx->mp.l_len;
+        case 3:
+            *rows = ctx->ramp.result;
+            *len = ctx->ramp.sep_len;
+            return ctx->ramp.l_len;
+        case 6:
+            *rows = ctx->cf2d.result;
+            *len = ctx->cf2d.sep_len;
+            return ctx->cf2d.sep_len;
+        default:
+            *rows = NULL;
+            *len = 0;
+            return 0;
+    }
+}
+
+
+/**
+    the terms of <all> containing the density exactly <count> times
+**/
+
+static struct coffe_corr_terms coffe_context_density_terms(
+    const struct coffe_corr_terms *all,
+    int count
+)
+{
+    struct coffe_corr_terms terms;
+    terms.len = 0;
+    for (int i = 0; i<all->len; ++i){
+        /* the labels are 10 a + b with a <= b, so the density is always a */
+        const int label = all->value[i];
+        const int density =
+            (label/10 == COFFE_DEN) + (label/10 == COFFE_DEN && label%10 == COFFE_DEN);
+        if (density == count) terms.value[terms.len++] = label;
+    }
+    return terms;
+}
+
+
+/**
+    computes the correlation <stages> as the four blocks proportional to 1,
+    b1, b2 and b1 b2; the matter biases only enter the terms with the density,
+    so each block only needs those terms, with the other bias set to zero
+**/
+
+static int coffe_context_bias_blocks(
+    struct coffe_context_t *ctx,
+    int stages
+)
+{
+    struct coffe_parameters_t *par = &ctx->par;
+    const struct coffe_corr_terms nonintegrated = par->nonintegrated_terms;
+    const struct coffe_corr_terms single = par->single_terms;
+    const struct coffe_corr_terms twice = par->double_terms;
+    const struct coffe_interpolation bias1 = par->matter_bias1;
+    const struct coffe_interpolation bias2 = par->matter_bias2;
+    struct coffe_corr_terms none;
+    none.len = 0;
+
+    struct coffe_interpolation zero = {0};
+    double zero_redshift[] = {0, 25, 50, 75, 100};
+    double zero_value[] = {0, 0, 0, 0, 0};
+    init_spline(
+        &zero, zero_redshift, zero_value,
+        sizeof(zero_redshift)/sizeof(zero_redshift[0]), par->interp_method
+    );
+
+    for (int block = 0; block<4; ++block){
+        const int density = block == 0 ? 0 : block == 3 ? 2 : 1;
+        par->nonintegrated_terms = coffe_context_density_terms(&nonintegrated, density);
+        par->single_terms = coffe_context_density_terms(&single, density);
+        par->double_terms = block == 0 ? twice : none;
+        par->matter_bias1 = block == 1 || block == 3 ? bias1 : zero;
+        par->matter_bias2 = block == 2 || block == 3 ? bias2 : zero;
+
+        coffe_context_correlation(ctx, stages);
+
+        double *rows;
+        size_t len;
+        const size_t rows_len = coffe_context_rows(ctx, &rows, &len);
+        if (block == 0){
+            ctx->bias_block_len = rows_len*len;
+            for (int i = 0; i<4; ++i){
+                free(ctx->bias_block[i]);
+                ctx->bias_block[i] =
+                    (double *)coffe_malloc(sizeof(double)*ctx->bias_block_len);
+            }
+        }
+        memcpy(ctx->bias_block[block], rows, sizeof(double)*ctx->bias_block_len);
+    }
+
+    par->nonintegrated_terms = nonintegrated;
+    par->single_terms = single;
+    par->double_terms = twice;
+    par->matter_bias1 = bias1;
+    par->matter_bias2 = bias2;
+    free_spline(&zero);
+
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    writes the correlation result for the current bias amplitudes from the blocks
+**/
+
+static int coffe_context_bias_contract(
+    struct coffe_context_t *ctx
+)
+{
+    const double a1 = ctx->bias_amplitude[0], a2 = ctx->bias_amplitude[1];
+    double *rows;
+    size_t len;
+    const size_t rows_len = coffe_context_rows(ctx, &rows, &len);
+
+    for (size_t k = 0; k<rows_len*len; ++k){
+        rows[k] =
+            ctx->bias_block[0][k]
+           +a1*ctx->bias_block[1][k]
+           +a2*ctx->bias_block[2][k]
+           +a1*a2*ctx->bias_block[3][k];
+    }
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    sets the bias <name> (matter_bias1, magnification_bias2 etc., as in the
+    settings file) to <value> at the <len> redshifts <z>, or to the constant
+    value[0] if <len> is 1; the magnification and evolution biases enter
+    the background, the matter ones only the results
+**/
+
+int coffe_context_set_bias(
+    struct coffe_context_t *ctx,
+    const char *name,
+    const double *z,
+    const double *value,
+    size_t len
+)
+{
+    struct coffe_parameters_t *par = &ctx->par;
+    struct coffe_interpolation *bias = NULL;
+    int stages = COFFE_STAGE_RESULTS;
+
+    if (strcmp(name, "matter_bias1") == 0){
+        bias = &par->matter_bias1;
+    }
+    else if (strcmp(name, "matter_bias2") == 0){
+        bias = &par->matter_bias2;
+    }
+    else if (strcmp(name, "magnification_bias1") == 0){
+        bias = &par->magnification_bias1;
+        stages = COFFE_STAGE_BACKGROUND;
+    }
+    else if (strcmp(name, "magnification_bias2") == 0){
+        bias = &par->magnification_bias2;
+        stages = COFFE_STAGE_BACKGROUND;
+    }
+    else if (strcmp(name, "evolution_bias1") == 0){
+        bias = &par->evolution_bias1;
+        stages = COFFE_STAGE_BACKGROUND;
+    }
+    else if (strcmp(name, "evolution_bias2") == 0){
+        bias = &par->evolution_bias2;
+        stages = COFFE_STAGE_BACKGROUND;
+    }
+    if (bias == NULL || len == 0){
+        print_error_verbose(PROG_VALUE_ERROR, name);
+        return EXIT_FAILURE;
+    }
+
+    free_spline(bias);
+    if (len == 1){
+        /* the same range as a constant bias from the settings file */
+        double bias_redshift[] = {0, 25, 50, 75, 100};
+        double bias_value[] = {value[0], value[0], value[0], value[0], value[0]};
+        init_spline(
+            bias, bias_redshift, bias_value,
+            sizeof(bias_redshift)/sizeof(bias_redshift[0]), par->interp_method
+        );
+    }
+    else{
+        double *bias_redshift = (double *)coffe_malloc(sizeof(double)*len);
+        double *bias_value = (double *)coffe_malloc(sizeof(double)*len);
+        memcpy(bias_redshift, z, sizeof(double)*len);
+        memcpy(bias_value, value, sizeof(double)*len);
+        init_spline(bias, bias_redshift, bias_value, len, par->interp_method);
+        free(bias_redshift);
+        free(bias_value);
+    }
+
+    return coffe_context_invalidate(ctx, stages);
+}
+
+
+/**
+    replaces the separations of the correlation function
+    or the (redshift averaged) multipoles by the <len> ones in <sep>
+**/
+
+int coffe_context_set_separations(
+    struct coffe_context_t *ctx,
+    const double *sep,
+    size_t len
+)
+{
+    struct coffe_parameters_t *par = &ctx->par;
+    if (
+        len == 0 ||
+        !(par->output_type == 1 || par->output_type == 2 || par->output_type == 3)
+    ){
+        print_error_verbose(PROG_VALUE_ERROR, "separations");
+        return EXIT_FAILURE;
+    }
+
+    free(par->sep);
+    par->sep = (double *)coffe_malloc(sizeof(double)*len);
+    memcpy(par->sep, sep, sizeof(double)*len);
+    par->sep_len = len;
+
+    return coffe_context_invalidate(ctx, COFFE_STAGE_RESULTS);
+}
+
+
+/**
+    rescales the matter biases to <amplitude1> and <amplitude2> times the
+    current ones (from the settings file or coffe_context_set_bias); the first
+    call splits the correlation results into blocks, costing about as much as
+    computing them twice, then changing the amplitudes takes no new integrals;
+    not available for the covariance
+**/
+
+int coffe_context_set_bias_amplitude(
+    struct coffe_context_t *ctx,
+    double amplitude1,
+    double amplitude2
+)
+{
+    const int type = ctx->par.output_type;
+    if (type == 4 || type == 5){
+        print_error_verbose(PROG_VALUE_ERROR, "output_type");
+        return EXIT_FAILURE;
+    }
+
+    ctx->bias_amplitude[0] = amplitude1;
+    ctx->bias_amplitude[1] = amplitude2;
+    if (!ctx->bias_split){
+        ctx->bias_split = 1;
+        return coffe_context_invalidate(ctx, COFFE_STAGE_CORRELATION);
+    }
+    if (!(ctx->stale & COFFE_STAGE_CORRELATION)){
+        coffe_context_bias_contract(ctx);
+    }
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    (re)computes the background and the integrals if they are stale,
+    and flags the results depending on them
+**/
+
+static int coffe_context_tables(
+    struct coffe_context_t *ctx
+)
+{
+    struct coffe_parameters_t *par = &ctx->par;
+
+    if (ctx->stale & COFFE_STAGE_BACKGROUND){
+        if (ctx->computed & COFFE_STAGE_BACKGROUND){
+            coffe_background_free(&ctx->bg);
+        }
+        coffe_background_init(par, &ctx->bg);
+        ctx->computed |= COFFE_STAGE_BACKGROUND;
+        ctx->stale |= COFFE_STAGE_RESULTS;
+    }
+
+    if (ctx->stale & COFFE_STAGE_INTEGRALS){
+        if (ctx->computed & COFFE_STAGE_INTEGRALS){
+            coffe_integrals_free(ctx->integral);
+            memset(ctx->integral, 0, sizeof(ctx->integral));
+        }
+        coffe_integrals_init(par, &ctx->bg, ctx->integral);
+        ctx->computed |= COFFE_STAGE_INTEGRALS;
+        ctx->stale |=
+            COFFE_STAGE_CORRFUNC | COFFE_STAGE_MULTIPOLES | COFFE_STAGE_AVERAGE_MULTIPOLES;
+    }
+
+    ctx->stale &= ~(COFFE_STAGE_BACKGROUND | COFFE_STAGE_INTEGRALS);
+
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    (re)computes all the stages of <ctx> which are out of date;
+    the results are then available in the members of <ctx>
+**/
+
+int coffe_context_compute(
+    struct coffe_context_t *ctx
+)
+{
+    struct coffe_parameters_t *par = &ctx->par;
+
+    coffe_context_tables(ctx);
+
+    if (ctx->stale & COFFE_STAGE_CORRELATION){
+        if (ctx->bias_split){
+            coffe_context_bias_blocks(ctx, ctx->stale & COFFE_STAGE_CORRELATION);
+            coffe_context_bias_contract(ctx);
+        }
+        else{
+            coffe_context_correlation(ctx, ctx->stale & COFFE_STAGE_CORRELATION);
+        }
+    }
+
+    if (ctx->stale & COFFE_STAGE_COVARIANCE){
+        coffe_covariance_free(&ctx->cov_mp);
+        coffe_covariance_free(&ctx->cov_ramp);
+        coffe_covariance_init(par, &ctx->bg, &ctx->cov_mp, &ctx->cov_ramp);
+    }
+
+    ctx->computed |= ctx->stale & COFFE_STAGE_RESULTS;
+    ctx->stale = 0;
+
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    writes the current results of <ctx> to the output files,
+    computing them first if needed
+**/
+
+int coffe_context_output(
+    struct coffe_context_t *ctx
+)
+{
+    if (ctx->stale) coffe_context_compute(ctx);
+
+    return coffe_output_init(
+        &ctx->par, &ctx->bg,
+#ifdef HAVE_INTEGRALS
+        ctx->integral,
+#endif
+        &ctx->cf_ang, &ctx->cf,
+        &ctx->mp, &ctx->ramp,
+        &ctx->cov_mp, &ctx->cov_ramp,
+        &ctx->cf2d
+    );
+}
+
+
+/**
+    sets the redshifts of bin <b> of the batch in <par>
+    and appends "bin<b>_" to the output prefix <prefix>
+**/
+
+static void coffe_context_batch_bin(
+    struct coffe_parameters_t *par,
+    const char *prefix,
+    size_t b
+)
+{
+    if (par->output_type == 3){
+        par->z_min = par->batch_z_min[b];
+        par->z_max = par->batch_z_max[b];
+    }
+    else{
+        par->z_mean = par->batch_z_mean[b];
+        if (par->output_type == 1 || par->output_type == 2){
+            par->deltaz = par->batch_deltaz[b];
+        }
+    }
+    if (strcmp(prefix, "$TIME") == 0){
+        snprintf(par->output_prefix, COFFE_MAX_STRLEN, "%s_bin%zu_", par->timestamp, b);
+    }
+    else{
+        snprintf(par->output_prefix, COFFE_MAX_STRLEN, "%sbin%zu_", prefix, b);
+    }
+}
+
+
+/**
+    computes and writes all the redshift bins of the batch in the settings
+    (or just the one bin if there is no batch), the output of bin b having
+    "bin<b>_" appended to the prefix; the background and the integrals are
+    computed once for all of them, and the multipoles of all the bins
+    are scheduled as one task graph, while the other outputs
+    are computed bin after bin
+**/
+
+int coffe_context_batch(
+    struct coffe_context_t *ctx
+)
+{
+    struct coffe_parameters_t *par = &ctx->par;
+    const size_t nbins = (size_t)par->batch_len;
+    if (nbins == 0){
+        coffe_context_compute(ctx);
+        return coffe_context_output(ctx);
+    }
+    printf("Running a batch of %zu redshift bins\n", nbins);
+
+    coffe_context_tables(ctx);
+
+    char prefix[COFFE_MAX_STRLEN];
+    snprintf(prefix, COFFE_MAX_STRLEN, "%s", par->output_prefix);
+
+    if (par->output_type == 2 && !ctx->bias_split){
+        struct coffe_parameters_t *bins = (struct coffe_parameters_t *)
+            coffe_malloc(sizeof(struct coffe_parameters_t)*nbins);
+        struct coffe_multipoles_t *mp = (struct coffe_multipoles_t *)
+            coffe_malloc(sizeof(struct coffe_multipoles_t)*nbins);
+        memset(mp, 0, sizeof(struct coffe_multipoles_t)*nbins);
+        /* the copies share everything allocated with the context */
+        for (size_t b = 0; b<nbins; ++b){
+            bins[b] = *par;
+            coffe_context_batch_bin(&bins[b], prefix, b);
+        }
+
+        coffe_offload_init(par, &ctx->bg, ctx->integral);
+        coffe_multipoles_batch_init(bins, nbins, &ctx->bg, ctx->integral, mp);
+        coffe_offload_free();
+
+        for (size_t b = 0; b<nbins; ++b){
+            coffe_output_init(
+                &bins[b], &ctx->bg,
+#ifdef HAVE_INTEGRALS
+                ctx->integral,
+#endif
+                &ctx->cf_ang, &ctx->cf,
+                &mp[b], &ctx->ramp,
+                &ctx->cov_mp, &ctx->cov_ramp,
+                &ctx->cf2d
+            );
+            coffe_multipoles_free(&mp[b]);
+        }
+        free(mp);
+        free(bins);
+    }
+    else{
+        const double z_mean = par->z_mean, deltaz = par->deltaz;
+        const double z_min = par->z_min, z_max = par->z_max;
+        for (size_t b = 0; b<nbins; ++b){
+            coffe_context_batch_bin(par, prefix, b);
+            coffe_context_invalidate(ctx, COFFE_STAGE_CORRELATION);
+            coffe_context_compute(ctx);
+            coffe_context_output(ctx);
+        }
+        par->z_mean = z_mean, par->deltaz = deltaz;
+        par->z_min = z_min, par->z_max = z_max;
+        coffe_context_invalidate(ctx, COFFE_STAGE_CORRELATION);
+    }
+    snprintf(par->output_prefix, COFFE_MAX_STRLEN, "%s", prefix);
+
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    frees everything held by <ctx>
+**/
+
+int coffe_context_free(
+    struct coffe_context_t *ctx
+)
+{
+    if (ctx->computed & COFFE_STAGE_BACKGROUND){
+        coffe_background_free(&ctx->bg);
+    }
+
+    if (ctx->computed & COFFE_STAGE_INTEGRALS){
+        coffe_integrals_free(ctx->integral);
+    }
+
+    coffe_corrfunc_ang_free(&ctx->cf_ang);
+
+    coffe_corrfunc_free(&ctx->cf);
+
+    coffe_corrfunc2d_free(&ctx->cf2d);
+
+    coffe_multipoles_free(&ctx->mp);
+
+    coffe_average_multipoles_free(&ctx->ramp);
+
+    coffe_covariance_free(&ctx->cov_mp);
+
+    coffe_covariance_free(&ctx->cov_ramp);
+
+    for (int i = 0; i<4; ++i){
+        free(ctx->bias_block[i]);
+        ctx->bias_block[i] = NULL;
+    }
+    ctx->bias_split = 0;
+
+    coffe_parser_free(&ctx->par);
+
+    /* the integration workspaces are kept per thread */
+    #pragma omp parallel num_threads(ctx->par.nthreads)
+    coffe_workspace_free();
+
+    coffe_profile_stop(COFFE_PROFILE_TOTAL);
+    coffe_profile_free();
+
+    ctx->computed = 0;
+    ctx->stale = 0;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,122 @@
+/*
+ * This file is part of COFFE
+ * Copyright (C) 2018 Goran Jelic-Cizmek
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+    COFFE as a library: a context holds the settings, the background,
+    the integrals and all the results, and can be evaluated repeatedly;
+    after changing some of the parameters, only the stages depending
+    on them are recomputed, and the results stay in memory
+**/
+
+#ifndef COFFE_H
+#define COFFE_H
+
+#include "common.h"
+#include "background.h"
+#include "integrals.h"
+#include "corrfunc.h"
+#include "multipoles.h"
+#include "average_multipoles.h"
+#include "covariance.h"
+
+/* the stages of the computation, to be used as bit flags */
+#define COFFE_STAGE_BACKGROUND 1
+#define COFFE_STAGE_INTEGRALS 2
+#define COFFE_STAGE_CORRFUNC 4
+#define COFFE_STAGE_MULTIPOLES 8
+#define COFFE_STAGE_AVERAGE_MULTIPOLES 16
+#define COFFE_STAGE_COVARIANCE 32
+#define COFFE_STAGE_RESULTS \
+    (COFFE_STAGE_CORRFUNC | COFFE_STAGE_MULTIPOLES | \
+    COFFE_STAGE_AVERAGE_MULTIPOLES | COFFE_STAGE_COVARIANCE)
+#define COFFE_STAGE_ALL \
+    (COFFE_STAGE_BACKGROUND | COFFE_STAGE_INTEGRALS | COFFE_STAGE_RESULTS)
+
+struct coffe_context_t
+{
+    struct coffe_parameters_t par;
+    struct coffe_background_t bg;
+    struct coffe_integrals_t integral[9];
+    struct coffe_corrfunc_ang_t cf_ang;
+    struct coffe_corrfunc_t cf;
+    struct coffe_corrfunc2d_t cf2d;
+    struct coffe_multipoles_t mp;
+    struct coffe_average_multipoles_t ramp;
+    struct coffe_covariance_t cov_mp;
+    struct coffe_covariance_t cov_ramp;
+    int computed; /* the stages which hold memory */
+    int stale; /* the stages which need to be (re)computed */
+
+    /*
+        with the matter biases rescaled by amplitudes, the correlation results
+        are kept as the blocks proportional to 1, b1, b2 and b1 b2 (in that order)
+    */
+    int bias_split;
+    double bias_amplitude[2];
+    double *bias_block[4];
+    size_t bias_block_len;
+};
+
+int coffe_context_init(
+    struct coffe_context_t *ctx,
+    char *settings_file,
+    int nthreads
+);
+
+int coffe_context_invalidate(
+    struct coffe_context_t *ctx,
+    int stages
+);
+
+int coffe_context_set_bias(
+    struct coffe_context_t *ctx,
+    const char *name,
+    const double *z,
+    const double *value,
+    size_t len
+);
+
+int coffe_context_set_separations(
+    struct coffe_context_t *ctx,
+    const double *sep,
+    size_t len
+);
+
+int coffe_context_set_bias_amplitude(
+    struct coffe_context_t *ctx,
+    double amplitude1,
+    double amplitude2
+);
+
+int coffe_context_compute(
+    struct coffe_context_t *ctx
+);
+
+int coffe_context_output(
+    struct coffe_context_t *ctx
+);
+
+int coffe_context_batch(
+    struct coffe_context_t *ctx
+);
+
+int coffe_context_free(
+    struct coffe_context_t *ctx
+);
+
+#endif
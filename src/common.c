@@ -21,8 +21,28 @@
 #include <string.h>
 #include <time.h>
 #include <stdarg.h>
+#include <math.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
 #include <gsl/gsl_version.h>
 #include <gsl/gsl_interp.h>
+#include <gsl/gsl_spline2d.h>
+#include <gsl/gsl_integration.h>
+#include <gsl/gsl_rng.h>
+#include <gsl/gsl_monte_plain.h>
+#include <gsl/gsl_monte_miser.h>
+#include <gsl/gsl_monte_vegas.h>
+#include <gsl/gsl_qrng.h>
+#include <gsl/gsl_sf_bessel.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "common.h"
 #include "errors.h"
@@ -74,6 +94,15 @@ int read_1col(
     size_t *len
 )
 {
+    if (is_binary(filename)){
+        struct coffe_table_t table;
+        if (map_binary(filename, &table) != EXIT_SUCCESS) return EXIT_FAILURE;
+        *len = table.len[0];
+        *values = (double *)coffe_malloc(sizeof(double)*(*len));
+        memcpy(*values, table.columns[0], sizeof(double)*(*len));
+        return unmap_binary(&table);
+    }
+
     int error = 0;
     FILE *data = fopen(filename, "r");
     if (data == NULL){
@@ -138,6 +167,22 @@ int read_2col(
     size_t *len
 )
 {
+    if (is_binary(filename)){
+        struct coffe_table_t table;
+        if (map_binary(filename, &table) != EXIT_SUCCESS) return EXIT_FAILURE;
+        if (table.ncolumns < 2 || table.len[0] != table.len[1]){
+            print_error_verbose(PROG_READ_ERROR, filename);
+            unmap_binary(&table);
+            return EXIT_FAILURE;
+        }
+        *len = table.len[0];
+        *values1 = (double *)coffe_malloc(sizeof(double)*(*len));
+        *values2 = (double *)coffe_malloc(sizeof(double)*(*len));
+        memcpy(*values1, table.columns[0], sizeof(double)*(*len));
+        memcpy(*values2, table.columns[1], sizeof(double)*(*len));
+        return unmap_binary(&table);
+    }
+
     int error = 0;
     FILE *data = fopen(filename, "r");
     if (data == NULL){
@@ -336,13 +381,6 @@ int write_ncol_null(
 )
 {
     va_list args;
-    FILE *data = fopen(filename, "w");
-    if (data == NULL){
-        print_error_verbose(PROG_OPEN_ERROR, filename);
-        return EXIT_FAILURE;
-    }
-    if (header != NULL) fprintf(data, "%s", header);
-
     va_start(args, values);
     size_t counter = 0;
     double **all_values = (double **)coffe_malloc(sizeof(double *)*COFFE_MAX_ALLOCABLE);
@@ -355,43 +393,66 @@ int write_ncol_null(
     } while (values != NULL);
     va_end(args);
 
+    int error = write_ncol_array(filename, len, header, sep, counter, all_values);
+    free(all_values);
+    return error;
+}
+
+
+/**
+    same as the above, with the <ncolumns> columns given as an array
+**/
+
+int write_ncol_array(
+    char *filename,
+    size_t len,
+    const char *header,
+    const char *sep,
+    size_t ncolumns,
+    double **values
+)
+{
+    FILE *data = fopen(filename, "w");
+    if (data == NULL){
+        print_error_verbose(PROG_OPEN_ERROR, filename);
+        return EXIT_FAILURE;
+    }
+    setvbuf(data, NULL, _IOFBF, COFFE_OUTPUT_BUFFER);
+    if (header != NULL) fprintf(data, "%s", header);
+
     for (size_t i = 0; i<len; ++i){
-        for (size_t j = 0; j<counter; ++j){
-            if (j<counter - 1)
-                fprintf(data, "%.10e%s", all_values[j][i], sep);
+        for (size_t j = 0; j<ncolumns; ++j){
+            if (j<ncolumns - 1)
+                fprintf(data, "%.10e%s", values[j][i], sep);
             else
-                fprintf(data, "%.10e%s\n", all_values[j][i], sep);
+                fprintf(data, "%.10e%s\n", values[j][i], sep);
         }
     }
     fclose(data);
-    for (size_t i = 0; i<counter; ++i){
-        all_values[i] = NULL;
-    }
-    free(all_values);
     return EXIT_SUCCESS;
 }
 
 
 
 /**
-    writes a <len1>x<len2> matrix <values> into file <filename>
+    writes a <len1>x<len2> matrix <values> (stored row by row) into file <filename>
 **/
 
 int write_matrix(
     char *filename,
-    double **values,
+    const double *values,
     size_t len1,
     size_t len2,
     const char *header,
     const char *sep
 )
 {
-    int error = 0;
     FILE *data = fopen(filename, "w");
     if (data == NULL){
         print_error(PROG_OPEN_ERROR);
         return EXIT_FAILURE;
     }
+    setvbuf(data, NULL, _IOFBF, COFFE_OUTPUT_BUFFER);
 
     if (header != NULL){
         fprintf(data, "%s\n", header);
@@ -400,57 +461,457 @@ int write_matrix(
     for (size_t i = 0; i<len1; ++i){
         for (size_t j = 0; j<len2; ++j){
             if (j != len2 - 1)
-                fprintf(data, "%10e%s", values[i][j], sep);
+                fprintf(data, "%10e%s", values[i*len2 + j], sep);
             else
-                fprintf(data, "\n");
+                fprintf(data, "%10e\n", values[i*len2 + j]);
         }
     }
 
-    error = fclose(data);
-    if (error){
-        print_error(PROG_CLOSE_ERROR);
-        return EXIT_FAILURE;
+    return fclose(data) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/**
+    writes the <len> <values> of <size> bytes each
+    to <data> in little endian, independently of the host
+**/
+
+static int write_little_endian(
+    FILE *data,
+    const void *values,
+    size_t size,
+    size_t len
+)
+{
+    const uint16_t probe = 1;
+    if (*(const unsigned char *)&probe == 1){
+        return fwrite(values, size, len, data) == len ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    for (size_t i = 0; i<len; ++i){
+        unsigned char swapped[size];
+        for (size_t j = 0; j<size; ++j){
+            swapped[j] = ((const unsigned char *)values)[i*size + size - 1 - j];
+        }
+        if (fwrite(swapped, size, 1, data) != 1) return EXIT_FAILURE;
     }
     return EXIT_SUCCESS;
 }
 
 
 /**
-    allocates an <len1>x<len2> matrix
-    and stores it into <values>
+    the offset (in bytes) of the first column in a binary file
+    with the text <header> and <ncolumns> columns
 **/
 
-int alloc_double_matrix(
-    double ***values,
-    size_t len1,
-    size_t len2
+size_t binary_data_offset(
+    const char *header,
+    size_t ncolumns
 )
 {
-    *values = (double **)coffe_malloc(sizeof(double *)*len1);
-    for (size_t i = 0; i<len1; ++i){
-        (*values)[i] = (double *)coffe_malloc(sizeof(double)*len2);
+    const size_t text_len = header != NULL ? strlen(header) + 1 : 1;
+    const size_t offset =
+        8 + sizeof(uint64_t)*(3 + ncolumns) + (text_len + 7)/8*8;
+    return (offset + COFFE_BINARY_ALIGNMENT - 1)
+        /COFFE_BINARY_ALIGNMENT*COFFE_BINARY_ALIGNMENT;
+}
+
+
+/**
+    writes everything in the binary format of COFFE (see write_binary)
+    up to the start of the first column to <data>
+**/
+
+int write_binary_header(
+    FILE *data,
+    const char *header,
+    size_t ncolumns,
+    const size_t *len
+)
+{
+    const size_t text_len = header != NULL ? strlen(header) + 1 : 1;
+    const uint64_t info[3] = {
+        COFFE_BINARY_VERSION,
+        (uint64_t)ncolumns,
+        (uint64_t)((text_len + 7)/8*8)
+    };
+    uint64_t *lengths = (uint64_t *)coffe_malloc(sizeof(uint64_t)*(ncolumns + 1));
+    for (size_t i = 0; i<ncolumns; ++i) lengths[i] = (uint64_t)len[i];
+
+    int error = 0;
+    error |= fwrite("COFFEBIN", 1, 8, data) != 8;
+    error |= write_little_endian(data, info, sizeof(uint64_t), 3);
+    error |= write_little_endian(data, lengths, sizeof(uint64_t), ncolumns);
+    free(lengths);
+
+    /* the text header, then zeros up to the data */
+    size_t offset = 8 + sizeof(uint64_t)*(3 + ncolumns);
+    error |= fwrite(header != NULL ? header : "", 1, text_len, data) != text_len;
+    offset += text_len;
+    const size_t start = binary_data_offset(header, ncolumns);
+    for (; offset<start; ++offset){
+        error |= fputc(0, data) == EOF;
+    }
+    return error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+/**
+    writes <len> doubles <values> to <data> as (part of) a binary column
+**/
+
+int write_binary_column(
+    FILE *data,
+    const double *values,
+    size_t len
+)
+{
+    return write_little_endian(data, values, sizeof(double), len);
+}
+
+
+/**
+    writes <ncolumns> columns <values>, the i-th one having length <len[i]>,
+    into file <filename> in the binary format of COFFE:
+    the magic "COFFEBIN", then as uint64 the version, the number of columns,
+    the length of the text header (padded) and the lengths of all the columns,
+    then the text <header>, and from the next multiple of
+    COFFE_BINARY_ALIGNMENT bytes the columns one after another as doubles;
+    all little endian, so the columns can be memory mapped directly
+**/
+
+int write_binary(
+    char *filename,
+    const char *header,
+    size_t ncolumns,
+    const size_t *len,
+    double **values
+)
+{
+    FILE *data = fopen(filename, "wb");
+    if (data == NULL){
+        print_error_verbose(PROG_OPEN_ERROR, filename);
+        return EXIT_FAILURE;
+    }
+    /* the columns are written in one go each */
+    setvbuf(data, NULL, _IOFBF, COFFE_OUTPUT_BUFFER);
+
+    int error = write_binary_header(data, header, ncolumns, len);
+
+    for (size_t i = 0; i<ncolumns; ++i){
+        error |= write_binary_column(data, values[i], len[i]);
+    }
+
+    error |= fclose(data);
+    if (error){
+        print_error_verbose(PROG_WRITE_ERROR, filename);
+        return EXIT_FAILURE;
     }
     return EXIT_SUCCESS;
 }
 
 
-int free_double_matrix(
-    double ***values,
+/**
+    checks whether <filename> is in the binary format of COFFE
+**/
+
+int is_binary(
+    char *filename
+)
+{
+    char magic[8];
+    FILE *data = fopen(filename, "rb");
+    if (data == NULL) return 0;
+    const int result =
+        fread(magic, 1, 8, data) == 8 && memcmp(magic, "COFFEBIN", 8) == 0;
+    fclose(data);
+    return result;
+}
+
+
+/**
+    converts the <len> little endian numbers of <size> bytes
+    at <values> to the byte order of the host, in place
+**/
+
+static void read_little_endian(
+    void *values,
+    size_t size,
     size_t len
 )
 {
-    *values = (double **)coffe_malloc(sizeof(double *)*len);
+    const uint16_t probe = 1;
+    if (*(const unsigned char *)&probe == 1) return;
+    unsigned char *bytes = (unsigned char *)values;
     for (size_t i = 0; i<len; ++i){
-        free((*values)[i]);
+        for (size_t j = 0; j<size/2; ++j){
+            const unsigned char temp = bytes[i*size + j];
+            bytes[i*size + j] = bytes[i*size + size - 1 - j];
+            bytes[i*size + size - 1 - j] = temp;
+        }
+    }
+}
+
+
+/**
+    memory maps the binary file <filename> (see write_binary) into <table>,
+    whose columns then point directly into the file; on big endian hosts
+    the mapping is private and converted in place
+**/
+
+int map_binary(
+    char *filename,
+    struct coffe_table_t *table
+)
+{
+    const uint16_t probe = 1;
+    const int little_endian = *(const unsigned char *)&probe == 1;
+
+    memset(table, 0, sizeof(struct coffe_table_t));
+    int descriptor = open(filename, O_RDONLY);
+    if (descriptor < 0){
+        print_error_verbose(PROG_OPEN_ERROR, filename);
+        return EXIT_FAILURE;
+    }
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || status.st_size < 32){
+        close(descriptor);
+        print_error_verbose(PROG_READ_ERROR, filename);
+        return EXIT_FAILURE;
+    }
+    table->size = (size_t)status.st_size;
+    table->mapping = mmap(
+        NULL, table->size,
+        little_endian ? PROT_READ : PROT_READ | PROT_WRITE,
+        MAP_PRIVATE, descriptor, 0
+    );
+    close(descriptor);
+    if (table->mapping == MAP_FAILED){
+        table->mapping = NULL;
+        print_error_verbose(PROG_READ_ERROR, filename);
+        return EXIT_FAILURE;
+    }
+
+    /* the magic, then the version, the number of columns and the text length */
+    unsigned char *bytes = (unsigned char *)table->mapping;
+    uint64_t info[3];
+    memcpy(info, bytes + 8, sizeof(info));
+    read_little_endian(info, sizeof(uint64_t), 3);
+    if (
+        memcmp(bytes, "COFFEBIN", 8) != 0 ||
+        info[0] != COFFE_BINARY_VERSION ||
+        info[1] == 0 ||
+        8 + sizeof(uint64_t)*(3 + info[1]) + info[2] > table->size
+    ){
+        print_error_verbose(PROG_READ_ERROR, filename);
+        unmap_binary(table);
+        return EXIT_FAILURE;
+    }
+    table->ncolumns = (size_t)info[1];
+
+    uint64_t *lengths = (uint64_t *)coffe_malloc(sizeof(uint64_t)*table->ncolumns);
+    memcpy(lengths, bytes + 8 + 3*sizeof(uint64_t), sizeof(uint64_t)*table->ncolumns);
+    read_little_endian(lengths, sizeof(uint64_t), table->ncolumns);
+
+    size_t offset = 8 + sizeof(uint64_t)*(3 + table->ncolumns) + (size_t)info[2];
+    offset = (offset + COFFE_BINARY_ALIGNMENT - 1)
+        /COFFE_BINARY_ALIGNMENT*COFFE_BINARY_ALIGNMENT;
+
+    table->len = (size_t *)coffe_malloc(sizeof(size_t)*table->ncolumns);
+    table->columns = (double **)coffe_malloc(sizeof(double *)*table->ncolumns);
+    for (size_t i = 0; i<table->ncolumns; ++i){
+        table->len[i] = (size_t)lengths[i];
+        table->columns[i] = (double *)(bytes + offset);
+        offset += sizeof(double)*table->len[i];
+    }
+    free(lengths);
+
+    if (offset > table->size){
+        print_error_verbose(PROG_READ_ERROR, filename);
+        unmap_binary(table);
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i<table->ncolumns; ++i){
+        read_little_endian(table->columns[i], sizeof(double), table->len[i]);
+    }
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    releases the mapping of <table>; the columns are invalid afterwards
+**/
+
+int unmap_binary(
+    struct coffe_table_t *table
+)
+{
+    int error = 0;
+    if (table->mapping != NULL){
+        error = munmap(table->mapping, table->size);
+    }
+    free(table->len);
+    free(table->columns);
+    memset(table, 0, sizeof(struct coffe_table_t));
+    return error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+/**
+    converts the text table <input> (columns separated by any of ",\t: ",
+    lines starting with # are comments and kept as the header)
+    into the binary file <output>, so it can be memory mapped when read
+**/
+
+int convert_binary(
+    char *input,
+    char *output
+)
+{
+    FILE *data = fopen(input, "r");
+    if (data == NULL){
+        print_error_verbose(PROG_OPEN_ERROR, input);
+        return EXIT_FAILURE;
+    }
+
+    char temp_string[COFFE_MAX_STRLEN];
+    char *header = (char *)coffe_malloc(sizeof(char));
+    header[0] = '\0';
+    size_t header_len = 0, ncolumns = 0, rows = 0, capacity = 0;
+    double *values = NULL;
+
+    while (fgets(temp_string, COFFE_MAX_STRLEN, data) != NULL){
+        if (temp_string[0] == '#'){
+            header_len += strlen(temp_string);
+            header = (char *)realloc(header, header_len + 1);
+            if (header == NULL){
+                print_error(PROG_ALLOC_ERROR);
+                exit(EXIT_FAILURE);
+            }
+            strcat(header, temp_string);
+            continue;
+        }
+        double row[COFFE_MAX_ALLOCABLE];
+        size_t counter = 0;
+        for (
+            char *temp_token = strtok(temp_string, ",\t: \n");
+            temp_token != NULL && counter < COFFE_MAX_ALLOCABLE;
+            temp_token = strtok(NULL, ",\t: \n")
+        ){
+            row[counter++] = atof(temp_token);
+        }
+        if (counter == 0) continue;
+        if (ncolumns == 0) ncolumns = counter;
+        if (counter != ncolumns){
+            fprintf(
+                stderr,
+                "ERROR: line %zu of %s has %zu columns instead of %zu!\n",
+                rows + 1, input, counter, ncolumns
+            );
+            fclose(data);
+            free(header);
+            free(values);
+            return EXIT_FAILURE;
+        }
+        if (rows == capacity){
+            capacity = capacity ? 2*capacity : 1024;
+            values = (double *)realloc(values, sizeof(double)*ncolumns*capacity);
+            if (values == NULL){
+                print_error(PROG_ALLOC_ERROR);
+                exit(EXIT_FAILURE);
+            }
+        }
+        memcpy(&values[ncolumns*rows], row, sizeof(double)*ncolumns);
+        ++rows;
+    }
+    fclose(data);
+
+    if (rows == 0){
+        print_error_verbose(PROG_READ_ERROR, input);
+        free(header);
+        return EXIT_FAILURE;
+    }
+
+    /* the rows are read one by one, the file stores columns */
+    double **columns = (double **)coffe_malloc(sizeof(double *)*ncolumns);
+    size_t *len = (size_t *)coffe_malloc(sizeof(size_t)*ncolumns);
+    for (size_t j = 0; j<ncolumns; ++j){
+        columns[j] = (double *)coffe_malloc(sizeof(double)*rows);
+        len[j] = rows;
+        for (size_t i = 0; i<rows; ++i){
+            columns[j][i] = values[ncolumns*i + j];
+        }
+    }
+    free(values);
+
+    int error = write_binary(output, header, ncolumns, len, columns);
+
+    for (size_t j = 0; j<ncolumns; ++j){
+        free(columns[j]);
+    }
+    free(columns);
+    free(len);
+    free(header);
+    return error;
+}
+
+
+/**
+    creates and opens (for writing) a new temporary file next to <filename>,
+    storing its name in <temp> (of <size> bytes), so that the file can be
+    written in full and then renamed to <filename>; the name is unique
+    (mkstemp), so concurrent processes never write into the same one
+**/
+
+FILE *open_temporary(
+    const char *filename,
+    char *temp,
+    size_t size
+)
+{
+    if ((size_t)snprintf(temp, size, "%s.XXXXXX", filename) >= size) return NULL;
+    const int fd = mkstemp(temp);
+    if (fd == -1) return NULL;
+    /* mkstemp only allows the owner to read, unlike the usual files */
+    fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    FILE *file = fdopen(fd, "wb");
+    if (file == NULL){
+        close(fd);
+        remove(temp);
+    }
+    return file;
+}
+
+
+
+
+/**
+    allocates a contiguous <len1>x<len2> matrix, aligned to a cache line,
+    with element (i, j) at values[i*len2 + j]; freed with free()
+**/
+
+int alloc_double_matrix(
+    double **values,
+    size_t len1,
+    size_t len2
+)
+{
+    /* the size has to be a multiple of the alignment */
+    const size_t size = sizeof(double)*len1*len2;
+    const size_t aligned =
+        (size + COFFE_CACHELINE - 1)/COFFE_CACHELINE*COFFE_CACHELINE;
+    void *memory = NULL;
+    if (posix_memalign(&memory, COFFE_CACHELINE, aligned > 0 ? aligned : COFFE_CACHELINE) != 0){
+        print_error(PROG_ALLOC_ERROR);
+        exit(EXIT_FAILURE);
     }
-    free(*values);
+    *values = (double *)memory;
     return EXIT_SUCCESS;
 }
 
 
 int copy_matrix_array(
     double **destination,
-    double **source,
+    const double *source,
     size_t rows,
     size_t columns,
     size_t index,
@@ -463,8 +924,7 @@ int copy_matrix_array(
             print_error(PROG_FAIL);
             exit(EXIT_FAILURE);
         }
-        for (size_t i = 0; i<columns; ++i)
-            (*destination)[i] = source[index][i];
+        memcpy(*destination, &source[index*columns], sizeof(double)*columns);
     }
     else if (strcmp(type, "column") == 0){
         *destination = (double *)coffe_malloc(sizeof(double)*rows);
@@ -473,13 +933,55 @@ int copy_matrix_array(
             exit(EXIT_FAILURE);
         }
         for (size_t i = 0; i<rows; ++i)
-            (*destination)[i] = source[i][index];
+            (*destination)[i] = source[i*columns + index];
     }
 
     return EXIT_SUCCESS;
 }
 
 
+/**
+    allocates one (reset) lookup accelerator per thread, each in a cache line
+    of its own, and stores their number in <len>; freed with free()
+**/
+
+static union coffe_accel *coffe_accel_alloc(int *len)
+{
+#ifdef _OPENMP
+    *len = omp_get_max_threads();
+#else
+    *len = 1;
+#endif
+    /* the padding only keeps the threads apart if the array starts on a cache line */
+    void *memory = NULL;
+    if (posix_memalign(&memory, COFFE_CACHELINE, sizeof(union coffe_accel)*(*len)) != 0){
+        print_error(PROG_ALLOC_ERROR);
+        exit(EXIT_FAILURE);
+    }
+    union coffe_accel *accel = (union coffe_accel *)memory;
+    for (int i = 0; i<*len; ++i){
+        gsl_interp_accel_reset(&accel[i].accel);
+    }
+    return accel;
+}
+
+
+/**
+    the accelerator belonging to the calling thread;
+    threads without one fall back to a binary search
+**/
+
+static gsl_interp_accel *coffe_accel_get(union coffe_accel *accel, int len)
+{
+#ifdef _OPENMP
+    const int thread = omp_get_thread_num();
+#else
+    const int thread = 0;
+#endif
+    return thread < len ? &accel[thread].accel : NULL;
+}
+
+
 int init_spline(
     struct coffe_interpolation *interp,
     double *xi,
@@ -529,7 +1031,7 @@ int init_spline(
     interp->spline
         = gsl_spline_alloc(T, bins);
     interp->accel
-        = gsl_interp_accel_alloc();
+        = coffe_accel_alloc(&interp->accel_len);
     gsl_spline_init(interp->spline, xi, yi, bins);
     return EXIT_SUCCESS;
 }
@@ -540,37 +1042,1492 @@ int free_spline(
 )
 {
     gsl_spline_free(interp->spline);
-    gsl_interp_accel_free(interp->accel);
+    free(interp->accel);
     if (interp->spline != NULL) interp->spline = NULL;
     if (interp->accel != NULL) interp->accel = NULL;
+    interp->accel_len = 0;
     return EXIT_SUCCESS;
 }
 
 
-int coffe_compare_ascending(
-    const void *a,
-    const void *b
+/**
+    bicubic interpolation of <zi> on the grid <xi> x <yi>
+**/
+
+int init_spline2d(
+    struct coffe_interpolation2d *interp,
+    double *xi,
+    double *yi,
+    double *zi,
+    size_t xbins,
+    size_t ybins
 )
 {
-    if (*(double *)a > *(double *)b) return 1;
-    else if (*(double *)a < *(double *)b) return -1;
-    else return 0;
+    if (xbins <= 0 || ybins <= 0){
+        print_error(PROG_VALUE_ERROR);
+        exit(EXIT_FAILURE);
+    }
+    interp->spline
+        = gsl_spline2d_alloc(gsl_interp2d_bicubic, xbins, ybins);
+    interp->xaccel
+        = coffe_accel_alloc(&interp->accel_len);
+    interp->yaccel
+        = coffe_accel_alloc(&interp->accel_len);
+    gsl_spline2d_init(interp->spline, xi, yi, zi, xbins, ybins);
+    return EXIT_SUCCESS;
 }
 
-int coffe_compare_descending(
-    const void *a,
-    const void *b
+
+int free_spline2d(
+    struct coffe_interpolation2d *interp
 )
 {
-    if (*(double *)a > *(double *)b) return -1;
-    else if (*(double *)a < *(double *)b) return 1;
-    else return 0;
+    gsl_spline2d_free(interp->spline);
+    free(interp->xaccel);
+    free(interp->yaccel);
+    interp->spline = NULL;
+    interp->xaccel = NULL;
+    interp->yaccel = NULL;
+    interp->accel_len = 0;
+    return EXIT_SUCCESS;
 }
 
 
-
 /**
-    function describing w(z)
+    tabulates the splines <interp> as cubic polynomials on <len>
+    uniform intervals between <xmin> and <xmax>; each cubic matches
+    its spline at four points of the interval, so splines whose
+    knots coincide with the grid are reproduced exactly
+**/
+
+int init_uniform_table(
+    struct coffe_uniform_table *table,
+    struct coffe_interpolation *interp[],
+    size_t fields,
+    double xmin,
+    double xmax,
+    size_t len
+)
+{
+    if (len == 0 || fields == 0 || xmax <= xmin){
+        print_error(PROG_VALUE_ERROR);
+        exit(EXIT_FAILURE);
+    }
+    table->xmin = xmin;
+    table->xmax = xmax;
+    table->inv_dx = len/(xmax - xmin);
+    table->len = len;
+    table->fields = fields;
+    table->coeffs = (double *)coffe_malloc(sizeof(double)*4*fields*len);
+
+    const double dx = (xmax - xmin)/len;
+    for (size_t i = 0; i<len; ++i){
+        for (size_t j = 0; j<fields; ++j){
+            double y[4];
+            for (int k = 0; k<4; ++k){
+                /* the last point is evaluated explicitly at xmax to avoid roundoff */
+                y[k] = interp_spline(
+                    interp[j],
+                    (i == len - 1 && k == 3) ? xmax : xmin + (i + k/3.)*dx
+                );
+            }
+            /* coefficients of the cubic through (0, y0), (1/3, y1), (2/3, y2), (1, y3) */
+            double *c = &table->coeffs[4*(i*fields + j)];
+            c[0] = y[0];
+            c[1] = (-11*y[0] + 18*y[1] - 9*y[2] + 2*y[3])/2.;
+            c[2] = 9*(2*y[0] - 5*y[1] + 4*y[2] - y[3])/2.;
+            c[3] = 9*(-y[0] + 3*y[1] - 3*y[2] + y[3])/2.;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    the GSL integration objects of one thread
+**/
+
+struct coffe_thread_workspace
+{
+    gsl_integration_workspace *integration;
+    gsl_rng *random;
+    void *monte[3][COFFE_MAX_MONTE_DIMS + 1];
+};
+
+static struct coffe_thread_workspace coffe_thread_workspace;
+#ifdef _OPENMP
+#pragma omp threadprivate(coffe_thread_workspace)
+#endif
+
+
+gsl_integration_workspace *coffe_workspace(void)
+{
+    if (coffe_thread_workspace.integration == NULL){
+        coffe_thread_workspace.integration =
+            gsl_integration_workspace_alloc(COFFE_MAX_INTSPACE);
+    }
+    return coffe_thread_workspace.integration;
+}
+
+
+gsl_rng *coffe_rng(void)
+{
+    if (coffe_thread_workspace.random == NULL){
+        #pragma omp critical(coffe_rng_setup)
+        gsl_rng_env_setup();
+        coffe_thread_workspace.random = gsl_rng_alloc(gsl_rng_default);
+    }
+    /* same stream as a freshly allocated generator, so the results stay reproducible */
+    gsl_rng_set(coffe_thread_workspace.random, gsl_rng_default_seed);
+    return coffe_thread_workspace.random;
+}
+
+
+void *coffe_monte_state(int method, size_t dims)
+{
+    if (method < 0 || method > 2 || dims == 0 || dims > COFFE_MAX_MONTE_DIMS){
+        print_error(PROG_VALUE_ERROR);
+        exit(EXIT_FAILURE);
+    }
+    void **state = &coffe_thread_workspace.monte[method][dims];
+    switch (method){
+        case 0:
+            if (*state == NULL) *state = gsl_monte_plain_alloc(dims);
+            else gsl_monte_plain_init((gsl_monte_plain_state *)*state);
+            break;
+        case 1:
+            if (*state == NULL) *state = gsl_monte_miser_alloc(dims);
+            else gsl_monte_miser_init((gsl_monte_miser_state *)*state);
+            break;
+        default:
+            if (*state == NULL) *state = gsl_monte_vegas_alloc(dims);
+            else gsl_monte_vegas_init((gsl_monte_vegas_state *)*state);
+            break;
+    }
+    return *state;
+}
+
+
+void coffe_workspace_free(void)
+{
+    if (coffe_thread_workspace.integration != NULL){
+        gsl_integration_workspace_free(coffe_thread_workspace.integration);
+    }
+    if (coffe_thread_workspace.random != NULL){
+        gsl_rng_free(coffe_thread_workspace.random);
+    }
+    for (size_t dims = 0; dims<=COFFE_MAX_MONTE_DIMS; ++dims){
+        if (coffe_thread_workspace.monte[0][dims] != NULL){
+            gsl_monte_plain_free(coffe_thread_workspace.monte[0][dims]);
+        }
+        if (coffe_thread_workspace.monte[1][dims] != NULL){
+            gsl_monte_miser_free(coffe_thread_workspace.monte[1][dims]);
+        }
+        if (coffe_thread_workspace.monte[2][dims] != NULL){
+            gsl_monte_vegas_free(coffe_thread_workspace.monte[2][dims]);
+        }
+    }
+    memset(&coffe_thread_workspace, 0, sizeof(coffe_thread_workspace));
+}
+
+
+/* the counters of one thread */
+struct coffe_profile_counters
+{
+    unsigned long long count[COFFE_COUNT_EVENTS];
+    double busy[COFFE_PROFILE_CLASSES];
+};
+
+/* the counters padded to whole cache lines, so the threads never share one */
+union coffe_profile_thread
+{
+    struct coffe_profile_counters value;
+    char padding[
+        (sizeof(struct coffe_profile_counters) + COFFE_CACHELINE - 1)
+       /COFFE_CACHELINE*COFFE_CACHELINE
+    ];
+};
+
+static struct
+{
+    double wall[COFFE_PROFILE_STAGES], cpu[COFFE_PROFILE_STAGES];
+    double wall_start[COFFE_PROFILE_STAGES];
+    clock_t cpu_start[COFFE_PROFILE_STAGES];
+    int runs[COFFE_PROFILE_STAGES], running[COFFE_PROFILE_STAGES];
+    union coffe_profile_thread *thread;
+    int threads;
+} coffe_profile;
+
+
+static int coffe_profile_thread_num(void)
+{
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+
+void coffe_profile_init(int nthreads)
+{
+    free(coffe_profile.thread);
+    memset(&coffe_profile, 0, sizeof(coffe_profile));
+    coffe_profile.threads = nthreads > 0 ? nthreads : 1;
+    /* the padding only keeps the threads apart if the array starts on a cache line */
+    void *memory = NULL;
+    if (posix_memalign(
+            &memory, COFFE_CACHELINE,
+            sizeof(union coffe_profile_thread)*coffe_profile.threads
+        ) != 0){
+        print_error(PROG_ALLOC_ERROR);
+        exit(EXIT_FAILURE);
+    }
+    coffe_profile.thread = (union coffe_profile_thread *)memory;
+    memset(
+        coffe_profile.thread, 0,
+        sizeof(union coffe_profile_thread)*coffe_profile.threads
+    );
+}
+
+
+double coffe_profile_time(void)
+{
+#ifdef _OPENMP
+    return omp_get_wtime();
+#else
+    return (double)clock()/CLOCKS_PER_SEC;
+#endif
+}
+
+
+void coffe_profile_start(int stage)
+{
+    coffe_profile.wall_start[stage] = coffe_profile_time();
+    coffe_profile.cpu_start[stage] = clock();
+    coffe_profile.running[stage] = 1;
+}
+
+
+double coffe_profile_stop(int stage)
+{
+    const double wall = coffe_profile_time() - coffe_profile.wall_start[stage];
+    if (coffe_profile.running[stage]){
+        coffe_profile.wall[stage] += wall;
+        coffe_profile.cpu[stage] +=
+            (double)(clock() - coffe_profile.cpu_start[stage])/CLOCKS_PER_SEC;
+        ++coffe_profile.runs[stage];
+        coffe_profile.running[stage] = 0;
+    }
+    return wall;
+}
+
+
+void coffe_profile_task(int kind, double start)
+{
+    const int thread = coffe_profile_thread_num();
+    if (thread < coffe_profile.threads){
+        coffe_profile.thread[thread].value.busy[kind] += coffe_profile_time() - start;
+    }
+}
+
+
+#if COFFE_PROFILE
+void coffe_profile_count(int event)
+{
+    const int thread = coffe_profile_thread_num();
+    if (thread < coffe_profile.threads){
+        ++coffe_profile.thread[thread].value.count[event];
+    }
+}
+
+
+void coffe_profile_count_n(int event, size_t n)
+{
+    const int thread = coffe_profile_thread_num();
+    if (thread < coffe_profile.threads){
+        coffe_profile.thread[thread].value.count[event] += n;
+    }
+}
+#endif
+
+
+int coffe_profile_write(char *filename)
+{
+    const char *stages[COFFE_PROFILE_STAGES] = {
+        "parser", "class", "background", "integrals", "corrfunc",
+        "multipoles", "average_multipoles", "covariance", "output", "total"
+    };
+    const char *classes[COFFE_PROFILE_CLASSES] = {
+        "nonintegrated", "single_integrated", "double_integrated"
+    };
+
+    FILE *data = fopen(filename, "w");
+    if (data == NULL){
+        print_error_verbose(PROG_OPEN_ERROR, filename);
+        return EXIT_FAILURE;
+    }
+
+    /* stages still running (the total, say) are reported up to now */
+    fprintf(data, "{\n    \"version\": \"%s\",\n", COFFE_VERSION_STRING);
+    fprintf(data, "    \"threads\": %d,\n", coffe_profile.threads);
+    fprintf(data, "    \"stages\": {\n");
+    int first = 1;
+    for (int i = 0; i<COFFE_PROFILE_STAGES; ++i){
+        double wall = coffe_profile.wall[i], cpu = coffe_profile.cpu[i];
+        int runs = coffe_profile.runs[i];
+        if (coffe_profile.running[i]){
+            wall += coffe_profile_time() - coffe_profile.wall_start[i];
+            cpu += (double)(clock() - coffe_profile.cpu_start[i])/CLOCKS_PER_SEC;
+            ++runs;
+        }
+        if (runs == 0) continue;
+        fprintf(data,
+            "%s        \"%s\": {\"wall\": %.6f, \"cpu\": %.6f, \"runs\": %d}",
+            first ? "" : ",\n", stages[i], wall, cpu, runs
+        );
+        first = 0;
+    }
+    fprintf(data, "\n    },\n");
+
+    unsigned long long count[COFFE_COUNT_EVENTS] = {0};
+    double busy[COFFE_PROFILE_CLASSES] = {0};
+    for (int t = 0; t<coffe_profile.threads; ++t){
+        for (int i = 0; i<COFFE_COUNT_EVENTS; ++i){
+            count[i] += coffe_profile.thread[t].value.count[i];
+        }
+        for (int i = 0; i<COFFE_PROFILE_CLASSES; ++i){
+            busy[i] += coffe_profile.thread[t].value.busy[i];
+        }
+    }
+
+    /* the thread time is summed over all the threads; the calls are only counted with COFFE_PROFILE */
+    fprintf(data, "    \"contributions\": {\n");
+    for (int i = 0; i<COFFE_PROFILE_CLASSES; ++i){
+#if COFFE_PROFILE
+        fprintf(data,
+            "        \"%s\": {\"thread_time\": %.6f, \"integrand_calls\": %llu}%s\n",
+            classes[i], busy[i], count[i], i + 1 < COFFE_PROFILE_CLASSES ? "," : ""
+        );
+#else
+        fprintf(data,
+            "        \"%s\": {\"thread_time\": %.6f}%s\n",
+            classes[i], busy[i], i + 1 < COFFE_PROFILE_CLASSES ? "," : ""
+        );
+#endif
+    }
+#if COFFE_PROFILE
+    fprintf(data, "    },\n");
+    fprintf(data, "    \"interpolation_calls\": %llu\n}\n",
+        count[COFFE_COUNT_INTERPOLATION]
+    );
+#else
+    fprintf(data, "    }\n}\n");
+#endif
+
+    if (fclose(data)){
+        print_error_verbose(PROG_WRITE_ERROR, filename);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+
+void coffe_profile_free(void)
+{
+    free(coffe_profile.thread);
+    coffe_profile.thread = NULL;
+    coffe_profile.threads = 0;
+}
+
+
+#ifdef HAVE_MPI
+/* if MPI is not initialized (a library which never called coffe_mpi_init), there's one process */
+static int coffe_mpi_active(void)
+{
+    int initialized = 0, finalized = 0;
+    MPI_Initialized(&initialized);
+    MPI_Finalized(&finalized);
+    return initialized && !finalized;
+}
+#endif
+
+
+int coffe_mpi_init(int *argc, char ***argv)
+{
+#ifdef HAVE_MPI
+    int provided;
+    MPI_Init_thread(argc, argv, MPI_THREAD_SERIALIZED, &provided);
+    if (provided < MPI_THREAD_SERIALIZED){
+        fprintf(stderr,
+            "ERROR: the MPI library does not support MPI_THREAD_SERIALIZED!\n");
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+#else
+    (void)argc;
+    (void)argv;
+#endif
+    return EXIT_SUCCESS;
+}
+
+
+int coffe_mpi_finalize(void)
+{
+#ifdef HAVE_MPI
+    if (coffe_mpi_active()) MPI_Finalize();
+#endif
+    return EXIT_SUCCESS;
+}
+
+
+int coffe_mpi_rank(void)
+{
+    int rank = 0;
+#ifdef HAVE_MPI
+    if (coffe_mpi_active()) MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+#endif
+    return rank;
+}
+
+
+int coffe_mpi_size(void)
+{
+    int size = 1;
+#ifdef HAVE_MPI
+    if (coffe_mpi_active()) MPI_Comm_size(MPI_COMM_WORLD, &size);
+#endif
+    return size;
+}
+
+
+int coffe_mpi_sum(double *values, size_t len)
+{
+#ifdef HAVE_MPI
+    if (coffe_mpi_size() == 1) return EXIT_SUCCESS;
+    /* the counts of MPI are ints */
+    for (size_t start = 0; start<len; start += INT_MAX){
+        const size_t count = len - start < INT_MAX ? len - start : INT_MAX;
+        if (MPI_Allreduce(
+            MPI_IN_PLACE, values + start, (int)count,
+            MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD
+        ) != MPI_SUCCESS) return EXIT_FAILURE;
+    }
+#else
+    (void)values;
+    (void)len;
+#endif
+    return EXIT_SUCCESS;
+}
+
+
+int coffe_mpi_broadcast(void *values, size_t size)
+{
+#ifdef HAVE_MPI
+    if (coffe_mpi_size() == 1) return EXIT_SUCCESS;
+    for (size_t start = 0; start<size; start += INT_MAX){
+        const size_t count = size - start < INT_MAX ? size - start : INT_MAX;
+        if (MPI_Bcast(
+            (char *)values + start, (int)count,
+            MPI_BYTE, 0, MPI_COMM_WORLD
+        ) != MPI_SUCCESS) return EXIT_FAILURE;
+    }
+#else
+    (void)values;
+    (void)size;
+#endif
+    return EXIT_SUCCESS;
+}
+
+
+int coffe_mpi_barrier(void)
+{
+#ifdef HAVE_MPI
+    if (coffe_mpi_size() == 1) return EXIT_SUCCESS;
+    if (MPI_Barrier(MPI_COMM_WORLD) != MPI_SUCCESS) return EXIT_FAILURE;
+#endif
+    return EXIT_SUCCESS;
+}
+
+
+int coffe_mpi_counter_init(struct coffe_mpi_counter_t *counter, size_t len)
+{
+    counter->value = 0;
+    counter->len = len;
+    counter->exhausted = (len == 0);
+#ifdef HAVE_MPI
+    counter->base = NULL;
+    counter->distributed = coffe_mpi_size() > 1;
+    if (counter->distributed){
+        /* the counter lives in the first process */
+        const int rank = coffe_mpi_rank();
+        MPI_Win_allocate(
+            rank == 0 ? sizeof(unsigned long) : 0, sizeof(unsigned long),
+            MPI_INFO_NULL, MPI_COMM_WORLD, &counter->base, &counter->window
+        );
+        if (rank == 0){
+            MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, counter->window);
+            *counter->base = 0;
+            MPI_Win_unlock(0, counter->window);
+        }
+        MPI_Barrier(MPI_COMM_WORLD);
+    }
+#endif
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    adds <amount> to <counter> (in whichever process it lives),
+    returns its value before
+**/
+
+static unsigned long coffe_mpi_counter_fetch_add(
+    struct coffe_mpi_counter_t *counter,
+    unsigned long amount
+)
+{
+    unsigned long previous;
+#ifdef HAVE_MPI
+    if (counter->distributed){
+        /* one thread at a time talks to MPI */
+        #pragma omp critical (coffe_mpi)
+        {
+            MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, counter->window);
+            MPI_Fetch_and_op(
+                &amount, &previous, MPI_UNSIGNED_LONG, 0, 0, MPI_SUM, counter->window
+            );
+            MPI_Win_unlock(0, counter->window);
+        }
+        return previous;
+    }
+#endif
+    #pragma omp atomic capture
+    {
+        previous = counter->value;
+        counter->value += amount;
+    }
+    return previous;
+}
+
+
+size_t coffe_mpi_counter_next(struct coffe_mpi_counter_t *counter)
+{
+    int exhausted;
+    #pragma omp atomic read
+    exhausted = counter->exhausted;
+    if (exhausted) return counter->len;
+
+    const unsigned long next = coffe_mpi_counter_fetch_add(counter, 1);
+
+    if (next >= counter->len){
+        #pragma omp atomic write
+        counter->exhausted = 1;
+        return counter->len;
+    }
+    return next;
+}
+
+
+size_t coffe_mpi_counter_add(struct coffe_mpi_counter_t *counter, size_t amount)
+{
+    return coffe_mpi_counter_fetch_add(counter, amount) + amount;
+}
+
+
+int coffe_mpi_counter_free(struct coffe_mpi_counter_t *counter)
+{
+#ifdef HAVE_MPI
+    if (counter->distributed) MPI_Win_free(&counter->window);
+    counter->distributed = 0;
+    counter->base = NULL;
+#endif
+    counter->len = 0;
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    sets up the tensor Gauss-Legendre rule in <dims> dimensions
+    using (about) <calls> points in total
+**/
+
+int init_gauss_rule(
+    struct coffe_gauss_rule *rule,
+    size_t dims,
+    size_t calls,
+    size_t mu_dim,
+    const int *l,
+    size_t l_len
+)
+{
+    if (dims == 0 || mu_dim >= dims){
+        print_error(PROG_VALUE_ERROR);
+        exit(EXIT_FAILURE);
+    }
+    rule->dims = dims;
+    rule->mu_dim = mu_dim;
+    rule->order = (size_t)floor(pow((double)calls, 1./dims) + 1e-6);
+    if (rule->order < 2) rule->order = 2;
+
+    rule->x = (double *)coffe_malloc(sizeof(double)*rule->order);
+    rule->w = (double *)coffe_malloc(sizeof(double)*rule->order);
+    gsl_integration_glfixed_table *table =
+        gsl_integration_glfixed_table_alloc(rule->order);
+    for (size_t i = 0; i<rule->order; ++i){
+        gsl_integration_glfixed_point(0., 1., i, &rule->x[i], &rule->w[i], table);
+    }
+    gsl_integration_glfixed_table_free(table);
+
+    rule->l_len = l_len;
+    rule->l = NULL;
+    rule->legendre = NULL;
+    if (l_len > 0){
+        rule->l = (int *)coffe_malloc(sizeof(int)*l_len);
+        rule->legendre = (double *)coffe_malloc(sizeof(double)*l_len*rule->order);
+        for (size_t j = 0; j<l_len; ++j){
+            rule->l[j] = l[j];
+        }
+        double *mu = (double *)coffe_malloc(sizeof(double)*rule->order);
+        for (size_t i = 0; i<rule->order; ++i){
+            mu[i] = 2*rule->x[i] - 1;
+        }
+        coffe_legendre_array(l, l_len, mu, rule->order, rule->legendre);
+        free(mu);
+    }
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    integrates <integrand> over [0, 1]^dims with the tensor rule;
+    if <weight> is not NULL, the integrand at node n of the dimension
+    mu_dim is multiplied by weight[n]
+**/
+
+double integrate_gauss(
+    const struct coffe_gauss_rule *rule,
+    gsl_monte_function *integrand,
+    const double *weight
+)
+{
+    const size_t dims = rule->dims;
+    size_t index[dims];
+    double x[dims];
+    for (size_t d = 0; d<dims; ++d) index[d] = 0;
+
+    double result = 0;
+    while (1){
+        double w = 1;
+        for (size_t d = 0; d<dims; ++d){
+            x[d] = rule->x[index[d]];
+            w *= rule->w[index[d]];
+        }
+        if (weight != NULL) w *= weight[index[rule->mu_dim]];
+        result += w*integrand->f(x, dims, integrand->params);
+
+        /* next node of the tensor product */
+        size_t d = 0;
+        while (d < dims && ++index[d] == rule->order){
+            index[d] = 0;
+            ++d;
+        }
+        if (d == dims) break;
+    }
+    return result;
+}
+
+
+/**
+    integrates <integrand> over [0, 1]^dim with <calls> points of a Sobol sequence;
+    the first point (the origin) is skipped, as it lies on the boundary
+**/
+
+double integrate_qmc(
+    gsl_monte_function *integrand,
+    size_t calls
+)
+{
+    gsl_qrng *sequence = gsl_qrng_alloc(gsl_qrng_sobol, integrand->dim);
+    double x[integrand->dim];
+    gsl_qrng_get(sequence, x);
+
+    double result = 0;
+    for (size_t i = 0; i<calls; ++i){
+        gsl_qrng_get(sequence, x);
+        result += integrand->f(x, integrand->dim, integrand->params);
+    }
+    gsl_qrng_free(sequence);
+    return calls > 0 ? result/calls : 0;
+}
+
+
+/**
+    P_l[i](mu) for all the <len> multipoles <l>, from a single recurrence
+**/
+
+void coffe_legendre(
+    const int *l,
+    size_t len,
+    double mu,
+    double *result
+)
+{
+    int lmax = 0;
+    for (size_t i = 0; i<len; ++i){
+        if (l[i] > lmax) lmax = l[i];
+    }
+    double previous = 0, current = 1;
+    for (int n = 0; n<=lmax; ++n){
+        for (size_t i = 0; i<len; ++i){
+            if (l[i] == n) result[i] = current;
+        }
+        const double next = ((2*n + 1)*mu*current - n*previous)/(n + 1);
+        previous = current;
+        current = next;
+    }
+}
+
+
+/**
+    P_l[i](mu[m]) for all the <len> multipoles <l> and <n> points <mu>,
+    stored at result[i*n + m]; the same recurrence as coffe_legendre,
+    but over all the points at once, so the inner loops vectorize
+**/
+
+void coffe_legendre_array(
+    const int *l,
+    size_t len,
+    const double *mu,
+    size_t n,
+    double *result
+)
+{
+    int lmax = 0;
+    for (size_t i = 0; i<len; ++i){
+        if (l[i] > lmax) lmax = l[i];
+    }
+    double previous[COFFE_NVEC], current[COFFE_NVEC];
+    for (size_t start = 0; start<n; start += COFFE_NVEC){
+        const size_t size = start + COFFE_NVEC <= n ? COFFE_NVEC : n - start;
+        for (size_t m = 0; m<size; ++m){
+            previous[m] = 0;
+            current[m] = 1;
+        }
+        for (int degree = 0; degree<=lmax; ++degree){
+            for (size_t i = 0; i<len; ++i){
+                if (l[i] == degree){
+                    memcpy(&result[i*n + start], current, sizeof(double)*size);
+                }
+            }
+            for (size_t m = 0; m<size; ++m){
+                const double next =
+                    ((2*degree + 1)*mu[start + m]*current[m] - degree*previous[m])/(degree + 1);
+                previous[m] = current[m];
+                current[m] = next;
+            }
+        }
+    }
+}
+
+
+/**
+    the spherical Bessel functions j_l(x[q]) for l = 0, ..., <lmax> and
+    the <n> points <x>, stored at result[l*n + q]; the upward recurrence
+    from j_0 and j_1 runs over all the points at once, and the points
+    where it is unstable (x <= lmax) are redone with GSL
+**/
+
+void coffe_bessel_jl_array(
+    int lmax,
+    const double *x,
+    size_t n,
+    double *result
+)
+{
+    for (size_t q = 0; q<n; ++q){
+        const double inverse = 1./x[q], s = sin(x[q]), c = cos(x[q]);
+        result[q] = s*inverse;
+        if (lmax > 0) result[n + q] = (s*inverse - c)*inverse;
+    }
+    for (int degree = 1; degree<lmax; ++degree){
+        const double *previous = &result[(degree - 1)*n];
+        const double *current = &result[degree*n];
+        double *next = &result[(degree + 1)*n];
+        for (size_t q = 0; q<n; ++q){
+            next[q] = (2*degree + 1)/x[q]*current[q] - previous[q];
+        }
+    }
+
+    double jl[lmax + 1];
+    for (size_t q = 0; q<n; ++q){
+        if (x[q] <= lmax || x[q] < 1){
+            gsl_sf_bessel_jl_array(lmax, x[q], jl);
+            for (int degree = 0; degree<=lmax; ++degree){
+                result[degree*n + q] = jl[degree];
+            }
+        }
+    }
+}
+
+
+/**
+    integrates <integrand> over [0, 1]^dim with <calls> points
+    using the integration method <method> (see the settings file);
+    <rule> is used only by the Gauss-Legendre method
+**/
+
+double integrate_monte(
+    gsl_monte_function *integrand,
+    int method,
+    size_t calls,
+    const struct coffe_gauss_rule *rule,
+    double *error
+)
+{
+    const size_t dims = integrand->dim;
+    double lower[dims], upper[dims];
+    for (size_t i = 0; i<dims; ++i){
+        lower[i] = 0.0;
+        upper[i] = 1.0;
+    }
+    /* the deterministic methods have no error estimate of their own */
+    double result = 0, abserr = NAN;
+
+    switch (method){
+        case 0:
+            gsl_monte_plain_integrate(
+                integrand, lower, upper, dims, calls, coffe_rng(),
+                coffe_monte_state(0, dims), &result, &abserr
+            );
+            break;
+        case 1:
+            gsl_monte_miser_integrate(
+                integrand, lower, upper, dims, calls, coffe_rng(),
+                coffe_monte_state(1, dims), &result, &abserr
+            );
+            break;
+        case 2:
+            gsl_monte_vegas_integrate(
+                integrand, lower, upper, dims, calls, coffe_rng(),
+                coffe_monte_state(2, dims), &result, &abserr
+            );
+            break;
+        case 3:
+            result = integrate_qmc(integrand, calls);
+            break;
+        case 4:
+            result = integrate_gauss(rule, integrand, NULL);
+            break;
+        default:
+            break;
+    }
+    if (error != NULL) *error = abserr;
+    return result;
+}
+
+
+/**
+    whether integrate_multipoles can be used with the method <method>,
+    i.e. if all the points are fixed in advance
+**/
+
+int integrate_multipoles_available(int method)
+{
+    return method == 3 || method == 4;
+}
+
+
+/**
+    evaluates the integrand <params> (a gsl_monte_function) point by point,
+    so it can be used as a batched one
+**/
+
+static int integrate_points(
+    const double *x,
+    size_t n,
+    size_t dim,
+    void *params,
+    double *value
+)
+{
+    gsl_monte_function *integrand = (gsl_monte_function *)params;
+    for (size_t i = 0; i<n; ++i){
+        value[i] = integrand->f((double *)&x[i*dim], dim, integrand->params);
+    }
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    integrates <integrand> times P_l[i](2 x[mu_dim] - 1) over [0, 1]^dim
+    for all the <len> multipoles <l> at once, from one set of evaluations
+    of <integrand>; the Gauss-Legendre method uses the P_l tabulated by <rule>
+    (which must be for the same multipoles), the Sobol one computes them per point;
+    if <error> is not NULL, the Sobol one also estimates the error as the difference
+    to the result from the first half of the points, the Gauss-Legendre one sets NAN
+**/
+
+int integrate_multipoles(
+    gsl_monte_function *integrand,
+    int method,
+    size_t calls,
+    const struct coffe_gauss_rule *rule,
+    size_t mu_dim,
+    const int *l,
+    size_t len,
+    double *result,
+    double *error
+)
+{
+    const struct coffe_batch_function batch = {
+        &integrate_points, integrand->dim, integrand
+    };
+    return integrate_multipoles_batch(
+        &batch, method, calls, rule, mu_dim, l, len, result, error
+    );
+}
+
+
+/**
+    the buffers of the Sobol method, so that a sequence
+    can be continued over several calls of integrate_sobol_add
+**/
+
+struct integrate_sobol
+{
+    gsl_qrng *sequence;
+    double *x, *value, *mu, *legendre;
+};
+
+
+static void integrate_sobol_init(
+    struct integrate_sobol *sobol,
+    size_t dims,
+    size_t len
+)
+{
+    const size_t batch = COFFE_BATCH_LEN;
+    sobol->sequence = gsl_qrng_alloc(gsl_qrng_sobol, dims);
+    sobol->x = (double *)coffe_malloc(sizeof(double)*batch*dims);
+    sobol->value = (double *)coffe_malloc(sizeof(double)*batch);
+    sobol->mu = (double *)coffe_malloc(sizeof(double)*batch);
+    sobol->legendre = (double *)coffe_malloc(sizeof(double)*len*batch);
+    /* the first point (the origin) lies on the boundary */
+    gsl_qrng_get(sobol->sequence, sobol->x);
+}
+
+
+static void integrate_sobol_free(
+    struct integrate_sobol *sobol
+)
+{
+    gsl_qrng_free(sobol->sequence);
+    free(sobol->x);
+    free(sobol->value);
+    free(sobol->mu);
+    free(sobol->legendre);
+}
+
+
+/**
+    adds the integrand times P_l[i](2 x[mu_dim] - 1) at the next <calls>
+    points of the sequence to sum[i], in batches of (at most) COFFE_BATCH_LEN
+**/
+
+static void integrate_sobol_add(
+    struct integrate_sobol *sobol,
+    const struct coffe_batch_function *integrand,
+    size_t calls,
+    size_t mu_dim,
+    const int *l,
+    size_t len,
+    double *sum
+)
+{
+    const size_t dims = integrand->dim;
+    for (size_t start = 0; start<calls; start += COFFE_BATCH_LEN){
+        const size_t n = start + COFFE_BATCH_LEN < calls ? COFFE_BATCH_LEN : calls - start;
+        for (size_t m = 0; m<n; ++m){
+            gsl_qrng_get(sobol->sequence, &sobol->x[m*dims]);
+        }
+        integrand->f(sobol->x, n, dims, integrand->params, sobol->value);
+        for (size_t m = 0; m<n; ++m){
+            sobol->mu[m] = 2*sobol->x[m*dims + mu_dim] - 1;
+        }
+        coffe_legendre_array(l, len, sobol->mu, n, sobol->legendre);
+        for (size_t m = 0; m<n; ++m){
+            for (size_t i = 0; i<len; ++i){
+                sum[i] += sobol->value[m]*sobol->legendre[i*n + m];
+            }
+        }
+    }
+}
+
+
+/**
+    the same as integrate_multipoles, with the points fixed in advance
+    handed to <integrand> in batches of (at most) COFFE_BATCH_LEN
+**/
+
+int integrate_multipoles_batch(
+    const struct coffe_batch_function *integrand,
+    int method,
+    size_t calls,
+    const struct coffe_gauss_rule *rule,
+    size_t mu_dim,
+    const int *l,
+    size_t len,
+    double *result,
+    double *error
+)
+{
+    for (size_t i = 0; i<len; ++i) result[i] = 0;
+    for (size_t i = 0; i<len && error != NULL; ++i) error[i] = NAN;
+    if (!integrate_multipoles_available(method)) return EXIT_FAILURE;
+
+    const size_t dims = integrand->dim;
+
+    if (method == 4){
+        const size_t batch = COFFE_BATCH_LEN;
+        double *x = (double *)coffe_malloc(sizeof(double)*batch*dims);
+        double *value = (double *)coffe_malloc(sizeof(double)*batch);
+        double *weight = (double *)coffe_malloc(sizeof(double)*batch);
+        size_t *node = (size_t *)coffe_malloc(sizeof(size_t)*batch);
+        size_t index[dims];
+        for (size_t d = 0; d<dims; ++d) index[d] = 0;
+        int done = 0;
+        while (!done){
+            size_t n = 0;
+            while (n < batch && !done){
+                double w = 1;
+                for (size_t d = 0; d<dims; ++d){
+                    x[n*dims + d] = rule->x[index[d]];
+                    w *= rule->w[index[d]];
+                }
+                weight[n] = w;
+                node[n] = index[rule->mu_dim];
+                ++n;
+
+                size_t d = 0;
+                while (d < dims && ++index[d] == rule->order){
+                    index[d] = 0;
+                    ++d;
+                }
+                if (d == dims) done = 1;
+            }
+            integrand->f(x, n, dims, integrand->params, value);
+            for (size_t m = 0; m<n; ++m){
+                const double v = weight[m]*value[m];
+                for (size_t i = 0; i<len; ++i){
+                    result[i] += v*rule->legendre[i*rule->order + node[m]];
+                }
+            }
+        }
+        free(x);
+        free(value);
+        free(weight);
+        free(node);
+    }
+    else{
+        /* the error estimate is the difference to the result from the first half */
+        struct integrate_sobol sobol;
+        integrate_sobol_init(&sobol, dims, len);
+        double half[len];
+        integrate_sobol_add(&sobol, integrand, calls/2, mu_dim, l, len, result);
+        for (size_t i = 0; i<len; ++i) half[i] = result[i];
+        integrate_sobol_add(&sobol, integrand, calls - calls/2, mu_dim, l, len, result);
+        integrate_sobol_free(&sobol);
+        for (size_t i = 0; i<len && calls > 0; ++i) result[i] /= calls;
+        for (size_t i = 0; i<len && error != NULL && calls/2 > 0; ++i){
+            error[i] = fabs(result[i] - half[i]/(calls/2));
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    the effort of the first integration of a term: everything at once
+    with the relative precision <epsrel>, or, with integration_accuracy set,
+    only a cheap estimate which is refined later where needed
+**/
+
+struct coffe_effort coffe_effort_first(
+    const struct coffe_parameters_t *par,
+    double epsrel
+)
+{
+    struct coffe_effort effort;
+    effort.calls_max = (size_t)par->integration_bins;
+    effort.epsabs = 0;
+    effort.epsrel = epsrel;
+    if (par->integration_accuracy > 0){
+        effort.calls_max /= COFFE_ACCURACY_PILOT;
+        if (effort.calls_max == 0) effort.calls_max = 1;
+        effort.epsrel = par->integration_accuracy;
+    }
+    effort.calls_min = effort.calls_max;
+    return effort;
+}
+
+
+/**
+    the effort refining a term to the absolute error <epsabs>, starting over
+    at twice the evaluations of the estimate of coffe_effort_first (which are
+    1/COFFE_ACCURACY_PILOT of the most), up to integration_sampling evaluations;
+    there is no relative tolerance, as with terms cancelling each other one
+    larger than the total would otherwise pass with an error above the budget
+**/
+
+struct coffe_effort coffe_effort_refine(
+    const struct coffe_parameters_t *par,
+    double epsabs
+)
+{
+    struct coffe_effort effort = coffe_effort_first(par, 0);
+    effort.calls_min = 2*effort.calls_max;
+    effort.calls_max = (size_t)par->integration_bins;
+    if (effort.calls_min > effort.calls_max) effort.calls_min = effort.calls_max;
+    effort.epsabs = epsabs;
+    effort.epsrel = 0;
+    return effort;
+}
+
+
+/**
+    whether all the <len> results are within the tolerance of <effort>;
+    unknown (NAN) errors count as converged, as nothing can be done about them
+**/
+
+int coffe_effort_converged(
+    const struct coffe_effort *effort,
+    const double *result,
+    const double *error,
+    size_t len
+)
+{
+    for (size_t i = 0; i<len; ++i){
+        if (error[i] > fmax(effort->epsabs, effort->epsrel*fabs(result[i])))
+            return COFFE_FALSE;
+    }
+    return COFFE_TRUE;
+}
+
+
+/**
+    the absolute error allowed for each of <terms> integrated contributions
+    to the <len> multipoles <total> at one separation, so that their sum,
+    adding the errors in quadrature, reaches integration_accuracy relative
+    to the largest multipole; relative to each one, a multipole crossing
+    zero would ask for an error of about zero
+**/
+
+double coffe_error_budget(
+    const struct coffe_parameters_t *par,
+    const double *total,
+    size_t len,
+    size_t terms
+)
+{
+    double largest = 0;
+    for (size_t i = 0; i<len; ++i){
+        if (fabs(total[i]) > largest) largest = fabs(total[i]);
+    }
+    return par->integration_accuracy*largest/sqrt((double)terms);
+}
+
+
+/**
+    integrates the <len> multipoles <l> with the <effort> given, doubling
+    the evaluations until they converge; with integrate_multipoles when the
+    method allows it, otherwise one by one with integrate_monte, setting
+    *index to the multipole integrated; the error estimates go to <error>;
+    the Monte Carlo methods start over at each doubling, so they cost up to
+    twice the evaluations of the last one
+**/
+
+int integrate_multipoles_adaptive(
+    gsl_monte_function *integrand,
+    int method,
+    const struct coffe_effort *effort,
+    const struct coffe_gauss_rule *rule,
+    size_t mu_dim,
+    const int *l,
+    size_t len,
+    size_t *index,
+    double *result,
+    double *error
+)
+{
+    if (integrate_multipoles_available(method)){
+        const struct coffe_batch_function batch = {
+            &integrate_points, integrand->dim, integrand
+        };
+        integrate_multipoles_adaptive_batch(
+            &batch, method, effort, rule, mu_dim, l, len, result, error
+        );
+    }
+    else{
+        for (size_t i = 0; i<len; ++i){
+            size_t calls = effort->calls_min;
+            *index = i;
+            while (1){
+                result[i] = integrate_monte(
+                    integrand, method, calls, rule, &error[i]
+                );
+                if (
+                    calls >= effort->calls_max
+                 || coffe_effort_converged(effort, &result[i], &error[i], 1)
+                ) break;
+                calls = 2*calls < effort->calls_max ? 2*calls : effort->calls_max;
+            }
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+
+
+/**
+    the same as integrate_multipoles_adaptive for the methods with the points
+    fixed in advance, with <integrand> evaluated in batches; the Sobol sequence
+    and its sums are continued at each doubling, the error being the difference
+    to the result before it, so no point is evaluated twice
+**/
+
+int integrate_multipoles_adaptive_batch(
+    const struct coffe_batch_function *integrand,
+    int method,
+    const struct coffe_effort *effort,
+    const struct coffe_gauss_rule *rule,
+    size_t mu_dim,
+    const int *l,
+    size_t len,
+    double *result,
+    double *error
+)
+{
+    size_t calls = effort->calls_min;
+    /* the Gauss-Legendre rule is fixed in advance */
+    if (method != 3 || calls >= effort->calls_max){
+        return integrate_multipoles_batch(
+            integrand, method, calls, rule, mu_dim, l, len, result, error
+        );
+    }
+
+    struct integrate_sobol sobol;
+    integrate_sobol_init(&sobol, integrand->dim, len);
+    double sum[len], previous[len];
+    for (size_t i = 0; i<len; ++i) sum[i] = 0;
+    size_t done = calls/2;
+    integrate_sobol_add(&sobol, integrand, done, mu_dim, l, len, sum);
+    while (1){
+        for (size_t i = 0; i<len; ++i) previous[i] = done > 0 ? sum[i]/done : 0;
+        integrate_sobol_add(&sobol, integrand, calls - done, mu_dim, l, len, sum);
+        done = calls;
+        for (size_t i = 0; i<len; ++i){
+            result[i] = calls > 0 ? sum[i]/calls : 0;
+            error[i] = fabs(result[i] - previous[i]);
+        }
+        if (
+            calls >= effort->calls_max
+         || coffe_effort_converged(effort, result, error, len)
+        ) break;
+        calls = 2*calls < effort->calls_max ? 2*calls : effort->calls_max;
+    }
+    integrate_sobol_free(&sobol);
+    return EXIT_SUCCESS;
+}
+
+
+int free_gauss_rule(
+    struct coffe_gauss_rule *rule
+)
+{
+    free(rule->x);
+    free(rule->w);
+    free(rule->l);
+    free(rule->legendre);
+    rule->x = NULL;
+    rule->w = NULL;
+    rule->l = NULL;
+    rule->legendre = NULL;
+    rule->l_len = 0;
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    evaluates all the fields of <table> at <value> and stores
+    them in <result>; outside of the range the outermost
+    intervals are extrapolated
+**/
+
+void interp_uniform_table(
+    const struct coffe_uniform_table *table,
+    double value,
+    double *result
+)
+{
+    coffe_profile_count(COFFE_COUNT_INTERPOLATION);
+    double t = (value - table->xmin)*table->inv_dx;
+    size_t i;
+    if (t <= 0) i = 0;
+    else if (t >= table->len) i = table->len - 1;
+    else i = (size_t)t;
+    t -= i;
+
+    const double *c = &table->coeffs[4*i*table->fields];
+    for (size_t j = 0; j<table->fields; ++j, c += 4){
+        result[j] = c[0] + t*(c[1] + t*(c[2] + t*c[3]));
+    }
+}
+
+
+/**
+    interp_uniform_table at the <n> points <value>, with the fields
+    of point i in result[i*fields], ..., result[(i + 1)*fields - 1];
+    in blocks, first the intervals and the offsets within them of all
+    the points, and then each field of all the points, so that both
+    passes are loops without branches the compiler can vectorize
+**/
+
+void interp_uniform_table_array(
+    const struct coffe_uniform_table *table,
+    size_t n,
+    const double *value,
+    double *result
+)
+{
+    const size_t fields = table->fields;
+    const double last = (double)(table->len - 1);
+    coffe_profile_count_n(COFFE_COUNT_INTERPOLATION, n);
+    long offset[64];
+    double u[64];
+    for (size_t start = 0; start<n; start += 64){
+        const size_t m = start + 64 < n ? 64 : n - start;
+        #pragma omp simd
+        for (size_t i = 0; i<m; ++i){
+            const double t = (value[start + i] - table->xmin)*table->inv_dx;
+            const double index = fmin(fmax(floor(t), 0.0), last);
+            u[i] = t - index;
+            offset[i] = 4*(long)index*(long)fields;
+        }
+        const double *c = table->coeffs;
+        for (size_t j = 0; j<fields; ++j){
+            double *out = &result[start*fields + j];
+            #pragma omp simd
+            for (size_t i = 0; i<m; ++i){
+                const long k = offset[i] + 4*(long)j;
+                out[i*fields] = c[k] + u[i]*(c[k + 1] + u[i]*(c[k + 2] + u[i]*c[k + 3]));
+            }
+        }
+    }
+}
+
+
+int free_uniform_table(
+    struct coffe_uniform_table *table
+)
+{
+    free(table->coeffs);
+    table->coeffs = NULL;
+    table->len = 0;
+    table->fields = 0;
+    return EXIT_SUCCESS;
+}
+
+
+int coffe_compare_ascending(
+    const void *a,
+    const void *b
+)
+{
+    if (*(double *)a > *(double *)b) return 1;
+    else if (*(double *)a < *(double *)b) return -1;
+    else return 0;
+}
+
+int coffe_compare_descending(
+    const void *a,
+    const void *b
+)
+{
+    if (*(double *)a > *(double *)b) return -1;
+    else if (*(double *)a < *(double *)b) return 1;
+    else return 0;
+}
+
+struct coffe_order_t
+{
+    double value;
+    size_t index;
+};
+
+static int coffe_compare_order(
+    const void *a,
+    const void *b
+)
+{
+    const struct coffe_order_t *x = (const struct coffe_order_t *)a;
+    const struct coffe_order_t *y = (const struct coffe_order_t *)b;
+    if (x->value > y->value) return -1;
+    else if (x->value < y->value) return 1;
+    /* ties keep their original order */
+    else if (x->index < y->index) return -1;
+    else if (x->index > y->index) return 1;
+    else return 0;
+}
+
+/**
+    fills order with the indices of values, sorted so that
+    values[order[0]] is the largest one
+**/
+
+int coffe_order_descending(
+    const double *values,
+    size_t len,
+    size_t *order
+)
+{
+    struct coffe_order_t *temp =
+        (struct coffe_order_t *)coffe_malloc(sizeof(struct coffe_order_t)*len);
+    for (size_t i = 0; i<len; ++i){
+        temp[i].value = values[i];
+        temp[i].index = i;
+    }
+    qsort(temp, len, sizeof(struct coffe_order_t), coffe_compare_order);
+    for (size_t i = 0; i<len; ++i){
+        order[i] = temp[i].index;
+    }
+    free(temp);
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    FNV-1a hash of <len> bytes of <data>, continuing from <hash>
+    (COFFE_HASH_INIT for a new one)
+**/
+
+uint64_t coffe_hash(
+    const void *data,
+    size_t len,
+    uint64_t hash
+)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+    for (size_t i = 0; i<len; ++i){
+        hash ^= bytes[i];
+        hash *= UINT64_C(1099511628211);
+    }
+    return hash;
+}
+
+
+
+/**
+    function describing w(z)
     for now only w(z) = w0 + wa*(1 - a),
     but others straightforward to implement
 **/
@@ -588,6 +2545,36 @@ double interp_spline(
     double value
 )
 {
-    return gsl_spline_eval(interp->spline, value, interp->accel);
+    coffe_profile_count(COFFE_COUNT_INTERPOLATION);
+    return gsl_spline_eval(
+        interp->spline, value,
+        coffe_accel_get(interp->accel, interp->accel_len)
+    );
+}
+
+double interp_spline_deriv(
+    struct coffe_interpolation *interp,
+    double value
+)
+{
+    coffe_profile_count(COFFE_COUNT_INTERPOLATION);
+    return gsl_spline_eval_deriv(
+        interp->spline, value,
+        coffe_accel_get(interp->accel, interp->accel_len)
+    );
+}
+
+double interp_spline2d(
+    struct coffe_interpolation2d *interp,
+    double xvalue,
+    double yvalue
+)
+{
+    coffe_profile_count(COFFE_COUNT_INTERPOLATION);
+    return gsl_spline2d_eval(
+        interp->spline, xvalue, yvalue,
+        coffe_accel_get(interp->xaccel, interp->accel_len),
+        coffe_accel_get(interp->yaccel, interp->accel_len)
+    );
 }
 
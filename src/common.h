@@ -19,10 +19,19 @@
 #ifndef COFFE_COMMON_H
 #define COFFE_COMMON_H
 
+#include <stdio.h>
+#include <stdint.h>
 #include <gsl/gsl_spline.h>
 #include <gsl/gsl_spline2d.h>
+#include <gsl/gsl_integration.h>
+#include <gsl/gsl_rng.h>
+#include <gsl/gsl_monte.h>
 #include <libconfig.h>
 
+#ifdef HAVE_MPI
+#include <mpi.h>
+#endif
+
 #ifndef COFFE_VERSION_STRING
 #define COFFE_VERSION_STRING "1.0"
 #endif
@@ -64,10 +73,65 @@
 #define COFFE_MAX_INTSPACE 50000 // for 1D integration, the size of workspace
 #endif
 
+#ifndef COFFE_MAX_MONTE_DIMS
+#define COFFE_MAX_MONTE_DIMS 4 // largest dimension of a cached GSL Monte Carlo state
+#endif
+
+#ifndef COFFE_PROFILE
+#define COFFE_PROFILE 0 // whether to count the integrand and interpolation calls (./configure --enable-profile-counts)
+#endif
+
+/* the stages timed by the profiler */
+#define COFFE_PROFILE_PARSER 0
+#define COFFE_PROFILE_CLASS 1
+#define COFFE_PROFILE_BACKGROUND 2
+#define COFFE_PROFILE_INTEGRALS 3
+#define COFFE_PROFILE_CORRFUNC 4
+#define COFFE_PROFILE_MULTIPOLES 5
+#define COFFE_PROFILE_AVERAGE_MULTIPOLES 6
+#define COFFE_PROFILE_COVARIANCE 7
+#define COFFE_PROFILE_OUTPUT 8
+#define COFFE_PROFILE_TOTAL 9
+#define COFFE_PROFILE_STAGES 10
+
+/* the classes of contributions, timed per task */
+#define COFFE_PROFILE_NONINTEGRATED 0
+#define COFFE_PROFILE_SINGLE 1
+#define COFFE_PROFILE_DOUBLE 2
+#define COFFE_PROFILE_CLASSES 3
+
+/* the counted events: the integrands of each class above, then the interpolations */
+#define COFFE_COUNT_INTERPOLATION COFFE_PROFILE_CLASSES
+#define COFFE_COUNT_EVENTS (COFFE_PROFILE_CLASSES + 1)
+
+#ifndef COFFE_NVEC
+#define COFFE_NVEC 64 // largest number of points passed at once to a batched integrand
+#endif
+
+#ifndef COFFE_BATCH_LEN
+#define COFFE_BATCH_LEN 16384 // points evaluated at once by integrate_multipoles_batch
+#endif
+
 #ifndef COFFE_H0
 #define COFFE_H0 (1./(2997.92458)) // H0 in units h/Mpc
 #endif
 
+#ifndef COFFE_OUTPUT_BUFFER
+#define COFFE_OUTPUT_BUFFER (1 << 22) // size of the buffer of the output files in bytes
+#endif
+
+#ifndef COFFE_BINARY_VERSION
+#define COFFE_BINARY_VERSION 1 // version of the binary output format
+#endif
+
+#ifndef COFFE_BINARY_ALIGNMENT
+#define COFFE_BINARY_ALIGNMENT 64 // the columns of the binary output start at a multiple of this
+#endif
+
+#ifndef COFFE_ACCURACY_PILOT
+#define COFFE_ACCURACY_PILOT 16 // fraction of integration_sampling used to estimate each term
+#endif
+
 
 /**
     simple wrapper with failsafe for malloc
@@ -75,16 +139,147 @@
 
 void *coffe_malloc(size_t len);
 
+#ifndef COFFE_CACHELINE
+#define COFFE_CACHELINE 64 // size of a cache line in bytes
+#endif
+
+
+/**
+    accelerator of a spline lookup, padded to a full cache line
+    so the accelerators of different threads never share one
+**/
+
+union coffe_accel
+{
+    gsl_interp_accel accel;
+    char padding[COFFE_CACHELINE];
+};
+
+/**
+    spline with one accelerator per thread, as returned
+    by omp_get_max_threads() at the time of initialization
+**/
+
 struct coffe_interpolation
 {
     gsl_spline *spline;
-    gsl_interp_accel *accel;
+    union coffe_accel *accel;
+    int accel_len;
+};
+
+/* a memory mapped binary file, see map_binary */
+struct coffe_table_t
+{
+    void *mapping;
+    size_t size; /* of the mapping, in bytes */
+    size_t ncolumns;
+    size_t *len; /* length of each column */
+    double **columns; /* point into the mapping */
 };
 
 struct coffe_interpolation2d
 {
     gsl_spline2d *spline;
-    gsl_interp_accel *xaccel, *yaccel;
+    union coffe_accel *xaccel, *yaccel;
+    int accel_len;
+};
+
+/**
+    piecewise cubic representation of <fields> functions
+    on a uniform grid of <len> intervals; the coefficients
+    of all the fields in one interval are stored next to each other,
+    so a lookup is a direct index and a Horner evaluation
+**/
+
+struct coffe_uniform_table
+{
+    double xmin, xmax, inv_dx;
+    size_t len, fields;
+    double *coeffs;
+};
+
+
+/**
+    tensor Gauss-Legendre rule on [0, 1]^dims with <order> nodes along each
+    dimension; P_l(2 x - 1) of all the multipoles <l> is tabulated once
+    at the nodes of the dimension <mu_dim>, and shared by all the integrations
+**/
+
+struct coffe_gauss_rule
+{
+    size_t dims, order, mu_dim;
+    double *x, *w;
+    int *l;
+    size_t l_len;
+    double *legendre; /* P_l[i] at node n is legendre[i*order + n] */
+};
+
+
+/**
+    how hard a multidimensional integration tries: it starts with <calls_min>
+    evaluations and doubles them, up to <calls_max>, until the estimated error
+    is below max(epsabs, epsrel |result|)
+**/
+
+struct coffe_effort
+{
+    size_t calls_min, calls_max;
+    double epsabs, epsrel;
+};
+
+
+/**
+    an integrand over [0, 1]^dim evaluated at <n> points at once,
+    x[i*dim + d] being the coordinate d of point i, with the values in value[i]
+**/
+
+struct coffe_batch_function
+{
+    int (*f)(const double *x, size_t n, size_t dim, void *params, double *value);
+    size_t dim;
+    void *params;
+};
+
+
+/**
+    the correlation sources, in the same order
+    as the digits used in corr_terms
+**/
+
+enum coffe_sources
+{
+    COFFE_DEN = 0,
+    COFFE_RSD = 1,
+    COFFE_D1 = 2,
+    COFFE_D2 = 3,
+    COFFE_G1 = 4,
+    COFFE_G2 = 5,
+    COFFE_G3 = 6,
+    COFFE_G4 = 7,
+    COFFE_G5 = 8,
+    COFFE_LEN = 9
+};
+
+/**
+    integer label of the correlation term between sources a and b;
+    symmetric, so "MN" and "NM" have the same label
+**/
+
+#ifndef COFFE_TERM
+#define COFFE_TERM(a, b) ((a) < (b) ? 10*(a) + (b) : 10*(b) + (a))
+#endif
+
+
+/**
+    the correlation terms of one kind (nonintegrated,
+    single integrated or double integrated),
+    resolved once by the parser
+**/
+
+struct coffe_corr_terms
+{
+    int value[COFFE_MAX_STRLEN]; /* labels given by COFFE_TERM */
+    int len;
 };
 
 
@@ -134,9 +329,18 @@ struct coffe_parameters_t
         "g1"  = 4
         "g2"  = 5
         "g3"  = 6
+        "g4"  = 7
+        "g5"  = 8
+        "len" = 9
     cross terms are of the form "MN",
     with M and N one of the above numbers */
 
+    struct coffe_corr_terms nonintegrated_terms; /* terms with no integral along the line of sight */
+
+    struct coffe_corr_terms single_terms; /* terms with a single integral along the line of sight */
+
+    struct coffe_corr_terms double_terms; /* terms with a double integral along the line of sight */
+
     struct nl_terms nonzero_terms[9];
 
     char **type_bg; /* background values to output */
@@ -145,8 +349,16 @@ struct coffe_parameters_t
 
     int background_bins; /* number of bins for the background */
 
+    double background_z_max; /* largest redshift of the background, 0 to take it from the output */
+
     int bessel_bins; /* number of bins for the bessel integrals */
 
+    int fftw_flag; /* FFTW planner flag for the bessel integrals (0 = estimate, ..., 3 = exhaustive) */
+
+    char fftw_wisdom[COFFE_MAX_STRLEN]; /* file to import/export FFTW wisdom from/to (empty if not used) */
+
+    char integrals_cache[COFFE_MAX_STRLEN]; /* directory with cached integrals of Bessel functions (empty if not used) */
+
     double H0; /* same as hardcoded COFFE_H0 in our units */
 
     double Omega0_m; /* omega parameter for (total) matter */
@@ -173,6 +385,12 @@ struct coffe_parameters_t
 
     int integration_bins;
 
+    double integration_accuracy; /* target relative accuracy of the result, 0 to disable */
+
+    double flatsky_threshold; /* flat-sky multipoles below this sep/chi(z_mean), 0 to disable */
+
+    int nonintegrated_projection; /* nodes in mu of the projected nonintegrated multipoles, 0 to disable */
+
     int nthreads; /* how many threads are used for the computation */
 
     char file_power_spectrum[COFFE_MAX_STRLEN]; /* file containing the PS */
@@ -218,8 +436,16 @@ struct coffe_parameters_t
 
     char output_prefix[COFFE_MAX_STRLEN]; /* output prefix for all the files */
 
+    int output_format; /* 0 for text files, 1 for binary ones */
+
+    double progress_interval; /* seconds between reports of the progress of the multipoles, 0 to disable */
+
+    int checkpoint; /* whether the finished jobs of the multipoles are checkpointed */
+
     int interp_method; /* method used for interpolation (linear, poly, etc.) */
 
+    int fast_interpolation; /* whether to use uniform cubic tables for the background */
+
     int *multipole_values; /* the multipoles to calculate */
 
     int multipole_values_len;
@@ -250,9 +476,16 @@ struct coffe_parameters_t
 
     double covariance_pixelsize;
 
+    double covariance_memory; /* memory budget of the tiled covariance (in MB), 0 to keep it all in memory */
+
     /* for redshift averaged multipoles */
     double z_min, z_max;
 
+    /* optional batch of redshift bins, used instead of z_mean and deltaz (or z_min and z_max) */
+    double *batch_z_mean, *batch_deltaz, *batch_z_min, *batch_z_max;
+
+    int batch_len; /* number of bins in the batch, 0 if there is none */
+
     int theta_len;
 
 #ifdef HAVE_CLASS
@@ -329,29 +562,83 @@ int write_ncol_null(
     ...
 );
 
+int write_ncol_array(
+    char *filename,
+    size_t len,
+    const char *header,
+    const char *sep,
+    size_t ncolumns,
+    double **values
+);
+
 int alloc_double_matrix(
-    double ***values,
+    double **values,
     size_t len1,
     size_t len2
 );
 
-int free_double_matrix(
-    double ***values,
-    size_t len
-);
-
 int write_matrix(
     char *filename,
-    double **values,
+    const double *values,
     size_t len1,
     size_t len2,
     const char *header,
     const char *sep
 );
 
+size_t binary_data_offset(
+    const char *header,
+    size_t ncolumns
+);
+
+int write_binary_header(
+    FILE *data,
+    const char *header,
+    size_t ncolumns,
+    const size_t *len
+);
+
+int write_binary_column(
+    FILE *data,
+    const double *values,
+    size_t len
+);
+
+int write_binary(
+    char *filename,
+    const char *header,
+    size_t ncolumns,
+    const size_t *len,
+    double **values
+);
+
+int is_binary(
+    char *filename
+);
+
+int map_binary(
+    char *filename,
+    struct coffe_table_t *table
+);
+
+int unmap_binary(
+    struct coffe_table_t *table
+);
+
+int convert_binary(
+    char *input,
+    char *output
+);
+
+FILE *open_temporary(
+    const char *filename,
+    char *temp,
+    size_t size
+);
+
 int copy_matrix_array(
     double **destination,
-    double **source,
+    const double *source,
     size_t rows,
     size_t columns,
     size_t index,
@@ -371,10 +658,295 @@ double interp_spline(
     double value
 );
 
+double interp_spline_deriv(
+    struct coffe_interpolation *interp,
+    double value
+);
+
 int free_spline(
     struct coffe_interpolation *interp
 );
 
+int init_spline2d(
+    struct coffe_interpolation2d *interp,
+    double *xi,
+    double *yi,
+    double *zi,
+    size_t xbins,
+    size_t ybins
+);
+
+double interp_spline2d(
+    struct coffe_interpolation2d *interp,
+    double xvalue,
+    double yvalue
+);
+
+int free_spline2d(
+    struct coffe_interpolation2d *interp
+);
+
+int init_uniform_table(
+    struct coffe_uniform_table *table,
+    struct coffe_interpolation *interp[],
+    size_t fields,
+    double xmin,
+    double xmax,
+    size_t len
+);
+
+void interp_uniform_table(
+    const struct coffe_uniform_table *table,
+    double value,
+    double *result
+);
+
+void interp_uniform_table_array(
+    const struct coffe_uniform_table *table,
+    size_t n,
+    const double *value,
+    double *result
+);
+
+int free_uniform_table(
+    struct coffe_uniform_table *table
+);
+
+/**
+    per-thread objects for the GSL integrators, allocated on first use
+    by the calling thread and kept until coffe_workspace_free;
+    none of them may be used by nested integrations
+**/
+
+/* integration workspace of size COFFE_MAX_INTSPACE */
+gsl_integration_workspace *coffe_workspace(void);
+
+/* default random number generator, reset to the default seed */
+gsl_rng *coffe_rng(void);
+
+/* (reset) state of the Monte Carlo method (0 - plain, 1 - miser, 2 - vegas) in <dims> dimensions */
+void *coffe_monte_state(int method, size_t dims);
+
+/* frees the above objects of the calling thread */
+void coffe_workspace_free(void);
+
+/**
+    the profiler: wall and CPU time of each stage, the time the threads
+    spend in each class of contributions, and the number of integrand
+    and interpolation calls; everything is kept per thread, so it is
+    cheap enough to stay on, and written as JSON with the output
+**/
+
+/* resets everything, with counters for <nthreads> threads */
+void coffe_profile_init(int nthreads);
+
+/* wall clock time in seconds */
+double coffe_profile_time(void);
+
+/* starts timing the stage <stage> (COFFE_PROFILE_PARSER, ...) */
+void coffe_profile_start(int stage);
+
+/* stops timing <stage>, returns the wall time since the start */
+double coffe_profile_stop(int stage);
+
+/* adds the time since <start> spent by the calling thread to the class <kind> */
+void coffe_profile_task(int kind, double start);
+
+#if COFFE_PROFILE
+/* counts one <event> (COFFE_PROFILE_NONINTEGRATED, ..., COFFE_COUNT_INTERPOLATION) */
+void coffe_profile_count(int event);
+
+/* counts <n> times the <event> at once */
+void coffe_profile_count_n(int event, size_t n);
+#else
+/* without COFFE_PROFILE nothing is counted, and the calls compile to nothing */
+#define coffe_profile_count(event) ((void)(event))
+#define coffe_profile_count_n(event, n) ((void)(event), (void)(n))
+#endif
+
+/* writes the report as JSON into <filename> */
+int coffe_profile_write(char *filename);
+
+void coffe_profile_free(void);
+
+/**
+    distribution of the work over MPI processes (with -DHAVE_MPI);
+    every process does the (cheap) setup, the expensive jobs are handed
+    out one at a time by a shared counter, and the results summed up;
+    without MPI, or if it was never initialized, there is just one process
+**/
+
+struct coffe_mpi_counter_t
+{
+    unsigned long value; /* the next job, without MPI */
+    unsigned long len; /* the number of jobs */
+    int exhausted; /* no need to ask for more jobs */
+#ifdef HAVE_MPI
+    int distributed; /* whether the counter is shared by several processes */
+    MPI_Win window;
+    unsigned long *base;
+#endif
+};
+
+/* initializes MPI, if available, with the threads calling it one at a time */
+int coffe_mpi_init(int *argc, char ***argv);
+
+int coffe_mpi_finalize(void);
+
+int coffe_mpi_rank(void);
+
+int coffe_mpi_size(void);
+
+/* sums <values> over all the processes, the result ending up in all of them */
+int coffe_mpi_sum(double *values, size_t len);
+
+/* copies <size> bytes of <values> from the first process to all the others */
+int coffe_mpi_broadcast(void *values, size_t size);
+
+/* waits until all the processes get here */
+int coffe_mpi_barrier(void);
+
+/* a counter handing out the jobs 0, ..., <len> - 1 (collective) */
+int coffe_mpi_counter_init(struct coffe_mpi_counter_t *counter, size_t len);
+
+/* the next job of the calling thread, or <len> if there are none left */
+size_t coffe_mpi_counter_next(struct coffe_mpi_counter_t *counter);
+
+/* adds <amount> to the counter, shared by all the processes, and returns the sum so far */
+size_t coffe_mpi_counter_add(struct coffe_mpi_counter_t *counter, size_t amount);
+
+/* frees the counter (collective) */
+int coffe_mpi_counter_free(struct coffe_mpi_counter_t *counter);
+
+int init_gauss_rule(
+    struct coffe_gauss_rule *rule,
+    size_t dims,
+    size_t calls,
+    size_t mu_dim,
+    const int *l,
+    size_t l_len
+);
+
+double integrate_gauss(
+    const struct coffe_gauss_rule *rule,
+    gsl_monte_function *integrand,
+    const double *weight
+);
+
+double integrate_qmc(
+    gsl_monte_function *integrand,
+    size_t calls
+);
+
+int free_gauss_rule(
+    struct coffe_gauss_rule *rule
+);
+
+void coffe_legendre(
+    const int *l,
+    size_t len,
+    double mu,
+    double *result
+);
+
+void coffe_legendre_array(
+    const int *l,
+    size_t len,
+    const double *mu,
+    size_t n,
+    double *result
+);
+
+void coffe_bessel_jl_array(
+    int lmax,
+    const double *x,
+    size_t n,
+    double *result
+);
+
+double integrate_monte(
+    gsl_monte_function *integrand,
+    int method,
+    size_t calls,
+    const struct coffe_gauss_rule *rule,
+    double *error
+);
+
+int integrate_multipoles_available(int method);
+
+int integrate_multipoles(
+    gsl_monte_function *integrand,
+    int method,
+    size_t calls,
+    const struct coffe_gauss_rule *rule,
+    size_t mu_dim,
+    const int *l,
+    size_t len,
+    double *result,
+    double *error
+);
+
+int integrate_multipoles_batch(
+    const struct coffe_batch_function *integrand,
+    int method,
+    size_t calls,
+    const struct coffe_gauss_rule *rule,
+    size_t mu_dim,
+    const int *l,
+    size_t len,
+    double *result,
+    double *error
+);
+
+struct coffe_effort coffe_effort_first(
+    const struct coffe_parameters_t *par,
+    double epsrel
+);
+
+struct coffe_effort coffe_effort_refine(
+    const struct coffe_parameters_t *par,
+    double epsabs
+);
+
+int coffe_effort_converged(
+    const struct coffe_effort *effort,
+    const double *result,
+    const double *error,
+    size_t len
+);
+
+double coffe_error_budget(
+    const struct coffe_parameters_t *par,
+    const double *total,
+    size_t len,
+    size_t terms
+);
+
+int integrate_multipoles_adaptive(
+    gsl_monte_function *integrand,
+    int method,
+    const struct coffe_effort *effort,
+    const struct coffe_gauss_rule *rule,
+    size_t mu_dim,
+    const int *l,
+    size_t len,
+    size_t *index,
+    double *result,
+    double *error
+);
+
+int integrate_multipoles_adaptive_batch(
+    const struct coffe_batch_function *integrand,
+    int method,
+    const struct coffe_effort *effort,
+    const struct coffe_gauss_rule *rule,
+    size_t mu_dim,
+    const int *l,
+    size_t len,
+    double *result,
+    double *error
+);
+
 int coffe_compare_ascending(
     const void *a,
     const void *b
@@ -385,6 +957,21 @@ int coffe_compare_descending(
     const void *b
 );
 
+int coffe_order_descending(
+    const double *values,
+    size_t len,
+    size_t *order
+);
+
+/* the offset basis of coffe_hash */
+#define COFFE_HASH_INIT UINT64_C(14695981039346656037)
+
+uint64_t coffe_hash(
+    const void *data,
+    size_t len,
+    uint64_t hash
+);
+
 double common_wfunction(
     struct coffe_parameters_t *par,
     double z
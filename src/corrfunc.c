@@ -171,55 +171,7 @@ static double corrfunc_single_integrated(
     test.integral = integral;
     test.mu = mu;
     test.sep = sep;
-    int flag = 0;
-    int len = par->correlation_sources_len*(par->correlation_sources_len + 1)/2;
-    for (int i = 0; i<len; ++i){
-        if (
-            strcmp(par->corr_terms[i], "07") == 0 ||
-            strcmp(par->corr_terms[i], "70") == 0 ||
-            strcmp(par->corr_terms[i], "08") == 0 ||
-            strcmp(par->corr_terms[i], "80") == 0 ||
-            strcmp(par->corr_terms[i], "09") == 0 ||
-            strcmp(par->corr_terms[i], "90") == 0 ||
-            strcmp(par->corr_terms[i], "17") == 0 ||
-            strcmp(par->corr_terms[i], "71") == 0 ||
-            strcmp(par->corr_terms[i], "18") == 0 ||
-            strcmp(par->corr_terms[i], "81") == 0 ||
-            strcmp(par->corr_terms[i], "19") == 0 ||
-            strcmp(par->corr_terms[i], "91") == 0 ||
-            strcmp(par->corr_terms[i], "27") == 0 ||
-            strcmp(par->corr_terms[i], "72") == 0 ||
-            strcmp(par->corr_terms[i], "28") == 0 ||
-            strcmp(par->corr_terms[i], "82") == 0 ||
-            strcmp(par->corr_terms[i], "29") == 0 ||
-            strcmp(par->corr_terms[i], "92") == 0 ||
-            strcmp(par->corr_terms[i], "37") == 0 ||
-            strcmp(par->corr_terms[i], "73") == 0 ||
-            strcmp(par->corr_terms[i], "38") == 0 ||
-            strcmp(par->corr_terms[i], "83") == 0 ||
-            strcmp(par->corr_terms[i], "39") == 0 ||
-            strcmp(par->corr_terms[i], "93") == 0 ||
-            strcmp(par->corr_terms[i], "47") == 0 ||
-            strcmp(par->corr_terms[i], "74") == 0 ||
-            strcmp(par->corr_terms[i], "48") == 0 ||
-            strcmp(par->corr_terms[i], "84") == 0 ||
-            strcmp(par->corr_terms[i], "49") == 0 ||
-            strcmp(par->corr_terms[i], "94") == 0 ||
-            strcmp(par->corr_terms[i], "57") == 0 ||
-            strcmp(par->corr_terms[i], "75") == 0 ||
-            strcmp(par->corr_terms[i], "58") == 0 ||
-            strcmp(par->corr_terms[i], "85") == 0 ||
-            strcmp(par->corr_terms[i], "59") == 0 ||
-            strcmp(par->corr_terms[i], "95") == 0 ||
-            strcmp(par->corr_terms[i], "67") == 0 ||
-            strcmp(par->corr_terms[i], "76") == 0 ||
-            strcmp(par->corr_terms[i], "68") == 0 ||
-            strcmp(par->corr_terms[i], "86") == 0 ||
-            strcmp(par->corr_terms[i], "69") == 0 ||
-            strcmp(par->corr_terms[i], "96") == 0
-        ) ++flag;
-    }
-    if (flag == 0) return 0;
+    if (par->single_terms.len == 0) return 0;
 
     double result, error, prec = 1E-5;
 
@@ -227,15 +179,13 @@ static double corrfunc_single_integrated(
     integrand.function = &corrfunc_single_integrated_integrand;
     integrand.params = &test;
 
-    gsl_integration_workspace *wspace =
-        gsl_integration_workspace_alloc(COFFE_MAX_INTSPACE);
+    gsl_integration_workspace *wspace = coffe_workspace();
     gsl_integration_qag(
         &integrand, 0., 1., 0,
         prec, COFFE_MAX_INTSPACE,
         GSL_INTEG_GAUSS61, wspace,
         &result, &error
     );
-    gsl_integration_workspace_free(wspace);
 
     return result/interp_spline(&bg->D1, 0)/interp_spline(&bg->D1, 0);
 }
@@ -245,7 +195,7 @@ static double corrfunc_single_integrated(
 static int corrfunc_double_integrated_integrand(
     const int *ndim, const cubareal var[],
     const int *ncomp, cubareal value[],
-    void *p
+    void *p, const int *nvec
 )
 #else
 static double corrfunc_double_integrated_integrand(
@@ -258,20 +208,28 @@ static double corrfunc_double_integrated_integrand(
     struct coffe_background_t *bg = test->bg;
     struct coffe_parameters_t *par = test->par;
     struct coffe_integrals_t *integral = test->integral;
-    double mu = test->mu;
     double sep = test->sep;
-    double x1 = var[0], x2 = var[1];
 #ifdef HAVE_CUBA
-    value[0] =
+    /* Cuba hands over *nvec points at once, each with *ndim coordinates */
+    double z_mean[*nvec], mu[*nvec], x1[*nvec], x2[*nvec];
+    for (int i = 0; i<*nvec; ++i){
+        z_mean[i] = par->z_mean;
+        mu[i] = test->mu;
+        x1[i] = var[i*(*ndim)];
+        x2[i] = var[i*(*ndim) + 1];
+    }
+    functions_double_integrated_batch(
+        par, bg, integral, sep, *nvec, z_mean, mu, x1, x2, value
+    );
+    return EXIT_SUCCESS;
 #else
+    double mu = test->mu;
+    double x1 = var[0], x2 = var[1];
     return
-#endif
         functions_double_integrated(
             par, bg, integral,
             par->z_mean, mu, sep, x1, x2
         );
-#ifdef HAVE_CUBA
-    return EXIT_SUCCESS;
 #endif
 }
 
@@ -281,7 +239,8 @@ static double corrfunc_double_integrated(
     struct coffe_background_t *bg,
     struct coffe_integrals_t integral[],
     double mu,
-    double sep
+    double sep,
+    const struct coffe_gauss_rule *rule
 )
 {
     const int dims = 2;
@@ -292,30 +251,16 @@ static double corrfunc_double_integrated(
     test.integral = integral;
     test.mu = mu;
     test.sep = sep;
-    int flag = 0;
-    int len = par->correlation_sources_len*(par->correlation_sources_len + 1)/2;
-    for (int i = 0; i<len; ++i){
-        if (
-            strcmp(par->corr_terms[i], "77") == 0 || // g4-g4
-            strcmp(par->corr_terms[i], "88") == 0 || // g5-g5
-            strcmp(par->corr_terms[i], "99") == 0 || // len-len
-            strcmp(par->corr_terms[i], "78") == 0 || // g4-g5
-            strcmp(par->corr_terms[i], "87") == 0 || // g5-g4
-            strcmp(par->corr_terms[i], "79") == 0 || // g4-len
-            strcmp(par->corr_terms[i], "97") == 0 || // len-g4
-            strcmp(par->corr_terms[i], "89") == 0 || // g5-len
-            strcmp(par->corr_terms[i], "98") == 0    // len-g5
-        ) ++flag;
-    }
-    if (flag == 0) return 0;
+    if (par->double_terms.len == 0) return 0;
 
 #ifdef HAVE_CUBA
+    (void)rule;
     int nregions, neval, fail;
     double result[1], error[1], prob[1];
 
     Cuhre(dims, 1,
-        corrfunc_double_integrated_integrand,
-        (void *)&test, 1,
+        (integrand_t)corrfunc_double_integrated_integrand,
+        (void *)&test, COFFE_NVEC,
         5e-4, 0, 0,
         1, par->integration_bins, 7,
         NULL, NULL,
@@ -328,62 +273,84 @@ static double corrfunc_double_integrated(
     integrand.params = &test;
     integrand.f = &corrfunc_double_integrated_integrand;
 
-    gsl_rng *random;
-    gsl_rng_env_setup();
-    const gsl_rng_type *T = gsl_rng_default;
-    random = gsl_rng_alloc(T);
-    double result, error;
-    double lower[dims];
-    double upper[dims];
-    for (int i = 0; i<dims; ++i){
-        lower[i] = 0.0;
-        upper[i] = 1.0;
-    }
+    double result = integrate_monte(
+        &integrand, par->integration_method, par->integration_bins, rule, NULL
+    );
+    return result/interp_spline(&bg->D1, 0)/interp_spline(&bg->D1, 0);
+#endif
+}
 
-    switch (par->integration_method){
-        case 0:{
-            gsl_monte_plain_state *state =
-                gsl_monte_plain_alloc(dims);
-            gsl_monte_plain_integrate(
-                &integrand, lower, upper,
-                dims, par->integration_bins, random,
-                state,
-                &result, &error
-            );
-            gsl_monte_plain_free(state);
-            break;
+
+/**
+    computes the correlation function at the points (mu[k], sep[k])
+    as one task graph; the double integrated terms are by far the
+    most expensive, so they are spawned first, largest separation first,
+    and the single and nonintegrated ones fill in the gaps
+**/
+
+static int corrfunc_tasks(
+    struct coffe_parameters_t *par,
+    struct coffe_background_t *bg,
+    struct coffe_integrals_t integral[],
+    const double *mu,
+    const double *sep,
+    size_t len,
+    const struct coffe_gauss_rule *rule,
+    double *result
+)
+{
+    double *single = (double *)coffe_malloc(sizeof(double)*len);
+    double *twice = (double *)coffe_malloc(sizeof(double)*len);
+    size_t *order = (size_t *)coffe_malloc(sizeof(size_t)*len);
+    coffe_order_descending(sep, len, order);
+
+    #pragma omp parallel num_threads(par->nthreads)
+    #pragma omp single
+    {
+        for (size_t k = 0; k<len; ++k){
+            const size_t m = order[k];
+            #pragma omp task firstprivate(m)
+            {
+                const double start = coffe_profile_time();
+                twice[m] = corrfunc_double_integrated(
+                    par, bg, integral, mu[m], sep[m], rule
+                );
+                coffe_profile_task(COFFE_PROFILE_DOUBLE, start);
+            }
         }
-        case 1:{
-            gsl_monte_miser_state *state =
-                gsl_monte_miser_alloc(dims);
-            gsl_monte_miser_integrate(
-                &integrand, lower, upper,
-                dims, par->integration_bins, random,
-                state,
-                &result, &error
-            );
-            gsl_monte_miser_free(state);
-            break;
+        for (size_t k = 0; k<len; ++k){
+            const size_t m = order[k];
+            #pragma omp task firstprivate(m)
+            {
+                const double start = coffe_profile_time();
+                single[m] = corrfunc_single_integrated(
+                    par, bg, integral, mu[m], sep[m]
+                );
+                coffe_profile_task(COFFE_PROFILE_SINGLE, start);
+            }
         }
-        case 2:{
-            gsl_monte_vegas_state *state =
-                gsl_monte_vegas_alloc(dims);
-            gsl_monte_vegas_integrate(
-                &integrand, lower, upper,
-                dims, par->integration_bins, random,
-                state,
-                &result, &error
-            );
-            gsl_monte_vegas_free(state);
-            break;
+        for (size_t k = 0; k<len; ++k){
+            const size_t m = order[k];
+            #pragma omp task firstprivate(m)
+            {
+                const double start = coffe_profile_time();
+                result[m] = corrfunc_nonintegrated(
+                    par, bg, integral, mu[m], sep[m]
+                );
+                coffe_profile_task(COFFE_PROFILE_NONINTEGRATED, start);
+            }
         }
-        default:
-            result = 0;
-            break;
     }
-    gsl_rng_free(random);
-    return result/interp_spline(&bg->D1, 0)/interp_spline(&bg->D1, 0);
-#endif
+
+    for (size_t k = 0; k<len; ++k){
+        result[k] += single[k] + twice[k];
+    }
+
+    free(single);
+    free(twice);
+    free(order);
+
+    return EXIT_SUCCESS;
 }
 
 
@@ -403,12 +370,18 @@ int coffe_corrfunc_init(
 {
 #ifdef HAVE_CUBA
     cubacores(0, 10000);
+#endif
+    /* the Gauss-Legendre rule for the double integrated terms */
+    struct coffe_gauss_rule rule = {0};
+#ifndef HAVE_CUBA
+    if (par->integration_method == 4){
+        init_gauss_rule(&rule, 2, par->integration_bins, 0, NULL, 0);
+    }
 #endif
     if (par->output_type == 0){
         cf_ang->flag = 1;
-        clock_t start, end;
         printf("Calculating the angular correlation function...\n");
-        start = clock();
+        coffe_profile_start(COFFE_PROFILE_CORRFUNC);
 
         double chi_mean = interp_spline(&bg->comoving_distance, par->z_mean);
         gsl_error_handler_t *default_handler =
@@ -425,39 +398,27 @@ int coffe_corrfunc_init(
             cf_ang->theta[i] = maxangle*(i + 1)/theta_len;
         }
 
-        #pragma omp parallel for num_threads(par->nthreads)
+        double *mu = (double *)coffe_malloc(sizeof(double)*theta_len);
+        double *sep = (double *)coffe_malloc(sizeof(double)*theta_len);
         for (size_t i = 0; i<theta_len; ++i){
-            (cf_ang->result)[i] =
-                corrfunc_nonintegrated(
-                    par, bg, integral, 0, chi_mean*sqrt(2*(1. - cos(cf_ang->theta[i])))
-                );
-        }
-        #pragma omp parallel for num_threads(par->nthreads)
-        for (size_t i = 0; i<theta_len; ++i){
-            (cf_ang->result)[i] +=
-                corrfunc_single_integrated(
-                    par, bg, integral, 0, chi_mean*sqrt(2*(1. - cos(cf_ang->theta[i])))
-                );
-        }
-        #pragma omp parallel for num_threads(par->nthreads)
-        for (size_t i = 0; i<theta_len; ++i){
-            (cf_ang->result)[i] +=
-                corrfunc_double_integrated(
-                    par, bg, integral, 0, chi_mean*sqrt(2*(1. - cos(cf_ang->theta[i])))
-                );
+            mu[i] = 0;
+            sep[i] = chi_mean*sqrt(2*(1. - cos(cf_ang->theta[i])));
         }
+        corrfunc_tasks(
+            par, bg, integral, mu, sep, theta_len, &rule, cf_ang->result
+        );
+        free(mu);
+        free(sep);
 
         gsl_set_error_handler(default_handler);
 
-        end = clock();
         printf("Angular correlation function calculated in %.2f s\n",
-            (double)(end - start) / CLOCKS_PER_SEC);
+            coffe_profile_stop(COFFE_PROFILE_CORRFUNC));
     }
     else if (par->output_type == 1){
         corrfunc->flag = 1;
-        clock_t start, end;
         printf("Calculating the correlation function...\n");
-        start = clock();
+        coffe_profile_start(COFFE_PROFILE_CORRFUNC);
 
 
         /* first index mu, second separations */
@@ -490,48 +451,29 @@ int coffe_corrfunc_init(
         gsl_error_handler_t *default_handler =
             gsl_set_error_handler_off();
 
-        #pragma omp parallel for num_threads(par->nthreads) collapse(2)
-        for (size_t i = 0; i<corrfunc->mu_len; ++i){
-            for (size_t j = 0; j<corrfunc->sep_len; ++j){
-                (corrfunc->result)[i][j] =
-                    corrfunc_nonintegrated(
-                        par, bg, integral,
-                        corrfunc->mu[i], corrfunc->sep[j]*COFFE_H0
-                    );
-            }
-        }
-        #pragma omp parallel for num_threads(par->nthreads) collapse(2)
+        const size_t len = corrfunc->mu_len*corrfunc->sep_len;
+        double *mu = (double *)coffe_malloc(sizeof(double)*len);
+        double *sep = (double *)coffe_malloc(sizeof(double)*len);
         for (size_t i = 0; i<corrfunc->mu_len; ++i){
             for (size_t j = 0; j<corrfunc->sep_len; ++j){
-                (corrfunc->result)[i][j] +=
-                    corrfunc_single_integrated(
-                        par, bg, integral,
-                        corrfunc->mu[i], corrfunc->sep[j]*COFFE_H0
-                    );
-            }
-        }
-        #pragma omp parallel for num_threads(par->nthreads) collapse(2)
-        for (size_t i = 0; i<corrfunc->mu_len; ++i){
-            for (size_t j = 0; j<corrfunc->sep_len; ++j){
-                (corrfunc->result)[i][j] +=
-                    corrfunc_double_integrated(
-                        par, bg, integral,
-                        corrfunc->mu[i], corrfunc->sep[j]*COFFE_H0
-                    );
+                mu[i*corrfunc->sep_len + j] = corrfunc->mu[i];
+                sep[i*corrfunc->sep_len + j] = corrfunc->sep[j]*COFFE_H0;
             }
         }
+        corrfunc_tasks(par, bg, integral, mu, sep, len, &rule, corrfunc->result);
+        free(mu);
+        free(sep);
+
         gsl_set_error_handler(default_handler);
 
-        end = clock();
         printf("Correlation function calculated in %.2f s\n",
-            (double)(end - start) / CLOCKS_PER_SEC);
+            coffe_profile_stop(COFFE_PROFILE_CORRFUNC));
     }
 
     else if (par->output_type == 6){
         cf2d->flag = 1;
-        clock_t start, end;
         printf("Calculating the 2D correlation function...\n");
-        start = clock();
+        coffe_profile_start(COFFE_PROFILE_CORRFUNC);
 
         const double chi_mean = interp_spline(&bg->comoving_distance, par->z_mean);
         if (chi_mean < 320.*COFFE_H0){
@@ -542,7 +484,7 @@ int coffe_corrfunc_init(
             exit(EXIT_FAILURE);
         }
 
-        /* first index mu, second separations */
+        /* first index parallel, second perpendicular separations */
         alloc_double_matrix(
             &cf2d->result, r_p_len, r_p_len
         );
@@ -560,45 +502,28 @@ int coffe_corrfunc_init(
         gsl_error_handler_t *default_handler =
             gsl_set_error_handler_off();
 
-        #pragma omp parallel for num_threads(par->nthreads) collapse(2)
-        for (size_t i = 0; i<cf2d->sep_len; ++i){
-            for (size_t j = 0; j<cf2d->sep_len; ++j){
-                (cf2d->result)[i][j] =
-                    corrfunc_nonintegrated(
-                        par, bg, integral,
-                        cf2d->sep_parallel[i]/sqrt(pow(cf2d->sep_parallel[i], 2) + pow(cf2d->sep_perpendicular[j], 2)),
-                        sqrt(pow(cf2d->sep_parallel[i], 2) + pow(cf2d->sep_perpendicular[j], 2))*COFFE_H0
-                    );
-            }
-        }
-        #pragma omp parallel for num_threads(par->nthreads) collapse(2)
+        const size_t len = cf2d->sep_len*cf2d->sep_len;
+        double *mu = (double *)coffe_malloc(sizeof(double)*len);
+        double *sep = (double *)coffe_malloc(sizeof(double)*len);
         for (size_t i = 0; i<cf2d->sep_len; ++i){
             for (size_t j = 0; j<cf2d->sep_len; ++j){
-                (cf2d->result)[i][j] +=
-                    corrfunc_single_integrated(
-                        par, bg, integral,
-                        cf2d->sep_parallel[i]/sqrt(pow(cf2d->sep_parallel[i], 2) + pow(cf2d->sep_perpendicular[j], 2)),
-                        sqrt(pow(cf2d->sep_parallel[i], 2) + pow(cf2d->sep_perpendicular[j], 2))*COFFE_H0
-                    );
-            }
-        }
-        #pragma omp parallel for num_threads(par->nthreads) collapse(2)
-        for (size_t i = 0; i<cf2d->sep_len; ++i){
-            for (size_t j = 0; j<cf2d->sep_len; ++j){
-                (cf2d->result)[i][j] +=
-                    corrfunc_double_integrated(
-                        par, bg, integral,
-                        cf2d->sep_parallel[i]/sqrt(pow(cf2d->sep_parallel[i], 2) + pow(cf2d->sep_perpendicular[j], 2)),
-                        sqrt(pow(cf2d->sep_parallel[i], 2) + pow(cf2d->sep_perpendicular[j], 2))*COFFE_H0
-                    );
+                const double r = sqrt(
+                    pow(cf2d->sep_parallel[i], 2) + pow(cf2d->sep_perpendicular[j], 2)
+                );
+                mu[i*cf2d->sep_len + j] = cf2d->sep_parallel[i]/r;
+                sep[i*cf2d->sep_len + j] = r*COFFE_H0;
             }
         }
+        corrfunc_tasks(par, bg, integral, mu, sep, len, &rule, cf2d->result);
+        free(mu);
+        free(sep);
+
         gsl_set_error_handler(default_handler);
 
-        end = clock();
         printf("2D correlation function calculated in %.2f s\n",
-            (double)(end - start) / CLOCKS_PER_SEC);
+            coffe_profile_stop(COFFE_PROFILE_CORRFUNC));
     }
+    free_gauss_rule(&rule);
 
     return EXIT_SUCCESS;
 }
@@ -620,9 +545,6 @@ int coffe_corrfunc_free(
 )
 {
     if (cf->flag){
-        for (size_t i = 0; i<cf->mu_len; ++i){
-            free(cf->result[i]);
-        }
         free(cf->result);
         free(cf->sep);
         free(cf->mu);
@@ -636,9 +558,6 @@ int coffe_corrfunc2d_free(
 )
 {
     if (cf2d->flag){
-        for (size_t i = 0; i<cf2d->sep_len; ++i){
-            free(cf2d->result[i]);
-        }
         free(cf2d->result);
         free(cf2d->sep_parallel);
         free(cf2d->sep_perpendicular);
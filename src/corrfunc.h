@@ -29,7 +29,7 @@ struct coffe_corrfunc_ang_t
 
 struct coffe_corrfunc_t
 {
-    double **result;
+    double *result; /* result[i*sep_len + j] is at mu[i] and sep[j] */
     double *sep;
     double *mu;
 
@@ -40,7 +40,7 @@ struct coffe_corrfunc_t
 
 struct coffe_corrfunc2d_t
 {
-    double **result;
+    double *result; /* result[i*sep_len + j] is at sep_parallel[i] and sep_perpendicular[j] */
     double *sep_parallel;
     double *sep_perpendicular;
     size_t sep_len;
@@ -16,25 +16,37 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <math.h>
 #include <gsl/gsl_integration.h>
-#include <gsl/gsl_sf_bessel.h>
 #include <gsl/gsl_sf_coupling.h>
 #include <gsl/gsl_errno.h>
 #include "common.h"
 #include "background.h"
 #include "covariance.h"
+#include "integrals.h"
+#include "corrfunc.h"
+#include "multipoles.h"
+#include "average_multipoles.h"
+#include "output.h"
 
-/**
-    contains the necessary integration parameters
-**/
-struct covariance_params
-{
-    struct coffe_interpolation *power_spectrum;
-    double chi1, chi2;
-    int l1, l2;
-};
+#ifndef COFFE_COVARIANCE_SAMPLING
+#define COFFE_COVARIANCE_SAMPLING 16 // points in k per period of the fastest oscillating Bessel product
+#endif
+
+#ifndef COFFE_COVARIANCE_CHUNK
+#define COFFE_COVARIANCE_CHUNK 256 // points in k per block of the covariance integrals
+#endif
+
+#ifndef COFFE_COVARIANCE_MPI_BLOCKS
+#define COFFE_COVARIANCE_MPI_BLOCKS 4 // blocks of rows per process, with MPI
+#endif
 
+#ifndef COFFE_COVARIANCE_TILES_VERSION
+#define COFFE_COVARIANCE_TILES_VERSION 1 // bump when the tiles change for the same inputs
+#endif
 
 /**
     contains the parameter necessary to calculate the volume for average multipoles
@@ -92,54 +104,540 @@ static int covariance_complex(int l1, int l2)
 
 
 /**
-    integrand P(k) (or P(k)^2) * k^2 * j_l1(k\chi_1) * j_l2(k\chi_2)
+    computes the integrals D_l1l2 (of P(k)) and G_l1l2 (of P^2(k))
+    of k^2 j_l1(k chi1) j_l2(k chi2), for all pairs of multipoles
+    and of pixels at once; the k integral is a composite Simpson rule
+    which resolves the oscillations at the largest separation, done in
+    blocks in k so the Bessel functions of a block are computed once
+    (all the multipoles from one recurrence) and shared by all the pairs.
+    Only the rows [start_row, start_row + rows) of chi2 are computed, with
+    the element (m, n) at npixels*(n - start_row) + m. Since D_l1l2(m, n)
+    = D_l2l1(n, m), the entries whose column m is in [sym_start, sym_end)
+    are only computed for l1 <= l2 (and m <= n if l1 == l2); the others
+    are left zero, for covariance_integrals_mirror once all the rows
+    [sym_start, sym_end) are known
 **/
-static double covariance_integrand(
-    double k,
-    void *p
+static int covariance_integrals(
+    struct coffe_parameters_t *par,
+    struct coffe_interpolation *integrand_pk,
+    struct coffe_interpolation *integrand_pk2,
+    const int *l,
+    size_t l_len,
+    size_t npixels,
+    double pixelsize,
+    size_t start_row,
+    size_t rows,
+    size_t sym_start,
+    size_t sym_end,
+    double **integral_pk,
+    double **integral_pk2
 )
 {
-    struct covariance_params *test = (struct covariance_params *) p;
-    return
-        interp_spline(test->power_spectrum, k)*k*k
-       *gsl_sf_bessel_jl(test->l1, k*test->chi1)
-       *gsl_sf_bessel_jl(test->l2, k*test->chi2);
+    if (npixels == 0 || rows == 0) return EXIT_SUCCESS;
+
+    int lmax = l[0];
+    for (size_t i = 1; i<l_len; ++i){
+        if (l[i] > lmax) lmax = l[i];
+    }
+
+    /* the fastest oscillation has the period pi/chi_max */
+    const double chi_max = npixels*pixelsize;
+    size_t kbins = (size_t)ceil(
+        (par->k_max - par->k_min)*chi_max*COFFE_COVARIANCE_SAMPLING/M_PI
+    );
+    if (kbins < 2) kbins = 2;
+    if (kbins % 2 != 0) ++kbins;
+    const double dk = (par->k_max - par->k_min)/kbins;
+
+    for (size_t i = 0; i<l_len*l_len; ++i){
+        memset(integral_pk[i], 0, sizeof(double)*npixels*rows);
+        memset(integral_pk2[i], 0, sizeof(double)*npixels*rows);
+    }
+    /* the pairs l1 > l2 are skipped altogether if all of their columns are mirrored */
+    const int lower = sym_start > 0 || sym_end < npixels;
+
+    const size_t chunk = COFFE_COVARIANCE_CHUNK;
+    /* j_l[i](k chi_m) for all k in a block is at bessel[(i*npixels + m)*chunk] */
+    double *bessel =
+        (double *)coffe_malloc(sizeof(double)*l_len*npixels*chunk);
+    double *weight_pk = (double *)coffe_malloc(sizeof(double)*chunk);
+    double *weight_pk2 = (double *)coffe_malloc(sizeof(double)*chunk);
+
+    for (size_t start = 0; start<=kbins; start += chunk){
+        const size_t len = start + chunk <= kbins + 1 ? chunk : kbins + 1 - start;
+
+        for (size_t q = 0; q<len; ++q){
+            const size_t index = start + q;
+            const double k = par->k_min + index*dk;
+            double weight = (index == 0 || index == kbins) ? 1 : (index % 2 != 0 ? 4 : 2);
+            weight *= dk/3.*k*k;
+            weight_pk[q] = weight*interp_spline(integrand_pk, k);
+            weight_pk2[q] = weight*interp_spline(integrand_pk2, k);
+        }
+
+        #pragma omp parallel num_threads(par->nthreads)
+        {
+            /* all the multipoles over the whole block in k at once */
+            double *x = (double *)coffe_malloc(sizeof(double)*len);
+            double *jl = (double *)coffe_malloc(sizeof(double)*(lmax + 1)*len);
+            #pragma omp for
+            for (size_t m = 0; m<npixels; ++m){
+                const double chi = (m + 1)*pixelsize;
+                for (size_t q = 0; q<len; ++q){
+                    x[q] = (par->k_min + (start + q)*dk)*chi;
+                }
+                coffe_bessel_jl_array(lmax, x, len, jl);
+                for (size_t i = 0; i<l_len; ++i){
+                    memcpy(
+                        &bessel[(i*npixels + m)*chunk],
+                        &jl[l[i]*len],
+                        sizeof(double)*len
+                    );
+                }
+            }
+            free(x);
+            free(jl);
+
+            for (size_t i = 0; i<l_len; ++i){
+                for (size_t j = (lower ? 0 : i); j<l_len; ++j){
+                    double *result_pk = integral_pk[i*l_len + j];
+                    double *result_pk2 = integral_pk2[i*l_len + j];
+                    #pragma omp for schedule(dynamic)
+                    for (size_t m = 0; m<npixels; ++m){
+                        const int mirrored = m >= sym_start && m < sym_end;
+                        if (mirrored && i > j) continue;
+                        const double *bessel1 = &bessel[(i*npixels + m)*chunk];
+                        for (
+                            size_t n = (mirrored && i == j && m > start_row ? m : start_row);
+                            n<start_row + rows;
+                            ++n
+                        ){
+                            const double *bessel2 = &bessel[(j*npixels + n)*chunk];
+                            double sum_pk = 0, sum_pk2 = 0;
+                            for (size_t q = 0; q<len; ++q){
+                                const double product = bessel1[q]*bessel2[q];
+                                sum_pk += product*weight_pk[q];
+                                sum_pk2 += product*weight_pk2[q];
+                            }
+                            result_pk[npixels*(n - start_row) + m] += sum_pk;
+                            result_pk2[npixels*(n - start_row) + m] += sum_pk2;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    free(bessel);
+    free(weight_pk);
+    free(weight_pk2);
+
+    /* the prefactors (the entries left out are zero) */
+    for (size_t i = 0; i<l_len; ++i){
+        for (size_t j = 0; j<l_len; ++j){
+            const double coefficient = (2*l[i] + 1)*(2*l[j] + 1)/M_PI/M_PI;
+            double *result_pk = integral_pk[i*l_len + j];
+            double *result_pk2 = integral_pk2[i*l_len + j];
+            for (size_t m = 0; m<npixels*rows; ++m){
+                result_pk[m] *= 2*coefficient;
+                result_pk2[m] *= coefficient;
+            }
+        }
+    }
+
+    return EXIT_SUCCESS;
 }
 
 
 /**
-    integrates the above
+    fills in the entries covariance_integrals left out, for the columns
+    in the rows [start_row, start_row + rows), from their transposes:
+    the other half of the diagonal blocks, and the pairs l1 > l2
 **/
-static double covariance_integral(
-    struct coffe_interpolation *power_spectrum,
-    double chi1, double chi2,
-    int l1, int l2,
-    double kmin, double kmax
+static void covariance_integrals_mirror(
+    size_t l_len,
+    size_t npixels,
+    size_t start_row,
+    size_t rows,
+    double **integral_pk,
+    double **integral_pk2
 )
 {
-    struct covariance_params test;
-    test.power_spectrum = power_spectrum;
-    test.chi1 = chi1;
-    test.chi2 = chi2;
-    test.l1 = l1;
-    test.l2 = l2;
-
-    double result, error, prec = 1E-3;
-    gsl_function integrand;
-    integrand.function = &covariance_integrand;
-    integrand.params = &test;
-
-    gsl_integration_workspace *wspace =
-        gsl_integration_workspace_alloc(COFFE_MAX_INTSPACE);
-    gsl_integration_qag(
-        &integrand, kmin, kmax, 0,
-        prec, COFFE_MAX_INTSPACE,
-        GSL_INTEG_GAUSS61, wspace,
-        &result, &error
+    for (size_t i = 0; i<l_len; ++i){
+        double *diagonal_pk = integral_pk[i*l_len + i];
+        double *diagonal_pk2 = integral_pk2[i*l_len + i];
+        for (size_t m = 0; m<rows; ++m){
+            for (size_t n = m + 1; n<rows; ++n){
+                diagonal_pk[npixels*m + start_row + n] =
+                    diagonal_pk[npixels*n + start_row + m];
+                diagonal_pk2[npixels*m + start_row + n] =
+                    diagonal_pk2[npixels*n + start_row + m];
+            }
+        }
+        for (size_t j = 0; j<i; ++j){
+            for (size_t m = 0; m<rows; ++m){
+                for (size_t n = 0; n<rows; ++n){
+                    integral_pk[i*l_len + j][npixels*n + start_row + m] =
+                        integral_pk[j*l_len + i][npixels*m + start_row + n];
+                    integral_pk2[i*l_len + j][npixels*n + start_row + m] =
+                        integral_pk2[j*l_len + i][npixels*m + start_row + n];
+                }
+            }
+        }
+    }
+}
+
+
+/**
+    all the integrals D_l1l2 and G_l1l2 of <npixels> pixels of size
+    <pixelsize> at once, as in the covariance (used by the benchmarks)
+**/
+int coffe_covariance_integrals(
+    struct coffe_parameters_t *par,
+    struct coffe_interpolation *integrand_pk,
+    struct coffe_interpolation *integrand_pk2,
+    const int *l,
+    size_t l_len,
+    size_t npixels,
+    double pixelsize,
+    double **integral_pk,
+    double **integral_pk2
+)
+{
+    covariance_integrals(
+        par, integrand_pk, integrand_pk2,
+        l, l_len, npixels, pixelsize,
+        0, npixels, 0, npixels,
+        integral_pk, integral_pk2
     );
+    covariance_integrals_mirror(l_len, npixels, 0, npixels, integral_pk, integral_pk2);
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    the rows [start_row, start_row + rows) of the integrals, using the
+    symmetry within their square; with several processes the rows are
+    split into blocks handed out one at a time (the last rows, which
+    have the most entries to compute, first), summed up, and only then
+    is the square mirrored
+**/
+static int covariance_integrals_distributed(
+    struct coffe_parameters_t *par,
+    struct coffe_interpolation *integrand_pk,
+    struct coffe_interpolation *integrand_pk2,
+    const int *l,
+    size_t l_len,
+    size_t npixels,
+    double pixelsize,
+    size_t start_row,
+    size_t rows,
+    double **integral_pk,
+    double **integral_pk2
+)
+{
+    const size_t nprocs = (size_t)coffe_mpi_size();
+    if (nprocs == 1 || rows == 0){
+        covariance_integrals(
+            par, integrand_pk, integrand_pk2,
+            l, l_len, npixels, pixelsize,
+            start_row, rows, start_row, start_row + rows,
+            integral_pk, integral_pk2
+        );
+        covariance_integrals_mirror(
+            l_len, npixels, start_row, rows, integral_pk, integral_pk2
+        );
+        return EXIT_SUCCESS;
+    }
+
+    const size_t len = l_len*l_len;
+    for (size_t i = 0; i<len; ++i){
+        memset(integral_pk[i], 0, sizeof(double)*npixels*rows);
+        memset(integral_pk2[i], 0, sizeof(double)*npixels*rows);
+    }
+
+    size_t block = (rows + COFFE_COVARIANCE_MPI_BLOCKS*nprocs - 1)
+        /(COFFE_COVARIANCE_MPI_BLOCKS*nprocs);
+    if (block == 0) block = 1;
+    const size_t nblocks = (rows + block - 1)/block;
+
+    /* the rows of a block are contiguous, so it's computed in place */
+    double *block_pk[len], *block_pk2[len];
+    struct coffe_mpi_counter_t counter;
+    coffe_mpi_counter_init(&counter, nblocks);
+    for (
+        size_t k = coffe_mpi_counter_next(&counter);
+        k<nblocks;
+        k = coffe_mpi_counter_next(&counter)
+    ){
+        const size_t first = (nblocks - 1 - k)*block;
+        const size_t block_rows = first + block <= rows ? block : rows - first;
+        for (size_t i = 0; i<len; ++i){
+            block_pk[i] = integral_pk[i] + npixels*first;
+            block_pk2[i] = integral_pk2[i] + npixels*first;
+        }
+        covariance_integrals(
+            par, integrand_pk, integrand_pk2,
+            l, l_len, npixels, pixelsize,
+            start_row + first, block_rows, start_row, start_row + rows,
+            block_pk, block_pk2
+        );
+    }
+    coffe_mpi_counter_free(&counter);
+
+    for (size_t i = 0; i<len; ++i){
+        coffe_mpi_sum(integral_pk[i], npixels*rows);
+        coffe_mpi_sum(integral_pk2[i], npixels*rows);
+    }
+    covariance_integrals_mirror(
+        l_len, npixels, start_row, rows, integral_pk, integral_pk2
+    );
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    fills the rows [start_row, start_row + rows) of the covariance
+    at redshift <k> (with npixels[k] pixels) into result, with the
+    element (m, n) of the multipoles l[i], l[j] at
+    npixels[k]*((l_len*i + j)*rows + n - start_row) + m, from
+    the integrals of the same rows (with the stride npixels_max);
+    prefactor_*[k*l_len*l_len + l_len*i + j] contain everything
+    except the integrals and the separations
+**/
+static void covariance_fill(
+    const struct coffe_covariance_t *cov,
+    size_t k,
+    const double *prefactor_noise,
+    const double *prefactor_pk,
+    const double *prefactor_pk2,
+    size_t npixels_max,
+    size_t start_row,
+    size_t rows,
+    double **integral_pk,
+    double **integral_pk2,
+    double *result
+)
+{
+    const size_t npixels = cov->sep_len[k];
+    const size_t len = cov->l_len*cov->l_len;
+    for (size_t ij = 0; ij<len; ++ij){
+        const double noise = prefactor_noise[k*len + ij];
+        const double pk = prefactor_pk[k*len + ij];
+        const double pk2 = prefactor_pk2[k*len + ij];
+        for (size_t n = start_row; n<start_row + rows; ++n){
+            for (size_t m = 0; m<npixels; ++m){
+                const size_t index = npixels_max*(n - start_row) + m;
+                result[(ij*rows + n - start_row)*npixels + m] =
+                    (m == n ? noise/cov->sep[k][m]/cov->sep[k][n] : 0)
+                   +pk*integral_pk[ij][index]
+                   +pk2*integral_pk2[ij][index];
+            }
+        }
+    }
+}
+
+
+/**
+    the rows of separations in one tile of the covariance such that
+    everything fits in covariance_memory
+**/
+static size_t covariance_tile_rows(
+    struct coffe_parameters_t *par,
+    size_t l_len,
+    size_t npixels_max
+)
+{
+    /* the Bessel functions of a block in k, and the weights */
+    const double fixed =
+        sizeof(double)*(l_len*npixels_max + 2)*COFFE_COVARIANCE_CHUNK;
+    /* the two integrals and the result */
+    const double per_row =
+        3*sizeof(double)*l_len*l_len*npixels_max;
+    const double budget = par->covariance_memory*1024*1024;
+
+    if (budget < fixed + per_row){
+        fprintf(
+            stderr,
+            "WARNING: covariance_memory is too small, "
+            "using tiles of one row (%.0f MB)!\n",
+            (fixed + per_row)/1024/1024
+        );
+        return 1;
+    }
+    const double rows = floor((budget - fixed)/per_row);
+    return rows < npixels_max ? (size_t)rows : npixels_max;
+}
+
+
+/**
+    the hash of everything the tiles of the covariance <cov> depend on:
+    the prefactors stand in for the cosmology, the biases, the densities,
+    the sky fractions and the redshifts they were computed from, the
+    rest are the power spectrum and the layout of the integrals
+**/
+static uint64_t covariance_key(
+    struct coffe_parameters_t *par,
+    struct coffe_covariance_t *cov,
+    struct coffe_interpolation *integrand_pk,
+    const double *prefactor_noise,
+    const double *prefactor_pk,
+    const double *prefactor_pk2
+)
+{
+    const int version = COFFE_COVARIANCE_TILES_VERSION;
+    const size_t len = cov->list_len*cov->l_len*cov->l_len;
+    uint64_t hash = COFFE_HASH_INIT;
+    hash = coffe_hash(&version, sizeof(version), hash);
+    hash = coffe_hash(&par->output_type, sizeof(int), hash);
+    hash = coffe_hash(cov->l, sizeof(int)*cov->l_len, hash);
+    for (size_t k = 0; k<cov->list_len; ++k){
+        hash = coffe_hash(cov->sep[k], sizeof(double)*cov->sep_len[k], hash);
+    }
+    const double real[] = {cov->pixelsize, par->k_min, par->k_max};
+    hash = coffe_hash(real, sizeof(real), hash);
+    hash = coffe_hash(prefactor_noise, sizeof(double)*len, hash);
+    hash = coffe_hash(prefactor_pk, sizeof(double)*len, hash);
+    hash = coffe_hash(prefactor_pk2, sizeof(double)*len, hash);
+    const gsl_spline *spline = integrand_pk->spline;
+    hash = coffe_hash(spline->x, sizeof(double)*spline->size, hash);
+    hash = coffe_hash(spline->y, sizeof(double)*spline->size, hash);
+    return hash;
+}
+
+
+/**
+    computes all the covariances in <cov> from the prefactors,
+    either in memory, or in tiles of rows which are written directly
+    into the binary output (and which are skipped if done already)
+**/
+static int covariance_compute(
+    struct coffe_parameters_t *par,
+    struct coffe_covariance_t *cov,
+    struct coffe_interpolation *integrand_pk,
+    struct coffe_interpolation *integrand_pk2,
+    const double *prefactor_noise,
+    const double *prefactor_pk,
+    const double *prefactor_pk2
+)
+{
+    const size_t len = cov->l_len*cov->l_len;
+    const size_t npixels_max =
+        covariance_find_maximum(cov->sep_len, cov->list_len);
+
+    const size_t rows = par->covariance_memory > 0 ?
+        covariance_tile_rows(par, cov->l_len, npixels_max) : npixels_max;
+
+    /* allocating memory for the integrals of P(k) and P^2(k) (D_l1l2 and G_l1l2), as rows of one block */
+    double *integral_memory;
+    alloc_double_matrix(&integral_memory, 2*len, npixels_max*rows);
+    double **integral_pk =
+        (double **)coffe_malloc(sizeof(double *)*len);
+    double **integral_pk2 =
+        (double **)coffe_malloc(sizeof(double *)*len);
+    for (size_t i = 0; i<len; ++i){
+        integral_pk[i] = &integral_memory[i*npixels_max*rows];
+        integral_pk2[i] = &integral_memory[(len + i)*npixels_max*rows];
+    }
 
-    gsl_integration_workspace_free(wspace);
-    return 2*result/M_PI;
+    if (par->covariance_memory <= 0){
+        /* calculating the integrals G_l1l2 and D_l1l2 (without the scale factor D1) */
+        covariance_integrals_distributed(
+            par, integrand_pk, integrand_pk2,
+            cov->l, cov->l_len,
+            npixels_max, cov->pixelsize,
+            0, npixels_max,
+            integral_pk, integral_pk2
+        );
+
+        /* allocating memory for the final result, all the redshifts in one block */
+        cov->offset = (size_t *)coffe_malloc(sizeof(size_t)*cov->list_len);
+        size_t total = 0;
+        for (size_t k = 0; k<cov->list_len; ++k){
+            cov->offset[k] = total;
+            total += len*cov->sep_len[k]*cov->sep_len[k];
+        }
+        alloc_double_matrix(&cov->result, 1, total);
+        for (size_t k = 0; k<cov->list_len; ++k){
+            covariance_fill(
+                cov, k,
+                prefactor_noise, prefactor_pk, prefactor_pk2,
+                npixels_max, 0, cov->sep_len[k],
+                integral_pk, integral_pk2,
+                &cov->result[cov->offset[k]]
+            );
+        }
+    }
+    else{
+        cov->result = NULL;
+        cov->offset = NULL;
+        const size_t ntiles = (npixels_max + rows - 1)/rows;
+        char *done = (char *)coffe_malloc(sizeof(char)*ntiles);
+        /* only the first process writes, the others compute the same tiles */
+        const int writer = coffe_mpi_rank() == 0;
+        int error = 0;
+        if (writer){
+            const uint64_t key = covariance_key(
+                par, cov, integrand_pk, prefactor_noise, prefactor_pk, prefactor_pk2
+            );
+            error = coffe_output_covariance_resume(par, cov, key, rows, ntiles, done);
+        }
+        coffe_mpi_broadcast(&error, sizeof(error));
+        coffe_mpi_broadcast(done, sizeof(char)*ntiles);
+
+        double *tile;
+        alloc_double_matrix(&tile, len, npixels_max*rows);
+
+        for (size_t t = 0; t<ntiles && !error; ++t){
+            if (done[t]) continue;
+            const size_t start_row = t*rows;
+            const size_t tile_rows =
+                start_row + rows <= npixels_max ? rows : npixels_max - start_row;
+            covariance_integrals_distributed(
+                par, integrand_pk, integrand_pk2,
+                cov->l, cov->l_len,
+                npixels_max, cov->pixelsize,
+                start_row, tile_rows,
+                integral_pk, integral_pk2
+            );
+            for (size_t k = 0; k<cov->list_len && !error && writer; ++k){
+                if (start_row >= cov->sep_len[k]) continue;
+                const size_t rows_k =
+                    start_row + tile_rows <= cov->sep_len[k] ?
+                    tile_rows : cov->sep_len[k] - start_row;
+                covariance_fill(
+                    cov, k,
+                    prefactor_noise, prefactor_pk, prefactor_pk2,
+                    npixels_max, start_row, rows_k,
+                    integral_pk, integral_pk2,
+                    tile
+                );
+                error |= coffe_output_covariance_tile(
+                    par, cov, k, start_row, rows_k, tile
+                );
+            }
+            if (!error && writer) error |= coffe_output_covariance_done(par, t, ntiles);
+            coffe_mpi_broadcast(&error, sizeof(error));
+            printf("Covariance tile %zu of %zu done\n", t + 1, ntiles);
+        }
+
+        /* all the tiles are in the output, so a rerun starts over */
+        if (!error && writer) coffe_output_covariance_finish(par);
+
+        free(tile);
+        free(done);
+        if (error){
+            fprintf(stderr, "ERROR: cannot write the tiles of the covariance!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* memory cleanup */
+    free(integral_pk);
+    free(integral_pk2);
+    free(integral_memory);
+
+    return EXIT_SUCCESS;
 }
 
 
@@ -156,9 +654,8 @@ int coffe_covariance_init(
 {
     if (par->output_type == 4){
         cov_mp->flag = 1;
-        time_t start, end;
         printf("Calculating covariance of multipoles...\n");
-        start = clock();
+        coffe_profile_start(COFFE_PROFILE_COVARIANCE);
 
         gsl_error_handler_t *default_handler =
             gsl_set_error_handler_off();
@@ -241,80 +738,20 @@ int coffe_covariance_init(
                 (double *)coffe_malloc(sizeof(double)*npixels[i]);
             cov_mp->sep_len[i] = npixels[i];
         }
-        size_t npixels_max = covariance_find_maximum(npixels, cov_mp->list_len);
-
-        /* allocating memory for the integrals of P(k) and P^2(k) (D_l1l2 and G_l1l2) */
-        double **integral_pk =
-            (double **)coffe_malloc(sizeof(double *)*cov_mp->l_len*cov_mp->l_len);
-        double **integral_pk2 =
-            (double **)coffe_malloc(sizeof(double *)*cov_mp->l_len*cov_mp->l_len);
-        for (size_t i = 0; i<cov_mp->l_len; ++i){
-            for (size_t j = 0; j<cov_mp->l_len; ++j){
-            integral_pk[i*cov_mp->l_len + j] =
-                (double *)coffe_malloc(sizeof(double)*npixels_max*npixels_max);
-            integral_pk2[i*cov_mp->l_len + j] =
-                (double *)coffe_malloc(sizeof(double)*npixels_max*npixels_max);
-            }
-        }
-
-        /* calculating the integrals G_l1l2 and D_l1l2 (without the scale factor D1) */
-        for (size_t i = 0; i<cov_mp->l_len; ++i){
-            for (size_t j = i; j<cov_mp->l_len; ++j){
-                #pragma omp parallel for num_threads(par->nthreads) collapse(2)
-                for (size_t m = 0; m<npixels_max; ++m){
-                    for (size_t n = 0; n<npixels_max; ++n){
-                        integral_pk[i*cov_mp->l_len + j][npixels_max*n + m] =
-                            (2*cov_mp->l[i] + 1)*(2*cov_mp->l[j] + 1)
-                           *covariance_integral(
-                                &integrand_pk,
-                                (m + 1)*cov_mp->pixelsize, (n + 1)*cov_mp->pixelsize,
-                                cov_mp->l[i], cov_mp->l[j],
-                                par->k_min, par->k_max
-                            )/M_PI;
-                    }
-                }
-                #pragma omp parallel for num_threads(par->nthreads) collapse(2)
-                for (size_t m = 0; m<npixels_max; ++m){
-                    for (size_t n = 0; n<npixels_max; ++n){
-                        integral_pk2[i*cov_mp->l_len + j][npixels_max*n + m] =
-                            (2*cov_mp->l[i] + 1)*(2*cov_mp->l[j] + 1)
-                           *covariance_integral(
-                                &integrand_pk2,
-                                (m + 1)*cov_mp->pixelsize, (n + 1)*cov_mp->pixelsize,
-                                cov_mp->l[i], cov_mp->l[j],
-                                par->k_min, par->k_max
-                            )/2./M_PI;
-                    }
-                }
-            }
-        }
-
-        /* allocating memory for the final result */
-        cov_mp->result = (double ***)coffe_malloc(sizeof(double **)*cov_mp->list_len);
         for (size_t k = 0; k<cov_mp->list_len; ++k){
-            cov_mp->result[k] =
-                (double **)coffe_malloc(sizeof(double *)*cov_mp->l_len*cov_mp->l_len);
-            for (size_t i = 0; i<cov_mp->l_len; ++i){
-                for (size_t j = 0; j<cov_mp->l_len; ++j){
-                    cov_mp->result[k][i*cov_mp->l_len + j] =
-                        (double *)coffe_malloc(sizeof(double)*npixels[k]*npixels[k]);
-                }
+            for (size_t m = 0; m<npixels[k]; ++m){
+                cov_mp->sep[k][m] = (m + 1)*cov_mp->pixelsize;
             }
         }
 
-        /* setting the transpose */
-        for (size_t i = 0; i<cov_mp->l_len; ++i){
-            for (size_t j = 0; j<i; ++j){
-                for (size_t m = 0; m<npixels_max; ++m){
-                    for (size_t n = 0; n<npixels_max; ++n){
-                        integral_pk[i*cov_mp->l_len + j][npixels_max*n + m] =
-                            integral_pk[j*cov_mp->l_len + i][npixels_max*m + n];
-                        integral_pk2[i*cov_mp->l_len + j][npixels_max*n + m] =
-                            integral_pk2[j*cov_mp->l_len + i][npixels_max*m + n];
-                    }
-                }
-            }
-        }
+        /* everything but the integrals, for each redshift and pair of multipoles */
+        const size_t pairs = cov_mp->l_len*cov_mp->l_len;
+        double *prefactor_noise =
+            (double *)coffe_malloc(sizeof(double)*cov_mp->list_len*pairs);
+        double *prefactor_pk =
+            (double *)coffe_malloc(sizeof(double)*cov_mp->list_len*pairs);
+        double *prefactor_pk2 =
+            (double *)coffe_malloc(sizeof(double)*cov_mp->list_len*pairs);
 
         double *volume =
             (double *)coffe_malloc(sizeof(double)*cov_mp->list_len);
@@ -377,53 +814,45 @@ int coffe_covariance_init(
                     if (cov_mp->l[i] == cov_mp->l[j]) deltal1l2 = 1;
                     else deltal1l2 = 0;
 
-                    for (size_t m = 0; m<npixels[k]; ++m){
-                        for (size_t n = 0; n<npixels[k]; ++n){
-                            double deltaij;
-                            if (m == n) deltaij = 1;
-                            else deltaij = 0;
-
-                            cov_mp->sep[k][m] = (m + 1)*cov_mp->pixelsize;
-                            cov_mp->sep[k][n] = (n + 1)*cov_mp->pixelsize;
-                            /* flat-sky covariance */
-                            cov_mp->result[k][cov_mp->l_len*i + j][npixels[k]*n + m] =
-                                covariance_complex(cov_mp->l[i], cov_mp->l[j])*(
-                                (2*cov_mp->l[i] + 1)*deltaij*deltal1l2
-                               /2./M_PI/cov_mp->density[k]/cov_mp->density[k]
-                               /cov_mp->pixelsize/((n + 1)*cov_mp->pixelsize)/((m + 1)*cov_mp->pixelsize)
-                               +D1z*D1z/D10/D10*integral_pk[i*cov_mp->l_len + j][npixels_max*n + m]*coeff_sum/cov_mp->density[k]
-                               +D1z*D1z*D1z*D1z/D10/D10/D10/D10*integral_pk2[i*cov_mp->l_len + j][npixels_max*n + m]*coeffbar_sum
-                            )/volume[k];
-                        }
-                    }
+                    /* flat-sky covariance */
+                    const double complex_factor =
+                        covariance_complex(cov_mp->l[i], cov_mp->l[j])/volume[k];
+                    prefactor_noise[k*pairs + cov_mp->l_len*i + j] =
+                        complex_factor*(2*cov_mp->l[i] + 1)*deltal1l2
+                       /2./M_PI/cov_mp->density[k]/cov_mp->density[k]/cov_mp->pixelsize;
+                    prefactor_pk[k*pairs + cov_mp->l_len*i + j] =
+                        complex_factor*D1z*D1z/D10/D10*coeff_sum/cov_mp->density[k];
+                    prefactor_pk2[k*pairs + cov_mp->l_len*i + j] =
+                        complex_factor*D1z*D1z*D1z*D1z/D10/D10/D10/D10*coeffbar_sum;
                     coeff_sum = 0, coeffbar_sum = 0;
                 }
             }
         }
 
+        covariance_compute(
+            par, cov_mp, &integrand_pk, &integrand_pk2,
+            prefactor_noise, prefactor_pk, prefactor_pk2
+        );
+
         /* memory cleanup */
-        for (size_t i = 0; i<cov_mp->l_len*cov_mp->l_len; ++i){
-            free(integral_pk[i]);
-            free(integral_pk2[i]);
-        }
-        free(integral_pk);
-        free(integral_pk2);
-        gsl_spline_free(integrand_pk.spline);
-        gsl_interp_accel_free(integrand_pk.accel);
-        gsl_spline_free(integrand_pk2.spline);
-        gsl_interp_accel_free(integrand_pk2.accel);
-
-        end = clock();
+        free(prefactor_noise);
+        free(prefactor_pk);
+        free(prefactor_pk2);
+        free(volume);
+        free(npixels);
+        free(upper_limit);
+        free_spline(&integrand_pk);
+        free_spline(&integrand_pk2);
+
         printf("Covariance calculated in %.2f s\n",
-            (double)(end - start) / CLOCKS_PER_SEC);
+            coffe_profile_stop(COFFE_PROFILE_COVARIANCE));
 
         gsl_set_error_handler(default_handler);
     }
     else if (par->output_type == 5){
         cov_ramp->flag = 1;
-        time_t start, end;
         printf("Calculating covariance of redshift averaged multipoles...\n");
-        start = clock();
+        coffe_profile_start(COFFE_PROFILE_COVARIANCE);
 
         gsl_error_handler_t *default_handler =
             gsl_set_error_handler_off();
@@ -506,80 +935,20 @@ int coffe_covariance_init(
                 (double *)coffe_malloc(sizeof(double)*npixels[i]);
             cov_ramp->sep_len[i] = npixels[i];
         }
-        size_t npixels_max = covariance_find_maximum(npixels, cov_ramp->list_len);
-
-        /* allocating memory for the integrals of P(k) and P^2(k) (D_l1l2 and G_l1l2) */
-        double **integral_pk =
-            (double **)coffe_malloc(sizeof(double *)*cov_ramp->l_len*cov_ramp->l_len);
-        double **integral_pk2 =
-            (double **)coffe_malloc(sizeof(double *)*cov_ramp->l_len*cov_ramp->l_len);
-        for (size_t i = 0; i<cov_ramp->l_len; ++i){
-            for (size_t j = 0; j<cov_ramp->l_len; ++j){
-            integral_pk[i*cov_ramp->l_len + j] =
-                (double *)coffe_malloc(sizeof(double)*npixels_max*npixels_max);
-            integral_pk2[i*cov_ramp->l_len + j] =
-                (double *)coffe_malloc(sizeof(double)*npixels_max*npixels_max);
-            }
-        }
-
-        /* calculating the integrals G_l1l2 and D_l1l2 (without the scale factor D1) */
-        for (size_t i = 0; i<cov_ramp->l_len; ++i){
-            for (size_t j = i; j<cov_ramp->l_len; ++j){
-                #pragma omp parallel for num_threads(par->nthreads) collapse(2)
-                for (size_t m = 0; m<npixels_max; ++m){
-                    for (size_t n = 0; n<npixels_max; ++n){
-                        integral_pk[i*cov_ramp->l_len + j][npixels_max*n + m] =
-                            (2*cov_ramp->l[i] + 1)*(2*cov_ramp->l[j] + 1)
-                           *covariance_integral(
-                                &integrand_pk,
-                                (m + 1)*cov_ramp->pixelsize, (n + 1)*cov_ramp->pixelsize,
-                                cov_ramp->l[i], cov_ramp->l[j],
-                                par->k_min, par->k_max
-                            )/M_PI;
-                    }
-                }
-                #pragma omp parallel for num_threads(par->nthreads) collapse(2)
-                for (size_t m = 0; m<npixels_max; ++m){
-                    for (size_t n = 0; n<npixels_max; ++n){
-                        integral_pk2[i*cov_ramp->l_len + j][npixels_max*n + m] =
-                            (2*cov_ramp->l[i] + 1)*(2*cov_ramp->l[j] + 1)
-                           *covariance_integral(
-                                &integrand_pk2,
-                                (m + 1)*cov_ramp->pixelsize, (n + 1)*cov_ramp->pixelsize,
-                                cov_ramp->l[i], cov_ramp->l[j],
-                                par->k_min, par->k_max
-                            )/2./M_PI;
-                    }
-                }
-            }
-        }
-
-        /* allocating memory for the final result */
-        cov_ramp->result = (double ***)coffe_malloc(sizeof(double **)*cov_ramp->list_len);
         for (size_t k = 0; k<cov_ramp->list_len; ++k){
-            cov_ramp->result[k] =
-                (double **)coffe_malloc(sizeof(double *)*cov_ramp->l_len*cov_ramp->l_len);
-            for (size_t i = 0; i<cov_ramp->l_len; ++i){
-                for (size_t j = 0; j<cov_ramp->l_len; ++j){
-                    cov_ramp->result[k][i*cov_ramp->l_len + j] =
-                        (double *)coffe_malloc(sizeof(double)*npixels[k]*npixels[k]);
-                }
+            for (size_t m = 0; m<npixels[k]; ++m){
+                cov_ramp->sep[k][m] = (m + 1)*cov_ramp->pixelsize;
             }
         }
 
-        /* setting the transpose */
-        for (size_t i = 0; i<cov_ramp->l_len; ++i){
-            for (size_t j = 0; j<i; ++j){
-                for (size_t m = 0; m<npixels_max; ++m){
-                    for (size_t n = 0; n<npixels_max; ++n){
-                        integral_pk[i*cov_ramp->l_len + j][npixels_max*n + m] =
-                            integral_pk[j*cov_ramp->l_len + i][npixels_max*m + n];
-                        integral_pk2[i*cov_ramp->l_len + j][npixels_max*n + m] =
-                            integral_pk2[j*cov_ramp->l_len + i][npixels_max*m + n];
-                    }
-                }
-            }
-        }
+        /* everything but the integrals, for each redshift and pair of multipoles */
+        const size_t pairs = cov_ramp->l_len*cov_ramp->l_len;
+        double *prefactor_noise =
+            (double *)coffe_malloc(sizeof(double)*cov_ramp->list_len*pairs);
+        double *prefactor_pk =
+            (double *)coffe_malloc(sizeof(double)*cov_ramp->list_len*pairs);
+        double *prefactor_pk2 =
+            (double *)coffe_malloc(sizeof(double)*cov_ramp->list_len*pairs);
 
         double *volume =
             (double *)coffe_malloc(sizeof(double)*cov_ramp->list_len);
@@ -589,8 +958,7 @@ int coffe_covariance_init(
             test.conformal_Hz = &bg->conformal_Hz;
             test.comoving_distance = &bg->comoving_distance;
 
-            gsl_integration_workspace *space =
-                gsl_integration_workspace_alloc(COFFE_MAX_INTSPACE);
+            gsl_integration_workspace *space = coffe_workspace();
             gsl_function integrand;
             integrand.function = &covariance_volume_integrand;
             integrand.params = &test;
@@ -602,7 +970,6 @@ int coffe_covariance_init(
                 GSL_INTEG_GAUSS61, space,
                 &integral_result, &integral_error
             );
-            gsl_integration_workspace_free(space);
             volume[k] = 4*M_PI*cov_ramp->fsky[k]/integral_result/pow(COFFE_H0, 3);
             c0 =
                 interp_spline(&par->matter_bias1, (cov_ramp->zmin[k] + cov_ramp->zmax[k])/2)
@@ -651,45 +1018,38 @@ int coffe_covariance_init(
                     if (cov_ramp->l[i] == cov_ramp->l[j]) deltal1l2 = 1;
                     else deltal1l2 = 0;
 
-                    for (size_t m = 0; m<npixels[k]; ++m){
-                        for (size_t n = 0; n<npixels[k]; ++n){
-                            double deltaij;
-                            if (m == n) deltaij = 1;
-                            else deltaij = 0;
-
-                            cov_ramp->sep[k][m] = (m + 1)*cov_ramp->pixelsize;
-                            cov_ramp->sep[k][n] = (n + 1)*cov_ramp->pixelsize;
-                            /* flat-sky covariance */
-                            cov_ramp->result[k][cov_ramp->l_len*i + j][npixels[k]*n + m] =
-                                covariance_complex(cov_ramp->l[i], cov_ramp->l[j])*(
-                                (2*cov_ramp->l[i] + 1)*deltaij*deltal1l2
-                               /2./M_PI/cov_ramp->density[k]/cov_ramp->density[k]
-                               /cov_ramp->pixelsize/((n + 1)*cov_ramp->pixelsize)/((m + 1)*cov_ramp->pixelsize)
-                               +D1z*D1z/D10/D10*integral_pk[i*cov_ramp->l_len + j][npixels_max*n + m]*coeff_sum/cov_ramp->density[k]
-                               +D1z*D1z*D1z*D1z/D10/D10/D10/D10*integral_pk2[i*cov_ramp->l_len + j][npixels_max*n + m]*coeffbar_sum
-                            )/volume[k];
-                        }
-                    }
+                    /* flat-sky covariance */
+                    const double complex_factor =
+                        covariance_complex(cov_ramp->l[i], cov_ramp->l[j])/volume[k];
+                    prefactor_noise[k*pairs + cov_ramp->l_len*i + j] =
+                        complex_factor*(2*cov_ramp->l[i] + 1)*deltal1l2
+                       /2./M_PI/cov_ramp->density[k]/cov_ramp->density[k]/cov_ramp->pixelsize;
+                    prefactor_pk[k*pairs + cov_ramp->l_len*i + j] =
+                        complex_factor*D1z*D1z/D10/D10*coeff_sum/cov_ramp->density[k];
+                    prefactor_pk2[k*pairs + cov_ramp->l_len*i + j] =
+                        complex_factor*D1z*D1z*D1z*D1z/D10/D10/D10/D10*coeffbar_sum;
                     coeff_sum = 0, coeffbar_sum = 0;
                 }
             }
         }
 
+        covariance_compute(
+            par, cov_ramp, &integrand_pk, &integrand_pk2,
+            prefactor_noise, prefactor_pk, prefactor_pk2
+        );
+
         /* memory cleanup */
-        for (size_t i = 0; i<cov_ramp->l_len*cov_ramp->l_len; ++i){
-            free(integral_pk[i]);
-            free(integral_pk2[i]);
-        }
-        free(integral_pk);
-        free(integral_pk2);
-        gsl_spline_free(integrand_pk.spline);
-        gsl_interp_accel_free(integrand_pk.accel);
-        gsl_spline_free(integrand_pk2.spline);
-        gsl_interp_accel_free(integrand_pk2.accel);
-
-        end = clock();
+        free(prefactor_noise);
+        free(prefactor_pk);
+        free(prefactor_pk2);
+        free(volume);
+        free(npixels);
+        free(upper_limit);
+        free_spline(&integrand_pk);
+        free_spline(&integrand_pk2);
+
         printf("Covariance calculated in %.2f s\n",
-            (double)(end - start) / CLOCKS_PER_SEC);
+            coffe_profile_stop(COFFE_PROFILE_COVARIANCE));
 
         gsl_set_error_handler(default_handler);
     }
@@ -702,15 +1062,9 @@ int coffe_covariance_free(
 )
 {
     if (cov->flag){
-        for (size_t k = 0; k<cov->list_len; ++k){
-            for (size_t i = 0; i<cov->l_len; ++i){
-                for (size_t j = 0; j<cov->l_len; ++j){
-                    free(cov->result[k][i*cov->l_len + j]);
-                }
-            }
-            free(cov->result[k]);
-        }
+        /* in tiled mode the result is only in the output files */
         free(cov->result);
+        free(cov->offset);
 
         for (size_t i = 0; i<cov->list_len; ++i){
             free(cov->sep[i]);
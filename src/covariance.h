@@ -28,7 +28,8 @@ struct coffe_covariance_t
     double **sep;
     int *l;
     size_t *sep_len, l_len; /* sep_len is actually number of pixels */
-    double ***result; /* result[i][j*l_len + k][l*sep_len[i] + m] gives the covariance at z_mean[i], with f_sky[i], density[i], of multipoles l[j] and l[k], at separations sep[i][l] and sep[i][m] */
+    double *result; /* result[offset[i] + (j*l_len + k)*sep_len[i]*sep_len[i] + l*sep_len[i] + m] gives the covariance at z_mean[i], with f_sky[i], density[i], of multipoles l[j] and l[k], at separations sep[i][l] and sep[i][m] */
+    size_t *offset; /* start of the covariances at z_mean[i] in result */
     int flag;
 };
 
@@ -39,6 +40,18 @@ int coffe_covariance_init(
     struct coffe_covariance_t *cov_ramp
 );
 
+int coffe_covariance_integrals(
+    struct coffe_parameters_t *par,
+    struct coffe_interpolation *integrand_pk,
+    struct coffe_interpolation *integrand_pk2,
+    const int *l,
+    size_t l_len,
+    size_t npixels,
+    double pixelsize,
+    double **integral_pk,
+    double **integral_pk2
+);
+
 int coffe_covariance_free(
     struct coffe_covariance_t *cov
 );
@@ -0,0 +1,313 @@
+/*
+ * This file is part of COFFE
+ * Copyright (C) 2018 Goran Jelic-Cizmek
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <gsl/gsl_integration.h>
+#include <gsl/gsl_sf_legendre.h>
+
+#include "common.h"
+#include "background.h"
+#include "integrals.h"
+#include "flatsky.h"
+
+#ifndef COFFE_FLATSKY_BINS
+#define COFFE_FLATSKY_BINS 512 // points of the tables of the len-len term
+#endif
+
+
+struct flatsky_params
+{
+    struct coffe_interpolation *interp;
+    double value; /* the separation (or the transverse one) */
+    double max; /* largest argument of the interpolation */
+    double chi_mean;
+    int l;
+    struct coffe_background_t *bg;
+};
+
+
+/**
+    whether the source pair <term> is given by the flat-sky approximation
+**/
+
+static int flatsky_term(int term)
+{
+    return
+        term == COFFE_TERM(COFFE_DEN, COFFE_DEN) ||
+        term == COFFE_TERM(COFFE_DEN, COFFE_RSD) ||
+        term == COFFE_TERM(COFFE_RSD, COFFE_RSD) ||
+        term == COFFE_TERM(COFFE_LEN, COFFE_LEN);
+}
+
+
+static int flatsky_has_term(
+    const struct coffe_corr_terms *terms,
+    int term
+)
+{
+    for (int i = 0; i<terms->len; ++i){
+        if (terms->value[i] == term) return 1;
+    }
+    return 0;
+}
+
+
+int coffe_flatsky_use(
+    struct coffe_parameters_t *par,
+    struct coffe_background_t *bg,
+    double z_mean,
+    double sep
+)
+{
+    if (par->flatsky_threshold <= 0) return 0;
+    return sep < par->flatsky_threshold*interp_spline(&bg->comoving_distance, z_mean);
+}
+
+
+int coffe_flatsky_remaining(
+    const struct coffe_parameters_t *par,
+    struct coffe_parameters_t *rest
+)
+{
+    *rest = *par;
+    struct coffe_corr_terms *terms[3] = {
+        &rest->nonintegrated_terms, &rest->single_terms, &rest->double_terms
+    };
+    for (int k = 0; k<3; ++k){
+        int len = 0;
+        for (int i = 0; i<terms[k]->len; ++i){
+            if (!flatsky_term(terms[k]->value[i])){
+                terms[k]->value[len++] = terms[k]->value[i];
+            }
+        }
+        terms[k]->len = len;
+    }
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    the projected correlation function, 2 int_0^infty dpi xi(sqrt(R^2 + pi^2)),
+    where the integral I^0_0 is xi(r)
+**/
+
+static double flatsky_projected_integrand(double pi, void *p)
+{
+    struct flatsky_params *params = (struct flatsky_params *)p;
+    const double r = sqrt(params->value*params->value + pi*pi);
+    return r < params->max ? 2*interp_spline(params->interp, r) : 0;
+}
+
+
+/**
+    the multipole l of the projected correlation function at the
+    transverse separation R sqrt(1 - mu^2), as mu = cos(theta)
+    runs over the separations at a fixed angle on the sky
+**/
+
+static double flatsky_angular_integrand(double mu, void *p)
+{
+    struct flatsky_params *params = (struct flatsky_params *)p;
+    return interp_spline(params->interp, params->value*sqrt(1 - mu*mu))
+       *gsl_sf_legendre_Pl(params->l, mu);
+}
+
+
+int coffe_flatsky_init(
+    struct coffe_parameters_t *par,
+    struct coffe_integrals_t *integral,
+    const int *l,
+    size_t l_len,
+    double sep_max,
+    struct coffe_flatsky_t *flat
+)
+{
+    flat->flag = 1;
+    flat->l_len = l_len;
+    flat->l = (int *)coffe_malloc(sizeof(int)*l_len);
+    memcpy(flat->l, l, sizeof(int)*l_len);
+    flat->lensing = NULL;
+
+    if (!flatsky_has_term(&par->double_terms, COFFE_TERM(COFFE_LEN, COFFE_LEN))){
+        return EXIT_SUCCESS;
+    }
+
+    const size_t bins = COFFE_FLATSKY_BINS;
+    double *x = (double *)coffe_malloc(sizeof(double)*bins);
+    double *y = (double *)coffe_malloc(sizeof(double)*bins);
+    for (size_t i = 0; i<bins; ++i){
+        x[i] = sep_max*i/(bins - 1);
+    }
+
+    const gsl_spline *spline = integral[0].result.spline;
+    const double xi_max = spline->x[spline->size - 1];
+
+    #pragma omp parallel for num_threads(par->nthreads)
+    for (size_t i = 0; i<bins; ++i){
+        struct flatsky_params params = {
+            .interp = &integral[0].result, .value = x[i], .max = xi_max
+        };
+        gsl_function integrand;
+        integrand.function = &flatsky_projected_integrand;
+        integrand.params = &params;
+        double result = 0, error = 0;
+        if (x[i] < xi_max){
+            gsl_integration_qag(
+                &integrand, 0., sqrt(xi_max*xi_max - x[i]*x[i]), 0,
+                1e-5, COFFE_MAX_INTSPACE,
+                GSL_INTEG_GAUSS61, coffe_workspace(),
+                &result, &error
+            );
+        }
+        y[i] = result;
+    }
+    struct coffe_interpolation projected;
+    init_spline(&projected, x, y, bins, par->interp_method);
+
+    /* only the even multipoles are nonzero */
+    flat->lensing = (struct coffe_interpolation *)
+        coffe_malloc(sizeof(struct coffe_interpolation)*l_len);
+    for (size_t n = 0; n<l_len; ++n){
+        #pragma omp parallel for num_threads(par->nthreads)
+        for (size_t i = 0; i<bins; ++i){
+            struct flatsky_params params = {
+                .interp = &projected, .value = x[i], .l = l[n]
+            };
+            gsl_function integrand;
+            integrand.function = &flatsky_angular_integrand;
+            integrand.params = &params;
+            double result = 0, error = 0;
+            if (l[n] % 2 == 0){
+                gsl_integration_qag(
+                    &integrand, 0., 1., 0,
+                    1e-5, COFFE_MAX_INTSPACE,
+                    GSL_INTEG_GAUSS61, coffe_workspace(),
+                    &result, &error
+                );
+            }
+            y[i] = (2*l[n] + 1)*result;
+        }
+        init_spline(&flat->lensing[n], x, y, bins, par->interp_method);
+    }
+
+    free_spline(&projected);
+    free(x);
+    free(y);
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    the Limber integrand of the len-len term along the line of sight, chi = x chi_mean
+**/
+
+static double flatsky_lensing_integrand(double x, void *p)
+{
+    struct flatsky_params *params = (struct flatsky_params *)p;
+    struct coffe_background_point back;
+    coffe_background_eval(
+        params->bg, coffe_background_z(params->bg, x*params->chi_mean), &back
+    );
+    return pow(x*(1 - x)*back.D1/back.a, 2)
+       *interp_spline(params->interp, x*params->value);
+}
+
+
+double coffe_flatsky_multipole(
+    struct coffe_parameters_t *par,
+    struct coffe_background_t *bg,
+    struct coffe_integrals_t *integral,
+    struct coffe_flatsky_t *flat,
+    double z_mean,
+    double sep,
+    size_t index
+)
+{
+    const int l = flat->l[index];
+    struct coffe_background_point back;
+    coffe_background_eval(bg, z_mean, &back);
+    const double D10 = interp_spline(&bg->D1, 0);
+    const double f = back.f;
+    const double b1 = interp_spline(&par->matter_bias1, z_mean);
+    const double b2 = interp_spline(&par->matter_bias2, z_mean);
+
+    /* the Kaiser multipoles, with I^0_l the multipoles of the power spectrum */
+    double kaiser = 0;
+    for (int i = 0; i<par->nonintegrated_terms.len; ++i){
+        const int term = par->nonintegrated_terms.value[i];
+        if (term == COFFE_TERM(COFFE_DEN, COFFE_DEN)){
+            if (l == 0) kaiser += b1*b2*interp_spline(&integral[0].result, sep);
+        }
+        else if (term == COFFE_TERM(COFFE_DEN, COFFE_RSD)){
+            if (l == 0) kaiser += (b1 + b2)*f/3.*interp_spline(&integral[0].result, sep);
+            if (l == 2) kaiser -= 2*(b1 + b2)*f/3.*interp_spline(&integral[1].result, sep);
+        }
+        else if (term == COFFE_TERM(COFFE_RSD, COFFE_RSD)){
+            if (l == 0) kaiser += f*f/5.*interp_spline(&integral[0].result, sep);
+            if (l == 2) kaiser -= 4*f*f/7.*interp_spline(&integral[1].result, sep);
+            if (l == 4) kaiser += 8*f*f/35.*interp_spline(&integral[2].result, sep);
+        }
+    }
+    double result = kaiser*back.D1*back.D1;
+
+    /* len-len in the Limber approximation */
+    if (flat->lensing != NULL && l % 2 == 0){
+        const double chi_mean = interp_spline(&bg->comoving_distance, z_mean);
+        const double s1 = interp_spline(&par->magnification_bias1, z_mean);
+        const double s2 = interp_spline(&par->magnification_bias2, z_mean);
+        struct flatsky_params params = {
+            .interp = &flat->lensing[index], .value = sep,
+            .chi_mean = chi_mean, .bg = bg
+        };
+        gsl_function integrand;
+        integrand.function = &flatsky_lensing_integrand;
+        integrand.params = &params;
+        double lensing = 0, error = 0;
+        gsl_integration_qag(
+            &integrand, 0., 1., 0,
+            1e-5, COFFE_MAX_INTSPACE,
+            GSL_INTEG_GAUSS61, coffe_workspace(),
+            &lensing, &error
+        );
+        result += 9.*par->Omega0_m*par->Omega0_m*(2 - 5*s1)*(2 - 5*s2)/4.
+           *pow(chi_mean, 3)*lensing;
+    }
+
+    return result/D10/D10;
+}
+
+
+int coffe_flatsky_free(
+    struct coffe_flatsky_t *flat
+)
+{
+    if (flat->flag){
+        if (flat->lensing != NULL){
+            for (size_t n = 0; n<flat->l_len; ++n){
+                free_spline(&flat->lensing[n]);
+            }
+            free(flat->lensing);
+        }
+        free(flat->l);
+        flat->flag = 0;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,75 @@
+/*
+ * This file is part of COFFE
+ * Copyright (C) 2018 Goran Jelic-Cizmek
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+    the flat-sky approximation of the multipoles: closed-form (Kaiser)
+    multipoles of the den and rsd terms, and the len-len term in the
+    Limber approximation, as a single integral along the line of sight
+**/
+
+#ifndef COFFE_FLATSKY_H
+#define COFFE_FLATSKY_H
+
+struct coffe_flatsky_t
+{
+    struct coffe_interpolation *lensing; /* the angular part of the len-len term, for each multipole */
+    int *l;
+    size_t l_len;
+    int flag;
+};
+
+/* whether the flat-sky approximation is used at <sep> (in units of 1/H0) around <z_mean> */
+int coffe_flatsky_use(
+    struct coffe_parameters_t *par,
+    struct coffe_background_t *bg,
+    double z_mean,
+    double sep
+);
+
+/* copies <par> into <rest>, without the terms given by the flat-sky approximation */
+int coffe_flatsky_remaining(
+    const struct coffe_parameters_t *par,
+    struct coffe_parameters_t *rest
+);
+
+/* tabulates the len-len term (if needed) up to the separation <sep_max> */
+int coffe_flatsky_init(
+    struct coffe_parameters_t *par,
+    struct coffe_integrals_t *integral,
+    const int *l,
+    size_t l_len,
+    double sep_max,
+    struct coffe_flatsky_t *flat
+);
+
+/* the flat-sky multipole <flat->l[index]> of all the terms it covers */
+double coffe_flatsky_multipole(
+    struct coffe_parameters_t *par,
+    struct coffe_background_t *bg,
+    struct coffe_integrals_t *integral,
+    struct coffe_flatsky_t *flat,
+    double z_mean,
+    double sep,
+    size_t index
+);
+
+int coffe_flatsky_free(
+    struct coffe_flatsky_t *flat
+);
+
+#endif
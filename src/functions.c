@@ -16,69 +16,150 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 
-#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <gsl/gsl_math.h>
 
 #include "common.h"
 #include "background.h"
 #include "integrals.h"
 #include "functions.h"
+#include "offload.h"
+
+#ifndef COFFE_FUNCTIONS_CHUNK
+#define COFFE_FUNCTIONS_CHUNK 64 // points of a batch whose geometry and background are done together
+#endif
 
 /**
-    all the nonintegrated terms in one place
+    the geometry, background and biases at both ends
+    of the pair (z_mean, mu, sep) of the nonintegrated terms
 **/
 
-double functions_nonintegrated(
+struct functions_point
+{
+    double chi_mean, chi1, chi2, costheta, z1, z2;
+    double f1, f2, curlyH1, curlyH2, b1, b2, G1, G2;
+    double s1, s2, fevo1, fevo2, a1, a2, D1_1, D1_2;
+};
+
+
+static void functions_nonintegrated_point(
     struct coffe_parameters_t *par,
     struct coffe_background_t *bg,
-    struct coffe_integrals_t integral[],
     double z_mean,
     double mu,
-    double sep
+    double sep,
+    struct functions_point *pt
 )
 {
-    double chi_mean = interp_spline(&bg->comoving_distance, z_mean);
-    double chi1 = chi_mean - sep*mu/2.;
-    double chi2 = chi_mean + sep*mu/2.;
-    double costheta =
-        (2.*chi_mean*chi_mean - sep*sep + mu*mu*sep*sep/2.)
-       /(2.*chi_mean*chi_mean - mu*mu*sep*sep/2.);
+    pt->chi_mean = interp_spline(&bg->comoving_distance, z_mean);
+    pt->chi1 = pt->chi_mean - sep*mu/2.;
+    pt->chi2 = pt->chi_mean + sep*mu/2.;
+    pt->costheta =
+        (2.*pt->chi_mean*pt->chi_mean - sep*sep + mu*mu*sep*sep/2.)
+       /(2.*pt->chi_mean*pt->chi_mean - mu*mu*sep*sep/2.);
+
+    pt->z1 = coffe_background_z(bg, pt->chi1);
+    pt->z2 = coffe_background_z(bg, pt->chi2);
+    struct coffe_background_point back1, back2;
+    coffe_background_eval(bg, pt->z1, &back1);
+    coffe_background_eval(bg, pt->z2, &back2);
+    pt->f1 = back1.f;
+    pt->f2 = back2.f;
+    pt->curlyH1 = back1.conformal_Hz; // dimensionless
+    pt->curlyH2 = back2.conformal_Hz; // dimensionless
+    pt->b1 = interp_spline(&par->matter_bias1, pt->z1);
+    pt->b2 = interp_spline(&par->matter_bias2, pt->z2);
+    pt->G1 = back1.G1;
+    pt->G2 = back2.G2;
+    pt->s1 = interp_spline(&par->magnification_bias1, pt->z1);
+    pt->s2 = interp_spline(&par->magnification_bias2, pt->z2);
+    pt->fevo1 = interp_spline(&par->evolution_bias1, pt->z1);
+    pt->fevo2 = interp_spline(&par->evolution_bias2, pt->z2);
+    pt->a1 = back1.a;
+    pt->a2 = back2.a;
+    pt->D1_1 = back1.D1;
+    pt->D1_2 = back2.D1;
+}
+
+
+/**
+    the values of I^n_l at the separation, looked up the first time they are needed;
+    I^4_0 (index 8) is the renormalized one, which also depends on chi1 and chi2
+**/
+
+struct functions_values
+{
+    struct coffe_integrals_t *integral; /* NULL if all the values are given */
+    double sep, chi1, chi2;
+    double value[9];
+    unsigned int known; /* bit k is set once value[k] is */
+};
+
+
+static inline double functions_I(
+    struct functions_values *I,
+    int k
+)
+{
+    if (!(I->known & (1u << k))){
+        if (k == 8){
+            I->value[k] =
+                interp_spline(&I->integral[8].result, I->sep)
+            /* renormalization term */
+               -interp_spline2d(
+                    &I->integral[8].renormalization,
+                    I->chi1, I->chi2
+                );
+        }
+        else{
+            I->value[k] = interp_spline(&I->integral[k].result, I->sep);
+        }
+        I->known |= 1u << k;
+    }
+    return I->value[k];
+}
+
 
+/**
+    all the nonintegrated terms in one place;
+    the sum is linear in the I^n_l, and the geometry only enters through <pt>
+**/
+
+static double functions_nonintegrated_sum(
+    struct coffe_parameters_t *par,
+    const struct functions_point *pt,
+    double sep,
+    struct functions_values *I
+)
+{
+    const double chi1 = pt->chi1, chi2 = pt->chi2, costheta = pt->costheta;
+    const double f1 = pt->f1, f2 = pt->f2;
+    const double curlyH1 = pt->curlyH1, curlyH2 = pt->curlyH2;
+    const double b1 = pt->b1, b2 = pt->b2, G1 = pt->G1, G2 = pt->G2;
+    const double s1 = pt->s1, s2 = pt->s2;
+    const double fevo1 = pt->fevo1, fevo2 = pt->fevo2;
+    const double a1 = pt->a1, a2 = pt->a2;
     double result = 0;
-    int len = par->correlation_sources_len*(par->correlation_sources_len + 1)/2;
-    double z1 = interp_spline(&bg->z_as_chi, chi1);
-    double z2 = interp_spline(&bg->z_as_chi, chi2);
-    double f1 = interp_spline(&bg->f, z1);
-    double f2 = interp_spline(&bg->f, z2);
-    double curlyH1 = interp_spline(&bg->conformal_Hz, z1); // dimensionless
-    double curlyH2 = interp_spline(&bg->conformal_Hz, z2); // dimensionless
-    double b1 = interp_spline(&par->matter_bias1, z1);
-    double b2 = interp_spline(&par->matter_bias2, z2);
-    double G1 = interp_spline(&bg->G1, z1);
-    double G2 = interp_spline(&bg->G2, z2);
-    double s1 = interp_spline(&par->magnification_bias1, z1);
-    double s2 = interp_spline(&par->magnification_bias2, z2);
-    double fevo1 = interp_spline(&par->evolution_bias1, z1);
-    double fevo2 = interp_spline(&par->evolution_bias2, z2);
-    double a1 = interp_spline(&bg->a, z1);
-    double a2 = interp_spline(&bg->a, z2);
-    for (int i = 0; i<len; ++i){
+    for (int i = 0; i<par->nonintegrated_terms.len; ++i){
+        const int term = par->nonintegrated_terms.value[i];
         /* den-den term */
-        if (strcmp(par->corr_terms[i], "00") == 0){
+        if (term == COFFE_TERM(COFFE_DEN, COFFE_DEN)){
             result += b1*b2
-               *interp_spline(&integral[0].result, sep);
+               *functions_I(I, 0);
         }
         /* rsd-rsd term */
-        else if (strcmp(par->corr_terms[i], "11") == 0){
+        else if (term == COFFE_TERM(COFFE_RSD, COFFE_RSD)){
             result +=
                 f1*f2*(1 + 2*pow(costheta, 2))/15
-               *interp_spline(&integral[0].result, sep)
+               *functions_I(I, 0)
                 -
                 f1*f2/21.*(
                     (1 + 11.*pow(costheta, 2)) + 18*costheta*(pow(costheta, 2) - 1)*chi1*chi2/sep/sep
                 )
-               *interp_spline(&integral[1].result, sep)
+               *functions_I(I, 1)
                 +
                 f1*f2*(
                     4*(3*pow(costheta, 2) - 1)*(pow(chi1, 4) + pow(chi2, 4))/35./pow(sep, 4)
@@ -87,15 +168,15 @@ double functions_nonintegrated(
                         3*(3 + pow(costheta, 2))*chi1*chi2 - 8*(pow(chi1, 2) + pow(chi2, 2))*costheta
                     )/35./pow(sep, 4)
                 )
-               *interp_spline(&integral[2].result, sep);
+               *functions_I(I, 2);
         }
         /* d1-d1 term */
-        else if (strcmp(par->corr_terms[i], "22") == 0){
+        else if (term == COFFE_TERM(COFFE_D1, COFFE_D1)){
             result +=
                 (
                     curlyH1*curlyH2*f1*f2*G1*G2
                    *costheta/3.
-                   *interp_spline(&integral[5].result, sep)
+                   *functions_I(I, 5)
                     +
                     curlyH1*curlyH2*f1*f2*G1*G2
                    *(
@@ -103,156 +184,107 @@ double functions_nonintegrated(
                         +
                         pow(sep, 2)*costheta/3.
                     )
-                   *interp_spline(&integral[6].result, sep)
+                   *functions_I(I, 6)
                 );
         }
         /* d2-d2 term */
-        else if (strcmp(par->corr_terms[i], "33") == 0){
+        else if (term == COFFE_TERM(COFFE_D2, COFFE_D2)){
             result +=
                 (3 - fevo1)*(3 - fevo2)*pow(curlyH1, 2)*pow(curlyH2, 2)*f1*f2
                *(
-                    interp_spline(&integral[8].result, sep)
-                    /* renormalization term */
-                   -gsl_spline2d_eval(
-                        integral[8].renormalization.spline,
-                        chi1, chi2,
-                        integral[8].renormalization.xaccel,
-                        integral[8].renormalization.yaccel
-                    )
+                    functions_I(I, 8)
                 );
         }
         /* g1-g1 term */
-        else if (strcmp(par->corr_terms[i], "44") == 0){
+        else if (term == COFFE_TERM(COFFE_G1, COFFE_G1)){
             result += 9*pow(par->Omega0_m, 2)
                *(1 + G1)*(1 + G2)/4/a1/a2
                *(
-                    interp_spline(&integral[8].result, sep)
-                    /* renormalization term */
-                   -gsl_spline2d_eval(
-                        integral[8].renormalization.spline,
-                        chi1, chi2,
-                        integral[8].renormalization.xaccel,
-                        integral[8].renormalization.yaccel
-                    )
+                    functions_I(I, 8)
                 );
         }
         /* g2-g2 term */
-        else if (strcmp(par->corr_terms[i], "55") == 0){
+        else if (term == COFFE_TERM(COFFE_G2, COFFE_G2)){
             result += 9*pow(par->Omega0_m, 2)
                *(5*s1 - 2)*(5*s2 - 2)/4/a1/a2
                *(
-                    interp_spline(&integral[8].result, sep)
-                    /* renormalization term */
-                   -gsl_spline2d_eval(
-                        integral[8].renormalization.spline,
-                        chi1, chi2,
-                        integral[8].renormalization.xaccel,
-                        integral[8].renormalization.yaccel
-                    )
+                    functions_I(I, 8)
                 );
         }
         /* g3-g3 term */
-        else if (strcmp(par->corr_terms[i], "66") == 0){
+        else if (term == COFFE_TERM(COFFE_G3, COFFE_G3)){
             result += 9*pow(par->Omega0_m, 2)
                *(f1 - 1)*(f2 - 1)/4/a1/a2
                *(
-                    interp_spline(&integral[8].result, sep)
-                    /* renormalization term */
-                   -gsl_spline2d_eval(
-                        integral[8].renormalization.spline,
-                        chi1, chi2,
-                        integral[8].renormalization.xaccel,
-                        integral[8].renormalization.yaccel
-                    )
+                    functions_I(I, 8)
                 );
         }
         /* den-rsd + rsd-den term */
-        else if (
-            strcmp(par->corr_terms[i], "01") == 0 ||
-            strcmp(par->corr_terms[i], "10") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_DEN, COFFE_RSD)){
             result += (b1*f2/3. + b2*f1/3.)
-               *interp_spline(&integral[0].result, sep)
+               *functions_I(I, 0)
                -
                 (
                     b1*f2*(2./3. - (1. - pow(costheta, 2))*pow(chi1/sep, 2))
                     +
                     b2*f1*(2./3. - (1. - pow(costheta, 2))*pow(chi2/sep, 2))
                 )
-               *interp_spline(&integral[1].result, sep);
+               *functions_I(I, 1);
         }
         /* den-d1 + d1-den term */
-        else if (
-            strcmp(par->corr_terms[i], "02") == 0 ||
-            strcmp(par->corr_terms[i], "20") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_DEN, COFFE_D1)){
             result += -(
                     b1*f2*curlyH2*G2*(chi1*costheta - chi2)
                     +
                     b2*f1*curlyH1*G1*(chi2*costheta - chi1)
                 )
-               *interp_spline(&integral[3].result, sep);
+               *functions_I(I, 3);
         }
         /* den-d2 + d2-den term */
-        else if (
-            strcmp(par->corr_terms[i], "03") == 0 ||
-            strcmp(par->corr_terms[i], "30") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_DEN, COFFE_D2)){
             result += (
                     (3 - fevo2)*b1*f2*pow(curlyH2, 2)
                     +
                     (3 - fevo1)*b2*f1*pow(curlyH1, 2)
                 )
-               *interp_spline(&integral[5].result, sep);
+               *functions_I(I, 5);
         }
         /* den-g1 + g1-den term */
-        else if (
-            strcmp(par->corr_terms[i], "04") == 0 ||
-            strcmp(par->corr_terms[i], "40") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_DEN, COFFE_G1)){
             result += -(
                     b1*3*par->Omega0_m/2/a2*(1 + G2)
                     +
                     b2*3*par->Omega0_m/2/a1*(1 + G1)
                 )
-               *interp_spline(&integral[5].result, sep);
+               *functions_I(I, 5);
         }
         /* den-g2 + g2-den term */
-        else if (
-            strcmp(par->corr_terms[i], "05") == 0 ||
-            strcmp(par->corr_terms[i], "50") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_DEN, COFFE_G2)){
             result += -(
                     b1*3*par->Omega0_m/2/a2*(5*s2 - 2)
                     +
                     b2*3*par->Omega0_m/2/a1*(5*s1 - 2)
                 )
-               *interp_spline(&integral[5].result, sep);
+               *functions_I(I, 5);
         }
         /* den-g3 + g3-den term */
-        else if (
-            strcmp(par->corr_terms[i], "06") == 0 ||
-            strcmp(par->corr_terms[i], "60") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_DEN, COFFE_G3)){
             result += -(
                     b1*3*par->Omega0_m/2/a2*(f2 - 1)
                     +
                     b2*3*par->Omega0_m/2/a1*(f1 - 1)
                 )
-               *interp_spline(&integral[5].result, sep);
+               *functions_I(I, 5);
         }
         /* rsd-d1 + d1-rsd term */
-        else if (
-            strcmp(par->corr_terms[i], "12") == 0 ||
-            strcmp(par->corr_terms[i], "21") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_RSD, COFFE_D1)){
             result += (
                 (
                     f1*f2*curlyH2*G2*((1. + 2*pow(costheta, 2))*chi2 - 3*chi1*costheta)/5.
                     +
                     f2*f1*curlyH1*G1*((1. + 2*pow(costheta, 2))*chi1 - 3*chi2*costheta)/5.
                 )
-               *interp_spline(&integral[3].result, sep)
+               *functions_I(I, 3)
                 + (
                     f1*f2*curlyH2*G2*(
                         (1. - 3*costheta*costheta)*pow(chi2, 3)
@@ -274,310 +306,331 @@ double functions_nonintegrated(
                         2*pow(chi2, 3)*costheta
                     )/5
                 )
-               *interp_spline(&integral[4].result, sep)/pow(sep, 2)
+               *functions_I(I, 4)/pow(sep, 2)
             );
         }
         /* rsd-d2 + d2-rsd term */
-        else if (
-            strcmp(par->corr_terms[i], "13") == 0 ||
-            strcmp(par->corr_terms[i], "31") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_RSD, COFFE_D2)){
             result += (
                 (
                     (3 - fevo2)/3*f1*f2*pow(curlyH2, 2)
                     +
                     (3 - fevo1)/3*f2*f1*pow(curlyH1, 2)
                 )
-               *interp_spline(&integral[5].result, sep)
+               *functions_I(I, 5)
                 - (
                     (3 - fevo2)*f1*f2*pow(curlyH2, 2)*(2./3*pow(sep, 2) - (1 - pow(costheta, 2))*pow(chi2, 2))
                     +
                     (3 - fevo1)*f2*f1*pow(curlyH1, 2)*(2./3*pow(sep, 2) - (1 - pow(costheta, 2))*pow(chi1, 2))
                 )
-               *interp_spline(&integral[6].result, sep)
+               *functions_I(I, 6)
             );
         }
         /* rsd-g1 + g1-rsd term */
-        else if (
-            strcmp(par->corr_terms[i], "14") == 0 ||
-            strcmp(par->corr_terms[i], "41") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_RSD, COFFE_G1)){
             result += -(
                     par->Omega0_m/2./a2*f1*(1 + G2)
                     +
                     par->Omega0_m/2./a1*f2*(1 + G1)
                 )
-               *interp_spline(&integral[5].result, sep)
+               *functions_I(I, 5)
                 + (
                     3*par->Omega0_m/2./a2*f1*(1 + G2)*(2./3*pow(sep, 2) - (1 - pow(costheta, 2))*pow(chi2, 2))
                     +
                     3*par->Omega0_m/2./a1*f2*(1 + G1)*(2./3*pow(sep, 2) - (1 - pow(costheta, 2))*pow(chi1, 2))
                 )
-               *interp_spline(&integral[6].result, sep);
+               *functions_I(I, 6);
         }
         /* rsd-g2 + g2-rsd term */
-        else if (
-            strcmp(par->corr_terms[i], "15") == 0 ||
-            strcmp(par->corr_terms[i], "51") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_RSD, COFFE_G2)){
             result += -(
                     par->Omega0_m/2./a2*f1*(5*s2 - 2)
                     +
                     par->Omega0_m/2./a1*f2*(5*s1 - 2)
                 )
-               *interp_spline(&integral[5].result, sep)
+               *functions_I(I, 5)
                 + (
                     3*par->Omega0_m/2./a2*f1*(5*s2 - 2)*(2./3*pow(sep, 2) - (1 - pow(costheta, 2))*pow(chi2, 2))
                     +
                     3*par->Omega0_m/2./a1*f2*(5*s1 - 2)*(2./3*pow(sep, 2) - (1 - pow(costheta, 2))*pow(chi1, 2))
                 )
-               *interp_spline(&integral[6].result, sep);
+               *functions_I(I, 6);
         }
         /* rsd-g3 + g3-rsd term */
-        else if (
-            strcmp(par->corr_terms[i], "16") == 0 ||
-            strcmp(par->corr_terms[i], "61") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_RSD, COFFE_G3)){
             result += -(
                     par->Omega0_m/2./a2*f1*(f2 - 1)
                     +
                     par->Omega0_m/2./a1*f2*(f1 - 1)
                 )
-               *interp_spline(&integral[5].result, sep)
+               *functions_I(I, 5)
                 + (
                     3*par->Omega0_m/2./a2*f1*(f2 - 1)*(2./3*pow(sep, 2) - (1 - pow(costheta, 2))*pow(chi2, 2))
                     +
                     3*par->Omega0_m/2./a1*f2*(f1 - 1)*(2./3*pow(sep, 2) - (1 - pow(costheta, 2))*pow(chi1, 2))
                 )
-               *interp_spline(&integral[6].result, sep);
+               *functions_I(I, 6);
 
         }
         /* d1-d2 + d2-d1 term */
-        else if (
-            strcmp(par->corr_terms[i], "23") == 0 ||
-            strcmp(par->corr_terms[i], "32") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_D1, COFFE_D2)){
             result += -(
                     (3 - fevo2)*curlyH1*pow(curlyH2, 2)*f1*f2*(chi2*costheta - chi1)
                     +
                     (3 - fevo1)*curlyH2*pow(curlyH1, 2)*f2*f1*(chi1*costheta - chi2)
                 )
-               *interp_spline(&integral[7].result, sep);
+               *functions_I(I, 7);
         }
         /* d1-g1 + g1-d1 term */
-        else if (
-            strcmp(par->corr_terms[i], "24") == 0 ||
-            strcmp(par->corr_terms[i], "42") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_D1, COFFE_G1)){
             result += (
                     3*par->Omega0_m/2./a2*curlyH1*f1*(1 + G2)*(chi2*costheta - chi1)
                     +
                     3*par->Omega0_m/2./a1*curlyH2*f2*(1 + G1)*(chi1*costheta - chi2)
                 )
-               *interp_spline(&integral[7].result, sep);
+               *functions_I(I, 7);
         }
         /* d1-g2 + g2-d1 term */
-        else if (
-            strcmp(par->corr_terms[i], "25") == 0 ||
-            strcmp(par->corr_terms[i], "52") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_D1, COFFE_G2)){
             result += (
                     3*par->Omega0_m/2./a2*curlyH1*f1*(5*s2 - 2)*(chi2*costheta - chi1)
                     +
                     3*par->Omega0_m/2./a1*curlyH2*f2*(5*s1 - 2)*(chi1*costheta - chi2)
                 )
-               *interp_spline(&integral[7].result, sep);
+               *functions_I(I, 7);
         }
         /* d1-g3 + g3-d1 term */
-        else if (
-            strcmp(par->corr_terms[i], "26") == 0 ||
-            strcmp(par->corr_terms[i], "62") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_D1, COFFE_G3)){
             result += (
                     3*par->Omega0_m/2./a2*curlyH1*f1*(f2 - 1.)*(chi2*costheta - chi1)
                     +
                     3*par->Omega0_m/2./a1*curlyH2*f2*(f1 - 1.)*(chi1*costheta - chi2)
                 )
-               *interp_spline(&integral[7].result, sep);
+               *functions_I(I, 7);
         }
         /* d2-g1 + g1-d2 term */
-        else if (
-            strcmp(par->corr_terms[i], "34") == 0 ||
-            strcmp(par->corr_terms[i], "43") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_D2, COFFE_G1)){
             result += -(
                     3*(3 - fevo1)*par->Omega0_m/2./a2*pow(curlyH1, 2)*f1*(1 + G2)
                     +
                     3*(3 - fevo2)*par->Omega0_m/2./a1*pow(curlyH2, 2)*f2*(1 + G1)
                 )
                *(
-                    interp_spline(&integral[8].result, sep)
-                    /* renormalization term */
-                   -gsl_spline2d_eval(
-                        integral[8].renormalization.spline,
-                        chi1, chi2,
-                        integral[8].renormalization.xaccel,
-                        integral[8].renormalization.yaccel
-                    )
+                    functions_I(I, 8)
                 );
         }
         /* d2-g2 + g2-d2 term */
-        else if (
-            strcmp(par->corr_terms[i], "35") == 0 ||
-            strcmp(par->corr_terms[i], "53") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_D2, COFFE_G2)){
             result += -(
                     3*(3 - fevo1)*par->Omega0_m/2./a2*pow(curlyH1, 2)*f1*(5*s2 - 2)
                     +
                     3*(3 - fevo2)*par->Omega0_m/2./a1*pow(curlyH2, 2)*f2*(5*s1 - 2)
                 )
                *(
-                    interp_spline(&integral[8].result, sep)
-                    /* renormalization term */
-                   -gsl_spline2d_eval(
-                        integral[8].renormalization.spline,
-                        chi1, chi2,
-                        integral[8].renormalization.xaccel,
-                        integral[8].renormalization.yaccel
-                    )
+                    functions_I(I, 8)
                 );
         }
         /* d2-g3 + g3-d2 term */
-        else if (
-            strcmp(par->corr_terms[i], "36") == 0 ||
-            strcmp(par->corr_terms[i], "63") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_D2, COFFE_G3)){
             result += -(
                     3*(3 - fevo1)*par->Omega0_m/2./a2*pow(curlyH1, 2)*f1*(f2 - 1)
                     +
                     3*(3 - fevo2)*par->Omega0_m/2./a1*pow(curlyH2, 2)*f2*(f1 - 1)
                 )
                *(
-                    interp_spline(&integral[8].result, sep)
-                    /* renormalization term */
-                   -gsl_spline2d_eval(
-                        integral[8].renormalization.spline,
-                        chi1, chi2,
-                        integral[8].renormalization.xaccel,
-                        integral[8].renormalization.yaccel
-                    )
+                    functions_I(I, 8)
                 );
         }
         /* g1-g2 + g2-g1 term */
-        else if (
-            strcmp(par->corr_terms[i], "45") == 0 ||
-            strcmp(par->corr_terms[i], "54") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_G1, COFFE_G2)){
             result += (
                     9*pow(par->Omega0_m, 2)/4./a1/a2*(1 + G1)*(5*s2 - 2)
                     +
                     9*pow(par->Omega0_m, 2)/4./a2/a1*(1 + G2)*(5*s1 - 2)
                 )
                *(
-                    interp_spline(&integral[8].result, sep)
-                    /* renormalization term */
-                   -gsl_spline2d_eval(
-                        integral[8].renormalization.spline,
-                        chi1, chi2,
-                        integral[8].renormalization.xaccel,
-                        integral[8].renormalization.yaccel
-                    )
+                    functions_I(I, 8)
                 );
         }
         /* g1-g3 + g3-g1 term */
-        else if (
-            strcmp(par->corr_terms[i], "46") == 0 ||
-            strcmp(par->corr_terms[i], "64") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_G1, COFFE_G3)){
             result += (
                     9*pow(par->Omega0_m, 2)/4./a1/a2*(1 + G1)*(f2 - 1)
                     +
                     9*pow(par->Omega0_m, 2)/4./a2/a1*(1 + G2)*(f1 - 1)
                 )
                *(
-                    interp_spline(&integral[8].result, sep)
-                    /* renormalization term */
-                   -gsl_spline2d_eval(
-                        integral[8].renormalization.spline,
-                        chi1, chi2,
-                        integral[8].renormalization.xaccel,
-                        integral[8].renormalization.yaccel
-                    )
+                    functions_I(I, 8)
                 );
         }
         /* g2-g3 + g3-g2 term */
-        else if (
-            strcmp(par->corr_terms[i], "56") == 0 ||
-            strcmp(par->corr_terms[i], "65") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_G2, COFFE_G3)){
             result += 9*pow(par->Omega0_m, 2)/4.*(
                     (5*s1 - 2)*(f2 - 1)/a1/a2
                     +
                     (5*s2 - 2)*(f1 - 1)/a2/a1
                 )
                *(
-                    interp_spline(&integral[8].result, sep)
-                /* renormalization term */
-                   -gsl_spline2d_eval(
-                        integral[8].renormalization.spline,
-                        chi1, chi2,
-                        integral[8].renormalization.xaccel,
-                        integral[8].renormalization.yaccel
-                    )
+                    functions_I(I, 8)
                 );
         }
     }
-    if (gsl_finite(result)){
-    return
-        result*interp_spline(&bg->D1, z1)*interp_spline(&bg->D1, z2);
-    }
-    else{
-        fprintf(stderr,
-            "ERROR: in function %s, values:\n"
-            "mu = %e\n"
-            "z_mean = %e\n"
-            "chi_mean = %e\n"
-            "sep = %e\n"
-            "z1 = %e\n"
-            "z2 = %e\n"
-            "chi1 = %e\n"
-            "chi2 = %e\n",
-            __func__, mu, z_mean, chi_mean, sep, z1, z2, chi1, chi2);
-        exit(EXIT_FAILURE);
-    }
+    return result;
 }
 
-double functions_single_integrated(
+
+static void functions_nonintegrated_error(
+    const char *name,
+    double z_mean,
+    double mu,
+    double sep,
+    const struct functions_point *pt
+)
+{
+    fprintf(stderr,
+        "ERROR: in function %s, values:\n"
+        "mu = %e\n"
+        "z_mean = %e\n"
+        "chi_mean = %e\n"
+        "sep = %e\n"
+        "z1 = %e\n"
+        "z2 = %e\n"
+        "chi1 = %e\n"
+        "chi2 = %e\n",
+        name, mu, z_mean, pt->chi_mean, sep, pt->z1, pt->z2, pt->chi1, pt->chi2);
+    exit(EXIT_FAILURE);
+}
+
+
+double functions_nonintegrated(
     struct coffe_parameters_t *par,
     struct coffe_background_t *bg,
     struct coffe_integrals_t integral[],
     double z_mean,
     double mu,
+    double sep
+)
+{
+    coffe_profile_count(COFFE_PROFILE_NONINTEGRATED);
+    struct functions_point pt;
+    functions_nonintegrated_point(par, bg, z_mean, mu, sep, &pt);
+    struct functions_values I = {
+        .integral = integral, .sep = sep, .chi1 = pt.chi1, .chi2 = pt.chi2, .known = 0
+    };
+    const double result = functions_nonintegrated_sum(par, &pt, sep, &I);
+    if (!gsl_finite(result)){
+        functions_nonintegrated_error(__func__, z_mean, mu, sep, &pt);
+    }
+    return
+        result*pt.D1_1*pt.D1_2;
+}
+
+
+int functions_nonintegrated_multipoles(
+    struct coffe_parameters_t *par,
+    struct coffe_background_t *bg,
+    struct coffe_integrals_t integral[],
+    double z_mean,
     double sep,
-    double x
+    const struct coffe_gauss_rule *rule,
+    double *result
 )
 {
-    double result = 0;
-    int len =
-        par->correlation_sources_len
-       *(par->correlation_sources_len + 1)/2;
+    memset(result, 0, sizeof(double)*rule->l_len);
 
-    double chi_mean = interp_spline(&bg->comoving_distance, z_mean);
-    double chi1 = chi_mean - sep*mu/2.;
-    double chi2 = chi_mean + sep*mu/2.;
-    double costheta =
+    /* only the renormalized I^4_0 depends on mu, the rest is looked up once */
+    struct functions_values I = {.integral = integral, .sep = sep, .known = 0};
+    for (int k = 0; k<8; ++k){
+        functions_I(&I, k);
+    }
+
+    for (size_t n = 0; n<rule->order; ++n){
+        coffe_profile_count(COFFE_PROFILE_NONINTEGRATED);
+        const double mu = 2*rule->x[n] - 1;
+        struct functions_point pt;
+        functions_nonintegrated_point(par, bg, z_mean, mu, sep, &pt);
+        I.chi1 = pt.chi1, I.chi2 = pt.chi2;
+        I.known &= ~(1u << 8);
+        const double value = functions_nonintegrated_sum(par, &pt, sep, &I)*pt.D1_1*pt.D1_2;
+        if (!gsl_finite(value)){
+            functions_nonintegrated_error(__func__, z_mean, mu, sep, &pt);
+        }
+        for (size_t i = 0; i<rule->l_len; ++i){
+            result[i] +=
+                (2*rule->l[i] + 1)*rule->w[n]*rule->legendre[i*rule->order + n]*value;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+    the geometry and background of a point (z_mean, mu, sep, x) of the
+    single integrated terms, with the distances and redshifts at both
+    ends of the pair (chi1, chi2) and on both lines of sight (lambda1, lambda2)
+**/
+
+struct functions_single_point
+{
+    double z_mean, mu, sep, x;
+    double chi_mean, chi1, chi2, costheta, lambda1, lambda2, r21, r22;
+    double z1, z2, z1_const, z2_const;
+    struct coffe_background_point back1, back2, back1_const, back2_const;
+};
+
+
+/**
+    the geometry of a point of the single integrated terms, which is
+    only arithmetic given chi_mean; inline and without branches, so the
+    batches can compute it over arrays of points with SIMD instructions
+**/
+
+static inline void functions_single_integrated_geometry(
+    double chi_mean,
+    double mu,
+    double sep,
+    double x,
+    double *chi1,
+    double *chi2,
+    double *costheta,
+    double *lambda1,
+    double *lambda2,
+    double *r21,
+    double *r22
+)
+{
+    const double c1 = chi_mean - sep*mu/2.;
+    const double c2 = chi_mean + sep*mu/2.;
+    const double cos =
         (2*chi_mean*chi_mean - sep*sep + mu*mu*sep*sep/2.)
        /(2*chi_mean*chi_mean - mu*mu*sep*sep/2.);
-    double lambda1 = chi1*x, lambda2 = chi2*x;
+    const double l1 = c1*x, l2 = c2*x;
+    *chi1 = c1, *chi2 = c2, *costheta = cos, *lambda1 = l1, *lambda2 = l2;
+    *r21 = fmax(l2*l2 + c1*c1 - 2*c1*l2*cos, 0.0);
+    *r22 = fmax(l1*l1 + c2*c2 - 2*c2*l1*cos, 0.0);
+}
 
-    double r21 = lambda2*lambda2 + chi1*chi1 - 2*chi1*lambda2*costheta;
-    double r22 = lambda1*lambda1 + chi2*chi2 - 2*chi2*lambda1*costheta;
-    if (r21 < 0) r21 = 0;
-    if (r22 < 0) r22 = 0;
-    double z1_const = interp_spline(&bg->z_as_chi, chi1);
-    double z2_const = interp_spline(&bg->z_as_chi, chi2);
-    double z1 = interp_spline(&bg->z_as_chi, lambda1);
-    double z2 = interp_spline(&bg->z_as_chi, lambda2);
+
+/**
+    the sum of the single integrated terms at the point <pt>,
+    with the biases and the I^n_l looked up here
+**/
+
+static double functions_single_integrated_sum(
+    struct coffe_parameters_t *par,
+    struct coffe_background_t *bg,
+    struct coffe_integrals_t integral[],
+    const struct functions_single_point *pt
+)
+{
+    double result = 0;
+
+    const double z_mean = pt->z_mean, mu = pt->mu, sep = pt->sep, x = pt->x;
+    const double chi_mean = pt->chi_mean, chi1 = pt->chi1, chi2 = pt->chi2;
+    const double costheta = pt->costheta, lambda1 = pt->lambda1, lambda2 = pt->lambda2;
+    const double r21 = pt->r21, r22 = pt->r22;
+    const double z1 = pt->z1, z2 = pt->z2, z1_const = pt->z1_const, z2_const = pt->z2_const;
+    const struct coffe_background_point back1 = pt->back1, back2 = pt->back2;
+    const struct coffe_background_point back1_const = pt->back1_const, back2_const = pt->back2_const;
 
     double s1 = interp_spline(&par->magnification_bias1, z1_const);
     double s2 = interp_spline(&par->magnification_bias2, z2_const);
@@ -589,36 +642,30 @@ double functions_single_integrated(
         if (r21 == 0.0) ren1 = interp_spline(&integral[8].renormalization0, lambda2);
         else ren1 = interp_spline(&integral[8].result, sqrt(r21))
                     /* renormalization term */
-                   -gsl_spline2d_eval(
-                        integral[8].renormalization.spline,
-                        lambda2, chi1,
-                        integral[8].renormalization.xaccel,
-                        integral[8].renormalization.yaccel
+                   -interp_spline2d(
+                        &integral[8].renormalization,
+                        lambda2, chi1
                 );
         if (r22 == 0.0) ren2 = interp_spline(&integral[8].renormalization0, lambda1);
         else ren2 = interp_spline(&integral[8].result, sqrt(r22))
                     /* renormalization term */
-                   -gsl_spline2d_eval(
-                        integral[8].renormalization.spline,
-                        lambda1, chi2,
-                        integral[8].renormalization.xaccel,
-                        integral[8].renormalization.yaccel
+                   -interp_spline2d(
+                        &integral[8].renormalization,
+                        lambda1, chi2
                 );
     }
 
-    for (int i = 0; i<len; ++i){
+    for (int i = 0; i<par->single_terms.len; ++i){
+        const int term = par->single_terms.value[i];
         /* den-len + len-den term */
-        if (
-            strcmp(par->corr_terms[i], "09") == 0 ||
-            strcmp(par->corr_terms[i], "90") == 0
-        ){
+        if (term == COFFE_TERM(COFFE_DEN, COFFE_LEN)){
             if (r21 != 0.0 && r22 != 0.0){
                 result +=
                    -3*par->Omega0_m/2.
                    *(
-                        b1*(2 - 5*s2)*interp_spline(&bg->D1, z1_const)*chi2
+                        b1*(2 - 5*s2)*back1_const.D1*chi2
                         /* integrand */
-                       *(1 - x)*interp_spline(&bg->D1, z2)/interp_spline(&bg->a, z2)
+                       *(1 - x)*back2.D1/back2.a
                        *(
                             2*chi1*costheta*interp_spline(&integral[3].result, sqrt(r21))
                            -chi1*chi1*lambda2*(1 - costheta*costheta)
@@ -626,9 +673,9 @@ double functions_single_integrated(
                            /r21
                         )
                         +
-                        b2*(2 - 5*s1)*interp_spline(&bg->D1, z2_const)*chi1
+                        b2*(2 - 5*s1)*back2_const.D1*chi1
                         /* integrand */
-                       *(1 - x)*interp_spline(&bg->D1, z1)/interp_spline(&bg->a, z1)
+                       *(1 - x)*back1.D1/back1.a
                        *(
                             2*chi2*costheta*interp_spline(&integral[3].result, sqrt(r22))
                            -chi2*chi2*lambda1*(1 - costheta*costheta)
@@ -641,16 +688,16 @@ double functions_single_integrated(
                 result +=
                    -3*par->Omega0_m/2.
                    *(
-                        b1*(2 - 5*s2)*interp_spline(&bg->D1, z1_const)*chi2
+                        b1*(2 - 5*s2)*back1_const.D1*chi2
                         /* integrand */
-                       *(1 - x)*interp_spline(&bg->D1, z2)/interp_spline(&bg->a, z2)
+                       *(1 - x)*back2.D1/back2.a
                        *(
                             2*chi1*interp_spline(&integral[3].result, 0.0)
                         )
                         +
-                        b2*(2 - 5*s1)*interp_spline(&bg->D1, z2_const)*chi1
+                        b2*(2 - 5*s1)*back2_const.D1*chi1
                         /* integrand */
-                       *(1 - x)*interp_spline(&bg->D1, z1)/interp_spline(&bg->a, z1)
+                       *(1 - x)*back1.D1/back1.a
                        *(
                             2*chi2*costheta*interp_spline(&integral[3].result, sqrt(r22))
                            -chi2*chi2*lambda1*(1 - costheta*costheta)
@@ -663,9 +710,9 @@ double functions_single_integrated(
                 result +=
                    -3*par->Omega0_m/2.
                    *(
-                        b1*(2 - 5*s2)*interp_spline(&bg->D1, z1_const)*chi2
+                        b1*(2 - 5*s2)*back1_const.D1*chi2
                         /* integrand */
-                       *(1 - x)*interp_spline(&bg->D1, z2)/interp_spline(&bg->a, z2)
+                       *(1 - x)*back2.D1/back2.a
                        *(
                             2*chi1*costheta*interp_spline(&integral[3].result, sqrt(r21))
                            -chi1*chi1*lambda2*(1 - costheta*costheta)
@@ -673,9 +720,9 @@ double functions_single_integrated(
                            /r21
                         )
                         +
-                        b2*(2 - 5*s1)*interp_spline(&bg->D1, z2_const)*chi1
+                        b2*(2 - 5*s1)*back2_const.D1*chi1
                         /* integrand */
-                       *(1 - x)*interp_spline(&bg->D1, z1)/interp_spline(&bg->a, z1)
+                       *(1 - x)*back1.D1/back1.a
                        *(
                             2*chi2*interp_spline(&integral[3].result, 0.0)
                         )
@@ -685,16 +732,16 @@ double functions_single_integrated(
                 result +=
                    -3*par->Omega0_m/2.
                    *(
-                        b1*(2 - 5*s2)*interp_spline(&bg->D1, z1_const)
+                        b1*(2 - 5*s2)*back1_const.D1
                         /* integrand */
-                       *(1 - x)*interp_spline(&bg->D1, z2)/interp_spline(&bg->a, z2)
+                       *(1 - x)*back2.D1/back2.a
                        *(
                             2*chi1*chi2*interp_spline(&integral[3].result, 0.0)
                         )
                         +
-                        b2*(2 - 5*s1)*interp_spline(&bg->D1, z2_const)
+                        b2*(2 - 5*s1)*back2_const.D1
                         /* integrand */
-                       *(1 - x)*interp_spline(&bg->D1, z1)/interp_spline(&bg->a, z1)
+                       *(1 - x)*back1.D1/back1.a
                        *(
                             2*chi2*chi1*interp_spline(&integral[3].result, 0.0)
                         )
@@ -702,18 +749,15 @@ double functions_single_integrated(
             }
         }
         /* rsd-len + len-rsd term */
-        else if (
-            strcmp(par->corr_terms[i], "19") == 0 ||
-            strcmp(par->corr_terms[i], "91") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_RSD, COFFE_LEN)){
             if (r21 != 0 && r22 != 0){
                 result +=
                     /* constant in front */
                     3*par->Omega0_m/2.
                    *(
-                        chi2*interp_spline(&bg->f, z1_const)*(2 - 5*s2)*interp_spline(&bg->D1, z1_const)
+                        chi2*back1_const.f*(2 - 5*s2)*back1_const.D1
                         /* integrand */
-                       *(1 - x)*interp_spline(&bg->D1, z2)/interp_spline(&bg->a, z2)
+                       *(1 - x)*back2.D1/back2.a
                        *(
                             (lambda2 - 6*chi1*costheta + 3*lambda2*(2*costheta*costheta - 1))
                            *interp_spline(&integral[0].result, sqrt(r21))/15.
@@ -725,9 +769,9 @@ double functions_single_integrated(
                            *interp_spline(&integral[1].result, sqrt(r21))/r21/21.
                         )
                         +
-                        chi1*interp_spline(&bg->f, z2_const)*(2 - 5*s1)*interp_spline(&bg->D1, z2_const)
+                        chi1*back2_const.f*(2 - 5*s1)*back2_const.D1
                         /* integrand */
-                       *(1 - x)*interp_spline(&bg->D1, z1)/interp_spline(&bg->a, z1)
+                       *(1 - x)*back1.D1/back1.a
                        *(
                             (lambda1 - 6*chi2*costheta + 3*lambda1*(2*costheta*costheta - 1))
                            *interp_spline(&integral[0].result, sqrt(r22))/15.
@@ -743,9 +787,9 @@ double functions_single_integrated(
                     result +=
                     3*par->Omega0_m/2.
                    *(
-                        chi2*interp_spline(&bg->f, z1_const)*(2 - 5*s2)*interp_spline(&bg->D1, z1_const)
+                        chi2*back1_const.f*(2 - 5*s2)*back1_const.D1
                         /* integrand */
-                       *(1 - x)*interp_spline(&bg->D1, z2)/interp_spline(&bg->a, z2)
+                       *(1 - x)*back2.D1/back2.a
                        *(
                            -(
                                -4*pow(chi1, 5)*costheta
@@ -758,9 +802,9 @@ double functions_single_integrated(
                            *interp_spline(&integral[2].result, sqrt(r21))/r21/r21/35.
                         )
                         +
-                        chi1*interp_spline(&bg->f, z2_const)*(2 - 5*s1)*interp_spline(&bg->D1, z2_const)
+                        chi1*back2_const.f*(2 - 5*s1)*back2_const.D1
                         /* integrand */
-                       *(1 - x)*interp_spline(&bg->D1, z1)/interp_spline(&bg->a, z1)
+                       *(1 - x)*back1.D1/back1.a
                        *(
                            -(
                                -4*pow(chi2, 5)*costheta
@@ -778,14 +822,14 @@ double functions_single_integrated(
                     result +=
                     3*par->Omega0_m/2.
                    *(
-                        chi2*interp_spline(&bg->f, z1_const)*(2 - 5*s2)*interp_spline(&bg->D1, z1_const)
+                        chi2*back1_const.f*(2 - 5*s2)*back1_const.D1
                         /* integrand */
-                       *(1 - x)*interp_spline(&bg->D1, z2)/interp_spline(&bg->a, z2)
+                       *(1 - x)*back2.D1/back2.a
                        *4.*(lambda2 + chi1)*interp_spline(&integral[2].result, sqrt(r21))/35.
                         +
-                        chi1*interp_spline(&bg->f, z2_const)*(2 - 5*s1)*interp_spline(&bg->D1, z2_const)
+                        chi1*back2_const.f*(2 - 5*s1)*back2_const.D1
                         /* integrand */
-                       *(1 - x)*interp_spline(&bg->D1, z1)/interp_spline(&bg->a, z1)
+                       *(1 - x)*back1.D1/back1.a
                        *4.*(lambda1 + chi2)*interp_spline(&integral[2].result, sqrt(r22))/35.
                     );
                 }
@@ -794,16 +838,16 @@ double functions_single_integrated(
                 result +=
                     3*par->Omega0_m/2.
                    *(
-                        chi2*interp_spline(&bg->f, z1_const)*(2 - 5*s2)*interp_spline(&bg->D1, z1_const)
+                        chi2*back1_const.f*(2 - 5*s2)*back1_const.D1
                         /* integrand */
-                       *(1 - chi1/chi2)*interp_spline(&bg->D1, z2)/interp_spline(&bg->a, z2)
+                       *(1 - chi1/chi2)*back2.D1/back2.a
                        *(
                            -2*chi1*interp_spline(&integral[0].result, 0.0)/15.
                         )
                         +
-                        chi1*interp_spline(&bg->f, z2_const)*(2 - 5*s1)*interp_spline(&bg->D1, z2_const)
+                        chi1*back2_const.f*(2 - 5*s1)*back2_const.D1
                         /* integrand */
-                       *(1 - x)*interp_spline(&bg->D1, z1)/interp_spline(&bg->a, z1)
+                       *(1 - x)*back1.D1/back1.a
                        *(
                             (lambda1 - 6*chi2*costheta + 3*lambda1*(2*costheta*costheta - 1))
                            *interp_spline(&integral[0].result, sqrt(r22))/15.
@@ -830,9 +874,9 @@ double functions_single_integrated(
                     /* constant in front */
                     3*par->Omega0_m/2.
                    *(
-                        chi2*interp_spline(&bg->f, z1_const)*(2 - 5*s2)*interp_spline(&bg->D1, z1_const)
+                        chi2*back1_const.f*(2 - 5*s2)*back1_const.D1
                         /* integrand */
-                       *(1 - x)*interp_spline(&bg->D1, z2)/interp_spline(&bg->a, z2)
+                       *(1 - x)*back2.D1/back2.a
                        *(
                             (lambda2 - 6*chi1*costheta + 3*lambda2*(2*costheta*costheta - 1))
                            *interp_spline(&integral[0].result, sqrt(r21))/15.
@@ -853,9 +897,9 @@ double functions_single_integrated(
                            *interp_spline(&integral[2].result, sqrt(r21))/r21/r21/35.
                         )
                         +
-                        chi1*interp_spline(&bg->f, z2_const)*(2 - 5*s1)*interp_spline(&bg->D1, z2_const)
+                        chi1*back2_const.f*(2 - 5*s1)*back2_const.D1
                         /* integrand */
-                       *(1 - chi2/chi1)*interp_spline(&bg->D1, z1)/interp_spline(&bg->a, z1)
+                       *(1 - chi2/chi1)*back1.D1/back1.a
                        *(
                           -2*chi2*interp_spline(&integral[0].result, 0.0)/15.
                         )
@@ -865,16 +909,16 @@ double functions_single_integrated(
                 result +=
                     3*par->Omega0_m/2.
                    *(
-                        chi2*interp_spline(&bg->f, z1_const)*(2 - 5*s2)*interp_spline(&bg->D1, z1_const)
+                        chi2*back1_const.f*(2 - 5*s2)*back1_const.D1
                         /* integrand */
-                       *(1 - chi1/chi2)*interp_spline(&bg->D1, z2)/interp_spline(&bg->a, z2)
+                       *(1 - chi1/chi2)*back2.D1/back2.a
                        *(
                           -2*chi1*interp_spline(&integral[0].result, 0.0)/15.
                         )
                         +
-                        chi1*interp_spline(&bg->f, z2_const)*(2 - 5*s1)*interp_spline(&bg->D1, z2_const)
+                        chi1*back2_const.f*(2 - 5*s1)*back2_const.D1
                         /* integrand */
-                       *(1 - chi2/chi1)*interp_spline(&bg->D1, z1)/interp_spline(&bg->a, z1)
+                       *(1 - chi2/chi1)*back1.D1/back1.a
                        *(
                            -2*chi2*interp_spline(&integral[0].result, 0.0)/15.
                         )
@@ -882,19 +926,16 @@ double functions_single_integrated(
             }
         }
         /* d1-len + len-d1 term */
-        else if (
-            strcmp(par->corr_terms[i], "29") == 0 ||
-            strcmp(par->corr_terms[i], "92") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_D1, COFFE_LEN)){
             if (r21 != 0 && r22 != 0){
                 result +=
                     /* constant in front */
                     3*par->Omega0_m/2.
                    *(
-                        chi2*interp_spline(&bg->conformal_Hz, z1_const)*interp_spline(&bg->f, z1_const)
-                       *interp_spline(&bg->G1, z1_const)*(2 - 5*s2)*interp_spline(&bg->D1, z1_const)
+                        chi2*back1_const.conformal_Hz*back1_const.f
+                       *back1_const.G1*(2 - 5*s2)*back1_const.D1
                         /* integrand */
-                       *(1 - x)*interp_spline(&bg->D1, z2)/interp_spline(&bg->a, z2)
+                       *(1 - x)*back2.D1/back2.a
                        *(
                             2*(costheta*(lambda2*lambda2 - 2*chi1*chi1) + chi1*lambda2*(2*(2*costheta*costheta - 1) - 1))
                            *interp_spline(&integral[3].result, sqrt(r21))/15.
@@ -908,10 +949,10 @@ double functions_single_integrated(
                             )*interp_spline(&integral[4].result, sqrt(r21))/r21/15.
                         )
                         +
-                        chi1*interp_spline(&bg->conformal_Hz, z2_const)*interp_spline(&bg->f, z2_const)
-                       *interp_spline(&bg->G1, z2_const)*(2 - 5*s2)*interp_spline(&bg->D1, z2_const)
+                        chi1*back2_const.conformal_Hz*back2_const.f
+                       *back2_const.G1*(2 - 5*s2)*back2_const.D1
                         /* integrand */
-                       *(1 - x)*interp_spline(&bg->D1, z1)/interp_spline(&bg->a, z1)
+                       *(1 - x)*back1.D1/back1.a
                        *(
                             2*(costheta*(lambda1*lambda1 - 2*chi2*chi2) + chi2*lambda1*(2*(2*costheta*costheta - 1) - 1))
                            *interp_spline(&integral[3].result, sqrt(r22))/15.
@@ -931,18 +972,18 @@ double functions_single_integrated(
                     /* constant in front */
                     3*par->Omega0_m/2.
                    *(
-                        chi2*interp_spline(&bg->conformal_Hz, z1_const)*interp_spline(&bg->f, z1_const)
-                       *interp_spline(&bg->G1, z1_const)*(2 - 5*s2)*interp_spline(&bg->D1, z1_const)
+                        chi2*back1_const.conformal_Hz*back1_const.f
+                       *back1_const.G1*(2 - 5*s2)*back1_const.D1
                         /* integrand */
-                       *(1 - x)*interp_spline(&bg->D1, z2)/interp_spline(&bg->a, z2)
+                       *(1 - x)*back2.D1/back2.a
                        *(
                            2*interp_spline(&integral[5].result, 0.0)/3.
                         )
                         +
-                        chi1*interp_spline(&bg->conformal_Hz, z2_const)*interp_spline(&bg->f, z2_const)
-                       *interp_spline(&bg->G1, z2_const)*(2 - 5*s2)*interp_spline(&bg->D1, z2_const)
+                        chi1*back2_const.conformal_Hz*back2_const.f
+                       *back2_const.G1*(2 - 5*s2)*back2_const.D1
                         /* integrand */
-                       *(1 - x)*interp_spline(&bg->D1, z1)/interp_spline(&bg->a, z1)
+                       *(1 - x)*back1.D1/back1.a
                        *(
                             2*(costheta*(lambda1*lambda1 - 2*chi2*chi2) + chi2*lambda1*(2*(2*costheta*costheta - 1) - 1))
                            *interp_spline(&integral[3].result, sqrt(r22))/15.
@@ -962,10 +1003,10 @@ double functions_single_integrated(
                     /* constant in front */
                     3*par->Omega0_m/2.
                    *(
-                        chi2*interp_spline(&bg->conformal_Hz, z1_const)*interp_spline(&bg->f, z1_const)
-                       *interp_spline(&bg->G1, z1_const)*(2 - 5*s2)*interp_spline(&bg->D1, z1_const)
+                        chi2*back1_const.conformal_Hz*back1_const.f
+                       *back1_const.G1*(2 - 5*s2)*back1_const.D1
                         /* integrand */
-                       *(1 - x)*interp_spline(&bg->D1, z2)/interp_spline(&bg->a, z2)
+                       *(1 - x)*back2.D1/back2.a
                        *(
                             2*(costheta*(lambda2*lambda2 - 2*chi1*chi1) + chi1*lambda2*(2*(2*costheta*costheta - 1) - 1))
                            *interp_spline(&integral[3].result, sqrt(r21))/15.
@@ -979,10 +1020,10 @@ double functions_single_integrated(
                             )*interp_spline(&integral[4].result, sqrt(r21))/r21/15.
                         )
                         +
-                        chi1*interp_spline(&bg->conformal_Hz, z2_const)*interp_spline(&bg->f, z2_const)
-                       *interp_spline(&bg->G1, z2_const)*(2 - 5*s2)*interp_spline(&bg->D1, z2_const)
+                        chi1*back2_const.conformal_Hz*back2_const.f
+                       *back2_const.G1*(2 - 5*s2)*back2_const.D1
                         /* integrand */
-                       *(1 - x)*interp_spline(&bg->D1, z1)/interp_spline(&bg->a, z1)
+                       *(1 - x)*back1.D1/back1.a
                        *(
                            2*interp_spline(&integral[5].result, 0.0)/3.
                         )
@@ -993,18 +1034,18 @@ double functions_single_integrated(
                     /* constant in front */
                     3*par->Omega0_m/2.
                    *(
-                        chi2*interp_spline(&bg->conformal_Hz, z1_const)*interp_spline(&bg->f, z1_const)
-                       *interp_spline(&bg->G1, z1_const)*(2 - 5*s2)*interp_spline(&bg->D1, z1_const)
+                        chi2*back1_const.conformal_Hz*back1_const.f
+                       *back1_const.G1*(2 - 5*s2)*back1_const.D1
                         /* integrand */
-                       *(1 - x)*interp_spline(&bg->D1, z2)/interp_spline(&bg->a, z2)
+                       *(1 - x)*back2.D1/back2.a
                        *(
                            2*interp_spline(&integral[5].result, 0.0)/3.
                         )
                         +
-                        chi1*interp_spline(&bg->conformal_Hz, z2_const)*interp_spline(&bg->f, z2_const)
-                       *interp_spline(&bg->G1, z2_const)*(2 - 5*s2)*interp_spline(&bg->D1, z2_const)
+                        chi1*back2_const.conformal_Hz*back2_const.f
+                       *back2_const.G1*(2 - 5*s2)*back2_const.D1
                         /* integrand */
-                       *(1 - x)*interp_spline(&bg->D1, z1)/interp_spline(&bg->a, z1)
+                       *(1 - x)*back1.D1/back1.a
                        *(
                            2*interp_spline(&integral[5].result, 0.0)/3.
                         )
@@ -1012,30 +1053,27 @@ double functions_single_integrated(
             }
         }
         /* d2-len + len-d2 term */
-        else if (
-            strcmp(par->corr_terms[i], "39") == 0 ||
-            strcmp(par->corr_terms[i], "93") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_D2, COFFE_LEN)){
             result +=
                 /* constant in front */
                -3*par->Omega0_m/2.
                *(
-                    chi2*(3 - interp_spline(&par->evolution_bias1, z1_const))*interp_spline(&bg->f, z1_const)
-                   *pow(interp_spline(&bg->conformal_Hz, z1_const), 2)*(2 - 5*s2)*interp_spline(&bg->D1, z1_const)
+                    chi2*(3 - interp_spline(&par->evolution_bias1, z1_const))*back1_const.f
+                   *pow(back1_const.conformal_Hz, 2)*(2 - 5*s2)*back1_const.D1
                    *(
                         /* integrand */
-                        (1 - x)*interp_spline(&bg->D1, z2)/interp_spline(&bg->a, z2)
+                        (1 - x)*back2.D1/back2.a
                        *(
                             2*chi1*costheta*interp_spline(&integral[7].result, sqrt(r21))
                            -chi1*chi1*lambda2*(1 - costheta*costheta)*interp_spline(&integral[6].result, sqrt(r21))
                         )
                     )
                     +
-                    chi1*(3 - interp_spline(&par->evolution_bias2, z2_const))*interp_spline(&bg->f, z2_const)
-                   *pow(interp_spline(&bg->conformal_Hz, z2_const), 2)*(2 - 5*s1)*interp_spline(&bg->D1, z2_const)
+                    chi1*(3 - interp_spline(&par->evolution_bias2, z2_const))*back2_const.f
+                   *pow(back2_const.conformal_Hz, 2)*(2 - 5*s1)*back2_const.D1
                    *(
                         /* integrand */
-                        (1 - x)*interp_spline(&bg->D1, z1)/interp_spline(&bg->a, z1)
+                        (1 - x)*back1.D1/back1.a
                        *(
                             2*chi2*costheta*interp_spline(&integral[7].result, sqrt(r22))
                            -chi2*chi2*lambda1*(1 - costheta*costheta)*interp_spline(&integral[6].result, sqrt(r22))
@@ -1044,28 +1082,25 @@ double functions_single_integrated(
                 );
         }
         /* g1-len + len-g1 term */
-        else if (
-            strcmp(par->corr_terms[i], "49") == 0 ||
-            strcmp(par->corr_terms[i], "94") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_G1, COFFE_LEN)){
             result +=
                 /* constant in front */
                 9*par->Omega0_m*par->Omega0_m/4.
                *(
-                    chi2*(1 + interp_spline(&bg->G1, z1_const))*(2 - 5*s2)*interp_spline(&bg->D1, z1_const)
+                    chi2*(1 + back1_const.G1)*(2 - 5*s2)*back1_const.D1
                    *(
                         /* integrand */
-                        (1 - x)*interp_spline(&bg->D1, z2)/interp_spline(&bg->a, z2)
+                        (1 - x)*back2.D1/back2.a
                        *(
                             2*chi1*costheta*interp_spline(&integral[7].result, sqrt(r21))
                            -chi1*chi1*lambda2*(1 - costheta*costheta)*interp_spline(&integral[6].result, sqrt(r21))
                         )
                     )
                     +
-                    chi1*(1 + interp_spline(&bg->G2, z2_const))*(2 - 5*s1)*interp_spline(&bg->D1, z2_const)
+                    chi1*(1 + back2_const.G2)*(2 - 5*s1)*back2_const.D1
                    *(
                         /* integrand */
-                        (1 - x)*interp_spline(&bg->D1, z1)/interp_spline(&bg->a, z1)
+                        (1 - x)*back1.D1/back1.a
                        *(
                             2*chi2*costheta*interp_spline(&integral[7].result, sqrt(r22))
                            -chi2*chi2*lambda1*(1 - costheta*costheta)*interp_spline(&integral[6].result, sqrt(r22))
@@ -1074,28 +1109,25 @@ double functions_single_integrated(
                 );
         }
         /* g2-len + len-g2 term */
-        else if (
-            strcmp(par->corr_terms[i], "59") == 0 ||
-            strcmp(par->corr_terms[i], "95") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_G2, COFFE_LEN)){
             result +=
                 /* constant in front */
                 9*par->Omega0_m*par->Omega0_m/4.
                *(
-                    chi2*(5*s1 - 2)*(2 - 5*s2)*interp_spline(&bg->D1, z1_const)
+                    chi2*(5*s1 - 2)*(2 - 5*s2)*back1_const.D1
                    *(
                         /* integrand */
-                        (1 - x)*interp_spline(&bg->D1, z2)/interp_spline(&bg->a, z2)
+                        (1 - x)*back2.D1/back2.a
                        *(
                             2*chi1*costheta*interp_spline(&integral[7].result, sqrt(r21))
                            -chi1*chi1*lambda2*(1 - costheta*costheta)*interp_spline(&integral[6].result, sqrt(r21))
                         )
                     )
                     +
-                    chi1*(5*s2 - 2)*(2 - 5*s1)*interp_spline(&bg->D1, z2_const)
+                    chi1*(5*s2 - 2)*(2 - 5*s1)*back2_const.D1
                    *(
                         /* integrand */
-                        (1 - x)*interp_spline(&bg->D1, z1)/interp_spline(&bg->a, z1)
+                        (1 - x)*back1.D1/back1.a
                        *(
                             2*chi2*costheta*interp_spline(&integral[7].result, sqrt(r22))
                            -chi2*chi2*lambda1*(1 - costheta*costheta)*interp_spline(&integral[6].result, sqrt(r22))
@@ -1104,28 +1136,25 @@ double functions_single_integrated(
                 );
         }
         /* g3-len + len-g3 term */
-        else if (
-            strcmp(par->corr_terms[i], "69") == 0 ||
-            strcmp(par->corr_terms[i], "96") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_G3, COFFE_LEN)){
             result +=
                 /* constant in front */
                 9*par->Omega0_m*par->Omega0_m/4.
                *(
-                    chi2*(interp_spline(&bg->f, z1_const) - 1)*(2 - 5*s2)*interp_spline(&bg->D1, z1_const)
+                    chi2*(back1_const.f - 1)*(2 - 5*s2)*back1_const.D1
                    *(
                         /* integrand */
-                        (1 - x)*interp_spline(&bg->D1, z2)/interp_spline(&bg->a, z2)
+                        (1 - x)*back2.D1/back2.a
                        *(
                             2*chi1*costheta*interp_spline(&integral[7].result, sqrt(r21))
                            -chi1*chi1*lambda2*(1 - costheta*costheta)*interp_spline(&integral[6].result, sqrt(r21))
                         )
                     )
                     +
-                    chi1*(interp_spline(&bg->f, z2_const) - 1)*(2 - 5*s1)*interp_spline(&bg->D1, z2_const)
+                    chi1*(back2_const.f - 1)*(2 - 5*s1)*back2_const.D1
                    *(
                         /* integrand */
-                        (1 - x)*interp_spline(&bg->D1, z1)/interp_spline(&bg->a, z1)
+                        (1 - x)*back1.D1/back1.a
                        *(
                             2*chi2*costheta*interp_spline(&integral[7].result, sqrt(r22))
                            -chi2*chi2*lambda1*(1 - costheta*costheta)*interp_spline(&integral[6].result, sqrt(r22))
@@ -1134,67 +1163,58 @@ double functions_single_integrated(
                 );
         }
         /* den-g4 + g4-den term */
-        else if (
-            strcmp(par->corr_terms[i], "07") == 0 ||
-            strcmp(par->corr_terms[i], "70") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_DEN, COFFE_G4)){
             result +=
                 /* constant in front */
                -3*par->Omega0_m
                *(
-                    b1*(2 - 5*s2)*interp_spline(&bg->D1, z1_const)
+                    b1*(2 - 5*s2)*back1_const.D1
                     /* integrand */
-                   *interp_spline(&bg->D1, z2)/interp_spline(&bg->a, z2)
+                   *back2.D1/back2.a
                    *interp_spline(&integral[5].result, sqrt(r21))
                    +
-                    b2*(2 - 5*s1)*interp_spline(&bg->D1, z2_const)
+                    b2*(2 - 5*s1)*back2_const.D1
                     /* integrand */
-                   *interp_spline(&bg->D1, z1)/interp_spline(&bg->a, z1)
+                   *back1.D1/back1.a
                    *interp_spline(&integral[5].result, sqrt(r22))
                 );
         }
         /* den-g5 + g5-den term */
-        else if (
-            strcmp(par->corr_terms[i], "08") == 0 ||
-            strcmp(par->corr_terms[i], "80") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_DEN, COFFE_G5)){
             result +=
                 /* constant in front */
                -3*par->Omega0_m
                *(
-                    chi2*b1*interp_spline(&bg->G2, z2_const)*interp_spline(&bg->D1, z1_const)
+                    chi2*b1*back2_const.G2*back1_const.D1
                     /* integrand */
-                   *interp_spline(&bg->conformal_Hz, z2)*(interp_spline(&bg->f, z2) - 1)
-                   *interp_spline(&bg->D1, z2)*interp_spline(&bg->a, z2)
+                   *back2.conformal_Hz*(back2.f - 1)
+                   *back2.D1*back2.a
                    *interp_spline(&integral[5].result, sqrt(r21))
                    +
-                    chi1*b2*interp_spline(&bg->G1, z1_const)*interp_spline(&bg->D1, z2_const)
+                    chi1*b2*back1_const.G1*back2_const.D1
                     /* integrand */
-                   *interp_spline(&bg->conformal_Hz, z1)*(interp_spline(&bg->f, z1) - 1)
-                   *interp_spline(&bg->D1, z1)*interp_spline(&bg->a, z1)
+                   *back1.conformal_Hz*(back1.f - 1)
+                   *back1.D1*back1.a
                    *interp_spline(&integral[5].result, sqrt(r22))
                 );
         }
         /* rsd-g4 + g4-rsd term */
-        else if (
-            strcmp(par->corr_terms[i], "17") == 0 ||
-            strcmp(par->corr_terms[i], "71") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_RSD, COFFE_G4)){
             result +=
                 3*par->Omega0_m
                *(
-                    interp_spline(&bg->f, z1_const)*(2 - 5*s2)*interp_spline(&bg->D1, z1_const)
+                    back1_const.f*(2 - 5*s2)*back1_const.D1
                     /* integrand */
-                   *interp_spline(&bg->D1, z2)/interp_spline(&bg->a, z2)
+                   *back2.D1/back2.a
                    *(
                         (2*r21/3. + (costheta*costheta - 1)*lambda2*lambda2)
                        *interp_spline(&integral[6].result, sqrt(r21))
                        -interp_spline(&integral[5].result, sqrt(r21))/3.
                     )
                    +
-                    interp_spline(&bg->f, z2_const)*(2 - 5*s1)*interp_spline(&bg->D1, z2_const)
+                    back2_const.f*(2 - 5*s1)*back2_const.D1
                     /* integrand */
-                   *interp_spline(&bg->D1, z1)/interp_spline(&bg->a, z1)
+                   *back1.D1/back1.a
                    *(
                         (2*r22/3. + (costheta*costheta - 1)*lambda1*lambda1)
                        *interp_spline(&integral[6].result, sqrt(r22))
@@ -1203,27 +1223,24 @@ double functions_single_integrated(
                 );
         }
         /* rsd-g5 + g5-rsd term */
-        else if (
-            strcmp(par->corr_terms[i], "18") == 0 ||
-            strcmp(par->corr_terms[i], "81") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_RSD, COFFE_G5)){
             result +=
                 3*par->Omega0_m
                *(
-                    chi2*interp_spline(&bg->f, z1_const)*interp_spline(&bg->G2, z2_const)*interp_spline(&bg->D1, z1_const)
+                    chi2*back1_const.f*back2_const.G2*back1_const.D1
                     /* integrand */
-                   *interp_spline(&bg->conformal_Hz, z2)*(interp_spline(&bg->f, z2) - 1)
-                   *interp_spline(&bg->D1, z2)/interp_spline(&bg->a, z2)
+                   *back2.conformal_Hz*(back2.f - 1)
+                   *back2.D1/back2.a
                    *(
                         (2*r21/3. + (costheta*costheta - 1)*lambda2*lambda2)
                        *interp_spline(&integral[6].result, sqrt(r21))
                        -interp_spline(&integral[5].result, sqrt(r21))/3.
                     )
                    +
-                    chi1*interp_spline(&bg->f, z2_const)*interp_spline(&bg->G1, z1_const)*interp_spline(&bg->D1, z2_const)
+                    chi1*back2_const.f*back1_const.G1*back2_const.D1
                     /* integrand */
-                   *interp_spline(&bg->conformal_Hz, z1)*(interp_spline(&bg->f, z1) - 1)
-                   *interp_spline(&bg->D1, z1)/interp_spline(&bg->a, z1)
+                   *back1.conformal_Hz*(back1.f - 1)
+                   *back1.D1/back1.a
                    *(
                         (2*r22/3. + (costheta*costheta - 1)*lambda1*lambda1)
                        *interp_spline(&integral[6].result, sqrt(r22))
@@ -1232,207 +1249,177 @@ double functions_single_integrated(
                 );
         }
         /* d1-g4 + d1-g4 term */
-        else if (
-            strcmp(par->corr_terms[i], "27") == 0 ||
-            strcmp(par->corr_terms[i], "72") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_D1, COFFE_G4)){
             result +=
                 3*par->Omega0_m
                *(
-                    interp_spline(&bg->conformal_Hz, z1_const)*interp_spline(&bg->f, z1_const)*(2 - 5*s2)*interp_spline(&bg->D1, z1_const)
-                   *interp_spline(&bg->D1, z2)/interp_spline(&bg->a, z2)*(lambda2*costheta - chi1)
+                    back1_const.conformal_Hz*back1_const.f*(2 - 5*s2)*back1_const.D1
+                   *back2.D1/back2.a*(lambda2*costheta - chi1)
                    *interp_spline(&integral[7].result, sqrt(r21))
                    +
-                    interp_spline(&bg->conformal_Hz, z2_const)*interp_spline(&bg->f, z2_const)*(2 - 5*s1)*interp_spline(&bg->D1, z2_const)
-                   *interp_spline(&bg->D1, z1)/interp_spline(&bg->a, z1)*(lambda1*costheta - chi2)
+                    back2_const.conformal_Hz*back2_const.f*(2 - 5*s1)*back2_const.D1
+                   *back1.D1/back1.a*(lambda1*costheta - chi2)
                    *interp_spline(&integral[7].result, sqrt(r22))
                 );
         }
         /* d1-g5 + d1-g5 term */
-        else if (
-            strcmp(par->corr_terms[i], "28") == 0 ||
-            strcmp(par->corr_terms[i], "82") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_D1, COFFE_G5)){
             result +=
                 3*par->Omega0_m
                *(
-                    chi2*interp_spline(&bg->conformal_Hz, z1_const)*interp_spline(&bg->f, z1_const)
-                   *interp_spline(&bg->G2, z2_const)*interp_spline(&bg->D1, z1_const)
-                   *interp_spline(&bg->conformal_Hz, z2)*(interp_spline(&bg->f, z2) - 1)
-                   *interp_spline(&bg->D1, z2)/interp_spline(&bg->a, z2)*(lambda2*costheta - chi1)
+                    chi2*back1_const.conformal_Hz*back1_const.f
+                   *back2_const.G2*back1_const.D1
+                   *back2.conformal_Hz*(back2.f - 1)
+                   *back2.D1/back2.a*(lambda2*costheta - chi1)
                    *interp_spline(&integral[7].result, sqrt(r21))
                    +
-                    chi1*interp_spline(&bg->conformal_Hz, z2_const)*interp_spline(&bg->f, z2_const)
-                   *interp_spline(&bg->G1, z1_const)*interp_spline(&bg->D1, z2_const)
-                   *interp_spline(&bg->conformal_Hz, z1)*(interp_spline(&bg->f, z1) - 1)
-                   *interp_spline(&bg->D1, z1)/interp_spline(&bg->a, z1)*(lambda1*costheta - chi2)
+                    chi1*back2_const.conformal_Hz*back2_const.f
+                   *back1_const.G1*back2_const.D1
+                   *back1.conformal_Hz*(back1.f - 1)
+                   *back1.D1/back1.a*(lambda1*costheta - chi2)
                    *interp_spline(&integral[7].result, sqrt(r22))
                 );
         }
         /* d2-g4 + g4-d2 term */
-        else if (
-            strcmp(par->corr_terms[i], "37") == 0 ||
-            strcmp(par->corr_terms[i], "73") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_D2, COFFE_G4)){
             result +=
                -3*par->Omega0_m
                *(
-                    (3 - interp_spline(&par->evolution_bias1, z1_const))*interp_spline(&bg->f, z1_const)
-                   *pow(interp_spline(&bg->conformal_Hz, z1_const), 2)*(2 - 5*s2)*interp_spline(&bg->D1, z1_const)
-                   *interp_spline(&bg->D1, z2)/interp_spline(&bg->a, z2)
+                    (3 - interp_spline(&par->evolution_bias1, z1_const))*back1_const.f
+                   *pow(back1_const.conformal_Hz, 2)*(2 - 5*s2)*back1_const.D1
+                   *back2.D1/back2.a
                    *ren1
                    +
-                    (3 - interp_spline(&par->evolution_bias2, z2_const))*interp_spline(&bg->f, z2_const)
-                   *pow(interp_spline(&bg->conformal_Hz, z2_const), 2)*(2 - 5*s1)*interp_spline(&bg->D1, z2_const)
-                   *interp_spline(&bg->D1, z1)/interp_spline(&bg->a, z1)
+                    (3 - interp_spline(&par->evolution_bias2, z2_const))*back2_const.f
+                   *pow(back2_const.conformal_Hz, 2)*(2 - 5*s1)*back2_const.D1
+                   *back1.D1/back1.a
                    *ren2
                 );
         }
         /* d2-g5 + g5-d2 term */
-        else if (
-            strcmp(par->corr_terms[i], "38") == 0 ||
-            strcmp(par->corr_terms[i], "83") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_D2, COFFE_G5)){
             result +=
                -3*par->Omega0_m
                *(
-                    chi2*(3 - interp_spline(&par->evolution_bias1, z1_const))*interp_spline(&bg->f, z1_const)
-                   *pow(interp_spline(&bg->conformal_Hz, z1_const), 2)*interp_spline(&bg->G2, z2_const)*interp_spline(&bg->D1, z1_const)
-                   *interp_spline(&bg->conformal_Hz, z2)*(interp_spline(&bg->f, z2) - 1)
-                   *interp_spline(&bg->D1, z2)/interp_spline(&bg->a, z2)
+                    chi2*(3 - interp_spline(&par->evolution_bias1, z1_const))*back1_const.f
+                   *pow(back1_const.conformal_Hz, 2)*back2_const.G2*back1_const.D1
+                   *back2.conformal_Hz*(back2.f - 1)
+                   *back2.D1/back2.a
                    *ren1
                    +
-                    chi1*(3 - interp_spline(&par->evolution_bias2, z2_const))*interp_spline(&bg->f, z2_const)
-                   *pow(interp_spline(&bg->conformal_Hz, z2_const), 2)*interp_spline(&bg->G1, z1_const)*interp_spline(&bg->D1, z2_const)
-                   *interp_spline(&bg->conformal_Hz, z1)*(interp_spline(&bg->f, z1) - 1)
-                   *interp_spline(&bg->D1, z1)/interp_spline(&bg->a, z1)
+                    chi1*(3 - interp_spline(&par->evolution_bias2, z2_const))*back2_const.f
+                   *pow(back2_const.conformal_Hz, 2)*back1_const.G1*back2_const.D1
+                   *back1.conformal_Hz*(back1.f - 1)
+                   *back1.D1/back1.a
                    *ren2
                 );
         }
         /* g1-g4 + g4-g1 term */
-        else if (
-            strcmp(par->corr_terms[i], "47") == 0 ||
-            strcmp(par->corr_terms[i], "74") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_G1, COFFE_G4)){
             result +=
                 9*par->Omega0_m*par->Omega0_m/2.
                *(
-                    (1 + interp_spline(&bg->G1, z1_const))*(2 - 5*s2)
-                   *interp_spline(&bg->D1, z1_const)/interp_spline(&bg->a, z1_const)
+                    (1 + back1_const.G1)*(2 - 5*s2)
+                   *back1_const.D1/back1_const.a
                     /* integrand */
-                   *interp_spline(&bg->D1, z2)/interp_spline(&bg->a, z2)*ren1
+                   *back2.D1/back2.a*ren1
                     +
-                    (1 + interp_spline(&bg->G2, z2_const))*(2 - 5*s1)
-                   *interp_spline(&bg->D1, z2_const)/interp_spline(&bg->a, z2_const)
+                    (1 + back2_const.G2)*(2 - 5*s1)
+                   *back2_const.D1/back2_const.a
                     /* integrand */
-                   *interp_spline(&bg->D1, z1)/interp_spline(&bg->a, z1)*ren2
+                   *back1.D1/back1.a*ren2
                 );
         }
         /* g1-g5 + g5-g1 term */
-        else if (
-            strcmp(par->corr_terms[i], "48") == 0 ||
-            strcmp(par->corr_terms[i], "84") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_G1, COFFE_G5)){
             result +=
                 9*par->Omega0_m*par->Omega0_m/2.
                *(
-                    chi2*(1 + interp_spline(&bg->G1, z1_const))*interp_spline(&bg->G2, z2_const)
-                   *interp_spline(&bg->D1, z1_const)/interp_spline(&bg->a, z1_const)
+                    chi2*(1 + back1_const.G1)*back2_const.G2
+                   *back1_const.D1/back1_const.a
                     /* integrand */
                    *interp_spline(&bg->conformal_Hz, lambda2)
                    *(interp_spline(&bg->f, lambda2) - 1)
-                   *interp_spline(&bg->D1, z2)/interp_spline(&bg->a, z2)*ren1
+                   *back2.D1/back2.a*ren1
                     +
-                    chi1*(1 + interp_spline(&bg->G2, z2_const))*interp_spline(&bg->G1, z1_const)
-                   *interp_spline(&bg->D1, z2_const)/interp_spline(&bg->a, z2_const)
+                    chi1*(1 + back2_const.G2)*back1_const.G1
+                   *back2_const.D1/back2_const.a
                     /* integrand */
                     *interp_spline(&bg->conformal_Hz, lambda1)
                    *(interp_spline(&bg->f, lambda1) - 1)
-                   *interp_spline(&bg->D1, z1)/interp_spline(&bg->a, z1)*ren2
+                   *back1.D1/back1.a*ren2
                 );
         }
         /* g2-g4 + g4-g2 term */
-        else if (
-            strcmp(par->corr_terms[i], "57") == 0 ||
-            strcmp(par->corr_terms[i], "75") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_G2, COFFE_G4)){
             result +=
                 9*par->Omega0_m*par->Omega0_m/2.
                *(
                     (5*s1 - 2)*(2 - 5*s2)
-                   *interp_spline(&bg->D1, z1_const)/interp_spline(&bg->a, z1_const)
+                   *back1_const.D1/back1_const.a
                     /* integrand */
-                   *interp_spline(&bg->D1, z2)/interp_spline(&bg->a, z2)*ren1
+                   *back2.D1/back2.a*ren1
                     +
                     (5*s2 - 2)*(2 - 5*s1)
-                   *interp_spline(&bg->D1, z2_const)/interp_spline(&bg->a, z2_const)
+                   *back2_const.D1/back2_const.a
                     /* integrand */
-                   *interp_spline(&bg->D1, z1)/interp_spline(&bg->a, z1)*ren2
+                   *back1.D1/back1.a*ren2
                 );
         }
         /* g2-g5 + g5-g2 term */
-        else if (
-            strcmp(par->corr_terms[i], "58") == 0 ||
-            strcmp(par->corr_terms[i], "85") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_G2, COFFE_G5)){
             result +=
                 9*par->Omega0_m*par->Omega0_m/2.
                *(
-                    chi2*(5*s1 - 2)*interp_spline(&bg->G2, z2_const)
-                   *interp_spline(&bg->D1, z1_const)/interp_spline(&bg->a, z1_const)
+                    chi2*(5*s1 - 2)*back2_const.G2
+                   *back1_const.D1/back1_const.a
                     /* integrand */
                    *interp_spline(&bg->conformal_Hz, lambda2)
                    *(interp_spline(&bg->f, lambda2) - 1)
-                   *interp_spline(&bg->D1, z2)/interp_spline(&bg->a, z2)*ren1
+                   *back2.D1/back2.a*ren1
                     +
-                    chi1*(5*s2 - 2)*interp_spline(&bg->G1, z1_const)
-                   *interp_spline(&bg->D1, z2_const)/interp_spline(&bg->a, z2_const)
+                    chi1*(5*s2 - 2)*back1_const.G1
+                   *back2_const.D1/back2_const.a
                     /* integrand */
                     *interp_spline(&bg->conformal_Hz, lambda1)
                    *(interp_spline(&bg->f, lambda1) - 1)
-                   *interp_spline(&bg->D1, z1)/interp_spline(&bg->a, z1)*ren2
+                   *back1.D1/back1.a*ren2
                 );
         }
         /* g3-g4 + g4-g3 term */
-        else if (
-            strcmp(par->corr_terms[i], "67") == 0 ||
-            strcmp(par->corr_terms[i], "76") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_G3, COFFE_G4)){
             result +=
                 9*par->Omega0_m*par->Omega0_m/2.
                *(
-                    (interp_spline(&bg->f, z1_const) - 1)*(2 - 5*s2)
-                   *interp_spline(&bg->D1, z1_const)/interp_spline(&bg->a, z1_const)
+                    (back1_const.f - 1)*(2 - 5*s2)
+                   *back1_const.D1/back1_const.a
                     /* integrand */
-                   *interp_spline(&bg->D1, z2)/interp_spline(&bg->a, z2)*ren1
+                   *back2.D1/back2.a*ren1
                     +
-                    (interp_spline(&bg->f, z2_const) - 1)*(2 - 5*s1)
-                   *interp_spline(&bg->D1, z2_const)/interp_spline(&bg->a, z2_const)
+                    (back2_const.f - 1)*(2 - 5*s1)
+                   *back2_const.D1/back2_const.a
                     /* integrand */
-                   *interp_spline(&bg->D1, z1)/interp_spline(&bg->a, z1)*ren2
+                   *back1.D1/back1.a*ren2
                 );
         }
         /* g3-g5 + g5-g3 term */
-        else if (
-            strcmp(par->corr_terms[i], "68") == 0 ||
-            strcmp(par->corr_terms[i], "86") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_G3, COFFE_G5)){
             result +=
                 9*par->Omega0_m*par->Omega0_m/2.
                *(
-                    chi2*(interp_spline(&bg->f, z1_const) - 1)*interp_spline(&bg->G2, z2_const)
-                   *interp_spline(&bg->D1, z1_const)/interp_spline(&bg->a, z1_const)
+                    chi2*(back1_const.f - 1)*back2_const.G2
+                   *back1_const.D1/back1_const.a
                     /* integrand */
                    *interp_spline(&bg->conformal_Hz, lambda2)
                    *(interp_spline(&bg->f, lambda2) - 1)
-                   *interp_spline(&bg->D1, z2)/interp_spline(&bg->a, z2)*ren1
+                   *back2.D1/back2.a*ren1
                     +
-                    chi1*(interp_spline(&bg->f, z2_const) - 1)*interp_spline(&bg->G1, z1_const)
-                   *interp_spline(&bg->D1, z2_const)/interp_spline(&bg->a, z2_const)
+                    chi1*(back2_const.f - 1)*back1_const.G1
+                   *back2_const.D1/back2_const.a
                     /* integrand */
                     *interp_spline(&bg->conformal_Hz, lambda1)
                    *(interp_spline(&bg->f, lambda1) - 1)
-                   *interp_spline(&bg->D1, z1)/interp_spline(&bg->a, z1)*ren2
+                   *back1.D1/back1.a*ren2
                 );
         }
     }
@@ -1469,259 +1456,386 @@ double functions_single_integrated(
 }
 
 
-double functions_double_integrated(
+double functions_single_integrated(
     struct coffe_parameters_t *par,
     struct coffe_background_t *bg,
     struct coffe_integrals_t integral[],
     double z_mean,
     double mu,
     double sep,
-    double x1,
-    double x2
+    double x
 )
 {
-    double result = 0;
-    int len =
-        par->correlation_sources_len
-       *(par->correlation_sources_len + 1)/2;
-
-    double chi_mean = interp_spline(&bg->comoving_distance, z_mean);
-    double chi1 = chi_mean - sep*mu/2.;
-    double chi2 = chi_mean + sep*mu/2.;
-    double costheta =
-        (2*chi_mean*chi_mean - sep*sep + mu*mu*sep*sep/2.)
-       /(2*chi_mean*chi_mean - mu*mu*sep*sep/2.);
-    double lambda1 = chi1*x1, lambda2 = chi2*x2;
-    double r2 = lambda1*lambda1 + lambda2*lambda2 - 2*lambda1*lambda2*costheta;
-    if (r2 < 0) r2 = 0;
+    coffe_profile_count(COFFE_PROFILE_SINGLE);
+    struct functions_single_point pt;
+    pt.z_mean = z_mean, pt.mu = mu, pt.sep = sep, pt.x = x;
+    pt.chi_mean = interp_spline(&bg->comoving_distance, z_mean);
+    functions_single_integrated_geometry(
+        pt.chi_mean, mu, sep, x,
+        &pt.chi1, &pt.chi2, &pt.costheta, &pt.lambda1, &pt.lambda2, &pt.r21, &pt.r22
+    );
+    pt.z1_const = coffe_background_z(bg, pt.chi1);
+    pt.z2_const = coffe_background_z(bg, pt.chi2);
+    pt.z1 = coffe_background_z(bg, pt.lambda1);
+    pt.z2 = coffe_background_z(bg, pt.lambda2);
+    coffe_background_eval(bg, pt.z1, &pt.back1);
+    coffe_background_eval(bg, pt.z2, &pt.back2);
+    coffe_background_eval(bg, pt.z1_const, &pt.back1_const);
+    coffe_background_eval(bg, pt.z2_const, &pt.back2_const);
+    return functions_single_integrated_sum(par, bg, integral, &pt);
+}
 
-    double z1_const = interp_spline(&bg->z_as_chi, chi1);
-    double z2_const = interp_spline(&bg->z_as_chi, chi2);
-    double z1 = interp_spline(&bg->z_as_chi, lambda1);
-    double z2 = interp_spline(&bg->z_as_chi, lambda2);
 
-    double s1 = interp_spline(&par->magnification_bias1, z1_const);
-    double s2 = interp_spline(&par->magnification_bias2, z2_const);
+/**
+    the sum of the double integrated terms <terms> at the point <pt>;
+    it only does arithmetic, so the offload backend evaluates the same
+    sum on the device from its own tables
+**/
 
-    double ren = 0;
-    if (par->divergent){
-        if (r2 <= pow(0.000001*COFFE_H0, 2)){
-            ren = interp_spline(&integral[8].renormalization0, lambda1);
-        }
-        else{
-            ren = interp_spline(&integral[8].result, sqrt(r2))
-                    /* renormalization term */
-                   -gsl_spline2d_eval(
-                        integral[8].renormalization.spline,
-                        lambda1, lambda2,
-                        integral[8].renormalization.xaccel,
-                        integral[8].renormalization.yaccel
-                    );
-        }
-    }
+#ifdef HAVE_OFFLOAD
+#pragma omp declare target
+#endif
+double functions_double_integrated_sum(
+    const int *terms,
+    int len,
+    double Omega0_m,
+    const struct functions_double_point *pt
+)
+{
+    const double chi1 = pt->chi1, chi2 = pt->chi2, costheta = pt->costheta;
+    const double lambda1 = pt->lambda1, lambda2 = pt->lambda2, r2 = pt->r2;
+    const double x1 = pt->x1, x2 = pt->x2;
+    const double s1 = pt->s1, s2 = pt->s2, ren = pt->ren;
+    double result = 0;
 
     for (int i = 0; i<len; ++i){
+        const int term = terms[i];
         /* len-len term */
-        if (strcmp(par->corr_terms[i], "99") == 0){
+        if (term == COFFE_TERM(COFFE_LEN, COFFE_LEN)){
             if (r2 > 1e-20){
                 result +=
                 /* constant in front */
-                9.*par->Omega0_m*par->Omega0_m*(2 - 5*s1)*(2 - 5*s2)/4.*chi1*chi2
+                9.*Omega0_m*Omega0_m*(2 - 5*s1)*(2 - 5*s2)/4.*chi1*chi2
                *
                 /* integrand */
-                interp_spline(&bg->D1, z1)
-               *interp_spline(&bg->D1, z2)
-               /interp_spline(&bg->a, z1)
-               /interp_spline(&bg->a, z2)
+                pt->D1_1
+               *pt->D1_2
+               /pt->a1
+               /pt->a2
                *(1 - x1)*(1 - x2)
                *(
                     2*(costheta*costheta - 1)*lambda1*lambda2
-                   *interp_spline(&integral[0].result, sqrt(r2))/5.
+                   *pt->integral[0]/5.
                    +
                     4*costheta
-                   *interp_spline(&integral[5].result, sqrt(r2))/3.
+                   *pt->integral[5]/3.
                    +
                     4*costheta*(r2 + 6*costheta*lambda1*lambda2)
-                   *interp_spline(&integral[3].result, sqrt(r2))/15.
+                   *pt->integral[3]/15.
                    +
                     2*(costheta*costheta - 1)*lambda1*lambda2
                    *(2*r2 + 3*costheta*lambda1*lambda2)
-                   *interp_spline(&integral[1].result, sqrt(r2))/7./r2
+                   *pt->integral[1]/7./r2
                    +
                     2*costheta
                    *(2*r2*r2 + 12*costheta*r2*lambda1*lambda2 + 15*(costheta*costheta - 1)*lambda1*lambda1*lambda2*lambda2)
-                   *interp_spline(&integral[4].result, sqrt(r2))/15./r2
+                   *pt->integral[4]/15./r2
                    +
                     (costheta*costheta - 1)*lambda1*lambda2
                    *(6*r2*r2 + 30*costheta*r2*lambda1*lambda2 + 35*(costheta*costheta - 1)*lambda1*lambda1*lambda2*lambda2)
-                   *interp_spline(&integral[2].result, sqrt(r2))/35./r2/r2
+                   *pt->integral[2]/35./r2/r2
                 );
             }
             else{
                 result +=
                 /* constant in front */
-                9./4*pow(par->Omega0_m, 2)*(2 - 5*s1)*(2 - 5*s2)*chi1*chi2
+                9./4*pow(Omega0_m, 2)*(2 - 5*s1)*(2 - 5*s2)*chi1*chi2
                *
                 /* integrand */
-                interp_spline(&bg->D1, z1)
-               *interp_spline(&bg->D1, z2)
-               /interp_spline(&bg->a, z1)
-               /interp_spline(&bg->a, z2)
+                pt->D1_1
+               *pt->D1_2
+               /pt->a1
+               /pt->a2
                *(1 - x1)*(1 - x2)
                *(
-                   4*interp_spline(&integral[5].result, 0.0)/3.
+                   4*pt->integral0[5]/3.
                    +
                     24.*lambda1*lambda2
-                   *interp_spline(&integral[3].result, 0.0)/15.
+                   *pt->integral0[3]/15.
                 );
             }
         }
         /* g4-g4 term */
-        else if (strcmp(par->corr_terms[i], "77") == 0){
+        else if (term == COFFE_TERM(COFFE_G4, COFFE_G4)){
             result +=
             /* constant in front */
-            9*par->Omega0_m*par->Omega0_m*(2 - 5*s1)*(2 - 5*s2)
+            9*Omega0_m*Omega0_m*(2 - 5*s1)*(2 - 5*s2)
            *
                 /* integrand */
-                interp_spline(&bg->D1, z1)
-               *interp_spline(&bg->D1, z2)
-               /interp_spline(&bg->a, z1)
-               /interp_spline(&bg->a, z2)
+                pt->D1_1
+               *pt->D1_2
+               /pt->a1
+               /pt->a2
                *ren;
         }
         /* g5-g5 term */
-        else if (strcmp(par->corr_terms[i], "88") == 0){
+        else if (term == COFFE_TERM(COFFE_G5, COFFE_G5)){
             result +=
             /* constant in front */
-            9*par->Omega0_m*par->Omega0_m
-           *interp_spline(&bg->G1, z1_const)
-           *interp_spline(&bg->G2, z2_const)
+            9*Omega0_m*Omega0_m
+           *pt->G1
+           *pt->G2
            *chi1*chi2
            *
             /* integrand */
-                interp_spline(&bg->D1, z1)
-               *interp_spline(&bg->D1, z2)
-               /interp_spline(&bg->a, z1)
-               /interp_spline(&bg->a, z2)
-               *interp_spline(&bg->conformal_Hz, z1)
-               *interp_spline(&bg->conformal_Hz, z2)
-               *(interp_spline(&bg->f, z1) - 1)
-               *(interp_spline(&bg->f, z2) - 1)
+                pt->D1_1
+               *pt->D1_2
+               /pt->a1
+               /pt->a2
+               *pt->H1
+               *pt->H2
+               *(pt->f1 - 1)
+               *(pt->f2 - 1)
                *ren;
         }
         /* g4-len + len-g4 term */
-        else if (
-            strcmp(par->corr_terms[i], "79") == 0 ||
-            strcmp(par->corr_terms[i], "97") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_G4, COFFE_LEN)){
             if (r2 != 0){
                 result +=
                     /* constant in front */
-                    9*par->Omega0_m*par->Omega0_m/2.
+                    9*Omega0_m*Omega0_m/2.
                    *(
                         (2 - 5*s1)*(2 - 5*s2)
-                       *(1 - x2)/x2*interp_spline(&bg->D1, z1)*interp_spline(&bg->D1, z2)
-                       /interp_spline(&bg->a, z1)/interp_spline(&bg->a, z2)
+                       *(1 - x2)/x2*pt->D1_1*pt->D1_2
+                       /pt->a1/pt->a2
                        *(
-                            2*lambda1*lambda2*costheta*interp_spline(&integral[7].result, sqrt(r2))
-                           -lambda1*lambda1*lambda2*lambda2*(1 - costheta*costheta)*interp_spline(&integral[6].result, sqrt(r2))
+                            2*lambda1*lambda2*costheta*pt->integral[7]
+                           -lambda1*lambda1*lambda2*lambda2*(1 - costheta*costheta)*pt->integral[6]
                         )
                         +
                         (2 - 5*s1)*(2 - 5*s2)
-                       *(1 - x1)/x1*interp_spline(&bg->D1, z1)*interp_spline(&bg->D1, z2)
-                       /interp_spline(&bg->a, z1)/interp_spline(&bg->a, z2)
+                       *(1 - x1)/x1*pt->D1_1*pt->D1_2
+                       /pt->a1/pt->a2
                        *(
-                            2*lambda1*lambda2*costheta*interp_spline(&integral[7].result, sqrt(r2))
-                           -lambda1*lambda1*lambda2*lambda2*(1 - costheta*costheta)*interp_spline(&integral[6].result, sqrt(r2))
+                            2*lambda1*lambda2*costheta*pt->integral[7]
+                           -lambda1*lambda1*lambda2*lambda2*(1 - costheta*costheta)*pt->integral[6]
                         )
                     );
             }
             else{
                 result +=
-                    9*par->Omega0_m*par->Omega0_m/2.
+                    9*Omega0_m*Omega0_m/2.
                    *(
                         (2 - 5*s1)*(2 - 5*s2)
-                       *(1 - x2)/x2*interp_spline(&bg->D1, z1)*interp_spline(&bg->D1, z2)
-                       /interp_spline(&bg->a, z1)/interp_spline(&bg->a, z2)
-                       *2*lambda1*lambda2*interp_spline(&integral[7].result, 0.0)
+                       *(1 - x2)/x2*pt->D1_1*pt->D1_2
+                       /pt->a1/pt->a2
+                       *2*lambda1*lambda2*pt->integral0[7]
                         +
                         (2 - 5*s1)*(2 - 5*s2)
-                       *(1 - x1)/x1*interp_spline(&bg->D1, z2)*interp_spline(&bg->D1, z1)
-                       /interp_spline(&bg->a, z2)/interp_spline(&bg->a, z1)
-                       *2*lambda1*lambda2*interp_spline(&integral[7].result, 0.0)
+                       *(1 - x1)/x1*pt->D1_2*pt->D1_1
+                       /pt->a2/pt->a1
+                       *2*lambda1*lambda2*pt->integral0[7]
                     );
             }
         }
         /* g5-len + len-g5 term */
-        else if (
-            strcmp(par->corr_terms[i], "89") == 0 ||
-            strcmp(par->corr_terms[i], "98") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_G5, COFFE_LEN)){
             if (r2 != 0){
                 result +=
                     /* constant in front */
-                    9*par->Omega0_m*par->Omega0_m/2.
+                    9*Omega0_m*Omega0_m/2.
                    *(
-                        (2 - 5*s2)*interp_spline(&bg->G1, z1_const)*chi1
-                       *interp_spline(&bg->conformal_Hz, z1)*(interp_spline(&bg->conformal_Hz, z1) - 1)
-                       *(1 - x2)/x2*interp_spline(&bg->D1, z1)*interp_spline(&bg->D1, z2)
-                       /interp_spline(&bg->a, z1)/interp_spline(&bg->a, z2)
+                        (2 - 5*s2)*pt->G1*chi1
+                       *pt->H1*(pt->H1 - 1)
+                       *(1 - x2)/x2*pt->D1_1*pt->D1_2
+                       /pt->a1/pt->a2
                        *(
-                            2*lambda1*lambda2*costheta*interp_spline(&integral[7].result, sqrt(r2))
-                           -lambda1*lambda1*lambda2*lambda2*(1 - costheta*costheta)*interp_spline(&integral[6].result, sqrt(r2))
+                            2*lambda1*lambda2*costheta*pt->integral[7]
+                           -lambda1*lambda1*lambda2*lambda2*(1 - costheta*costheta)*pt->integral[6]
                         )
                         +
-                        (2 - 5*s1)*interp_spline(&bg->G2, z2_const)*chi2
-                       *interp_spline(&bg->conformal_Hz, z2)*(interp_spline(&bg->conformal_Hz, z2) - 1)
-                       *(1 - x1)/x1*interp_spline(&bg->D1, z1)*interp_spline(&bg->D1, z2)
-                       /interp_spline(&bg->a, z1)/interp_spline(&bg->a, z2)
+                        (2 - 5*s1)*pt->G2*chi2
+                       *pt->H2*(pt->H2 - 1)
+                       *(1 - x1)/x1*pt->D1_1*pt->D1_2
+                       /pt->a1/pt->a2
                        *(
-                            2*lambda1*lambda2*costheta*interp_spline(&integral[7].result, sqrt(r2))
-                           -lambda1*lambda1*lambda2*lambda2*(1 - costheta*costheta)*interp_spline(&integral[6].result, sqrt(r2))
+                            2*lambda1*lambda2*costheta*pt->integral[7]
+                           -lambda1*lambda1*lambda2*lambda2*(1 - costheta*costheta)*pt->integral[6]
                         )
                     );
             }
             else{
                 result +=
-                    9*par->Omega0_m*par->Omega0_m/2.
+                    9*Omega0_m*Omega0_m/2.
                    *(
-                        (2 - 5*s2)*interp_spline(&bg->G1, z1_const)*chi1
-                       *interp_spline(&bg->conformal_Hz, z1)*(interp_spline(&bg->conformal_Hz, z1) - 1)
-                       *(1 - x2)/x2*interp_spline(&bg->D1, z1)*interp_spline(&bg->D1, z2)
-                       /interp_spline(&bg->a, z1)/interp_spline(&bg->a, z2)
-                       *2*lambda1*lambda2*interp_spline(&integral[7].result, 0.0)
+                        (2 - 5*s2)*pt->G1*chi1
+                       *pt->H1*(pt->H1 - 1)
+                       *(1 - x2)/x2*pt->D1_1*pt->D1_2
+                       /pt->a1/pt->a2
+                       *2*lambda1*lambda2*pt->integral0[7]
                         +
-                        (2 - 5*s1)*interp_spline(&bg->G2, z2_const)*chi2
-                       *interp_spline(&bg->conformal_Hz, z2)*(interp_spline(&bg->conformal_Hz, z2) - 1)
-                       *(1 - x1)/x1*interp_spline(&bg->D1, z1)*interp_spline(&bg->D1, z2)
-                       /interp_spline(&bg->a, z1)/interp_spline(&bg->a, z2)
-                       *2*lambda1*lambda2*interp_spline(&integral[7].result, 0.0)
+                        (2 - 5*s1)*pt->G2*chi2
+                       *pt->H2*(pt->H2 - 1)
+                       *(1 - x1)/x1*pt->D1_1*pt->D1_2
+                       /pt->a1/pt->a2
+                       *2*lambda1*lambda2*pt->integral0[7]
                     );
             }
         }
         /* g4-g5 + g5-g4 term */
-        else if (
-            strcmp(par->corr_terms[i], "78") == 0 ||
-            strcmp(par->corr_terms[i], "87") == 0
-        ){
+        else if (term == COFFE_TERM(COFFE_G4, COFFE_G5)){
             result +=
                 /* constant in front */
-                9*par->Omega0_m*par->Omega0_m
+                9*Omega0_m*Omega0_m
                *(
-                    interp_spline(&bg->G2, z2_const)*(2 - 5*s1)*chi2
-                   *interp_spline(&bg->conformal_Hz, z2)*(interp_spline(&bg->f, z2) - 1)
-                   *interp_spline(&bg->D1, z1)*interp_spline(&bg->D1, z2)
-                   /interp_spline(&bg->a, z1)/interp_spline(&bg->a, z2)
+                    pt->G2*(2 - 5*s1)*chi2
+                   *pt->H2*(pt->f2 - 1)
+                   *pt->D1_1*pt->D1_2
+                   /pt->a1/pt->a2
                    *ren
                    +
-                    interp_spline(&bg->G1, z1_const)*(2 - 5*s2)*chi1
-                   *interp_spline(&bg->conformal_Hz, z1)*(interp_spline(&bg->f, z1) - 1)
-                   *interp_spline(&bg->D1, z1)*interp_spline(&bg->D1, z2)
-                   /interp_spline(&bg->a, z1)/interp_spline(&bg->a, z2)
+                    pt->G1*(2 - 5*s2)*chi1
+                   *pt->H1*(pt->f1 - 1)
+                   *pt->D1_1*pt->D1_2
+                   /pt->a1/pt->a2
                    *ren
                 );
         }
     }
+    return result;
+}
+#ifdef HAVE_OFFLOAD
+#pragma omp end declare target
+#endif
+
+
+/**
+    which of the I^n_l (as bits) the double integrated <terms> need
+**/
+
+static unsigned int functions_double_integrated_needed(
+    const struct coffe_corr_terms *terms
+)
+{
+    unsigned int needed = 0;
+    for (int i = 0; i<terms->len; ++i){
+        switch (terms->value[i]){
+            case COFFE_TERM(COFFE_LEN, COFFE_LEN):
+                needed |= 0x3fu; /* I^0_0, I^0_2, I^0_4, I^1_1, I^1_3, I^2_0 */
+                break;
+            case COFFE_TERM(COFFE_G4, COFFE_LEN):
+            case COFFE_TERM(COFFE_G5, COFFE_LEN):
+                needed |= 0xc0u; /* I^2_2, I^3_1 */
+                break;
+            default:
+                break;
+        }
+    }
+    return needed;
+}
+
+
+/**
+    the geometry of a point of the double integrated terms,
+    inline and without branches, as the one of the single integrated ones
+**/
+
+static inline void functions_double_integrated_geometry(
+    double chi_mean,
+    double mu,
+    double sep,
+    double x1,
+    double x2,
+    double *chi1,
+    double *chi2,
+    double *costheta,
+    double *lambda1,
+    double *lambda2,
+    double *r2
+)
+{
+    const double c1 = chi_mean - sep*mu/2.;
+    const double c2 = chi_mean + sep*mu/2.;
+    const double cos =
+        (2*chi_mean*chi_mean - sep*sep + mu*mu*sep*sep/2.)
+       /(2*chi_mean*chi_mean - mu*mu*sep*sep/2.);
+    const double l1 = c1*x1, l2 = c2*x2;
+    *chi1 = c1, *chi2 = c2, *costheta = cos, *lambda1 = l1, *lambda2 = l2;
+    *r2 = fmax(l1*l1 + l2*l2 - 2*l1*l2*cos, 0.0);
+}
+
+
+double functions_double_integrated(
+    struct coffe_parameters_t *par,
+    struct coffe_background_t *bg,
+    struct coffe_integrals_t integral[],
+    double z_mean,
+    double mu,
+    double sep,
+    double x1,
+    double x2
+)
+{
+    coffe_profile_count(COFFE_PROFILE_DOUBLE);
+    struct functions_double_point pt;
+
+    double chi_mean = interp_spline(&bg->comoving_distance, z_mean);
+    double chi1, chi2, costheta, lambda1, lambda2, r2;
+    functions_double_integrated_geometry(
+        chi_mean, mu, sep, x1, x2,
+        &chi1, &chi2, &costheta, &lambda1, &lambda2, &r2
+    );
+
+    double z1_const = coffe_background_z(bg, chi1);
+    double z2_const = coffe_background_z(bg, chi2);
+    double z1 = coffe_background_z(bg, lambda1);
+    double z2 = coffe_background_z(bg, lambda2);
+    struct coffe_background_point back1, back2, back1_const, back2_const;
+    coffe_background_eval(bg, z1, &back1);
+    coffe_background_eval(bg, z2, &back2);
+    coffe_background_eval(bg, z1_const, &back1_const);
+    coffe_background_eval(bg, z2_const, &back2_const);
+
+    double s1 = interp_spline(&par->magnification_bias1, z1_const);
+    double s2 = interp_spline(&par->magnification_bias2, z2_const);
+
+    double ren = 0;
+    if (par->divergent){
+        if (r2 <= pow(0.000001*COFFE_H0, 2)){
+            ren = interp_spline(&integral[8].renormalization0, lambda1);
+        }
+        else{
+            ren = interp_spline(&integral[8].result, sqrt(r2))
+                    /* renormalization term */
+                   -interp_spline2d(
+                        &integral[8].renormalization,
+                        lambda1, lambda2
+                );
+        }
+    }
+
+    pt.chi1 = chi1, pt.chi2 = chi2, pt.costheta = costheta;
+    pt.lambda1 = lambda1, pt.lambda2 = lambda2, pt.r2 = r2;
+    pt.x1 = x1, pt.x2 = x2;
+    pt.s1 = s1, pt.s2 = s2, pt.ren = ren;
+    pt.D1_1 = back1.D1, pt.D1_2 = back2.D1;
+    pt.a1 = back1.a, pt.a2 = back2.a;
+    pt.H1 = back1.conformal_Hz, pt.H2 = back2.conformal_Hz;
+    pt.f1 = back1.f, pt.f2 = back2.f;
+    pt.G1 = back1_const.G1, pt.G2 = back2_const.G2;
+
+    /* only the I^n_l the terms need, at the separation and (close to it) at zero */
+    const unsigned int needed = functions_double_integrated_needed(&par->double_terms);
+    for (int k = 0; k<8; ++k){
+        pt.integral[k] = pt.integral0[k] = 0;
+        if (!(needed & (1u << k))) continue;
+        if (r2 != 0) pt.integral[k] = interp_spline(&integral[k].result, sqrt(r2));
+        if (r2 <= 1e-20) pt.integral0[k] = interp_spline(&integral[k].result, 0.0);
+    }
+
+    const double result = functions_double_integrated_sum(
+        par->double_terms.value, par->double_terms.len, par->Omega0_m, &pt
+    );
     if (gsl_finite(result)){
     return
         result;
@@ -1749,3 +1863,196 @@ double functions_double_integrated(
         exit(EXIT_FAILURE);
     }
 }
+
+
+/**
+    the batches are done in chunks of COFFE_FUNCTIONS_CHUNK points:
+    first the geometry of all of them (plain arithmetic over arrays),
+    then the redshifts and the background at all their distances at
+    once (with fast_interpolation, the uniform tables are evaluated
+    in one vectorized pass), and last the terms of each point
+**/
+
+int functions_single_integrated_batch(
+    struct coffe_parameters_t *par,
+    struct coffe_background_t *bg,
+    struct coffe_integrals_t integral[],
+    double r,
+    size_t n,
+    const double *z_mean,
+    const double *mu,
+    const double *x,
+    double *result
+)
+{
+    coffe_profile_count_n(COFFE_PROFILE_SINGLE, n);
+    struct functions_single_point pt[COFFE_FUNCTIONS_CHUNK];
+    double chi_mean[COFFE_FUNCTIONS_CHUNK], costheta[COFFE_FUNCTIONS_CHUNK];
+    double r21[COFFE_FUNCTIONS_CHUNK], r22[COFFE_FUNCTIONS_CHUNK];
+    double chi[4*COFFE_FUNCTIONS_CHUNK], z[4*COFFE_FUNCTIONS_CHUNK];
+    struct coffe_background_point back[4*COFFE_FUNCTIONS_CHUNK];
+
+    double last_z_mean = NAN, last_chi_mean = 0;
+    for (size_t start = 0; start<n; start += COFFE_FUNCTIONS_CHUNK){
+        const size_t m =
+            start + COFFE_FUNCTIONS_CHUNK < n ? COFFE_FUNCTIONS_CHUNK : n - start;
+
+        for (size_t i = 0; i<m; ++i){
+            /* all the points of a batch usually share z_mean */
+            if (z_mean[start + i] != last_z_mean){
+                last_z_mean = z_mean[start + i];
+                last_chi_mean = interp_spline(&bg->comoving_distance, last_z_mean);
+            }
+            chi_mean[i] = last_chi_mean;
+        }
+
+        #pragma omp simd
+        for (size_t i = 0; i<m; ++i){
+            functions_single_integrated_geometry(
+                chi_mean[i], mu[start + i], r, x[start + i],
+                &chi[i], &chi[m + i], &costheta[i],
+                &chi[2*m + i], &chi[3*m + i], &r21[i], &r22[i]
+            );
+        }
+
+        coffe_background_z_array(bg, 4*m, chi, z);
+        coffe_background_eval_array(bg, 4*m, z, back);
+
+        for (size_t i = 0; i<m; ++i){
+            pt[i].z_mean = z_mean[start + i], pt[i].mu = mu[start + i];
+            pt[i].sep = r, pt[i].x = x[start + i], pt[i].chi_mean = chi_mean[i];
+            pt[i].chi1 = chi[i], pt[i].chi2 = chi[m + i], pt[i].costheta = costheta[i];
+            pt[i].lambda1 = chi[2*m + i], pt[i].lambda2 = chi[3*m + i];
+            pt[i].r21 = r21[i], pt[i].r22 = r22[i];
+            pt[i].z1_const = z[i], pt[i].back1_const = back[i];
+            pt[i].z2_const = z[m + i], pt[i].back2_const = back[m + i];
+            pt[i].z1 = z[2*m + i], pt[i].back1 = back[2*m + i];
+            pt[i].z2 = z[3*m + i], pt[i].back2 = back[3*m + i];
+            result[start + i] = functions_single_integrated_sum(par, bg, integral, &pt[i]);
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    as above, except that the I^n_l are also looked up over the arrays
+    of separations, one spline at a time, before the sums of the terms
+**/
+
+int functions_double_integrated_batch(
+    struct coffe_parameters_t *par,
+    struct coffe_background_t *bg,
+    struct coffe_integrals_t integral[],
+    double r,
+    size_t n,
+    const double *z_mean,
+    const double *mu,
+    const double *x1,
+    const double *x2,
+    double *result
+)
+{
+    if (coffe_offload_enabled()){
+        return coffe_offload_double_integrated(
+            par, bg, r, n, z_mean, mu, x1, x2, result
+        );
+    }
+
+    coffe_profile_count_n(COFFE_PROFILE_DOUBLE, n);
+    struct functions_double_point pt[COFFE_FUNCTIONS_CHUNK];
+    double chi[4*COFFE_FUNCTIONS_CHUNK], z[4*COFFE_FUNCTIONS_CHUNK];
+    double chi_mean[COFFE_FUNCTIONS_CHUNK], costheta[COFFE_FUNCTIONS_CHUNK];
+    double r2[COFFE_FUNCTIONS_CHUNK], dist[COFFE_FUNCTIONS_CHUNK];
+    struct coffe_background_point back[4*COFFE_FUNCTIONS_CHUNK];
+
+    const unsigned int needed = functions_double_integrated_needed(&par->double_terms);
+    double at_zero[8];
+    for (int k = 0; k<8; ++k){
+        at_zero[k] = needed & (1u << k) ? interp_spline(&integral[k].result, 0.0) : 0;
+    }
+
+    double last_z_mean = NAN, last_chi_mean = 0;
+    for (size_t start = 0; start<n; start += COFFE_FUNCTIONS_CHUNK){
+        const size_t m =
+            start + COFFE_FUNCTIONS_CHUNK < n ? COFFE_FUNCTIONS_CHUNK : n - start;
+
+        for (size_t i = 0; i<m; ++i){
+            /* all the points of a batch usually share z_mean */
+            if (z_mean[start + i] != last_z_mean){
+                last_z_mean = z_mean[start + i];
+                last_chi_mean = interp_spline(&bg->comoving_distance, last_z_mean);
+            }
+            chi_mean[i] = last_chi_mean;
+        }
+
+        #pragma omp simd
+        for (size_t i = 0; i<m; ++i){
+            functions_double_integrated_geometry(
+                chi_mean[i], mu[start + i], r, x1[start + i], x2[start + i],
+                &chi[i], &chi[m + i], &costheta[i],
+                &chi[2*m + i], &chi[3*m + i], &r2[i]
+            );
+            dist[i] = sqrt(r2[i]);
+        }
+
+        coffe_background_z_array(bg, 4*m, chi, z);
+        coffe_background_eval_array(bg, 4*m, z, back);
+
+        for (size_t i = 0; i<m; ++i){
+            const struct coffe_background_point *back1 = &back[2*m + i];
+            const struct coffe_background_point *back2 = &back[3*m + i];
+            pt[i].chi1 = chi[i], pt[i].chi2 = chi[m + i], pt[i].costheta = costheta[i];
+            pt[i].lambda1 = chi[2*m + i], pt[i].lambda2 = chi[3*m + i], pt[i].r2 = r2[i];
+            pt[i].x1 = x1[start + i], pt[i].x2 = x2[start + i];
+            pt[i].s1 = interp_spline(&par->magnification_bias1, z[i]);
+            pt[i].s2 = interp_spline(&par->magnification_bias2, z[m + i]);
+            pt[i].D1_1 = back1->D1, pt[i].D1_2 = back2->D1;
+            pt[i].a1 = back1->a, pt[i].a2 = back2->a;
+            pt[i].H1 = back1->conformal_Hz, pt[i].H2 = back2->conformal_Hz;
+            pt[i].f1 = back1->f, pt[i].f2 = back2->f;
+            pt[i].G1 = back[i].G1, pt[i].G2 = back[m + i].G2;
+        }
+
+        for (int k = 0; k<8; ++k){
+            for (size_t i = 0; i<m; ++i){
+                pt[i].integral[k] = pt[i].integral0[k] = 0;
+            }
+            if (!(needed & (1u << k))) continue;
+            for (size_t i = 0; i<m; ++i){
+                if (pt[i].r2 != 0) pt[i].integral[k] = interp_spline(&integral[k].result, dist[i]);
+                if (pt[i].r2 <= 1e-20) pt[i].integral0[k] = at_zero[k];
+            }
+        }
+
+        for (size_t i = 0; i<m; ++i){
+            pt[i].ren = 0;
+            if (!par->divergent) continue;
+            if (pt[i].r2 <= pow(0.000001*COFFE_H0, 2)){
+                pt[i].ren = interp_spline(&integral[8].renormalization0, pt[i].lambda1);
+            }
+            else{
+                pt[i].ren = interp_spline(&integral[8].result, dist[i])
+                    /* renormalization term */
+                   -interp_spline2d(
+                        &integral[8].renormalization,
+                        pt[i].lambda1, pt[i].lambda2
+                    );
+            }
+        }
+
+        for (size_t i = 0; i<m; ++i){
+            result[start + i] = functions_double_integrated_sum(
+                par->double_terms.value, par->double_terms.len, par->Omega0_m, &pt[i]
+            );
+            /* the scalar version reports the values (and exits) */
+            if (!gsl_finite(result[start + i])){
+                functions_double_integrated(
+                    par, bg, integral, z_mean[start + i], mu[start + i], r,
+                    x1[start + i], x2[start + i]
+                );
+            }
+        }
+    }
+    return EXIT_SUCCESS;
+}
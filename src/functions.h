@@ -61,5 +61,82 @@ double functions_double_integrated(
     double x2
 );
 
+/**
+    everything the double integrated terms need at one point (mu, x1, x2);
+    integral[k] and integral0[k] are the I^n_l (in the order of par->nonzero_terms) at the
+    distance sqrt(r2) of the points on the two lines of sight and at zero,
+    and <ren> is the renormalized I^4_0
+**/
+
+struct functions_double_point
+{
+    double chi1, chi2, costheta, lambda1, lambda2, r2, x1, x2;
+    double s1, s2, ren;
+    double D1_1, D1_2, a1, a2, H1, H2, f1, f2, G1, G2;
+    double integral[8], integral0[8];
+};
+
+#ifdef HAVE_OFFLOAD
+#pragma omp declare target
+#endif
+double functions_double_integrated_sum(
+    const int *terms,
+    int len,
+    double Omega0_m,
+    const struct functions_double_point *pt
+);
+#ifdef HAVE_OFFLOAD
+#pragma omp end declare target
+#endif
+
+/**
+    the multipoles <rule->l> of the nonintegrated terms at the separation <sep>,
+    from their values at the nodes in mu of the 1D rule <rule>, in <result>;
+    the I^n_l are looked up once, as only the renormalized I^4_0 depends on mu;
+    nothing else is tabulated, the geometry, background and biases are
+    evaluated at every node, as they depend on sep*mu
+**/
+int functions_nonintegrated_multipoles(
+    struct coffe_parameters_t *par,
+    struct coffe_background_t *bg,
+    struct coffe_integrals_t integral[],
+    double z_mean,
+    double sep,
+    const struct coffe_gauss_rule *rule,
+    double *result
+);
+
+/**
+    batched versions of the above; evaluate the terms at <n> points
+    (z_mean[i], mu[i], x[i]) at the same separation <r>,
+    and store the output in <result>; the double integrated ones
+    go to the device if the offload backend is enabled
+**/
+
+int functions_single_integrated_batch(
+    struct coffe_parameters_t *par,
+    struct coffe_background_t *bg,
+    struct coffe_integrals_t integral[],
+    double r,
+    size_t n,
+    const double *z_mean,
+    const double *mu,
+    const double *x,
+    double *result
+);
+
+int functions_double_integrated_batch(
+    struct coffe_parameters_t *par,
+    struct coffe_background_t *bg,
+    struct coffe_integrals_t integral[],
+    double r,
+    size_t n,
+    const double *z_mean,
+    const double *mu,
+    const double *x1,
+    const double *x2,
+    double *result
+);
+
 #endif
 
@@ -21,6 +21,8 @@
 #include <time.h>
 #include <math.h>
 #include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
 #include <assert.h>
 #include <gsl/gsl_integration.h>
 #include <gsl/gsl_sf_bessel.h>
@@ -37,6 +39,26 @@
 #define NORM(X) (X*COFFE_H0)
 #endif
 
+#ifndef COFFE_RENORMALIZATION_BINS
+#define COFFE_RENORMALIZATION_BINS 32 // initial number of intervals of the renormalization grid
+#endif
+
+#ifndef COFFE_RENORMALIZATION_MAX_BINS
+#define COFFE_RENORMALIZATION_MAX_BINS 200 // largest number of intervals of the renormalization grid (that of the former fixed grid)
+#endif
+
+#ifndef COFFE_RENORMALIZATION_PRECISION
+#define COFFE_RENORMALIZATION_PRECISION 1E-5 // largest error of the renormalization spline, relative to its maximum
+#endif
+
+#ifndef COFFE_INTEGRALS_CACHE_MAGIC
+#define COFFE_INTEGRALS_CACHE_MAGIC "COFFEINT"
+#endif
+
+#ifndef COFFE_INTEGRALS_CACHE_VERSION
+#define COFFE_INTEGRALS_CACHE_VERSION 3 // bump whenever the integrals are computed differently
+#endif
+
 /**
     parameters for the integrand of the form P(k) k^2 j_l(k r)/(k r)^n
 **/
@@ -178,8 +200,7 @@ static double integrals_bessel(
 )
 {
     struct integrals_params test;
-    test.result.spline = result.spline;
-    test.result.accel = result.accel;
+    test.result = result;
     test.n = n;
     test.l = l;
     test.r = sep;
@@ -190,8 +211,7 @@ static double integrals_bessel(
 
     double output, error, precision = 1E-5;
 
-    gsl_integration_workspace *wspace =
-        gsl_integration_workspace_alloc(COFFE_MAX_INTSPACE);
+    gsl_integration_workspace *wspace = coffe_workspace();
 
     /* r^4 I^4_0 */
     gsl_integration_qag(
@@ -201,7 +221,6 @@ static double integrals_bessel(
         &output, &error
     );
 
-    gsl_integration_workspace_free(wspace);
 
     return output*pow(sep, 4)/2./M_PI/M_PI;
 }
@@ -230,8 +249,7 @@ static double integrals_renormalization0(
 )
 {
     struct integrals_params test;
-    test.result.spline = result.spline;
-    test.result.accel = result.accel;
+    test.result = result;
     test.n = n;
     test.l = l;
     test.r = sep;
@@ -242,8 +260,7 @@ static double integrals_renormalization0(
 
     double output, error, precision = 1E-5;
 
-    gsl_integration_workspace *wspace =
-        gsl_integration_workspace_alloc(COFFE_MAX_INTSPACE);
+    gsl_integration_workspace *wspace = coffe_workspace();
 
     /* renormalized term at r = 0 (depends on chi!) */
     gsl_integration_qag(
@@ -253,7 +270,6 @@ static double integrals_renormalization0(
         &output, &error
     );
 
-    gsl_integration_workspace_free(wspace);
 
     return output/2./M_PI/M_PI;
 }
@@ -284,8 +300,7 @@ static double integrals_renormalization(
 )
 {
     struct integrals_divergent_params test;
-    test.result.spline = result.spline;
-    test.result.accel = result.accel;
+    test.result = result;
     test.chi1 = chi1;
     test.chi2 = chi2;
 
@@ -296,8 +311,7 @@ static double integrals_renormalization(
     integrand.params = &test;
     integrand.function = &integrals_renormalization_integrand;
 
-    gsl_integration_workspace *wspace =
-        gsl_integration_workspace_alloc(COFFE_MAX_INTSPACE);
+    gsl_integration_workspace *wspace = coffe_workspace();
 
     gsl_integration_qag(
         &integrand, kmin, kmax, 0,
@@ -305,270 +319,820 @@ static double integrals_renormalization(
         GSL_INTEG_GAUSS61, wspace, &output, &error
     );
 
-    gsl_integration_workspace_free(wspace);
 
     return output/2./M_PI/M_PI;
 }
 
 
 /**
-    computes all the nonzero I^n_l integrals
+    the largest comoving distance (dimensionless) needed
+    for the renormalization of the divergent integral
 **/
 
-int coffe_integrals_init(
+static double integrals_chi_max(
     struct coffe_parameters_t *par,
-    struct coffe_background_t *bg,
-    struct coffe_integrals_t integral[]
+    struct coffe_background_t *bg
 )
 {
-    clock_t start, end;
-    start = clock();
-    printf("Calculating integrals of Bessel functions...\n");
+    double z_mean = par->z_mean, deltaz = par->deltaz, z_max = par->z_max;
 
-    gsl_error_handler_t *default_handler =
-        gsl_set_error_handler_off();
-    double r0_sep, r0_result;
+    /* with a batch, the integrals are shared, so the farthest bin counts */
+    for (int i = 0; i<par->batch_len; ++i){
+        if (par->output_type == 3){
+            if (i == 0 || par->batch_z_max[i] > z_max) z_max = par->batch_z_max[i];
+        }
+        else if (par->output_type == 1 || par->output_type == 2){
+            if (i == 0 || par->batch_z_mean[i] + par->batch_deltaz[i] > z_mean + deltaz){
+                z_mean = par->batch_z_mean[i];
+                deltaz = par->batch_deltaz[i];
+            }
+        }
+        else{
+            if (i == 0 || par->batch_z_mean[i] > z_mean) z_mean = par->batch_z_mean[i];
+        }
+    }
 
-    for (int j = 0; j<9; ++j){
-        if (par->nonzero_terms[j].n != -1 && par->nonzero_terms[j].l != -1){
-            const int n = par->nonzero_terms[j].n;
-            const int l = par->nonzero_terms[j].l;
-            if (n == 4 && l == 0){
-                double *result =
-                    (double *)coffe_malloc(sizeof(double)*coffe_sep_len);
-                double *separations =
-                    (double *)coffe_malloc(sizeof(double)*coffe_sep_len);
-
-                double *result0 =
-                    (double *)coffe_malloc(sizeof(double)*coffe_sep_len);
-
-                #pragma omp parallel for num_threads(par->nthreads)
-                for (size_t i = 0; i<coffe_sep_len; ++i){
-                    separations[i] = NORM(coffe_sep[i]); // dimensionless!
-
-                    result[i] = integrals_bessel(
-                        par->power_spectrum_norm,
-                        n, l, separations[i],
-                        par->k_min_norm, par->k_max_norm
-                    );
-
-                    result0[i] = integrals_renormalization0(
-                        par->power_spectrum_norm,
-                        n, l, separations[i],
-                        par->k_min_norm, par->k_max_norm
-                    );
+    double chi_max;
+    if (par->output_type == 0){
+        chi_max = interp_spline(&bg->comoving_distance, z_mean);
+    }
+    else if (par->output_type == 1 || par->output_type == 2){
+        chi_max = interp_spline(&bg->comoving_distance, z_mean + deltaz); // dimensionless
+    }
+    else if (par->output_type == 3){
+        chi_max = interp_spline(&bg->comoving_distance, z_max); // dimensionless
+    }
+    else if (par->output_type == 6){
+        chi_max = interp_spline(&bg->comoving_distance, z_mean) + 300.*COFFE_H0;
+    }
+    else{
+        chi_max = 0.;
+    }
+    return chi_max;
+}
 
-                }
-                init_spline(
-                    &(integral[j].result),
-                    separations,
-                    result,
-                    coffe_sep_len,
-                    par->interp_method
-                );
-                separations[0] = 0.0;
-                result0[0] = 0.0;
-                init_spline(
-                    &integral[j].renormalization0,
-                    separations,
-                    result0,
-                    coffe_sep_len,
-                    par->interp_method
-                );
-                free(separations);
-                free(result);
-                free(result0);
 
-                const size_t nbins = 200;
-                double *result2d = (double *)coffe_malloc(sizeof(double)*(nbins + 1)*(nbins + 1));
+/**
+    computes the renormalization term at all the <len> points (chi1[i], chi2[i]),
+    one task per point
+**/
 
-                double chi_min = 0.;
-                double chi_max;
-                if (par->output_type == 0){
-                    chi_max = interp_spline(&bg->comoving_distance, par->z_mean);
-                }
-                else if (par->output_type == 1 || par->output_type == 2){
-                    chi_max = interp_spline(&bg->comoving_distance, par->z_mean + par->deltaz); // dimensionless
-                }
-                else if (par->output_type == 3){
-                    chi_max = interp_spline(&bg->comoving_distance, par->z_max); // dimensionless
-                }
-                else if (par->output_type == 6){
-                    chi_max = interp_spline(&bg->comoving_distance, par->z_mean) + 300.*COFFE_H0;
-                }
-                else{
-                    chi_max = 0.;
-                }
-                double *chi_array = (double *)coffe_malloc(sizeof(double)*(nbins + 1));
-                for (size_t i = 0; i<=nbins; ++i){
-                    chi_array[i] = (chi_min + (double)i/nbins*(chi_max - chi_min)); // dimensionless
-                }
+static void integrals_renormalization_sample(
+    struct coffe_parameters_t *par,
+    size_t len,
+    const double *chi1,
+    const double *chi2,
+    double *result
+)
+{
+    #pragma omp taskloop
+    for (size_t i = 0; i<len; ++i){
+        result[i] = integrals_renormalization(
+            par->power_spectrum_norm,
+            chi1[i], chi2[i],
+            par->k_min_norm, par->k_max_norm
+        );
+    }
+}
+
+
+/**
+    tabulates the renormalization term on [0, chi_max]^2;
+    the grid (the same along both axes, as the term is symmetric in chi1 <-> chi2)
+    starts out uniform, and the spline is tested at the midpoints of all the
+    cells; the midpoint of an interval is added as a node whenever the spline
+    misses the term by more than COFFE_RENORMALIZATION_PRECISION (relative
+    to its largest value) in any cell of its row. A node adds a whole row and
+    column, so the grid never has more than COFFE_RENORMALIZATION_MAX_BINS
+    intervals, with a warning if that leaves errors above the precision.
+    Only the upper triangle is ever computed; the term at the midpoints is
+    kept, so on later passes only the cells in the rows and columns of the
+    refined intervals need it, and the values at the midpoints of two
+    refined intervals end up in the grid
+**/
 
-                #pragma omp parallel for num_threads(par->nthreads) collapse(2)
-                for (size_t i = 0; i<=nbins; ++i){
-                    for (size_t k = 0; k<=nbins; ++k){
-                        result2d[k*(nbins + 1) + i] = integrals_renormalization(
-                            par->power_spectrum_norm,
-                            chi_array[i], chi_array[k],
-                            par->k_min_norm, par->k_max_norm
-                        );
+static int integrals_renormalization_grid(
+    struct coffe_parameters_t *par,
+    const double chi_max,
+    struct coffe_interpolation2d *interp
+)
+{
+    size_t len = COFFE_RENORMALIZATION_BINS + 1;
+    double *chi = (double *)coffe_malloc(sizeof(double)*len);
+    for (size_t i = 0; i<len; ++i){
+        chi[i] = (double)i/(len - 1)*chi_max; // dimensionless
+    }
+    /* NAN marks the values not computed yet, in the grid and at the midpoints */
+    double *grid = (double *)coffe_malloc(sizeof(double)*len*len);
+    for (size_t i = 0; i<len*len; ++i) grid[i] = NAN;
+    double *mid = (double *)coffe_malloc(sizeof(double)*(len - 1)*(len - 1));
+    for (size_t i = 0; i<(len - 1)*(len - 1); ++i) mid[i] = NAN;
+
+    while (1){
+        /* computing the missing values in the upper triangle */
+        size_t missing = 0;
+        for (size_t i = 0; i<len; ++i){
+            for (size_t k = i; k<len; ++k){
+                if (isnan(grid[i*len + k])) ++missing;
+            }
+        }
+        if (missing > 0){
+            double *chi1 = (double *)coffe_malloc(sizeof(double)*missing);
+            double *chi2 = (double *)coffe_malloc(sizeof(double)*missing);
+            double *values = (double *)coffe_malloc(sizeof(double)*missing);
+            size_t counter = 0;
+            for (size_t i = 0; i<len; ++i){
+                for (size_t k = i; k<len; ++k){
+                    if (isnan(grid[i*len + k])){
+                        chi1[counter] = chi[i];
+                        chi2[counter] = chi[k];
+                        ++counter;
+                    }
+                }
+            }
+            integrals_renormalization_sample(par, missing, chi1, chi2, values);
+            counter = 0;
+            for (size_t i = 0; i<len; ++i){
+                for (size_t k = i; k<len; ++k){
+                    if (isnan(grid[i*len + k])){
+                        grid[i*len + k] = grid[k*len + i] = values[counter];
+                        ++counter;
                     }
                 }
+            }
+            free(chi1);
+            free(chi2);
+            free(values);
+        }
 
-                integral[8].renormalization.spline =
-                    gsl_spline2d_alloc(
-                        gsl_interp2d_bicubic,
-                        (nbins + 1), (nbins + 1)
-                    );
-                integral[8].renormalization.xaccel =
-                    gsl_interp_accel_alloc();
-                integral[8].renormalization.yaccel =
-                    gsl_interp_accel_alloc();
-
-                gsl_spline2d_init(
-                    integral[8].renormalization.spline,
-                    chi_array, chi_array, result2d,
-                    (nbins + 1), (nbins + 1)
-                );
+        const size_t intervals = len - 1;
+        if (intervals >= COFFE_RENORMALIZATION_MAX_BINS) break;
 
-                free(chi_array);
-                free(result2d);
+        /* the same for the midpoints of the cells, all of them on the first pass */
+        size_t tests = 0;
+        for (size_t i = 0; i<intervals; ++i){
+            for (size_t k = i; k<intervals; ++k){
+                if (isnan(mid[i*intervals + k])) ++tests;
             }
-            else{
-                /* if integral is not divergent, use implementation of 2FAST */
-                size_t npoints = (size_t)par->bessel_bins;
-                double *sep =
-                    (double *)coffe_malloc(sizeof(double)*npoints);
-                double *result =
-                    (double *)coffe_malloc(sizeof(double)*npoints);
-                twofast_1bessel(
-                    sep, result, npoints,
-                    par->power_spectrum_norm.spline->x,
-                    par->power_spectrum_norm.spline->y,
-                    par->power_spectrum_norm.spline->size,
-                    l, n,
-                    COFFE_H0, par->k_min_norm,
-                    par->k_min_norm, par->k_max_norm, 0
-                );
-                if (n >= l){
-                    for (size_t i = 0; i<npoints; ++i){
-                        result[i] *= pow(sep[i], n - l); // r^(n - l) * I^n_l(r)
+        }
+        if (tests > 0){
+            double *chi1 = (double *)coffe_malloc(sizeof(double)*tests);
+            double *chi2 = (double *)coffe_malloc(sizeof(double)*tests);
+            double *values = (double *)coffe_malloc(sizeof(double)*tests);
+            size_t counter = 0;
+            for (size_t i = 0; i<intervals; ++i){
+                for (size_t k = i; k<intervals; ++k){
+                    if (isnan(mid[i*intervals + k])){
+                        chi1[counter] = (chi[i] + chi[i + 1])/2.;
+                        chi2[counter] = (chi[k] + chi[k + 1])/2.;
+                        ++counter;
                     }
-                    double result_limit, error_limit;
-                    {
-                        struct integrals_params test;
-                        test.result.spline = par->power_spectrum_norm.spline;
-                        test.result.accel = par->power_spectrum_norm.accel;
-                        test.n = n;
-                        test.l = l;
-
-                        gsl_integration_workspace *space =
-                            gsl_integration_workspace_alloc(COFFE_MAX_INTSPACE);
-
-                        gsl_function integrand;
-                        integrand.function = &integrals_prefactor;
-                        integrand.params = &test;
-
-                        double precision = 1E-5;
-                        gsl_integration_qag(
-                            &integrand, par->k_min_norm, par->k_max_norm, 0,
-                            precision, COFFE_MAX_INTSPACE,
-                            GSL_INTEG_GAUSS61, space, &result_limit, &error_limit
-                        );
-                        gsl_integration_workspace_free(space);
+                }
+            }
+            integrals_renormalization_sample(par, tests, chi1, chi2, values);
+            counter = 0;
+            for (size_t i = 0; i<intervals; ++i){
+                for (size_t k = i; k<intervals; ++k){
+                    if (isnan(mid[i*intervals + k])){
+                        mid[i*intervals + k] = mid[k*intervals + i] = values[counter];
+                        ++counter;
                     }
-                    r0_result = result_limit*integrals_coefficients(l)/2./M_PI/M_PI;
                 }
-                else{
-                    r0_result = 0.0;
+            }
+            free(chi1);
+            free(chi2);
+            free(values);
+        }
+
+        double scale = 0;
+        for (size_t i = 0; i<len*len; ++i){
+            if (fabs(grid[i]) > scale) scale = fabs(grid[i]);
+        }
+
+        /* the error of an interval is the largest one in its row (and column) */
+        init_spline2d(interp, chi, chi, grid, len, len);
+        double *error = (double *)coffe_malloc(sizeof(double)*intervals);
+        for (size_t i = 0; i<intervals; ++i) error[i] = 0;
+        for (size_t i = 0; i<intervals; ++i){
+            for (size_t k = i; k<intervals; ++k){
+                const double diff = fabs(
+                    mid[i*intervals + k]
+                   -interp_spline2d(
+                        interp,
+                        (chi[i] + chi[i + 1])/2.,
+                        (chi[k] + chi[k + 1])/2.
+                    )
+                );
+                if (diff > error[i]) error[i] = diff;
+                if (diff > error[k]) error[k] = diff;
+            }
+        }
+        free_spline2d(interp);
+        size_t refined = 0;
+        for (size_t i = 0; i<intervals; ++i){
+            if (error[i] > COFFE_RENORMALIZATION_PRECISION*scale) ++refined;
+        }
+
+        if (refined == 0){
+            free(error);
+            break;
+        }
+
+        /* if there are more candidates than room, only the worst ones are refined */
+        double threshold = COFFE_RENORMALIZATION_PRECISION*scale;
+        const int capped = refined > COFFE_RENORMALIZATION_MAX_BINS - intervals;
+        if (capped){
+            refined = COFFE_RENORMALIZATION_MAX_BINS - intervals;
+            double *sorted = (double *)coffe_malloc(sizeof(double)*intervals);
+            memcpy(sorted, error, sizeof(double)*intervals);
+            qsort(sorted, intervals, sizeof(double), coffe_compare_descending);
+            threshold = sorted[refined - 1];
+            free(sorted);
+        }
+
+        /* inserting the new nodes, keeping everything computed so far */
+        const size_t new_len = len + refined;
+        double *new_chi = (double *)coffe_malloc(sizeof(double)*new_len);
+        double *new_grid = (double *)coffe_malloc(sizeof(double)*new_len*new_len);
+        size_t *position = (size_t *)coffe_malloc(sizeof(size_t)*len);
+        size_t *mid_position = (size_t *)coffe_malloc(sizeof(size_t)*intervals);
+        size_t counter = 0, inserted = 0;
+        double remaining = 0;
+        for (size_t i = 0; i<len; ++i){
+            position[i] = counter;
+            new_chi[counter++] = chi[i];
+            if (i < intervals){
+                const int refine = capped ? error[i] >= threshold : error[i] > threshold;
+                if (refine && inserted < refined){
+                    mid_position[i] = counter;
+                    new_chi[counter++] = (chi[i] + chi[i + 1])/2.;
+                    ++inserted;
                 }
-                r0_sep = 0.0;
-
-                double min_sep[] = {
-                    NORM(1E-6), NORM(1E-5), NORM(1E-4),
-                    NORM(1E-3), NORM(2E-3), NORM(5E-3),
-                    NORM(7E-3), NORM(8E-3), NORM(9E-3),
-                    NORM(1E-2), NORM(1.1E-2), NORM(1.2E-2),
-                    NORM(1.25E-2), NORM(1.3E-2), NORM(1.35E-2),
-                    NORM(1.5E-2), NORM(2E-2), NORM(2.5E-2),
-                    NORM(3E-2), NORM(3.5E-2), NORM(5E-2),
-                    NORM(7E-2), NORM(8E-2), NORM(9E-2),
-                    NORM(1E-1), NORM(1.1E-1), NORM(1.2E-1),
-                    NORM(1.25E-1), NORM(1.3E-1), NORM(1.35E-1),
-                    NORM(1.5E-1), NORM(1.75E-1), NORM(2E-1), NORM(2.5E-1),
-                    NORM(3E-1), NORM(3.5E-1), NORM(4E-1),
-                    NORM(5E-1), NORM(6E-1),
-                    NORM(7E-1), NORM(8E-1), NORM(9E-1)
-                };
-                const size_t len = sizeof(min_sep)/sizeof(min_sep[0]);
-                struct integrals_params test;
-                test.result.spline = par->power_spectrum_norm.spline;
-                test.result.accel = par->power_spectrum_norm.accel;
-                test.n = n;
-                test.l = l;
-
-                gsl_function integrand;
-                integrand.function = &integrals_bessel_integrand;
-                integrand.params = &test;
-
-                double precision = 1E-5;
-                double temp_result, temp_error;
-
-                gsl_integration_workspace *wspace =
-                    gsl_integration_workspace_alloc(COFFE_MAX_INTSPACE);
-
-                double *final_sep =
-                    (double *)coffe_malloc(sizeof(double)*(npoints + len + 1));
-
-                double *final_result =
-                    (double *)coffe_malloc(sizeof(double)*(npoints + len + 1));
-
-                final_sep[0] = r0_sep;
-                final_result[0] = r0_result;
-
-                for (size_t i = 1; i<=len; ++i){
-                    test.r = min_sep[i - 1];
-                    final_sep[i] = min_sep[i - 1]; // dimensionless!
-                    gsl_integration_qag(
-                        &integrand, par->k_min_norm, par->k_max_norm, 0,
-                        precision, COFFE_MAX_INTSPACE,
-                        GSL_INTEG_GAUSS61, wspace,
-                        &temp_result, &temp_error
-                    );
-                    if (n > l){
-                        final_result[i] = pow(final_sep[i], n - l)*temp_result/2./M_PI/M_PI;
-                    }
-                    else{
-                        final_result[i] = temp_result/2./M_PI/M_PI;
-                    }
+                else{
+                    mid_position[i] = new_len;
+                    if (error[i] > remaining) remaining = error[i];
                 }
-                gsl_integration_workspace_free(wspace);
+            }
+        }
+        if (capped && remaining > COFFE_RENORMALIZATION_PRECISION*scale){
+            fprintf(stderr,
+                "WARNING: the renormalization grid has reached its largest size "
+                "(COFFE_RENORMALIZATION_MAX_BINS = %d intervals) with errors "
+                "up to %e relative to its maximum left "
+                "(COFFE_RENORMALIZATION_PRECISION = %e)\n",
+                COFFE_RENORMALIZATION_MAX_BINS,
+                remaining/scale,
+                COFFE_RENORMALIZATION_PRECISION
+            );
+        }
+        for (size_t i = 0; i<new_len*new_len; ++i) new_grid[i] = NAN;
+        for (size_t i = 0; i<len; ++i){
+            for (size_t k = 0; k<len; ++k){
+                new_grid[position[i]*new_len + position[k]] = grid[i*len + k];
+            }
+        }
 
-                for (size_t i = len + 1; i<npoints + len + 1; ++i){
-                    final_sep[i] = sep[i - len - 1];
-                    final_result[i] = result[i - len - 1];
+        /*
+            the midpoints of two refined intervals become nodes, those of
+            two intervals left alone stay midpoints (of the interval starting
+            at the same node), the rest is computed on the next pass
+        */
+        const size_t new_intervals = counter - 1;
+        double *new_mid =
+            (double *)coffe_malloc(sizeof(double)*new_intervals*new_intervals);
+        for (size_t i = 0; i<new_intervals*new_intervals; ++i) new_mid[i] = NAN;
+        for (size_t i = 0; i<intervals; ++i){
+            for (size_t k = 0; k<intervals; ++k){
+                const size_t mid1 = mid_position[i], mid2 = mid_position[k];
+                if (mid1 != new_len && mid2 != new_len){
+                    new_grid[mid1*new_len + mid2] = mid[i*intervals + k];
                 }
+                else if (mid1 == new_len && mid2 == new_len){
+                    new_mid[position[i]*new_intervals + position[k]] = mid[i*intervals + k];
+                }
+            }
+        }
+
+        free(position);
+        free(mid_position);
+        free(error);
+        free(chi);
+        free(grid);
+        free(mid);
+        chi = new_chi;
+        grid = new_grid;
+        mid = new_mid;
+        len = counter;
+    }
+
+    init_spline2d(interp, chi, chi, grid, len, len);
+    free(chi);
+    free(grid);
+    free(mid);
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    computes the divergent integral I^4_0 and its renormalization,
+    spawning one task per separation and per point of the renormalization grid
+    into the pool of the enclosing parallel region
+**/
+
+static int integrals_divergent(
+    struct coffe_parameters_t *par,
+    struct coffe_background_t *bg,
+    struct coffe_integrals_t *integral,
+    const int n,
+    const int l
+)
+{
+    double *result =
+        (double *)coffe_malloc(sizeof(double)*coffe_sep_len);
+    double *separations =
+        (double *)coffe_malloc(sizeof(double)*coffe_sep_len);
+
+    double *result0 =
+        (double *)coffe_malloc(sizeof(double)*coffe_sep_len);
+
+    /* the 1D sweep runs alongside the tabulation of the renormalization */
+    #pragma omp taskloop nogroup
+    for (size_t i = 0; i<coffe_sep_len; ++i){
+        separations[i] = NORM(coffe_sep[i]); // dimensionless!
+
+        result[i] = integrals_bessel(
+            par->power_spectrum_norm,
+            n, l, separations[i],
+            par->k_min_norm, par->k_max_norm
+        );
+
+        result0[i] = integrals_renormalization0(
+            par->power_spectrum_norm,
+            n, l, separations[i],
+            par->k_min_norm, par->k_max_norm
+        );
 
+    }
+
+    integrals_renormalization_grid(
+        par, integrals_chi_max(par, bg), &integral->renormalization
+    );
+
+    #pragma omp taskwait
+
+    init_spline(
+        &integral->result,
+        separations,
+        result,
+        coffe_sep_len,
+        par->interp_method
+    );
+    separations[0] = 0.0;
+    result0[0] = 0.0;
+    init_spline(
+        &integral->renormalization0,
+        separations,
+        result0,
+        coffe_sep_len,
+        par->interp_method
+    );
+    free(separations);
+    free(result);
+    free(result0);
+
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    computes the (non-divergent) integral I^n_l using 2FAST,
+    with the small separations done directly
+**/
+
+static int integrals_twofast(
+    struct coffe_parameters_t *par,
+    struct coffe_integrals_t *integral,
+    const int n,
+    const int l
+)
+{
+    size_t npoints = (size_t)par->bessel_bins;
+    double *sep =
+        (double *)coffe_malloc(sizeof(double)*npoints);
+    double *result =
+        (double *)coffe_malloc(sizeof(double)*npoints);
+    twofast_1bessel(
+        sep, result, npoints,
+        par->power_spectrum_norm.spline->x,
+        par->power_spectrum_norm.spline->y,
+        par->power_spectrum_norm.spline->size,
+        l, n,
+        COFFE_H0, par->k_min_norm,
+        par->k_min_norm, par->k_max_norm, par->fftw_flag
+    );
+    double r0_result;
+    if (n >= l){
+        for (size_t i = 0; i<npoints; ++i){
+            result[i] *= pow(sep[i], n - l); // r^(n - l) * I^n_l(r)
+        }
+        double result_limit, error_limit;
+        {
+            struct integrals_params test;
+            test.result = par->power_spectrum_norm;
+            test.n = n;
+            test.l = l;
+
+            gsl_integration_workspace *space = coffe_workspace();
+
+            gsl_function integrand;
+            integrand.function = &integrals_prefactor;
+            integrand.params = &test;
+
+            double precision = 1E-5;
+            gsl_integration_qag(
+                &integrand, par->k_min_norm, par->k_max_norm, 0,
+                precision, COFFE_MAX_INTSPACE,
+                GSL_INTEG_GAUSS61, space, &result_limit, &error_limit
+            );
+        }
+        r0_result = result_limit*integrals_coefficients(l)/2./M_PI/M_PI;
+    }
+    else{
+        r0_result = 0.0;
+    }
+    const double r0_sep = 0.0;
+
+    double min_sep[] = {
+        NORM(1E-6), NORM(1E-5), NORM(1E-4),
+        NORM(1E-3), NORM(2E-3), NORM(5E-3),
+        NORM(7E-3), NORM(8E-3), NORM(9E-3),
+        NORM(1E-2), NORM(1.1E-2), NORM(1.2E-2),
+        NORM(1.25E-2), NORM(1.3E-2), NORM(1.35E-2),
+        NORM(1.5E-2), NORM(2E-2), NORM(2.5E-2),
+        NORM(3E-2), NORM(3.5E-2), NORM(5E-2),
+        NORM(7E-2), NORM(8E-2), NORM(9E-2),
+        NORM(1E-1), NORM(1.1E-1), NORM(1.2E-1),
+        NORM(1.25E-1), NORM(1.3E-1), NORM(1.35E-1),
+        NORM(1.5E-1), NORM(1.75E-1), NORM(2E-1), NORM(2.5E-1),
+        NORM(3E-1), NORM(3.5E-1), NORM(4E-1),
+        NORM(5E-1), NORM(6E-1),
+        NORM(7E-1), NORM(8E-1), NORM(9E-1)
+    };
+    const size_t len = sizeof(min_sep)/sizeof(min_sep[0]);
+    struct integrals_params test;
+    test.result = par->power_spectrum_norm;
+    test.n = n;
+    test.l = l;
+
+    gsl_function integrand;
+    integrand.function = &integrals_bessel_integrand;
+    integrand.params = &test;
+
+    double precision = 1E-5;
+    double temp_result, temp_error;
+
+    gsl_integration_workspace *wspace = coffe_workspace();
+
+    double *final_sep =
+        (double *)coffe_malloc(sizeof(double)*(npoints + len + 1));
+
+    double *final_result =
+        (double *)coffe_malloc(sizeof(double)*(npoints + len + 1));
+
+    final_sep[0] = r0_sep;
+    final_result[0] = r0_result;
+
+    for (size_t i = 1; i<=len; ++i){
+        test.r = min_sep[i - 1];
+        final_sep[i] = min_sep[i - 1]; // dimensionless!
+        gsl_integration_qag(
+            &integrand, par->k_min_norm, par->k_max_norm, 0,
+            precision, COFFE_MAX_INTSPACE,
+            GSL_INTEG_GAUSS61, wspace,
+            &temp_result, &temp_error
+        );
+        if (n > l){
+            final_result[i] = pow(final_sep[i], n - l)*temp_result/2./M_PI/M_PI;
+        }
+        else{
+            final_result[i] = temp_result/2./M_PI/M_PI;
+        }
+    }
+
+    for (size_t i = len + 1; i<npoints + len + 1; ++i){
+        final_sep[i] = sep[i - len - 1];
+        final_result[i] = result[i - len - 1];
+    }
+
+    init_spline(
+        &integral->result,
+        final_sep,
+        final_result,
+        npoints,
+        par->interp_method
+    );
+    free(sep);
+    free(result);
+    free(final_sep);
+    free(final_result);
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    key of the cache, i.e. the hash of everything the integrals depend on:
+    the (normalized) power spectrum, the k range, the sampling
+    of the Bessel integrals, which I^n_l are needed, and the chi range
+    of the renormalization
+**/
+
+static uint64_t integrals_cache_key(
+    struct coffe_parameters_t *par,
+    struct coffe_background_t *bg
+)
+{
+    const int version = COFFE_INTEGRALS_CACHE_VERSION;
+    uint64_t hash = COFFE_HASH_INIT;
+    hash = coffe_hash(&version, sizeof(version), hash);
+    hash = coffe_hash(
+        par->power_spectrum_norm.spline->x,
+        sizeof(double)*par->power_spectrum_norm.spline->size, hash
+    );
+    hash = coffe_hash(
+        par->power_spectrum_norm.spline->y,
+        sizeof(double)*par->power_spectrum_norm.spline->size, hash
+    );
+    hash = coffe_hash(&par->k_min_norm, sizeof(double), hash);
+    hash = coffe_hash(&par->k_max_norm, sizeof(double), hash);
+    hash = coffe_hash(&par->bessel_bins, sizeof(int), hash);
+    hash = coffe_hash(coffe_sep, sizeof(coffe_sep), hash);
+    for (int j = 0; j<9; ++j){
+        hash = coffe_hash(&par->nonzero_terms[j].n, sizeof(int), hash);
+        hash = coffe_hash(&par->nonzero_terms[j].l, sizeof(int), hash);
+    }
+    if (par->divergent){
+        const double chi_max = integrals_chi_max(par, bg);
+        hash = coffe_hash(&chi_max, sizeof(double), hash);
+    }
+    return hash;
+}
+
+
+static int integrals_cache_write_array(
+    FILE *file,
+    const double *values,
+    uint64_t len
+)
+{
+    if (fwrite(&len, sizeof(len), 1, file) != 1) return EXIT_FAILURE;
+    if (fwrite(values, sizeof(double), len, file) != len) return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    reads an array written by integrals_cache_write_array;
+    on success, <values> needs to be freed by the caller
+**/
+
+static int integrals_cache_read_array(
+    FILE *file,
+    double **values,
+    uint64_t *len
+)
+{
+    if (fread(len, sizeof(*len), 1, file) != 1 || *len == 0) return EXIT_FAILURE;
+    *values = (double *)coffe_malloc(sizeof(double)*(*len));
+    if (fread(*values, sizeof(double), *len, file) != *len){
+        free(*values);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    stores the raw data of all the splines in <integral>
+    into the (binary) file <filename>
+**/
+
+static int integrals_cache_write(
+    const char *filename,
+    uint64_t key,
+    struct coffe_parameters_t *par,
+    struct coffe_integrals_t integral[]
+)
+{
+    /* writing to a temporary file of its own first, so concurrent runs never see partial files */
+    char temp[COFFE_MAX_STRLEN + 16];
+    FILE *file = open_temporary(filename, temp, sizeof(temp));
+    if (file == NULL) return EXIT_FAILURE;
+
+    int error = 0;
+    error |= fwrite(COFFE_INTEGRALS_CACHE_MAGIC, 1, 8, file) != 8;
+    error |= fwrite(&key, sizeof(key), 1, file) != 1;
+    for (int j = 0; j<9 && !error; ++j){
+        const int32_t nl[2] = {par->nonzero_terms[j].n, par->nonzero_terms[j].l};
+        error |= fwrite(nl, sizeof(nl), 1, file) != 1;
+        if (nl[0] == -1 || error) continue;
+        const gsl_spline *result = integral[j].result.spline;
+        error |= integrals_cache_write_array(file, result->x, result->size);
+        error |= integrals_cache_write_array(file, result->y, result->size);
+        if (nl[0] == 4 && nl[1] == 0){
+            const gsl_spline *result0 = integral[j].renormalization0.spline;
+            error |= integrals_cache_write_array(file, result0->x, result0->size);
+            error |= integrals_cache_write_array(file, result0->y, result0->size);
+            const gsl_spline2d *result2d = integral[j].renormalization.spline;
+            const size_t xsize = result2d->interp_object.xsize;
+            const size_t ysize = result2d->interp_object.ysize;
+            error |= integrals_cache_write_array(file, result2d->xarr, xsize);
+            error |= integrals_cache_write_array(file, result2d->yarr, ysize);
+            error |= integrals_cache_write_array(file, result2d->zarr, xsize*ysize);
+        }
+    }
+    error |= fclose(file) != 0;
+
+    if (error || rename(temp, filename) != 0){
+        remove(temp);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    reads the integrals back from the file <filename>,
+    provided it was written with the same key;
+    on failure, <integral> is left untouched
+**/
+
+static int integrals_cache_read(
+    const char *filename,
+    uint64_t key,
+    struct coffe_parameters_t *par,
+    struct coffe_integrals_t integral[]
+)
+{
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) return EXIT_FAILURE;
+
+    char magic[8];
+    uint64_t file_key;
+    if (
+        fread(magic, 1, 8, file) != 8 ||
+        memcmp(magic, COFFE_INTEGRALS_CACHE_MAGIC, 8) != 0 ||
+        fread(&file_key, sizeof(file_key), 1, file) != 1 ||
+        file_key != key
+    ){
+        fclose(file);
+        return EXIT_FAILURE;
+    }
+
+    /* all the arrays are read first, and only then turned into splines */
+    double *values[9][7] = {{NULL}};
+    uint64_t len[9][7] = {{0}};
+    int error = 0;
+    for (int j = 0; j<9 && !error; ++j){
+        int32_t nl[2];
+        error |= fread(nl, sizeof(nl), 1, file) != 1;
+        if (error) break;
+        error |= nl[0] != par->nonzero_terms[j].n || nl[1] != par->nonzero_terms[j].l;
+        if (nl[0] == -1 || error) continue;
+        const int arrays = (nl[0] == 4 && nl[1] == 0) ? 7 : 2;
+        for (int i = 0; i<arrays && !error; ++i){
+            error |= integrals_cache_read_array(file, &values[j][i], &len[j][i]);
+        }
+        error |= len[j][0] != len[j][1];
+        if (arrays == 7){
+            error |= len[j][2] != len[j][3] || len[j][6] != len[j][4]*len[j][5];
+        }
+    }
+    fclose(file);
+
+    if (!error){
+        for (int j = 0; j<9; ++j){
+            const int n = par->nonzero_terms[j].n;
+            const int l = par->nonzero_terms[j].l;
+            if (n == -1) continue;
+            init_spline(
+                &integral[j].result,
+                values[j][0], values[j][1], len[j][0],
+                par->interp_method
+            );
+            if (n == 4 && l == 0){
                 init_spline(
-                    &(integral[j].result),
-                    final_sep,
-                    final_result,
-                    npoints,
+                    &integral[j].renormalization0,
+                    values[j][2], values[j][3], len[j][2],
                     par->interp_method
                 );
-                free(sep);
-                free(result);
-                free(final_sep);
-                free(final_result);
+                init_spline2d(
+                    &integral[j].renormalization,
+                    values[j][4], values[j][5], values[j][6],
+                    len[j][4], len[j][5]
+                );
             }
             integral[j].n = n, integral[j].l = l;
         }
     }
 
+    for (int j = 0; j<9; ++j){
+        for (int i = 0; i<7; ++i){
+            free(values[j][i]);
+        }
+    }
+
+    return error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+/**
+    computes all the nonzero I^n_l integrals
+**/
+
+int coffe_integrals_init(
+    struct coffe_parameters_t *par,
+    struct coffe_background_t *bg,
+    struct coffe_integrals_t integral[]
+)
+{
+    coffe_profile_start(COFFE_PROFILE_INTEGRALS);
+    printf("Calculating integrals of Bessel functions...\n");
+
+    /* reading the integrals from a previous run, if any */
+    char cache_file[COFFE_MAX_STRLEN + 32];
+    uint64_t cache_key = 0;
+    if (strlen(par->integrals_cache) > 0){
+        cache_key = integrals_cache_key(par, bg);
+        snprintf(
+            cache_file, sizeof(cache_file), "%s/integrals_%016" PRIx64 ".bin",
+            par->integrals_cache, cache_key
+        );
+        if (integrals_cache_read(cache_file, cache_key, par, integral) == EXIT_SUCCESS){
+            printf("Integrals of Bessel functions read from %s in %.2f s\n",
+                cache_file, coffe_profile_stop(COFFE_PROFILE_INTEGRALS));
+            return EXIT_SUCCESS;
+        }
+    }
+
+    gsl_error_handler_t *default_handler =
+        gsl_set_error_handler_off();
+
+    /* reusing the FFTW plans from previous runs, if any */
+    if (strlen(par->fftw_wisdom) > 0){
+        if (!twofast_import_wisdom(par->fftw_wisdom) && par->fftw_flag > 0){
+            fprintf(stderr,
+                "WARNING: cannot import FFTW wisdom from %s, "
+                "plans will be computed from scratch\n", par->fftw_wisdom);
+        }
+    }
+
+    /*
+        every nonzero I^n_l is an independent task; the divergent one
+        (if any) is the most expensive, so it's spawned first
+    */
+    #pragma omp parallel num_threads(par->nthreads)
+    {
+        #pragma omp single
+        {
+            for (int j = 8; j>=0; --j){
+                if (par->nonzero_terms[j].n != -1 && par->nonzero_terms[j].l != -1){
+                    const int n = par->nonzero_terms[j].n;
+                    const int l = par->nonzero_terms[j].l;
+                    #pragma omp task firstprivate(j)
+                    {
+                        if (n == 4 && l == 0){
+                            integrals_divergent(par, bg, &integral[j], n, l);
+                        }
+                        else{
+                            integrals_twofast(par, &integral[j], n, l);
+                        }
+                        integral[j].n = n, integral[j].l = l;
+                    }
+                }
+            }
+        }
+        /* the plans are cached per thread */
+        twofast_free_plans();
+    }
+    /* with MPI, all the processes computed the same, and the first one writes it */
+    const int writer = coffe_mpi_rank() == 0;
+    if (strlen(par->fftw_wisdom) > 0 && writer){
+        if (!twofast_export_wisdom(par->fftw_wisdom)){
+            fprintf(stderr,
+                "WARNING: cannot export FFTW wisdom to %s\n", par->fftw_wisdom);
+        }
+    }
+
+    if (strlen(par->integrals_cache) > 0 && writer){
+        if (integrals_cache_write(cache_file, cache_key, par, integral) != EXIT_SUCCESS){
+            fprintf(stderr,
+                "WARNING: cannot write the integrals to %s\n", cache_file);
+        }
+    }
+
     gsl_set_error_handler(default_handler);
-    end = clock();
     printf("Integrals of Bessel functions calculated in %.2f s\n",
-        (double)(end - start) / CLOCKS_PER_SEC);
+        coffe_profile_stop(COFFE_PROFILE_INTEGRALS));
 
     return EXIT_SUCCESS;
 }
@@ -583,9 +1147,7 @@ int coffe_integrals_free(
     if (integral[8].n == 4 && integral[8].l == 0){
         free_spline(&integral[8].result);
         free_spline(&integral[8].renormalization0);
-        gsl_spline2d_free(integral[8].renormalization.spline);
-        gsl_interp_accel_free(integral[8].renormalization.xaccel);
-        gsl_interp_accel_free(integral[8].renormalization.yaccel);
+        free_spline2d(&integral[8].renormalization);
     }
     return EXIT_SUCCESS;
 }
@@ -27,40 +27,23 @@
 
 #include "common.h"
 #include "errors.h"
-#include "parser.h"
-#include "background.h"
-#include "covariance.h"
-#include "integrals.h"
-#include "corrfunc.h"
-#include "multipoles.h"
-#include "average_multipoles.h"
-#include "output.h"
+#include "coffe.h"
 
 
 int main(int argc, char *argv[])
 {
-    struct coffe_parameters_t par;
-    struct coffe_background_t bg;
-    struct coffe_integrals_t integral[9];
-    struct coffe_corrfunc_ang_t cf_ang;
-    struct coffe_corrfunc_t cf;
-    struct coffe_multipoles_t mp;
-    struct coffe_average_multipoles_t ramp;
-    struct coffe_covariance_t cov_mp;
-    struct coffe_covariance_t cov_ramp;
-    struct coffe_corrfunc2d_t cf2d;
-
     char settings_file[COFFE_MAX_STRLEN];
 
     int command;
     char *nthreads_opt = 0, *settings_opt = 0;
-    while ((command = getopt(argc, argv, "hvCs:n:")) != -1){
+    while ((command = getopt(argc, argv, "hvCs:n:b:")) != -1){
         switch (command){
             case 'h':
                 printf("Usage: coffe [FLAGS] [FILE]\n");
                 printf("Options:\n");
                 printf("\t-s [FILE]\t Process settings file [FILE]\n");
                 printf("\t-n [NUMTHREADS]\t Use [NUMTHREADS] threads for the computation\n");
+                printf("\t-b [FILE]\t Convert the text table [FILE] into the binary [FILE].bin and exit\n");
                 printf("\t-h\t\t Show this help page and exit\n");
                 printf("\t-C\t\t Show copyright information and exit\n");
                 printf("\t-v\t\t Show version information and exit\n");
@@ -80,6 +63,15 @@ int main(int argc, char *argv[])
             case 'n':
                 nthreads_opt = optarg;
                 break;
+            case 'b':{
+                char output[COFFE_MAX_STRLEN];
+                snprintf(output, COFFE_MAX_STRLEN, "%s.bin", optarg);
+                if (convert_binary(optarg, output) != EXIT_SUCCESS){
+                    return EXIT_FAILURE;
+                }
+                printf("Converted %s into %s\n", optarg, output);
+                return EXIT_SUCCESS;
+            }
         }
     }
     if (settings_opt == NULL){
@@ -91,6 +83,9 @@ int main(int argc, char *argv[])
         strncpy(settings_file, settings_opt, COFFE_MAX_STRLEN);
     }
 
+    /* all the processes run the same program, sharing the expensive parts */
+    coffe_mpi_init(&argc, &argv);
+
     printf("   _____ ____  ______ ______ ______ \n");
     printf("  / ____/ __ \\|  ____|  ____|  ____|\n");
     printf(" | |   | |  | | |__  | |__  | |__   \n");
@@ -98,8 +93,7 @@ int main(int argc, char *argv[])
     printf(" | |___| |__| | |    | |    | |____ \n");
     printf("  \\_____\\____/|_|    |_|    |______|\n");
 
-    clock_t start, end;
-    start = clock();
+    const double start = coffe_profile_time();
 
     int n;
     if (nthreads_opt != NULL){
@@ -113,59 +107,31 @@ int main(int argc, char *argv[])
         print_error_verbose(PROG_VALUE_ERROR, "NUMTHREADS");
         exit(EXIT_FAILURE);
     }
-    par.nthreads = n;
-    printf("Number of threads in use: %d\n", par.nthreads);
+    printf("Number of threads in use: %d\n", n);
+    if (coffe_mpi_size() > 1){
+        printf("Number of processes in use: %d\n", coffe_mpi_size());
+    }
 
     /* the main sequence */
 
-    coffe_parser_init(settings_file, &par);
-
-    coffe_background_init(&par, &bg);
-
-    coffe_integrals_init(&par, &bg, integral);
-
-    coffe_corrfunc_init(&par, &bg, integral, &cf_ang, &cf, &cf2d);
-
-    coffe_multipoles_init(&par, &bg, integral, &mp);
-
-    coffe_average_multipoles_init(&par, &bg, integral, &ramp);
+    struct coffe_context_t *ctx =
+        (struct coffe_context_t *)coffe_malloc(sizeof(struct coffe_context_t));
 
-    coffe_covariance_init(&par, &bg, &cov_mp, &cov_ramp);
+    coffe_context_init(ctx, settings_file, n);
 
-    coffe_output_init(
-        &par, &bg,
-#ifdef HAVE_INTEGRALS
-        integral,
-#endif
-        &cf_ang, &cf,
-        &mp, &ramp,
-        &cov_mp, &cov_ramp,
-        &cf2d
-    );
+    /* all the redshift bins of a batch, or just the one */
+    coffe_context_batch(ctx);
 
     /* freeing the memory */
 
-    coffe_background_free(&bg);
+    coffe_context_free(ctx);
 
-    coffe_integrals_free(integral);
+    free(ctx);
 
-    coffe_corrfunc_ang_free(&cf_ang);
-
-    coffe_corrfunc_free(&cf);
-
-    coffe_corrfunc2d_free(&cf2d);
-
-    coffe_multipoles_free(&mp);
-
-    coffe_average_multipoles_free(&ramp);
-
-    coffe_covariance_free(&cov_mp);
-
-    coffe_covariance_free(&cov_ramp);
-
-    end = clock();
     printf("Total program runtime is: %.2f s\n",
-        (double)(end - start) / CLOCKS_PER_SEC);
+        coffe_profile_time() - start);
+
+    coffe_mpi_finalize();
 
     return EXIT_SUCCESS;
 }
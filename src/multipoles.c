@@ -20,7 +20,6 @@
 #include <string.h>
 #include <time.h>
 #include <gsl/gsl_integration.h>
-#include <gsl/gsl_sf_legendre.h>
 #include <gsl/gsl_errno.h>
 
 #ifdef HAVE_CUBA
@@ -41,6 +40,8 @@
 #include "integrals.h"
 #include "multipoles.h"
 #include "functions.h"
+#include "flatsky.h"
+#include "checkpoint.h"
 
 
 struct multipoles_params
@@ -49,7 +50,8 @@ struct multipoles_params
     struct coffe_parameters_t *par;
     struct coffe_integrals_t *integral;
     double sep;
-    int l;
+    const int *l; /* the multipoles */
+    size_t index; /* which of the above the integrand is for */
 };
 
 static int multipoles_check_range(
@@ -127,22 +129,15 @@ static double multipoles_nonintegrated_integrand(
     struct coffe_background_t *bg = all_params->bg;
     struct coffe_integrals_t *integral = all_params->integral;
     double sep = all_params->sep;
-    int l = all_params->l;
+    int l = all_params->l[all_params->index];
 
     double mu = 2*x - 1;
-    if (l == 0){
-        return functions_nonintegrated(
-            par, bg, integral,
-            par->z_mean, mu, sep
-        );
-    }
-    else{
-        return functions_nonintegrated(
-            par, bg, integral,
-            par->z_mean, mu, sep
-            )
-           *gsl_sf_legendre_Pl(l, mu);
-    }
+    double legendre = 1;
+    if (l != 0) coffe_legendre(&l, 1, mu, &legendre);
+    return functions_nonintegrated(
+        par, bg, integral,
+        par->z_mean, mu, sep
+    )*legendre;
 }
 
 static double multipoles_nonintegrated(
@@ -157,7 +152,8 @@ static double multipoles_nonintegrated(
     test.par = par;
     test.bg = bg;
     test.integral = integral;
-    test.l = l;
+    test.l = &l;
+    test.index = 0;
     test.sep = sep;
 
     double result, error, prec = 1E-5;
@@ -166,24 +162,51 @@ static double multipoles_nonintegrated(
     integrand.function = &multipoles_nonintegrated_integrand;
     integrand.params = &test;
 
-    gsl_integration_workspace *wspace =
-        gsl_integration_workspace_alloc(COFFE_MAX_INTSPACE);
+    gsl_integration_workspace *wspace = coffe_workspace();
     gsl_integration_qag(
         &integrand, 0., 1., 0,
         prec, COFFE_MAX_INTSPACE,
         GSL_INTEG_GAUSS61, wspace,
         &result, &error
     );
-    gsl_integration_workspace_free(wspace);
     return (2*l + 1)*result
         /interp_spline(&bg->D1, 0)/interp_spline(&bg->D1, 0);
 }
 
+/**
+    computes all the <l_len> multipoles of the nonintegrated terms at
+    separation <sep> at once, from the nodes in mu of the 1D rule <rule>
+**/
+
+static int multipoles_nonintegrated_projected(
+    struct coffe_parameters_t *par,
+    struct coffe_background_t *bg,
+    struct coffe_integrals_t *integral,
+    double sep,
+    const struct coffe_gauss_rule *rule,
+    double *result
+)
+{
+    for (size_t i = 0; i<rule->l_len; ++i){
+        result[i] = 0;
+    }
+    if (par->nonintegrated_terms.len == 0) return EXIT_SUCCESS;
+
+    functions_nonintegrated_multipoles(
+        par, bg, integral, par->z_mean, sep, rule, result
+    );
+    const double norm = 1./interp_spline(&bg->D1, 0)/interp_spline(&bg->D1, 0);
+    for (size_t i = 0; i<rule->l_len; ++i){
+        result[i] *= norm;
+    }
+    return EXIT_SUCCESS;
+}
+
 #ifdef HAVE_CUBA
 static int multipoles_single_integrated_integrand(
     const int *ndim, const cubareal var[],
     const int *ncomp, cubareal value[],
-    void *p
+    void *p, const int *nvec
 )
 #else
 static double multipoles_single_integrated_integrand(
@@ -197,42 +220,55 @@ static double multipoles_single_integrated_integrand(
     struct coffe_integrals_t *integral = params->integral;
     double sep = params->sep;
 
-    double mu = 2*var[0] - 1, x = var[1];
 #ifdef HAVE_CUBA
-    if (params->l == 0){
-        value[0] = functions_single_integrated(
-            par, bg, integral, par->z_mean, mu, sep, x
-        );
-        return EXIT_SUCCESS;
+    /*
+        Cuba hands over *nvec points at once, each with *ndim coordinates,
+        and expects the *ncomp multipoles of each of them
+    */
+    double z_mean[*nvec], mu[*nvec], x[*nvec], temp[*nvec];
+    for (int i = 0; i<*nvec; ++i){
+        z_mean[i] = par->z_mean;
+        mu[i] = 2*var[i*(*ndim)] - 1;
+        x[i] = var[i*(*ndim) + 1];
     }
-    else{
-        value[0] = functions_single_integrated(
-            par, bg, integral, par->z_mean, mu, sep, x
-        )
-       *gsl_sf_legendre_Pl(params->l, mu);
-        return EXIT_SUCCESS;
+    functions_single_integrated_batch(
+        par, bg, integral, sep, *nvec, z_mean, mu, x, temp
+    );
+    double legendre[(*ncomp)*(*nvec)];
+    coffe_legendre_array(params->l, *ncomp, mu, *nvec, legendre);
+    for (int i = 0; i<*nvec; ++i){
+        for (int j = 0; j<*ncomp; ++j){
+            value[i*(*ncomp) + j] = temp[i]*legendre[j*(*nvec) + i];
+        }
     }
+    return EXIT_SUCCESS;
 #else
-    if (params->l == 0){
-        return functions_single_integrated(
-            par, bg, integral, par->z_mean, mu, sep, x
-        );
-    }
-    else{
-        return functions_single_integrated(
-            par, bg, integral, par->z_mean, mu, sep, x
-        )
-       *gsl_sf_legendre_Pl(params->l, mu);
-    }
+    double mu = 2*var[0] - 1, x = var[1];
+    double legendre = 1;
+    coffe_legendre(&params->l[params->index], 1, mu, &legendre);
+    return functions_single_integrated(
+        par, bg, integral, par->z_mean, mu, sep, x
+    )*legendre;
 #endif
 }
 
-static double multipoles_single_integrated(
+/**
+    computes all the <l_len> multipoles <l> of the single integrated terms
+    at separation <sep>; when the integration method allows it (Cuba,
+    or the GSL methods with points fixed in advance), from one integration
+**/
+
+static int multipoles_single_integrated(
     struct coffe_parameters_t *par,
     struct coffe_background_t *bg,
     struct coffe_integrals_t integral[],
     double sep,
-    double l
+    const int *l,
+    size_t l_len,
+    const struct coffe_gauss_rule *rule,
+    const struct coffe_effort *effort,
+    double *result,
+    double *error
 )
 {
     const int dims = 2;
@@ -243,133 +279,54 @@ static double multipoles_single_integrated(
     test.integral = integral;
     test.sep = sep;
     test.l = l;
+    test.index = 0;
 
-    int flag = 0;
-    int len = par->correlation_sources_len*(par->correlation_sources_len + 1)/2;
-    for (int i = 0; i<len; ++i){
-        if (
-            strcmp(par->corr_terms[i], "07") == 0 ||
-            strcmp(par->corr_terms[i], "70") == 0 ||
-            strcmp(par->corr_terms[i], "08") == 0 ||
-            strcmp(par->corr_terms[i], "80") == 0 ||
-            strcmp(par->corr_terms[i], "09") == 0 ||
-            strcmp(par->corr_terms[i], "90") == 0 ||
-            strcmp(par->corr_terms[i], "17") == 0 ||
-            strcmp(par->corr_terms[i], "71") == 0 ||
-            strcmp(par->corr_terms[i], "18") == 0 ||
-            strcmp(par->corr_terms[i], "81") == 0 ||
-            strcmp(par->corr_terms[i], "19") == 0 ||
-            strcmp(par->corr_terms[i], "91") == 0 ||
-            strcmp(par->corr_terms[i], "27") == 0 ||
-            strcmp(par->corr_terms[i], "72") == 0 ||
-            strcmp(par->corr_terms[i], "28") == 0 ||
-            strcmp(par->corr_terms[i], "82") == 0 ||
-            strcmp(par->corr_terms[i], "29") == 0 ||
-            strcmp(par->corr_terms[i], "92") == 0 ||
-            strcmp(par->corr_terms[i], "37") == 0 ||
-            strcmp(par->corr_terms[i], "73") == 0 ||
-            strcmp(par->corr_terms[i], "38") == 0 ||
-            strcmp(par->corr_terms[i], "83") == 0 ||
-            strcmp(par->corr_terms[i], "39") == 0 ||
-            strcmp(par->corr_terms[i], "93") == 0 ||
-            strcmp(par->corr_terms[i], "47") == 0 ||
-            strcmp(par->corr_terms[i], "74") == 0 ||
-            strcmp(par->corr_terms[i], "48") == 0 ||
-            strcmp(par->corr_terms[i], "84") == 0 ||
-            strcmp(par->corr_terms[i], "49") == 0 ||
-            strcmp(par->corr_terms[i], "94") == 0 ||
-            strcmp(par->corr_terms[i], "57") == 0 ||
-            strcmp(par->corr_terms[i], "75") == 0 ||
-            strcmp(par->corr_terms[i], "58") == 0 ||
-            strcmp(par->corr_terms[i], "85") == 0 ||
-            strcmp(par->corr_terms[i], "59") == 0 ||
-            strcmp(par->corr_terms[i], "95") == 0 ||
-            strcmp(par->corr_terms[i], "67") == 0 ||
-            strcmp(par->corr_terms[i], "76") == 0 ||
-            strcmp(par->corr_terms[i], "68") == 0 ||
-            strcmp(par->corr_terms[i], "86") == 0 ||
-            strcmp(par->corr_terms[i], "69") == 0 ||
-            strcmp(par->corr_terms[i], "96") == 0
-        ) ++flag;
-    }
-    if (flag == 0) return 0;
+    for (size_t i = 0; i<l_len; ++i){
+        result[i] = 0;
+        error[i] = 0;
+    }
+    if (par->single_terms.len == 0) return EXIT_SUCCESS;
+
+    /* the tolerance applies to the normalized multipoles */
+    const double norm = 1./interp_spline(&bg->D1, 0)/interp_spline(&bg->D1, 0);
+    struct coffe_effort scaled = *effort;
+    scaled.epsabs = HUGE_VAL;
+    for (size_t i = 0; i<l_len; ++i){
+        scaled.epsabs = fmin(scaled.epsabs, effort->epsabs/((2*l[i] + 1)*norm));
+    }
 
 #ifdef HAVE_CUBA
+    (void)rule;
     int nregions, neval, fail;
-    double result[1], error[1], prob[1];
+    double prob[l_len];
 
-    Cuhre(dims, 1,
-        multipoles_single_integrated_integrand,
-        (void *)&test, 1,
-        5e-4, 0, 0,
-        1, par->integration_bins, 7,
+    Cuhre(dims, l_len,
+        (integrand_t)multipoles_single_integrated_integrand,
+        (void *)&test, COFFE_NVEC,
+        scaled.epsrel, scaled.epsabs, 0,
+        1, scaled.calls_max, 7,
         NULL, NULL,
         &nregions, &neval, &fail, result, error, prob
     );
-    return (2*l + 1)*result[0]/interp_spline(&bg->D1, 0)/interp_spline(&bg->D1, 0);
 #else
     gsl_monte_function integrand;
     integrand.dim = dims;
     integrand.params = &test;
     integrand.f = &multipoles_single_integrated_integrand;
 
-    gsl_rng *random;
-    gsl_rng_env_setup();
-    const gsl_rng_type *T = gsl_rng_default;
-    random = gsl_rng_alloc(T);
-    double result, error;
-    double lower[dims];
-    double upper[dims];
-    for (int i = 0; i<dims; ++i){
-        lower[i] = 0.0;
-        upper[i] = 1.0;
-    }
-
-    switch (par->integration_method){
-        case 0:{
-            gsl_monte_plain_state *state =
-                gsl_monte_plain_alloc(dims);
-            gsl_monte_plain_integrate(
-                &integrand, lower, upper,
-                dims, par->integration_bins, random,
-                state,
-                &result, &error
-            );
-            gsl_monte_plain_free(state);
-            break;
-        }
-        case 1:{
-            gsl_monte_miser_state *state =
-                gsl_monte_miser_alloc(dims);
-            gsl_monte_miser_integrate(
-                &integrand, lower, upper,
-                dims, par->integration_bins, random,
-                state,
-                &result, &error
-            );
-            gsl_monte_miser_free(state);
-            break;
-        }
-        case 2:{
-            gsl_monte_vegas_state *state =
-                gsl_monte_vegas_alloc(dims);
-            gsl_monte_vegas_integrate(
-                &integrand, lower, upper,
-                dims, par->integration_bins, random,
-                state,
-                &result, &error
-            );
-            gsl_monte_vegas_free(state);
-            break;
-        }
-        default:
-            result = 0;
-            break;
-    }
-    gsl_rng_free(random);
-    return (2*l + 1)*result
-        /interp_spline(&bg->D1, 0)/interp_spline(&bg->D1, 0);
+    /* the multipoles are applied by the integrator if it can share the points */
+    const int monopole = 0;
+    if (integrate_multipoles_available(par->integration_method)) test.l = &monopole;
+    integrate_multipoles_adaptive(
+        &integrand, par->integration_method, &scaled,
+        rule, 0, l, l_len, &test.index, result, error
+    );
 #endif
+    for (size_t i = 0; i<l_len; ++i){
+        result[i] *= (2*l[i] + 1)*norm;
+        error[i] *= (2*l[i] + 1)*norm;
+    }
+    return EXIT_SUCCESS;
 }
 
 
@@ -377,7 +334,7 @@ static double multipoles_single_integrated(
 static int multipoles_double_integrated_integrand(
     const int *ndim, const cubareal var[],
     const int *ncomp, cubareal value[],
-    void *p
+    void *p, const int *nvec
 )
 #else
 static double multipoles_double_integrated_integrand(
@@ -391,150 +348,164 @@ static double multipoles_double_integrated_integrand(
     struct coffe_integrals_t *integral = params->integral;
     double sep = params->sep;
 
-    double mu = 2*var[0] - 1, x1 = var[1], x2 = var[2];
 #ifdef HAVE_CUBA
-    if (params->l == 0){
-        value[0] = functions_double_integrated(
-            par, bg, integral, par->z_mean, mu, sep, x1, x2
-        );
-        return EXIT_SUCCESS;
+    /*
+        Cuba hands over *nvec points at once, each with *ndim coordinates,
+        and expects the *ncomp multipoles of each of them
+    */
+    double z_mean[*nvec], mu[*nvec], x1[*nvec], x2[*nvec], temp[*nvec];
+    for (int i = 0; i<*nvec; ++i){
+        z_mean[i] = par->z_mean;
+        mu[i] = 2*var[i*(*ndim)] - 1;
+        x1[i] = var[i*(*ndim) + 1];
+        x2[i] = var[i*(*ndim) + 2];
     }
-    else{
-        value[0] = functions_double_integrated(
-            par, bg, integral, par->z_mean, mu, sep, x1, x2
-        )
-       *gsl_sf_legendre_Pl(params->l, mu);
-        return EXIT_SUCCESS;
+    functions_double_integrated_batch(
+        par, bg, integral, sep, *nvec, z_mean, mu, x1, x2, temp
+    );
+    double legendre[(*ncomp)*(*nvec)];
+    coffe_legendre_array(params->l, *ncomp, mu, *nvec, legendre);
+    for (int i = 0; i<*nvec; ++i){
+        for (int j = 0; j<*ncomp; ++j){
+            value[i*(*ncomp) + j] = temp[i]*legendre[j*(*nvec) + i];
+        }
     }
+    return EXIT_SUCCESS;
 #else
-    if (params->l == 0){
-        return functions_double_integrated(
-            par, bg, integral, par->z_mean, mu, sep, x1, x2
-        );
-    }
-    else{
-        return functions_double_integrated(
-            par, bg, integral, par->z_mean, mu, sep, x1, x2
-        )
-       *gsl_sf_legendre_Pl(params->l, mu);
-    }
+    double mu = 2*var[0] - 1, x1 = var[1], x2 = var[2];
+    double legendre = 1;
+    coffe_legendre(&params->l[params->index], 1, mu, &legendre);
+    return functions_double_integrated(
+        par, bg, integral, par->z_mean, mu, sep, x1, x2
+    )*legendre;
 #endif
 }
 
-static double multipoles_double_integrated(
+#ifndef HAVE_CUBA
+/**
+    the above at <n> points at once, without the multipoles
+    (which are applied by the integrator)
+**/
+
+static int multipoles_double_integrated_batch(
+    const double *var, size_t n, size_t dim, void *p, double *value
+)
+{
+    struct multipoles_params *params = (struct multipoles_params *) p;
+    double *z_mean = (double *)coffe_malloc(sizeof(double)*4*n);
+    double *mu = z_mean + n, *x1 = z_mean + 2*n, *x2 = z_mean + 3*n;
+    for (size_t i = 0; i<n; ++i){
+        z_mean[i] = params->par->z_mean;
+        mu[i] = 2*var[i*dim] - 1;
+        x1[i] = var[i*dim + 1];
+        x2[i] = var[i*dim + 2];
+    }
+    functions_double_integrated_batch(
+        params->par, params->bg, params->integral, params->sep,
+        n, z_mean, mu, x1, x2, value
+    );
+    free(z_mean);
+    return EXIT_SUCCESS;
+}
+#endif
+
+/**
+    computes all the <l_len> multipoles <l> of the double integrated terms
+    at separation <sep>; when the integration method allows it (Cuba,
+    or the GSL methods with points fixed in advance), from one integration
+**/
+
+static int multipoles_double_integrated(
     struct coffe_parameters_t *par,
     struct coffe_background_t *bg,
     struct coffe_integrals_t integral[],
     double sep,
-    double l
+    const int *l,
+    size_t l_len,
+    const struct coffe_gauss_rule *rule,
+    const struct coffe_effort *effort,
+    double *result,
+    double *error
 )
 {
     const int dims = 3;
+
     struct multipoles_params test;
     test.par = par;
     test.bg = bg;
     test.integral = integral;
     test.sep = sep;
     test.l = l;
+    test.index = 0;
 
-    int flag = 0;
-    int len = par->correlation_sources_len*(par->correlation_sources_len + 1)/2;
-    for (int i = 0; i<len; ++i){
-        if (
-            strcmp(par->corr_terms[i], "77") == 0 || // g4-g4
-            strcmp(par->corr_terms[i], "88") == 0 || // g5-g5
-            strcmp(par->corr_terms[i], "99") == 0 || // len-len
-            strcmp(par->corr_terms[i], "78") == 0 || // g4-g5
-            strcmp(par->corr_terms[i], "87") == 0 || // g5-g4
-            strcmp(par->corr_terms[i], "79") == 0 || // g4-len
-            strcmp(par->corr_terms[i], "97") == 0 || // len-g4
-            strcmp(par->corr_terms[i], "89") == 0 || // g5-len
-            strcmp(par->corr_terms[i], "98") == 0    // len-g5
-        ) ++flag;
-    }
-    if (flag == 0) return 0;
+    for (size_t i = 0; i<l_len; ++i){
+        result[i] = 0;
+        error[i] = 0;
+    }
+    if (par->double_terms.len == 0) return EXIT_SUCCESS;
+
+    /* the tolerance applies to the normalized multipoles */
+    const double norm = 1./interp_spline(&bg->D1, 0)/interp_spline(&bg->D1, 0);
+    struct coffe_effort scaled = *effort;
+    scaled.epsabs = HUGE_VAL;
+    for (size_t i = 0; i<l_len; ++i){
+        scaled.epsabs = fmin(scaled.epsabs, effort->epsabs/((2*l[i] + 1)*norm));
+    }
 
 #ifdef HAVE_CUBA
+    (void)rule;
     int nregions, neval, fail;
-    double result[1], error[1], prob[1];
+    double prob[l_len];
 
-    Cuhre(dims, 1,
-        multipoles_double_integrated_integrand,
-        (void *)&test, 1,
-        5e-4, 0, 0,
-        1, par->integration_bins, 7,
+    Cuhre(dims, l_len,
+        (integrand_t)multipoles_double_integrated_integrand,
+        (void *)&test, COFFE_NVEC,
+        scaled.epsrel, scaled.epsabs, 0,
+        1, scaled.calls_max, 7,
         NULL, NULL,
         &nregions, &neval, &fail, result, error, prob
     );
-    return (2*l + 1)*result[0]/interp_spline(&bg->D1, 0)/interp_spline(&bg->D1, 0);
 #else
     gsl_monte_function integrand;
     integrand.dim = dims;
     integrand.params = &test;
     integrand.f = &multipoles_double_integrated_integrand;
 
-    gsl_rng *random;
-    gsl_rng_env_setup();
-    const gsl_rng_type *T = gsl_rng_default;
-    random = gsl_rng_alloc(T);
-    double result, error;
-    double lower[dims];
-    double upper[dims];
-    for (int i = 0; i<dims; ++i){
-        lower[i] = 0.0;
-        upper[i] = 1.0;
-    }
-
-    switch (par->integration_method){
-        case 0:{
-            gsl_monte_plain_state *state =
-                gsl_monte_plain_alloc(dims);
-            gsl_monte_plain_integrate(
-                &integrand, lower, upper,
-                dims, par->integration_bins, random,
-                state,
-                &result, &error
-            );
-            gsl_monte_plain_free(state);
-            break;
-        }
-        case 1:{
-            gsl_monte_miser_state *state =
-                gsl_monte_miser_alloc(dims);
-            gsl_monte_miser_integrate(
-                &integrand, lower, upper,
-                dims, par->integration_bins, random,
-                state,
-                &result, &error
-            );
-            gsl_monte_miser_free(state);
-            break;
-        }
-        case 2:{
-            gsl_monte_vegas_state *state =
-                gsl_monte_vegas_alloc(dims);
-            gsl_monte_vegas_integrate(
-                &integrand, lower, upper,
-                dims, par->integration_bins, random,
-                state,
-                &result, &error
-            );
-            gsl_monte_vegas_free(state);
-            break;
-        }
-        default:
-            result = 0;
-            break;
+    /* with the points fixed in advance they are evaluated in batches, applying the multipoles */
+    if (integrate_multipoles_available(par->integration_method)){
+        const struct coffe_batch_function batch = {
+            &multipoles_double_integrated_batch, dims, &test
+        };
+        integrate_multipoles_adaptive_batch(
+            &batch, par->integration_method, &scaled,
+            rule, 0, l, l_len, result, error
+        );
+    }
+    else{
+        integrate_multipoles_adaptive(
+            &integrand, par->integration_method, &scaled,
+            rule, 0, l, l_len, &test.index, result, error
+        );
     }
-    gsl_rng_free(random);
-    return (2*l + 1)*result
-        /interp_spline(&bg->D1, 0)/interp_spline(&bg->D1, 0);
 #endif
+    for (size_t i = 0; i<l_len; ++i){
+        result[i] *= (2*l[i] + 1)*norm;
+        error[i] *= (2*l[i] + 1)*norm;
+    }
+    return EXIT_SUCCESS;
 }
 
 
-int coffe_multipoles_init(
+/**
+    computes the multipoles of <nbins> redshift bins at once, with the
+    settings of bin b in par[b] and the result in mp[b], sharing the
+    background and the integrals; the contributions of all the bins
+    form one task graph, so no bin waits for another one to finish
+**/
+
+int coffe_multipoles_batch_init(
     struct coffe_parameters_t *par,
+    size_t nbins,
     struct coffe_background_t *bg,
     struct coffe_integrals_t *integral,
     struct coffe_multipoles_t *mp
@@ -543,89 +514,460 @@ int coffe_multipoles_init(
 #ifdef HAVE_CUBA
     cubacores(0, 10000);
 #endif
-    if (par->output_type == 2){
-        mp->flag = 1;
-        clock_t start, end;
-        printf("Calculating multipoles...\n");
-        start = clock();
+    if (nbins == 0 || par[0].output_type != 2) return EXIT_SUCCESS;
+
+    printf("Calculating multipoles...\n");
+    coffe_profile_start(COFFE_PROFILE_MULTIPOLES);
 
-        gsl_error_handler_t *default_handler =
-            gsl_set_error_handler_off();
+    gsl_error_handler_t *default_handler =
+        gsl_set_error_handler_off();
 
+    /* the separations of all the bins, as one list of tasks */
+    size_t ntasks = 0;
+    for (size_t b = 0; b<nbins; ++b){
+        mp[b].flag = 1;
         alloc_double_matrix(
-            &mp->result,
-            par->multipole_values_len,
-            par->sep_len
+            &mp[b].result,
+            par[b].multipole_values_len,
+            par[b].sep_len
         );
-        mp->l = (int *)coffe_malloc(sizeof(int)*par->multipole_values_len);
-        for (int i = 0; i<par->multipole_values_len; ++i){
-            mp->l[i] = (int)par->multipole_values[i];
+        alloc_double_matrix(
+            &mp[b].error_single,
+            par[b].multipole_values_len,
+            par[b].sep_len
+        );
+        alloc_double_matrix(
+            &mp[b].error_double,
+            par[b].multipole_values_len,
+            par[b].sep_len
+        );
+        mp[b].l = (int *)coffe_malloc(sizeof(int)*par[b].multipole_values_len);
+        for (int i = 0; i<par[b].multipole_values_len; ++i){
+            mp[b].l[i] = (int)par[b].multipole_values[i];
         }
-        mp->l_len = (size_t)par->multipole_values_len;
+        mp[b].l_len = (size_t)par[b].multipole_values_len;
 
-        mp->sep = (double *)coffe_malloc(sizeof(double)*par->sep_len);
-        for (size_t i = 0; i<par->sep_len; ++i){
-            mp->sep[i] = (double)par->sep[i];
+        mp[b].sep = (double *)coffe_malloc(sizeof(double)*par[b].sep_len);
+        for (size_t i = 0; i<par[b].sep_len; ++i){
+            mp[b].sep[i] = (double)par[b].sep[i];
         }
-        mp->sep_len = (size_t)par->sep_len;
+        mp[b].sep_len = (size_t)par[b].sep_len;
         multipoles_check_range(
-            &mp->sep,
-            &mp->sep_len,
-            par->z_mean,
-            par->deltaz,
+            &mp[b].sep,
+            &mp[b].sep_len,
+            par[b].z_mean,
+            par[b].deltaz,
             bg
         );
+        ntasks += mp[b].sep_len;
+    }
+    const size_t l_len = mp[0].l_len;
+
+    /*
+        the Gauss-Legendre rules in 2 and 3 dimensions, mu being the first one,
+        and the one in mu of the projected nonintegrated terms
+    */
+    struct coffe_gauss_rule rule[4] = {{0}};
+    const int projection = par[0].nonintegrated_projection > 0;
+    if (projection){
+        init_gauss_rule(
+            &rule[1], 1, par[0].nonintegrated_projection, 0, mp[0].l, l_len
+        );
+    }
+#ifndef HAVE_CUBA
+    if (par[0].integration_method == 4){
+        for (size_t dims = 2; dims<=3; ++dims){
+            init_gauss_rule(
+                &rule[dims], dims, par[0].integration_bins, 0,
+                mp[0].l, l_len
+            );
+        }
+    }
+#endif
 
-        #pragma omp parallel for num_threads(par->nthreads) collapse(2)
-        for (size_t i = 0; i<mp->l_len; ++i){
-            for (size_t j = 0; j<mp->sep_len; ++j){
-                mp->result[i][j] =
-                    multipoles_nonintegrated(
-                        par, bg, integral,
-                        mp->sep[j]*COFFE_H0, mp->l[i]
-                    );
+    /*
+        all the contributions as one task graph; the double integrated
+        ones are by far the most expensive, so they are spawned first,
+        largest separation first (over all the bins), and the cheaper
+        ones fill in the gaps
+    */
+    size_t *task_bin = (size_t *)coffe_malloc(sizeof(size_t)*ntasks);
+    size_t *task_sep = (size_t *)coffe_malloc(sizeof(size_t)*ntasks);
+    double *task_value = (double *)coffe_malloc(sizeof(double)*ntasks);
+    size_t *order = (size_t *)coffe_malloc(sizeof(size_t)*ntasks);
+    double **single = (double **)coffe_malloc(sizeof(double *)*nbins);
+    double **twice = (double **)coffe_malloc(sizeof(double *)*nbins);
+    double **error_single = (double **)coffe_malloc(sizeof(double *)*nbins);
+    double **error_twice = (double **)coffe_malloc(sizeof(double *)*nbins);
+    for (size_t b = 0, t = 0; b<nbins; ++b){
+        const size_t len = mp[b].sep_len*l_len;
+        /* zero unless computed, so the results of all the processes can be summed */
+        single[b] = (double *)coffe_malloc(sizeof(double)*len);
+        twice[b] = (double *)coffe_malloc(sizeof(double)*len);
+        error_single[b] = (double *)coffe_malloc(sizeof(double)*len);
+        error_twice[b] = (double *)coffe_malloc(sizeof(double)*len);
+        memset(single[b], 0, sizeof(double)*len);
+        memset(twice[b], 0, sizeof(double)*len);
+        memset(error_single[b], 0, sizeof(double)*len);
+        memset(error_twice[b], 0, sizeof(double)*len);
+        memset(mp[b].result, 0, sizeof(double)*len);
+        for (size_t j = 0; j<mp[b].sep_len; ++j, ++t){
+            task_bin[t] = b;
+            task_sep[t] = j;
+            task_value[t] = mp[b].sep[j];
+        }
+    }
+    coffe_order_descending(task_value, ntasks, order);
+    const struct coffe_effort effort = coffe_effort_first(&par[0], 5e-4);
+
+    /*
+        at the separations where the flat-sky approximation is used, the
+        terms it covers are tabulated separately, and the rest of the
+        terms are computed in full sky with the settings in rest[b]
+    */
+    char *flat = (char *)coffe_malloc(sizeof(char)*ntasks);
+    size_t *flat_task = (size_t *)coffe_malloc(sizeof(size_t)*ntasks);
+    size_t flat_len = 0;
+    double flat_sep_max = 0;
+    for (size_t k = 0; k<ntasks; ++k){
+        const size_t t = order[k], b = task_bin[t], j = task_sep[t];
+        flat[t] = coffe_flatsky_use(
+            &par[b], bg, par[b].z_mean, mp[b].sep[j]*COFFE_H0
+        );
+        if (flat[t]){
+            flat_task[flat_len++] = t;
+            flat_sep_max = fmax(flat_sep_max, mp[b].sep[j]*COFFE_H0);
+        }
+    }
+    struct coffe_parameters_t *rest = NULL;
+    struct coffe_flatsky_t flatsky = {0};
+    double **flat_value = (double **)coffe_malloc(sizeof(double *)*nbins);
+    for (size_t b = 0; b<nbins; ++b){
+        flat_value[b] = (double *)coffe_malloc(sizeof(double)*mp[b].sep_len*l_len);
+        memset(flat_value[b], 0, sizeof(double)*mp[b].sep_len*l_len);
+    }
+    if (flat_len > 0){
+        rest = (struct coffe_parameters_t *)
+            coffe_malloc(sizeof(struct coffe_parameters_t)*nbins);
+        for (size_t b = 0; b<nbins; ++b){
+            coffe_flatsky_remaining(&par[b], &rest[b]);
+        }
+        coffe_flatsky_init(&par[0], integral, mp[0].l, l_len, flat_sep_max, &flatsky);
+        printf("Using the flat-sky approximation at %zu of %zu separations\n",
+            flat_len, ntasks);
+    }
+
+    /*
+        the tasks are spawned in the above order, and each takes the next
+        job of its kind when it starts running, so with several processes
+        the jobs go to whichever is free first
+    */
+    struct coffe_mpi_counter_t counter[3];
+    coffe_mpi_counter_init(&counter[COFFE_PROFILE_DOUBLE], ntasks);
+    coffe_mpi_counter_init(&counter[COFFE_PROFILE_SINGLE], ntasks);
+    /* the projected nonintegrated terms give all the multipoles at once */
+    const size_t nonintegrated_len = projection ? ntasks : ntasks*l_len;
+    coffe_mpi_counter_init(&counter[COFFE_PROFILE_NONINTEGRATED], nonintegrated_len);
+    struct coffe_mpi_counter_t flat_counter;
+    coffe_mpi_counter_init(&flat_counter, flat_len);
+
+    /*
+        the kinds of jobs of the checkpoint are the double and single
+        integrated terms, the nonintegrated ones, the flat-sky ones, and
+        the refined double and single integrated ones, each labelled by
+        its task (times l_len plus the multipole, for the nonintegrated
+        ones without the projection)
+    */
+    const size_t cells[6] = {ntasks, ntasks, nonintegrated_len, ntasks, ntasks, ntasks};
+    struct coffe_checkpoint_t cp;
+    coffe_checkpoint_init(
+        &par[0], "multipoles", "multipoles.checkpoint",
+        coffe_checkpoint_key(par, nbins, bg, integral), 6, cells, l_len, &cp
+    );
+    coffe_checkpoint_phase(&cp, (3*ntasks + flat_len)*l_len);
+
+    #pragma omp parallel num_threads(par[0].nthreads)
+    #pragma omp single
+    {
+        for (size_t n = 0; n<ntasks; ++n){
+            #pragma omp task
+            {
+                const size_t k = coffe_mpi_counter_next(&counter[COFFE_PROFILE_DOUBLE]);
+                if (k < ntasks){
+                    const size_t t = order[k], b = task_bin[t], j = task_sep[t];
+                    double *value = &twice[b][j*l_len], *error = &error_twice[b][j*l_len];
+                    if (!coffe_checkpoint_restore(&cp, 0, t, l_len, value, error)){
+                        const double start = coffe_profile_time();
+                        multipoles_double_integrated(
+                            flat[t] ? &rest[b] : &par[b], bg, integral,
+                            mp[b].sep[j]*COFFE_H0, mp[b].l, l_len, &rule[3], &effort,
+                            value, error
+                        );
+                        coffe_profile_task(COFFE_PROFILE_DOUBLE, start);
+                        coffe_checkpoint_store(&cp, 0, t, l_len, value, error);
+                    }
+                }
             }
         }
-        #pragma omp parallel for num_threads(par->nthreads) collapse(2)
-        for (size_t i = 0; i<mp->l_len; ++i){
-            for (size_t j = 0; j<mp->sep_len; ++j){
-                mp->result[i][j] +=
-                    multipoles_single_integrated(
-                        par, bg, integral,
-                        mp->sep[j]*COFFE_H0, mp->l[i]
-                    );
+        for (size_t n = 0; n<ntasks; ++n){
+            #pragma omp task
+            {
+                const size_t k = coffe_mpi_counter_next(&counter[COFFE_PROFILE_SINGLE]);
+                if (k < ntasks){
+                    const size_t t = order[k], b = task_bin[t], j = task_sep[t];
+                    double *value = &single[b][j*l_len], *error = &error_single[b][j*l_len];
+                    if (!coffe_checkpoint_restore(&cp, 1, t, l_len, value, error)){
+                        const double start = coffe_profile_time();
+                        multipoles_single_integrated(
+                            &par[b], bg, integral,
+                            mp[b].sep[j]*COFFE_H0, mp[b].l, l_len, &rule[2], &effort,
+                            value, error
+                        );
+                        coffe_profile_task(COFFE_PROFILE_SINGLE, start);
+                        coffe_checkpoint_store(&cp, 1, t, l_len, value, error);
+                    }
+                }
             }
         }
-        #pragma omp parallel for num_threads(par->nthreads) collapse(2)
-        for (size_t i = 0; i<mp->l_len; ++i){
-            for (size_t j = 0; j<mp->sep_len; ++j){
-                mp->result[i][j] +=
-                    multipoles_double_integrated(
-                        par, bg, integral,
-                        mp->sep[j]*COFFE_H0, mp->l[i]
-                    );
+        for (size_t n = 0; n<nonintegrated_len; ++n){
+            #pragma omp task
+            {
+                const size_t job =
+                    coffe_mpi_counter_next(&counter[COFFE_PROFILE_NONINTEGRATED]);
+                if (job < nonintegrated_len && projection){
+                    const size_t t = order[job], b = task_bin[t], j = task_sep[t];
+                    double value[l_len];
+                    if (!coffe_checkpoint_restore(&cp, 2, t, l_len, value, NULL)){
+                        const double start = coffe_profile_time();
+                        multipoles_nonintegrated_projected(
+                            flat[t] ? &rest[b] : &par[b], bg, integral,
+                            mp[b].sep[j]*COFFE_H0, &rule[1], value
+                        );
+                        coffe_profile_task(COFFE_PROFILE_NONINTEGRATED, start);
+                        coffe_checkpoint_store(&cp, 2, t, l_len, value, NULL);
+                    }
+                    for (size_t i = 0; i<l_len; ++i){
+                        mp[b].result[i*mp[b].sep_len + j] = value[i];
+                    }
+                }
+                else if (job < nonintegrated_len){
+                    const size_t k = job/l_len, i = job%l_len;
+                    const size_t t = order[k], b = task_bin[t], j = task_sep[t];
+                    double value;
+                    if (!coffe_checkpoint_restore(&cp, 2, t*l_len + i, 1, &value, NULL)){
+                        const double start = coffe_profile_time();
+                        value = multipoles_nonintegrated(
+                            flat[t] ? &rest[b] : &par[b], bg, integral,
+                            mp[b].sep[j]*COFFE_H0, mp[b].l[i]
+                        );
+                        coffe_profile_task(COFFE_PROFILE_NONINTEGRATED, start);
+                        coffe_checkpoint_store(&cp, 2, t*l_len + i, 1, &value, NULL);
+                    }
+                    mp[b].result[i*mp[b].sep_len + j] = value;
+                }
             }
         }
+        for (size_t n = 0; n<flat_len; ++n){
+            #pragma omp task
+            {
+                const size_t k = coffe_mpi_counter_next(&flat_counter);
+                if (k < flat_len){
+                    const size_t t = flat_task[k], b = task_bin[t], j = task_sep[t];
+                    double *value = &flat_value[b][j*l_len];
+                    if (!coffe_checkpoint_restore(&cp, 3, t, l_len, value, NULL)){
+                        const double start = coffe_profile_time();
+                        for (size_t i = 0; i<l_len; ++i){
+                            value[i] = coffe_flatsky_multipole(
+                                &par[b], bg, integral, &flatsky,
+                                par[b].z_mean, mp[b].sep[j]*COFFE_H0, i
+                            );
+                        }
+                        coffe_profile_task(COFFE_PROFILE_NONINTEGRATED, start);
+                        coffe_checkpoint_store(&cp, 3, t, l_len, value, NULL);
+                    }
+                }
+            }
+        }
+    }
+    for (int kind = 0; kind<3; ++kind){
+        coffe_mpi_counter_free(&counter[kind]);
+    }
+    coffe_mpi_counter_free(&flat_counter);
+    for (size_t b = 0; b<nbins; ++b){
+        const size_t len = mp[b].sep_len*l_len;
+        coffe_mpi_sum(single[b], len);
+        coffe_mpi_sum(twice[b], len);
+        coffe_mpi_sum(error_single[b], len);
+        coffe_mpi_sum(error_twice[b], len);
+        coffe_mpi_sum(mp[b].result, len);
+        coffe_mpi_sum(flat_value[b], len);
+    }
 
-        end = clock();
-        printf("Multipoles calculated in %.2f s\n",
-            (double)(end - start) / CLOCKS_PER_SEC);
+    /*
+        with a target accuracy, the above were only estimates; the terms
+        whose error matters for the total at their separation are refined
+    */
+    if (par[0].integration_accuracy > 0){
+        struct coffe_effort *refine = (struct coffe_effort *)
+            coffe_malloc(sizeof(struct coffe_effort)*ntasks);
+        for (size_t t = 0; t<ntasks; ++t){
+            const size_t b = task_bin[t], j = task_sep[t];
+            double total[l_len];
+            for (size_t i = 0; i<l_len; ++i){
+                total[i] = mp[b].result[i*mp[b].sep_len + j] + flat_value[b][j*l_len + i]
+                    + single[b][j*l_len + i] + twice[b][j*l_len + i];
+            }
+            refine[t] = coffe_effort_refine(
+                &par[b], coffe_error_budget(&par[b], total, l_len, 2)
+            );
+        }
 
-        gsl_set_error_handler(default_handler);
+        /*
+            the terms to refine, in the same order as above; they are zeroed
+            everywhere and the rest everywhere but in the first process,
+            so summing over the processes gives back the result
+        */
+        size_t *redo[2], redo_len[2] = {0, 0};
+        double **value[2] = {twice, single}, **value_error[2] = {error_twice, error_single};
+        const int rank = coffe_mpi_rank();
+        for (int kind = 0; kind<2; ++kind){
+            redo[kind] = (size_t *)coffe_malloc(sizeof(size_t)*ntasks);
+            for (size_t k = 0; k<ntasks; ++k){
+                const size_t t = order[k], b = task_bin[t], j = task_sep[t];
+                const int converged = coffe_effort_converged(
+                    &refine[t], &value[kind][b][j*l_len],
+                    &value_error[kind][b][j*l_len], l_len
+                );
+                if (!converged) redo[kind][redo_len[kind]++] = t;
+                if (!converged || rank != 0){
+                    memset(&value[kind][b][j*l_len], 0, sizeof(double)*l_len);
+                    memset(&value_error[kind][b][j*l_len], 0, sizeof(double)*l_len);
+                }
+            }
+        }
+        struct coffe_mpi_counter_t counter[2];
+        for (int kind = 0; kind<2; ++kind){
+            coffe_mpi_counter_init(&counter[kind], redo_len[kind]);
+        }
+        coffe_checkpoint_phase(&cp, (redo_len[0] + redo_len[1])*l_len);
+
+        #pragma omp parallel num_threads(par[0].nthreads)
+        #pragma omp single
+        {
+            for (size_t n = 0; n<redo_len[0]; ++n){
+                #pragma omp task
+                {
+                    const size_t k = coffe_mpi_counter_next(&counter[0]);
+                    if (k < redo_len[0]){
+                        const size_t t = redo[0][k], b = task_bin[t], j = task_sep[t];
+                        double *value = &twice[b][j*l_len], *error = &error_twice[b][j*l_len];
+                        if (!coffe_checkpoint_restore(&cp, 4, t, l_len, value, error)){
+                            const double start = coffe_profile_time();
+                            multipoles_double_integrated(
+                                flat[t] ? &rest[b] : &par[b], bg, integral,
+                                mp[b].sep[j]*COFFE_H0, mp[b].l, l_len, &rule[3], &refine[t],
+                                value, error
+                            );
+                            coffe_profile_task(COFFE_PROFILE_DOUBLE, start);
+                            coffe_checkpoint_store(&cp, 4, t, l_len, value, error);
+                        }
+                    }
+                }
+            }
+            for (size_t n = 0; n<redo_len[1]; ++n){
+                #pragma omp task
+                {
+                    const size_t k = coffe_mpi_counter_next(&counter[1]);
+                    if (k < redo_len[1]){
+                        const size_t t = redo[1][k], b = task_bin[t], j = task_sep[t];
+                        double *value = &single[b][j*l_len], *error = &error_single[b][j*l_len];
+                        if (!coffe_checkpoint_restore(&cp, 5, t, l_len, value, error)){
+                            const double start = coffe_profile_time();
+                            multipoles_single_integrated(
+                                &par[b], bg, integral,
+                                mp[b].sep[j]*COFFE_H0, mp[b].l, l_len, &rule[2], &refine[t],
+                                value, error
+                            );
+                            coffe_profile_task(COFFE_PROFILE_SINGLE, start);
+                            coffe_checkpoint_store(&cp, 5, t, l_len, value, error);
+                        }
+                    }
+                }
+            }
+        }
+        for (int kind = 0; kind<2; ++kind){
+            coffe_mpi_counter_free(&counter[kind]);
+            free(redo[kind]);
+        }
+        for (size_t b = 0; b<nbins; ++b){
+            const size_t len = mp[b].sep_len*l_len;
+            coffe_mpi_sum(single[b], len);
+            coffe_mpi_sum(twice[b], len);
+            coffe_mpi_sum(error_single[b], len);
+            coffe_mpi_sum(error_twice[b], len);
+        }
+        free(refine);
     }
 
+    for (size_t b = 0; b<nbins; ++b){
+        for (size_t j = 0; j<mp[b].sep_len; ++j){
+            for (size_t i = 0; i<l_len; ++i){
+                mp[b].result[i*mp[b].sep_len + j] += flat_value[b][j*l_len + i]
+                    + single[b][j*l_len + i] + twice[b][j*l_len + i];
+                mp[b].error_single[i*mp[b].sep_len + j] = error_single[b][j*l_len + i];
+                mp[b].error_double[i*mp[b].sep_len + j] = error_twice[b][j*l_len + i];
+            }
+        }
+        free(single[b]);
+        free(twice[b]);
+        free(error_single[b]);
+        free(error_twice[b]);
+        free(flat_value[b]);
+    }
+    coffe_checkpoint_free(&cp);
+    free(flat_value);
+    free(flat);
+    free(flat_task);
+    free(rest);
+    coffe_flatsky_free(&flatsky);
+    free(single);
+    free(twice);
+    free(error_single);
+    free(error_twice);
+    free(task_bin);
+    free(task_sep);
+    free(task_value);
+    free(order);
+    free_gauss_rule(&rule[1]);
+    free_gauss_rule(&rule[2]);
+    free_gauss_rule(&rule[3]);
+
+    printf("Multipoles calculated in %.2f s\n",
+        coffe_profile_stop(COFFE_PROFILE_MULTIPOLES));
+
+    gsl_set_error_handler(default_handler);
+
     return EXIT_SUCCESS;
 }
 
+int coffe_multipoles_init(
+    struct coffe_parameters_t *par,
+    struct coffe_background_t *bg,
+    struct coffe_integrals_t *integral,
+    struct coffe_multipoles_t *mp
+)
+{
+    return coffe_multipoles_batch_init(par, 1, bg, integral, mp);
+}
+
 int coffe_multipoles_free(
     struct coffe_multipoles_t *mp
 )
 {
     if (mp->flag){
-        for (size_t i = 0; i<mp->l_len; ++i){
-            free(mp->result[i]);
-        }
         free(mp->result);
+        free(mp->error_single);
+        free(mp->error_double);
         free(mp->l);
         free(mp->sep);
         mp->flag = 0;
@@ -21,7 +21,8 @@
 
 struct coffe_multipoles_t
 {
-    double **result; /* first index = l, second index = separation */
+    double *result; /* result[i*sep_len + j] is the multipole l[i] at sep[j] */
+    double *error_single, *error_double; /* estimated errors of the integrated terms, stored as the result */
     int *l;
     double *sep;
     size_t l_len, sep_len;
@@ -35,6 +36,14 @@ int coffe_multipoles_init(
     struct coffe_multipoles_t *mp
 );
 
+int coffe_multipoles_batch_init(
+    struct coffe_parameters_t *par,
+    size_t nbins,
+    struct coffe_background_t *bg,
+    struct coffe_integrals_t *integral,
+    struct coffe_multipoles_t *mp
+);
+
 int coffe_multipoles_free(
     struct coffe_multipoles_t *mp
 );
@@ -0,0 +1,564 @@
+/*
+ * This file is part of COFFE
+ * Copyright (C) 2018 Goran Jelic-Cizmek
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <gsl/gsl_math.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "common.h"
+#include "background.h"
+#include "integrals.h"
+#include "functions.h"
+#include "offload.h"
+
+#ifndef COFFE_OFFLOAD_BINS
+#define COFFE_OFFLOAD_BINS 65536 // intervals of the uniform tables of the I^n_l
+#endif
+
+#ifndef COFFE_OFFLOAD_BINS2D
+#define COFFE_OFFLOAD_BINS2D 1024 // points along each side of the table of the renormalization
+#endif
+
+#ifdef HAVE_OFFLOAD
+
+/* the tables, all stored back to back in one array of coefficients */
+#define OFFLOAD_Z 0 // z(chi)
+#define OFFLOAD_BACKGROUND 1 // a, conformal_Hz, D1, f, G1, G2 as functions of z
+#define OFFLOAD_BIAS 2 // s1, s2 as functions of z
+#define OFFLOAD_INTEGRALS 3 // the (non-divergent) I^n_l as functions of r
+#define OFFLOAD_DIVERGENT 4 // I^4_0 as a function of r
+#define OFFLOAD_RENORMALIZATION0 5 // the renormalization of I^4_0 at r = 0
+#define OFFLOAD_TABLES 6
+
+
+/**
+    the device copy of a coffe_uniform_table; its coefficients
+    start at <offset> in the array of all the coefficients
+**/
+
+struct offload_table
+{
+    double xmin, inv_dx;
+    size_t len, fields, offset;
+};
+
+
+/**
+    the renormalization of I^4_0 on a uniform grid of <len>^2 points,
+    value[i*len + j] being the one at (x_i, y_j)
+**/
+
+struct offload_grid
+{
+    double xmin, ymin, inv_dx, inv_dy;
+    size_t len;
+};
+
+
+static struct
+{
+    int flag;
+    struct offload_table table[OFFLOAD_TABLES];
+    double *coeffs;
+    size_t coeffs_len;
+    struct offload_grid grid;
+    double *renormalization;
+    size_t renormalization_len;
+    double I0[8]; /* the I^n_l at r = 0 */
+} coffe_offload;
+
+
+#pragma omp declare target
+
+/**
+    field <field> of <table> at <value>, in the same
+    way as interp_uniform_table (without the counting)
+**/
+
+static double offload_eval(
+    const struct offload_table *table,
+    const double *coeffs,
+    double value,
+    size_t field
+)
+{
+    double t = (value - table->xmin)*table->inv_dx;
+    size_t i;
+    if (t <= 0) i = 0;
+    else if (t >= table->len) i = table->len - 1;
+    else i = (size_t)t;
+    t -= i;
+    const double *c = &coeffs[table->offset + 4*(i*table->fields + field)];
+    return c[0] + t*(c[1] + t*(c[2] + t*c[3]));
+}
+
+
+/* the Catmull-Rom cubic through p1 (t = 0) and p2 (t = 1) */
+static double offload_cubic(
+    double p0,
+    double p1,
+    double p2,
+    double p3,
+    double t
+)
+{
+    return p1 + 0.5*t*(
+        p2 - p0 + t*(2*p0 - 5*p1 + 4*p2 - p3 + t*(3*(p1 - p2) + p3 - p0))
+    );
+}
+
+
+/* bicubic interpolation of the renormalization at (x, y) */
+static double offload_renormalization(
+    const struct offload_grid *grid,
+    const double *value,
+    double x,
+    double y
+)
+{
+    const long len = (long)grid->len;
+    const double u = (x - grid->xmin)*grid->inv_dx;
+    const double v = (y - grid->ymin)*grid->inv_dy;
+    long i = (long)floor(u), j = (long)floor(v);
+    if (i < 1) i = 1;
+    if (i > len - 3) i = len - 3;
+    if (j < 1) j = 1;
+    if (j > len - 3) j = len - 3;
+
+    double row[4];
+    for (long a = 0; a<4; ++a){
+        const double *p = &value[(i - 1 + a)*len + j - 1];
+        row[a] = offload_cubic(p[0], p[1], p[2], p[3], v - j);
+    }
+    return offload_cubic(row[0], row[1], row[2], row[3], u - i);
+}
+
+
+/**
+    the double integrated terms at one point, as in functions_double_integrated,
+    with all the lookups done in the tables
+**/
+
+static double offload_point(
+    const struct offload_table *table,
+    const double *coeffs,
+    const struct offload_grid *grid,
+    const double *renormalization,
+    const double *I0,
+    const int *terms,
+    int len,
+    double Omega0_m,
+    int divergent,
+    double chi_mean,
+    double sep,
+    double mu,
+    double x1,
+    double x2
+)
+{
+    struct functions_double_point pt;
+    pt.x1 = x1, pt.x2 = x2;
+    pt.chi1 = chi_mean - sep*mu/2.;
+    pt.chi2 = chi_mean + sep*mu/2.;
+    pt.costheta =
+        (2*chi_mean*chi_mean - sep*sep + mu*mu*sep*sep/2.)
+       /(2*chi_mean*chi_mean - mu*mu*sep*sep/2.);
+    pt.lambda1 = pt.chi1*x1, pt.lambda2 = pt.chi2*x2;
+    pt.r2 = pt.lambda1*pt.lambda1 + pt.lambda2*pt.lambda2
+        - 2*pt.lambda1*pt.lambda2*pt.costheta;
+    if (pt.r2 < 0) pt.r2 = 0;
+
+    const struct offload_table *z = &table[OFFLOAD_Z];
+    const struct offload_table *back = &table[OFFLOAD_BACKGROUND];
+    const double z1_const = offload_eval(z, coeffs, pt.chi1, 0);
+    const double z2_const = offload_eval(z, coeffs, pt.chi2, 0);
+    const double z1 = offload_eval(z, coeffs, pt.lambda1, 0);
+    const double z2 = offload_eval(z, coeffs, pt.lambda2, 0);
+
+    pt.a1 = offload_eval(back, coeffs, z1, 0);
+    pt.H1 = offload_eval(back, coeffs, z1, 1);
+    pt.D1_1 = offload_eval(back, coeffs, z1, 2);
+    pt.f1 = offload_eval(back, coeffs, z1, 3);
+    pt.a2 = offload_eval(back, coeffs, z2, 0);
+    pt.H2 = offload_eval(back, coeffs, z2, 1);
+    pt.D1_2 = offload_eval(back, coeffs, z2, 2);
+    pt.f2 = offload_eval(back, coeffs, z2, 3);
+    pt.G1 = offload_eval(back, coeffs, z1_const, 4);
+    pt.G2 = offload_eval(back, coeffs, z2_const, 5);
+    pt.s1 = offload_eval(&table[OFFLOAD_BIAS], coeffs, z1_const, 0);
+    pt.s2 = offload_eval(&table[OFFLOAD_BIAS], coeffs, z2_const, 1);
+
+    const double r = sqrt(pt.r2);
+    pt.ren = 0;
+    if (divergent){
+        if (pt.r2 <= pow(0.000001*COFFE_H0, 2)){
+            pt.ren = offload_eval(&table[OFFLOAD_RENORMALIZATION0], coeffs, pt.lambda1, 0);
+        }
+        else{
+            pt.ren = offload_eval(&table[OFFLOAD_DIVERGENT], coeffs, r, 0)
+                /* renormalization term */
+               -offload_renormalization(grid, renormalization, pt.lambda1, pt.lambda2);
+        }
+    }
+    for (size_t k = 0; k<8; ++k){
+        pt.integral[k] = offload_eval(&table[OFFLOAD_INTEGRALS], coeffs, r, k);
+        pt.integral0[k] = I0[k];
+    }
+
+    return functions_double_integrated_sum(terms, len, Omega0_m, &pt);
+}
+
+#pragma omp end declare target
+
+
+/**
+    appends the coefficients of <source> to the ones in <coffe_offload>
+    as the table <index>, and frees <source>
+**/
+
+static void offload_append(
+    int index,
+    struct coffe_uniform_table *source
+)
+{
+    const size_t len = 4*source->len*source->fields;
+    struct offload_table *table = &coffe_offload.table[index];
+    table->xmin = source->xmin;
+    table->inv_dx = source->inv_dx;
+    table->len = source->len;
+    table->fields = source->fields;
+    table->offset = coffe_offload.coeffs_len;
+
+    coffe_offload.coeffs = (double *)realloc(
+        coffe_offload.coeffs, sizeof(double)*(coffe_offload.coeffs_len + len)
+    );
+    memcpy(&coffe_offload.coeffs[table->offset], source->coeffs, sizeof(double)*len);
+    coffe_offload.coeffs_len += len;
+    free_uniform_table(source);
+}
+
+
+static double offload_xmin(const struct coffe_interpolation *interp)
+{
+    return interp->spline->x[0];
+}
+
+
+static double offload_xmax(const struct coffe_interpolation *interp)
+{
+    return interp->spline->x[interp->spline->size - 1];
+}
+
+#endif
+
+
+int coffe_offload_init(
+    struct coffe_parameters_t *par,
+    struct coffe_background_t *bg,
+    struct coffe_integrals_t *integral
+)
+{
+    coffe_offload_free();
+#ifdef HAVE_OFFLOAD
+    if (par->double_terms.len == 0) return EXIT_SUCCESS;
+
+    struct coffe_uniform_table table;
+
+    struct coffe_interpolation *z[] = {&bg->z_as_chi};
+    init_uniform_table(
+        &table, z, 1,
+        offload_xmin(&bg->z_as_chi), offload_xmax(&bg->z_as_chi),
+        par->background_bins - 1
+    );
+    offload_append(OFFLOAD_Z, &table);
+
+    struct coffe_interpolation *back[] = {
+        &bg->a, &bg->conformal_Hz, &bg->D1, &bg->f, &bg->G1, &bg->G2
+    };
+    init_uniform_table(
+        &table, back, sizeof(back)/sizeof(back[0]),
+        offload_xmin(&bg->a), offload_xmax(&bg->a),
+        par->background_bins - 1
+    );
+    offload_append(OFFLOAD_BACKGROUND, &table);
+
+    /* the biases need not be given on the same redshifts as the background */
+    struct coffe_interpolation *bias[] = {
+        &par->magnification_bias1, &par->magnification_bias2
+    };
+    init_uniform_table(
+        &table, bias, 2,
+        fmax(offload_xmin(bias[0]), offload_xmin(bias[1])),
+        fmin(offload_xmax(bias[0]), offload_xmax(bias[1])),
+        par->background_bins - 1
+    );
+    offload_append(OFFLOAD_BIAS, &table);
+
+    struct coffe_interpolation *I[8];
+    double r_max = HUGE_VAL;
+    for (int k = 0; k<8; ++k){
+        I[k] = &integral[k].result;
+        r_max = fmin(r_max, offload_xmax(I[k]));
+        coffe_offload.I0[k] = interp_spline(I[k], 0.0);
+    }
+    init_uniform_table(&table, I, 8, 0., r_max, COFFE_OFFLOAD_BINS);
+    offload_append(OFFLOAD_INTEGRALS, &table);
+
+    size_t len = 4;
+    if (par->divergent){
+        struct coffe_interpolation *divergent[] = {&integral[8].result};
+        init_uniform_table(
+            &table, divergent, 1, 0., offload_xmax(divergent[0]), COFFE_OFFLOAD_BINS
+        );
+        offload_append(OFFLOAD_DIVERGENT, &table);
+
+        struct coffe_interpolation *renormalization0[] = {&integral[8].renormalization0};
+        init_uniform_table(
+            &table, renormalization0, 1,
+            offload_xmin(renormalization0[0]), offload_xmax(renormalization0[0]),
+            COFFE_OFFLOAD_BINS
+        );
+        offload_append(OFFLOAD_RENORMALIZATION0, &table);
+
+        len = COFFE_OFFLOAD_BINS2D;
+    }
+
+    /* the renormalization is sampled at the points of the grid, zero if not needed */
+    struct offload_grid *grid = &coffe_offload.grid;
+    grid->len = len;
+    coffe_offload.renormalization_len = len*len;
+    coffe_offload.renormalization = (double *)coffe_malloc(sizeof(double)*len*len);
+    memset(coffe_offload.renormalization, 0, sizeof(double)*len*len);
+    grid->xmin = grid->ymin = 0;
+    grid->inv_dx = grid->inv_dy = 1;
+    if (par->divergent){
+        const gsl_interp2d *interp = &integral[8].renormalization.spline->interp_object;
+        const double dx = (interp->xmax - interp->xmin)/(len - 1);
+        const double dy = (interp->ymax - interp->ymin)/(len - 1);
+        grid->xmin = interp->xmin;
+        grid->ymin = interp->ymin;
+        grid->inv_dx = 1./dx;
+        grid->inv_dy = 1./dy;
+        double *value = coffe_offload.renormalization;
+        #pragma omp parallel for num_threads(par->nthreads)
+        for (size_t i = 0; i<len; ++i){
+            for (size_t j = 0; j<len; ++j){
+                value[i*len + j] = interp_spline2d(
+                    &integral[8].renormalization,
+                    i == len - 1 ? interp->xmax : interp->xmin + i*dx,
+                    j == len - 1 ? interp->ymax : interp->ymin + j*dy
+                );
+            }
+        }
+    }
+
+    /* without a device the tables are only kept for coffe_offload_compare */
+    if (omp_get_num_devices() == 0){
+        fprintf(stderr,
+            "WARNING: no offload device found, "
+            "the double integrated terms are computed on the host\n");
+        return EXIT_SUCCESS;
+    }
+
+    #pragma omp target enter data \
+        map(to: coffe_offload.coeffs[0:coffe_offload.coeffs_len], \
+            coffe_offload.renormalization[0:coffe_offload.renormalization_len])
+
+    coffe_offload.flag = 1;
+    printf(
+        "Offloading the double integrated terms to device %d (%.1f MB of tables)\n",
+        omp_get_default_device(),
+        sizeof(double)*(coffe_offload.coeffs_len + coffe_offload.renormalization_len)/1048576.
+    );
+#else
+    (void)par;
+    (void)bg;
+    (void)integral;
+#endif
+    return EXIT_SUCCESS;
+}
+
+
+int coffe_offload_enabled(void)
+{
+#ifdef HAVE_OFFLOAD
+    return coffe_offload.flag;
+#else
+    return 0;
+#endif
+}
+
+
+int coffe_offload_double_integrated(
+    struct coffe_parameters_t *par,
+    struct coffe_background_t *bg,
+    double sep,
+    size_t n,
+    const double *z_mean,
+    const double *mu,
+    const double *x1,
+    const double *x2,
+    double *result
+)
+{
+#ifdef HAVE_OFFLOAD
+    if (!coffe_offload.flag) return EXIT_FAILURE;
+
+    /* the points of a batch usually share z_mean */
+    double *chi_mean = (double *)coffe_malloc(sizeof(double)*n);
+    for (size_t i = 0; i<n; ++i){
+        coffe_profile_count(COFFE_PROFILE_DOUBLE);
+        chi_mean[i] = i > 0 && z_mean[i] == z_mean[i - 1] ?
+            chi_mean[i - 1] : interp_spline(&bg->comoving_distance, z_mean[i]);
+    }
+
+    const struct offload_table *table = coffe_offload.table;
+    const double *coeffs = coffe_offload.coeffs;
+    const size_t coeffs_len = coffe_offload.coeffs_len;
+    const struct offload_grid *grid = &coffe_offload.grid;
+    const double *renormalization = coffe_offload.renormalization;
+    const size_t renormalization_len = coffe_offload.renormalization_len;
+    const double *I0 = coffe_offload.I0;
+    const int *terms = par->double_terms.value;
+    const int len = par->double_terms.len;
+    const double Omega0_m = par->Omega0_m;
+    const int divergent = par->divergent;
+
+    /* the tables are already on the device, so only the points are transferred */
+    #pragma omp target teams distribute parallel for \
+        map(to: table[0:OFFLOAD_TABLES], coeffs[0:coeffs_len], grid[0:1], \
+            renormalization[0:renormalization_len], I0[0:8], terms[0:len], \
+            chi_mean[0:n], mu[0:n], x1[0:n], x2[0:n]) \
+        map(from: result[0:n])
+    for (size_t i = 0; i<n; ++i){
+        result[i] = offload_point(
+            table, coeffs, grid, renormalization, I0,
+            terms, len, Omega0_m, divergent,
+            chi_mean[i], sep, mu[i], x1[i], x2[i]
+        );
+    }
+
+    for (size_t i = 0; i<n; ++i){
+        if (!gsl_finite(result[i])){
+            fprintf(stderr,
+                "ERROR: in function %s, values:\n"
+                "x1 = %e, x2 = %e\n"
+                "mu = %e\n"
+                "z_mean = %e\n"
+                "chi_mean = %e\n"
+                "sep = %e\n",
+                __func__, x1[i], x2[i], mu[i], z_mean[i], chi_mean[i], sep
+            );
+            exit(EXIT_FAILURE);
+        }
+    }
+    free(chi_mean);
+    return EXIT_SUCCESS;
+#else
+    (void)par;
+    (void)bg;
+    (void)sep;
+    (void)n;
+    (void)z_mean;
+    (void)mu;
+    (void)x1;
+    (void)x2;
+    (void)result;
+    return EXIT_FAILURE;
+#endif
+}
+
+
+/**
+    evaluates offload_point on the host, from the same tables as on the device,
+    and compares it with functions_double_integrated, so the tables can be
+    checked also on a machine without a device
+**/
+
+int coffe_offload_compare(
+    struct coffe_parameters_t *par,
+    struct coffe_background_t *bg,
+    struct coffe_integrals_t *integral,
+    double z_mean,
+    double sep,
+    size_t n,
+    const double *mu,
+    const double *x1,
+    const double *x2,
+    double *result,
+    double *difference
+)
+{
+    *difference = NAN;
+#ifdef HAVE_OFFLOAD
+    if (coffe_offload.coeffs == NULL) return EXIT_FAILURE;
+
+    const double chi_mean = interp_spline(&bg->comoving_distance, z_mean);
+    double largest = 0, largest_difference = 0;
+    for (size_t i = 0; i<n; ++i){
+        result[i] = offload_point(
+            coffe_offload.table, coffe_offload.coeffs, &coffe_offload.grid,
+            coffe_offload.renormalization, coffe_offload.I0,
+            par->double_terms.value, par->double_terms.len,
+            par->Omega0_m, par->divergent,
+            chi_mean, sep, mu[i], x1[i], x2[i]
+        );
+        const double reference = functions_double_integrated(
+            par, bg, integral, z_mean, mu[i], sep, x1[i], x2[i]
+        );
+        largest = fmax(largest, fabs(reference));
+        largest_difference = fmax(largest_difference, fabs(result[i] - reference));
+    }
+    *difference = largest > 0 ? largest_difference/largest : largest_difference;
+    return EXIT_SUCCESS;
+#else
+    (void)par;
+    (void)bg;
+    (void)integral;
+    (void)z_mean;
+    (void)sep;
+    (void)n;
+    (void)mu;
+    (void)x1;
+    (void)x2;
+    (void)result;
+    return EXIT_FAILURE;
+#endif
+}
+
+
+int coffe_offload_free(void)
+{
+#ifdef HAVE_OFFLOAD
+    if (coffe_offload.flag){
+        #pragma omp target exit data \
+            map(delete: coffe_offload.coeffs[0:coffe_offload.coeffs_len], \
+                coffe_offload.renormalization[0:coffe_offload.renormalization_len])
+    }
+    free(coffe_offload.coeffs);
+    free(coffe_offload.renormalization);
+    memset(&coffe_offload, 0, sizeof(coffe_offload));
+#endif
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,76 @@
+/*
+ * This file is part of COFFE
+ * Copyright (C) 2018 Goran Jelic-Cizmek
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+    the offload backend of the double integrated terms: the background,
+    the magnification biases and the I^n_l are tabulated as flat uniform
+    tables, uploaded to the device once, and the batches of points are
+    evaluated there in OpenMP target regions; only compiled in with
+    HAVE_OFFLOAD (./configure --enable-offload), otherwise never enabled
+**/
+
+#ifndef COFFE_OFFLOAD_H
+#define COFFE_OFFLOAD_H
+
+/* tabulates and uploads everything the double integrated terms of <par> need */
+int coffe_offload_init(
+    struct coffe_parameters_t *par,
+    struct coffe_background_t *bg,
+    struct coffe_integrals_t *integral
+);
+
+/* whether the batches of double integrated terms go to the device */
+int coffe_offload_enabled(void);
+
+/* the double integrated terms at the <n> points (z_mean[i], mu[i], x1[i], x2[i]) at separation <sep> */
+int coffe_offload_double_integrated(
+    struct coffe_parameters_t *par,
+    struct coffe_background_t *bg,
+    double sep,
+    size_t n,
+    const double *z_mean,
+    const double *mu,
+    const double *x1,
+    const double *x2,
+    double *result
+);
+
+/**
+    the double integrated terms at the <n> points (z_mean, mu[i], x1[i], x2[i])
+    at separation <sep> from the tables, evaluated on the host, in <result>, and
+    their largest difference to functions_double_integrated, relative to its
+    largest value, in <difference>; fails if the tables are not initialized
+**/
+int coffe_offload_compare(
+    struct coffe_parameters_t *par,
+    struct coffe_background_t *bg,
+    struct coffe_integrals_t *integral,
+    double z_mean,
+    double sep,
+    size_t n,
+    const double *mu,
+    const double *x1,
+    const double *x2,
+    double *result,
+    double *difference
+);
+
+/* releases the tables on the device and on the host */
+int coffe_offload_free(void);
+
+#endif
@@ -17,6 +17,8 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
 #include <time.h>
 #include <sys/types.h>
@@ -114,9 +116,10 @@ static int output_background(
             strncat(header, temp_header, COFFE_MAX_STRLEN);
         }
         else if (strcmp(par->type_bg[i], "H") == 0){
-            outputs[i] = (double *)coffe_malloc(sizeof(double)*bg->Hz.spline->size);
-            for (size_t n = 0; n<bg->Hz.spline->size; ++n){
-                outputs[i][n] = bg->Hz.spline->y[n]*COFFE_H0;
+            const gsl_spline *Hz = coffe_background_lazy(bg, COFFE_BACKGROUND_HZ)->spline;
+            outputs[i] = (double *)coffe_malloc(sizeof(double)*Hz->size);
+            for (size_t n = 0; n<Hz->size; ++n){
+                outputs[i][n] = Hz->y[n]*COFFE_H0;
             }
             snprintf(temp_header, COFFE_MAX_STRLEN, "%d)%s[h/Mpc]%s", i + 1, par->type_bg[i], sep);
             strncat(header, temp_header, COFFE_MAX_STRLEN);
@@ -130,9 +133,11 @@ static int output_background(
             strncat(header, temp_header, COFFE_MAX_STRLEN);
         }
         else if (strcmp(par->type_bg[i], "conformal_H_prime") == 0){
-            outputs[i] = (double *)coffe_malloc(sizeof(double)*bg->conformal_Hz_prime.spline->size);
-            for (size_t n = 0; n<bg->conformal_Hz_prime.spline->size; ++n){
-                outputs[i][n] = bg->conformal_Hz_prime.spline->y[n]*COFFE_H0*COFFE_H0;
+            const gsl_spline *conformal_Hz_prime =
+                coffe_background_lazy(bg, COFFE_BACKGROUND_CONFORMAL_HZ_PRIME)->spline;
+            outputs[i] = (double *)coffe_malloc(sizeof(double)*conformal_Hz_prime->size);
+            for (size_t n = 0; n<conformal_Hz_prime->size; ++n){
+                outputs[i][n] = conformal_Hz_prime->y[n]*COFFE_H0*COFFE_H0;
             }
             snprintf(temp_header, COFFE_MAX_STRLEN, "%d)%s[h^2/Mpc^2]%s", i + 1, par->type_bg[i], sep);
             strncat(header, temp_header, COFFE_MAX_STRLEN);
@@ -197,6 +202,457 @@ static int output_background(
     return EXIT_SUCCESS;
 }
 
+/**
+    writes the columns (of length <len>, the last argument MUST be NULL)
+    into <filepath> with the extension added, as text or binary according
+    to output_format
+**/
+
+static int output_columns(
+    struct coffe_parameters_t *par,
+    const char *filepath,
+    size_t len,
+    const char *header,
+    double *values,
+    ...
+)
+{
+    va_list args;
+    va_start(args, values);
+    size_t counter = 0;
+    double *all_values[COFFE_MAX_ALLOCABLE];
+    size_t all_len[COFFE_MAX_ALLOCABLE];
+    while (values != NULL && counter < COFFE_MAX_ALLOCABLE){
+        all_values[counter] = values;
+        all_len[counter] = len;
+        ++counter;
+        values = va_arg(args, double *);
+    }
+    va_end(args);
+
+    char filename[COFFE_MAX_STRLEN];
+    if (par->output_format == 1){
+        snprintf(filename, COFFE_MAX_STRLEN, "%s.bin", filepath);
+        return write_binary(filename, header, counter, all_len, all_values);
+    }
+    snprintf(filename, COFFE_MAX_STRLEN, "%s.dat", filepath);
+    return write_ncol_array(filename, len, header, " ", counter, all_values);
+}
+
+
+/**
+    sets the output prefix (with the path) of all the files into <prefix>
+**/
+
+static void output_prefix(
+    struct coffe_parameters_t *par,
+    char *prefix
+)
+{
+    if (strcmp(par->output_prefix, "$TIME") == 0){
+        snprintf(prefix, COFFE_MAX_STRLEN, "%s%s_", par->output_path, par->timestamp);
+    }
+    else{
+        snprintf(prefix, COFFE_MAX_STRLEN, "%s%s", par->output_path, par->output_prefix);
+    }
+}
+
+
+/**
+    the path of the file <name> next to the output,
+    creating the output directory if needed
+**/
+
+int coffe_output_filename(
+    struct coffe_parameters_t *par,
+    const char *name,
+    char *filename
+)
+{
+    char prefix[COFFE_MAX_STRLEN];
+    output_make_path(par->output_path);
+    output_prefix(par, prefix);
+    snprintf(filename, COFFE_MAX_STRLEN, "%s%s", prefix, name);
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    sets the path (without the extension) and the header
+    of the covariance <cov> at redshift <k>
+**/
+
+static void output_covariance_path(
+    struct coffe_parameters_t *par,
+    const char *prefix,
+    struct coffe_covariance_t *cov,
+    size_t k,
+    char *filepath,
+    char *header
+)
+{
+    if (par->output_type == 4){
+        snprintf(header, COFFE_MAX_STRLEN, "# z_mean = %f\n", cov->z_mean[k]);
+        snprintf(filepath, COFFE_MAX_STRLEN,
+            "%smultipoles_covariance_redshift%zu", prefix, k
+        );
+    }
+    else{
+        snprintf(header, COFFE_MAX_STRLEN,
+            "# zmin = %f, zmax = %f\n", cov->zmin[k], cov->zmax[k]
+        );
+        snprintf(filepath, COFFE_MAX_STRLEN,
+            "%savg_multipoles_covariance_redshift%zu", prefix, k
+        );
+    }
+}
+
+
+/**
+    the text header of the binary covariance files
+**/
+
+static void output_covariance_text(
+    struct coffe_covariance_t *cov,
+    const char *header,
+    char *text,
+    size_t size
+)
+{
+    snprintf(
+        text, size,
+        "%s# sep[Mpc/h], then the covariance of each pair of multipoles l1, l2"
+        " below (l2 running fastest), with the element (m, n) at m + n*len(sep)\n"
+        "# multipoles:",
+        header
+    );
+    for (size_t i = 0; i<cov->l_len; ++i){
+        char temp[COFFE_MAX_STRLEN];
+        snprintf(temp, COFFE_MAX_STRLEN, " %d", cov->l[i]);
+        strncat(text, temp, size - strlen(text) - 1);
+    }
+    strncat(text, "\n", size - strlen(text) - 1);
+}
+
+
+/**
+    writes the covariance <cov> at redshift <k> into <filepath>: one text file
+    per pair of multipoles (with _l1l2.dat appended), or one binary file with
+    the separations and then all the pairs
+**/
+
+static int output_covariance(
+    struct coffe_parameters_t *par,
+    const char *filepath,
+    const char *header,
+    struct coffe_covariance_t *cov,
+    size_t k
+)
+{
+    char filename[COFFE_MAX_STRLEN];
+    const size_t npixels = cov->sep_len[k];
+
+    if (par->output_format == 1){
+        char text[4*COFFE_MAX_STRLEN];
+        output_covariance_text(cov, header, text, sizeof(text));
+
+        const size_t ncolumns = 1 + cov->l_len*cov->l_len;
+        double **columns = (double **)coffe_malloc(sizeof(double *)*ncolumns);
+        size_t *lengths = (size_t *)coffe_malloc(sizeof(size_t)*ncolumns);
+        columns[0] = cov->sep[k];
+        lengths[0] = npixels;
+        for (size_t i = 1; i<ncolumns; ++i){
+            columns[i] = &cov->result[cov->offset[k] + (i - 1)*npixels*npixels];
+            lengths[i] = npixels*npixels;
+        }
+        snprintf(filename, COFFE_MAX_STRLEN, "%s.bin", filepath);
+        int error = write_binary(filename, text, ncolumns, lengths, columns);
+        free(columns);
+        free(lengths);
+        return error;
+    }
+
+    for (size_t i = 0; i<cov->l_len; ++i){
+        for (size_t j = 0; j<cov->l_len; ++j){
+            snprintf(filename, COFFE_MAX_STRLEN,
+                "%s_%d%d.dat", filepath, cov->l[i], cov->l[j]
+            );
+            FILE *output = fopen(filename, "w");
+            if (output == NULL){
+                print_error_verbose(PROG_OPEN_ERROR, filename);
+                return EXIT_FAILURE;
+            }
+            setvbuf(output, NULL, _IOFBF, COFFE_OUTPUT_BUFFER);
+            fprintf(output, "%s", header);
+            fprintf(output, "# sep[Mpc/h]\tsep[Mpc/h]\tresult\n");
+            for (size_t m = 0; m<npixels; ++m){
+                for (size_t n = 0; n<npixels; ++n){
+                    fprintf(
+                        output, "%e %e %e\n",
+                        cov->sep[k][m], cov->sep[k][n],
+                        cov->result[
+                            cov->offset[k] + (cov->l_len*i + j)*npixels*npixels + npixels*n + m
+                        ]
+                    );
+                }
+            }
+            fclose(output);
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    the file recording which tiles of the covariance are finished
+**/
+
+static void output_covariance_progress(
+    struct coffe_parameters_t *par,
+    char *filename
+)
+{
+    char prefix[COFFE_MAX_STRLEN];
+    output_prefix(par, prefix);
+    snprintf(filename, COFFE_MAX_STRLEN, "%s%s_covariance.tiles",
+        prefix, par->output_type == 4 ? "multipoles" : "avg_multipoles"
+    );
+}
+
+
+/**
+    the first line of the progress file, which has to match
+    for a tiled covariance to be resumed; <key> is the hash
+    of everything the tiles depend on
+**/
+
+static void output_covariance_progress_line(
+    struct coffe_covariance_t *cov,
+    uint64_t key,
+    size_t rows,
+    size_t ntiles,
+    char *line
+)
+{
+    snprintf(line, COFFE_MAX_STRLEN,
+        "%016llx %zu %zu %zu %zu %.10e",
+        (unsigned long long)key, rows, ntiles, cov->l_len, cov->list_len, cov->pixelsize
+    );
+    for (size_t k = 0; k<cov->list_len; ++k){
+        char temp[COFFE_MAX_STRLEN];
+        snprintf(temp, COFFE_MAX_STRLEN, " %zu", cov->sep_len[k]);
+        strncat(line, temp, COFFE_MAX_STRLEN - strlen(line) - 1);
+    }
+}
+
+
+/**
+    prepares the binary files of the covariance <cov> for <ntiles> tiles
+    of <rows> rows each; if the progress file of an earlier run with
+    the same layout and <key> exists, the files are kept and the finished tiles
+    are flagged in <done>, otherwise the files are created
+    (with the separations, the rest is filled in by the tiles)
+**/
+
+int coffe_output_covariance_resume(
+    struct coffe_parameters_t *par,
+    struct coffe_covariance_t *cov,
+    uint64_t key,
+    size_t rows,
+    size_t ntiles,
+    char *done
+)
+{
+    char filename[COFFE_MAX_STRLEN];
+    char line[COFFE_MAX_STRLEN], expected[COFFE_MAX_STRLEN];
+    output_make_path(par->output_path);
+    output_covariance_progress(par, filename);
+    output_covariance_progress_line(cov, key, rows, ntiles, expected);
+
+    memset(done, 0, sizeof(char)*ntiles);
+    FILE *progress = fopen(filename, "r");
+    if (progress != NULL){
+        int resumed = 0;
+        if (
+            fgets(line, COFFE_MAX_STRLEN, progress) != NULL &&
+            strncmp(line, expected, strlen(expected)) == 0 &&
+            line[strlen(expected)] == '\n'
+        ){
+            resumed = 1;
+            size_t finished = 0;
+            for (size_t i = 0; i<ntiles; ++i){
+                const int flag = fgetc(progress);
+                if (flag != '0' && flag != '1'){
+                    resumed = 0;
+                    break;
+                }
+                done[i] = (char)(flag == '1');
+                finished += done[i];
+            }
+            if (resumed){
+                printf("Resuming the covariance, %zu of %zu tiles already done\n",
+                    finished, ntiles
+                );
+            }
+        }
+        fclose(progress);
+        if (resumed) return EXIT_SUCCESS;
+        memset(done, 0, sizeof(char)*ntiles);
+        fprintf(
+            stderr,
+            "WARNING: %s does not match the settings, "
+            "starting the covariance over!\n",
+            filename
+        );
+    }
+
+    char prefix[COFFE_MAX_STRLEN];
+    output_prefix(par, prefix);
+    const size_t ncolumns = 1 + cov->l_len*cov->l_len;
+    size_t *lengths = (size_t *)coffe_malloc(sizeof(size_t)*ncolumns);
+    for (size_t k = 0; k<cov->list_len; ++k){
+        char filepath[COFFE_MAX_STRLEN], header[COFFE_MAX_STRLEN];
+        char text[4*COFFE_MAX_STRLEN];
+        output_covariance_path(par, prefix, cov, k, filepath, header);
+        output_covariance_text(cov, header, text, sizeof(text));
+        strncat(filepath, ".bin", COFFE_MAX_STRLEN - strlen(filepath) - 1);
+
+        lengths[0] = cov->sep_len[k];
+        for (size_t i = 1; i<ncolumns; ++i){
+            lengths[i] = cov->sep_len[k]*cov->sep_len[k];
+        }
+        FILE *data = fopen(filepath, "wb");
+        if (data == NULL){
+            print_error_verbose(PROG_OPEN_ERROR, filepath);
+            free(lengths);
+            return EXIT_FAILURE;
+        }
+        int error = write_binary_header(data, text, ncolumns, lengths);
+        error |= write_binary_column(data, cov->sep[k], cov->sep_len[k]);
+        error |= fclose(data);
+        if (error){
+            print_error_verbose(PROG_WRITE_ERROR, filepath);
+            free(lengths);
+            return EXIT_FAILURE;
+        }
+    }
+    free(lengths);
+
+    progress = fopen(filename, "w");
+    if (progress == NULL){
+        print_error_verbose(PROG_OPEN_ERROR, filename);
+        return EXIT_FAILURE;
+    }
+    fprintf(progress, "%s\n", expected);
+    for (size_t i = 0; i<ntiles; ++i) fputc('0', progress);
+    fputc('\n', progress);
+    if (fclose(progress)){
+        print_error_verbose(PROG_WRITE_ERROR, filename);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    writes the rows [start, start + rows) of the covariance <cov> at
+    redshift <k> into its binary file, where the pair of multipoles
+    l[i], l[j] has the element (m, n) at values[((l_len*i + j)*rows
+    + n - start)*sep_len[k] + m]
+**/
+
+int coffe_output_covariance_tile(
+    struct coffe_parameters_t *par,
+    struct coffe_covariance_t *cov,
+    size_t k,
+    size_t start,
+    size_t rows,
+    const double *values
+)
+{
+    char prefix[COFFE_MAX_STRLEN];
+    char filepath[COFFE_MAX_STRLEN], header[COFFE_MAX_STRLEN];
+    char text[4*COFFE_MAX_STRLEN];
+    output_prefix(par, prefix);
+    output_covariance_path(par, prefix, cov, k, filepath, header);
+    output_covariance_text(cov, header, text, sizeof(text));
+    strncat(filepath, ".bin", COFFE_MAX_STRLEN - strlen(filepath) - 1);
+
+    FILE *data = fopen(filepath, "r+b");
+    if (data == NULL){
+        print_error_verbose(PROG_OPEN_ERROR, filepath);
+        return EXIT_FAILURE;
+    }
+
+    const size_t npixels = cov->sep_len[k];
+    const size_t offset =
+        binary_data_offset(text, 1 + cov->l_len*cov->l_len)
+       +sizeof(double)*npixels;
+    int error = 0;
+    for (size_t i = 0; i<cov->l_len*cov->l_len; ++i){
+        error |= fseek(
+            data,
+            (long)(offset + sizeof(double)*npixels*(npixels*i + start)),
+            SEEK_SET
+        ) != 0;
+        error |= write_binary_column(data, &values[i*npixels*rows], npixels*rows);
+    }
+    error |= fclose(data);
+    if (error){
+        print_error_verbose(PROG_WRITE_ERROR, filepath);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    records that the tile <tile> (out of <ntiles>) of the covariance
+    is finished, so it is skipped when resuming
+**/
+
+int coffe_output_covariance_done(
+    struct coffe_parameters_t *par,
+    size_t tile,
+    size_t ntiles
+)
+{
+    char filename[COFFE_MAX_STRLEN];
+    output_covariance_progress(par, filename);
+    FILE *progress = fopen(filename, "r+");
+    if (progress == NULL){
+        print_error_verbose(PROG_OPEN_ERROR, filename);
+        return EXIT_FAILURE;
+    }
+    int error = fseek(progress, -(long)(ntiles - tile + 1), SEEK_END) != 0;
+    error |= fputc('1', progress) == EOF;
+    error |= fclose(progress);
+    if (error){
+        print_error_verbose(PROG_WRITE_ERROR, filename);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+
+/**
+    removes the progress file once all the tiles are written
+**/
+
+int coffe_output_covariance_finish(
+    struct coffe_parameters_t *par
+)
+{
+    char filename[COFFE_MAX_STRLEN];
+    output_covariance_progress(par, filename);
+    if (remove(filename) != 0){
+        fprintf(stderr, "WARNING: cannot remove %s!\n", filename);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+
 int coffe_output_init(
     struct coffe_parameters_t *par,
     struct coffe_background_t *bg,
@@ -212,26 +668,21 @@ int coffe_output_init(
     struct coffe_corrfunc2d_t *cf2d
 )
 {
-    clock_t start, end;
+    /* with MPI, all the processes have the results, and the first one writes them */
+    if (coffe_mpi_rank() != 0) return EXIT_SUCCESS;
+
     printf("Writing output...\n");
-    start = clock();
+    coffe_profile_start(COFFE_PROFILE_OUTPUT);
     char filepath[COFFE_MAX_STRLEN];
     char prefix[COFFE_MAX_STRLEN];
     char header[COFFE_MAX_STRLEN];
     output_make_path(par->output_path);
 
-    if (strcmp(par->output_prefix, "$TIME") == 0){
-        snprintf(prefix, COFFE_MAX_STRLEN, "%s%s_", par->output_path, par->timestamp);
-    }
-    else{
-        snprintf(prefix, COFFE_MAX_STRLEN, "%s%s", par->output_path, par->output_prefix);
-    }
+    output_prefix(par, prefix);
 
     /* settings file copy */
     snprintf(filepath, COFFE_MAX_STRLEN, "%ssettings.cfg", prefix);
     config_write_file(par->conf, filepath);
-    config_destroy(par->conf);
-    par->conf = NULL;
 
     /* background */
     snprintf(filepath, COFFE_MAX_STRLEN, "%sbackground.dat", prefix);
@@ -246,10 +697,10 @@ int coffe_output_init(
         }
         strncat(header, "\n", COFFE_MAX_STRLEN);
         strncat(header, "# sep[Mpc/h]\tresult\n", COFFE_MAX_STRLEN);
-        snprintf(filepath, COFFE_MAX_STRLEN, "%sang_corrfunc.dat", prefix);
-        write_ncol_null(
-            filepath,
-            cf_ang->theta_len, header, " ",
+        snprintf(filepath, COFFE_MAX_STRLEN, "%sang_corrfunc", prefix);
+        output_columns(
+            par, filepath,
+            cf_ang->theta_len, header,
             cf_ang->theta, cf_ang->result, NULL
         );
     }
@@ -268,11 +719,11 @@ int coffe_output_init(
             }
             strncat(header, "\n", COFFE_MAX_STRLEN);
             strncat(header, "# sep[Mpc/h]\tresult\n", COFFE_MAX_STRLEN);
-            snprintf(filepath, COFFE_MAX_STRLEN, "%scorrfunc%d.dat", prefix, i);
-            write_ncol_null(
-                filepath,
-                cf->sep_len, header, " ",
-                cf->sep, cf->result[i], NULL
+            snprintf(filepath, COFFE_MAX_STRLEN, "%scorrfunc%d", prefix, i);
+            output_columns(
+                par, filepath,
+                cf->sep_len, header,
+                cf->sep, &cf->result[i*cf->sep_len], NULL
             );
         }
     }
@@ -290,13 +741,29 @@ int coffe_output_init(
                 strncat(header, " ", COFFE_MAX_STRLEN);
             }
             strncat(header, "\n", COFFE_MAX_STRLEN);
-            strncat(header, "# sep[Mpc/h]\tresult\n", COFFE_MAX_STRLEN);
-            snprintf(filepath, COFFE_MAX_STRLEN, "%smultipoles%d.dat", prefix, par->multipole_values[i]);
-            write_ncol_null(
-                filepath,
-                mp->sep_len, header, " ",
-                mp->sep, mp->result[i], NULL
-            );
+            if (par->integration_accuracy > 0){
+                strncat(header, "# sep[Mpc/h]\tresult\terror_single\terror_double\n", COFFE_MAX_STRLEN);
+            }
+            else{
+                strncat(header, "# sep[Mpc/h]\tresult\n", COFFE_MAX_STRLEN);
+            }
+            snprintf(filepath, COFFE_MAX_STRLEN, "%smultipoles%d", prefix, par->multipole_values[i]);
+            if (par->integration_accuracy > 0){
+                output_columns(
+                    par, filepath,
+                    mp->sep_len, header,
+                    mp->sep, &mp->result[i*mp->sep_len],
+                    &mp->error_single[i*mp->sep_len],
+                    &mp->error_double[i*mp->sep_len], NULL
+                );
+            }
+            else{
+                output_columns(
+                    par, filepath,
+                    mp->sep_len, header,
+                    mp->sep, &mp->result[i*mp->sep_len], NULL
+                );
+            }
         }
     }
 
@@ -313,90 +780,89 @@ int coffe_output_init(
                 strncat(header, " ", COFFE_MAX_STRLEN);
             }
             strncat(header, "\n", COFFE_MAX_STRLEN);
-            strncat(header, "# sep[Mpc/h]\tresult\n", COFFE_MAX_STRLEN);
-            snprintf(filepath, COFFE_MAX_STRLEN,"%savg_multipoles%d.dat", prefix, par->multipole_values[i]);
-            write_ncol_null(
-                filepath,
-                ramp->sep_len, header, " ",
-                ramp->sep, ramp->result[i], NULL
-            );
+            if (par->integration_accuracy > 0){
+                strncat(header, "# sep[Mpc/h]\tresult\terror_nonintegrated\terror_single\terror_double\n", COFFE_MAX_STRLEN);
+            }
+            else{
+                strncat(header, "# sep[Mpc/h]\tresult\n", COFFE_MAX_STRLEN);
+            }
+            snprintf(filepath, COFFE_MAX_STRLEN,"%savg_multipoles%d", prefix, par->multipole_values[i]);
+            if (par->integration_accuracy > 0){
+                output_columns(
+                    par, filepath,
+                    ramp->sep_len, header,
+                    ramp->sep, &ramp->result[i*ramp->sep_len],
+                    &ramp->error_nonintegrated[i*ramp->sep_len],
+                    &ramp->error_single[i*ramp->sep_len],
+                    &ramp->error_double[i*ramp->sep_len], NULL
+                );
+            }
+            else{
+                output_columns(
+                    par, filepath,
+                    ramp->sep_len, header,
+                    ramp->sep, &ramp->result[i*ramp->sep_len], NULL
+                );
+            }
         }
     }
 
-    /* covariance of multipoles */
-    else if (par->output_type == 4){
+    /* covariance of multipoles, unless already written in tiles */
+    else if (par->output_type == 4 && par->covariance_memory <= 0){
         for (size_t k = 0; k<cov_mp->list_len; ++k){
-            for (size_t i = 0; i<cov_mp->l_len; ++i){
-                for (size_t j = 0; j<cov_mp->l_len; ++j){
-                    snprintf(filepath, COFFE_MAX_STRLEN,
-                        "%smultipoles_covariance_redshift%zu_%d%d.dat",
-                        prefix, k, cov_mp->l[i], cov_mp->l[j]
-                    );
-                    FILE *output = fopen(filepath, "w");
-                    fprintf(output, "# z_mean = %f\n", cov_mp->z_mean[k]);
-                    fprintf(output, "# sep[Mpc/h]\tsep[Mpc/h]\tresult\n");
-                    for (size_t m = 0; m<cov_mp->sep_len[k]; ++m){
-                        for (size_t n = 0; n<cov_mp->sep_len[k]; ++n){
-                            fprintf(
-                                output, "%e %e %e\n",
-                                cov_mp->sep[k][m], cov_mp->sep[k][n],
-                                cov_mp->result[k][cov_mp->l_len*i + j][cov_mp->sep_len[k]*n + m]
-                            );
-                        }
-                    }
-                    fclose(output);
-                }
-            }
+            output_covariance_path(par, prefix, cov_mp, k, filepath, header);
+            output_covariance(par, filepath, header, cov_mp, k);
         }
     }
 
-    /* covariance of RAMPs */
-    else if (par->output_type == 5){
+    /* covariance of RAMPs, unless already written in tiles */
+    else if (par->output_type == 5 && par->covariance_memory <= 0){
         for (size_t k = 0; k<cov_ramp->list_len; ++k){
-            for (size_t i = 0; i<cov_ramp->l_len; ++i){
-                for (size_t j = 0; j<cov_ramp->l_len; ++j){
-                    snprintf(filepath, COFFE_MAX_STRLEN,
-                        "%savg_multipoles_covariance_redshift%zu_%d%d.dat",
-                        prefix, k, cov_ramp->l[i], cov_ramp->l[j]
-                    );
-                    FILE *output = fopen(filepath, "w");
-                    fprintf(output, "# zmin = %f, zmax = %f\n", cov_ramp->zmin[k], cov_ramp->zmax[k]);
-                    fprintf(output, "# sep[Mpc/h]\tsep[Mpc/h]\tresult\n");
-                    for (size_t m = 0; m<cov_ramp->sep_len[k]; ++m){
-                        for (size_t n = 0; n<cov_ramp->sep_len[k]; ++n){
-                            fprintf(
-                                output, "%e %e %e\n",
-                                cov_ramp->sep[k][m], cov_ramp->sep[k][n],
-                                cov_ramp->result[k][cov_ramp->l_len*i + j][cov_ramp->sep_len[k]*n + m]
-                            );
-                        }
-                    }
-                    fclose(output);
-                }
-            }
+            output_covariance_path(par, prefix, cov_ramp, k, filepath, header);
+            output_covariance(par, filepath, header, cov_ramp, k);
         }
     }
 
     /* 2D correlation function */
     else if (par->output_type == 6){
-        snprintf(
-            filepath, COFFE_MAX_STRLEN,
-            "%scorrfunc2d.dat", prefix
-        );
-        FILE *output = fopen(filepath, "w");
-        fprintf(output, "# z_mean = %f\n", par->z_mean);
-        fprintf(output, "# sep_par[Mpc/h]\tsep_perp[Mpc/h]\tresult\n");
-
-        for (size_t i = 0; i<cf2d->sep_len; ++i){
-            for (size_t j = 0; j<cf2d->sep_len; ++j){
-                fprintf(
-                    output, "%e %e %e\n",
-                    cf2d->sep_parallel[i], cf2d->sep_perpendicular[j],
-                    cf2d->result[i][j]
-                );
+        if (par->output_format == 1){
+            /* the result as one column, with the element (i, j) at i*len + j */
+            const size_t len = cf2d->sep_len;
+            double *columns[] = {cf2d->sep_parallel, cf2d->sep_perpendicular, cf2d->result};
+            const size_t lengths[] = {len, len, len*len};
+            snprintf(
+                header, COFFE_MAX_STRLEN,
+                "# z_mean = %f\n# sep_par[Mpc/h]\tsep_perp[Mpc/h]\tresult[sep_par][sep_perp]\n",
+                par->z_mean
+            );
+            snprintf(filepath, COFFE_MAX_STRLEN, "%scorrfunc2d.bin", prefix);
+            write_binary(filepath, header, 3, lengths, columns);
+        }
+        else{
+            snprintf(
+                filepath, COFFE_MAX_STRLEN,
+                "%scorrfunc2d.dat", prefix
+            );
+            FILE *output = fopen(filepath, "w");
+            if (output == NULL){
+                print_error_verbose(PROG_OPEN_ERROR, filepath);
+                return EXIT_FAILURE;
+            }
+            setvbuf(output, NULL, _IOFBF, COFFE_OUTPUT_BUFFER);
+            fprintf(output, "# z_mean = %f\n", par->z_mean);
+            fprintf(output, "# sep_par[Mpc/h]\tsep_perp[Mpc/h]\tresult\n");
+
+            for (size_t i = 0; i<cf2d->sep_len; ++i){
+                for (size_t j = 0; j<cf2d->sep_len; ++j){
+                    fprintf(
+                        output, "%e %e %e\n",
+                        cf2d->sep_parallel[i], cf2d->sep_perpendicular[j],
+                        cf2d->result[i*cf2d->sep_len + j]
+                    );
+                }
             }
+            fclose(output);
         }
-        fclose(output);
     }
 
 
@@ -408,10 +874,10 @@ int coffe_output_init(
             integral[i].n,
             integral[i].l
         );
-        snprintf(filepath, COFFE_MAX_STRLEN, "%sintegral%d.dat", prefix, i);
-        write_ncol_null(
-            filepath,
-            integral[i].result.spline->size, header, " ",
+        snprintf(filepath, COFFE_MAX_STRLEN, "%sintegral%d", prefix, i);
+        output_columns(
+            par, filepath,
+            integral[i].result.spline->size, header,
             integral[i].result.spline->x,
             integral[i].result.spline->y,
             NULL
@@ -420,9 +886,12 @@ int coffe_output_init(
 #endif
 
 
-    end = clock();
     printf("Output finished in %.2f s\n",
-        (double)(end - start) / CLOCKS_PER_SEC);
+        coffe_profile_stop(COFFE_PROFILE_OUTPUT));
+
+    /* the timings and counts of everything so far */
+    snprintf(filepath, COFFE_MAX_STRLEN, "%sprofile.json", prefix);
+    coffe_profile_write(filepath);
 
     return EXIT_SUCCESS;
 }
@@ -19,6 +19,40 @@
 #ifndef COFFE_OUTPUT_H
 #define COFFE_OUTPUT_H
 
+int coffe_output_filename(
+    struct coffe_parameters_t *par,
+    const char *name,
+    char *filename
+);
+
+int coffe_output_covariance_resume(
+    struct coffe_parameters_t *par,
+    struct coffe_covariance_t *cov,
+    uint64_t key,
+    size_t rows,
+    size_t ntiles,
+    char *done
+);
+
+int coffe_output_covariance_tile(
+    struct coffe_parameters_t *par,
+    struct coffe_covariance_t *cov,
+    size_t k,
+    size_t start,
+    size_t rows,
+    const double *values
+);
+
+int coffe_output_covariance_done(
+    struct coffe_parameters_t *par,
+    size_t tile,
+    size_t ntiles
+);
+
+int coffe_output_covariance_finish(
+    struct coffe_parameters_t *par
+);
+
 int coffe_output_init(
     struct coffe_parameters_t *par,
     struct coffe_background_t *bg,
@@ -93,7 +93,7 @@ static int parse_string(
 {
     const char *temp_value;
     int error = config_lookup_string(conf, setting, &temp_value);
-    strcpy(value, (char *)temp_value);
+    if (error == 1) strcpy(value, (char *)temp_value);
     if (safe == COFFE_TRUE){
         if (error != 1){
             fprintf(stderr,
@@ -112,6 +112,38 @@ static int parse_string(
 }
 
 
+/**
+    parses an optional path from the setting <setting> into <value>,
+    relative to the directory of the settings file <filename>
+    unless it's absolute; <value> is empty if the setting is missing
+**/
+
+static int parse_path(
+    config_t *conf,
+    const char *filename,
+    const char *setting,
+    char value[]
+)
+{
+    char path[COFFE_MAX_STRLEN];
+    value[0] = '\0';
+    if (parse_string(conf, setting, path, COFFE_FALSE) != EXIT_SUCCESS){
+        return EXIT_FAILURE;
+    }
+    const char *dir_end = strrchr(filename, '/');
+    if (path[0] != '/' && dir_end != NULL){
+        snprintf(
+            value, COFFE_MAX_STRLEN, "%.*s/%s",
+            (int)(dir_end - filename), filename, path
+        );
+    }
+    else{
+        snprintf(value, COFFE_MAX_STRLEN, "%s", path);
+    }
+    return EXIT_SUCCESS;
+}
+
+
 /**
     parses an array of strings from the setting <setting>
     in config file <conf> into <values> with length <values_len>
@@ -211,6 +243,46 @@ static int parse_double_array(
 }
 
 
+/**
+    reads the table in <filename> (text or binary) into the spline <interp>;
+    binary tables are memory mapped and splined directly from the file
+**/
+
+static int parse_spline(
+    char *filename,
+    struct coffe_interpolation *interp,
+    int interpolation_type
+)
+{
+    if (is_binary(filename)){
+        struct coffe_table_t table;
+        if (
+            map_binary(filename, &table) != EXIT_SUCCESS ||
+            table.ncolumns < 2 || table.len[0] != table.len[1]
+        ){
+            print_error_verbose(PROG_READ_ERROR, filename);
+            exit(EXIT_FAILURE);
+        }
+        init_spline(
+            interp,
+            table.columns[0], table.columns[1], table.len[0],
+            interpolation_type
+        );
+        return unmap_binary(&table);
+    }
+
+    double *x, *y;
+    size_t len;
+    if (read_2col(filename, &x, &y, &len) != EXIT_SUCCESS){
+        exit(EXIT_FAILURE);
+    }
+    init_spline(interp, x, y, len, interpolation_type);
+    free(x);
+    free(y);
+    return EXIT_SUCCESS;
+}
+
+
 /**
     parses all the settings from the input file
     (given by argv[1]) into the structure <par>
@@ -231,17 +303,26 @@ int coffe_parser_init(
         exit(EXIT_FAILURE);
     }
 
-    clock_t start, end;
 
     printf("Parsing settings file \"%s\"...\n", filename);
 
-    start = clock();
+    coffe_profile_start(COFFE_PROFILE_PARSER);
 
     config_set_auto_convert(conf, CONFIG_TRUE);
 
     parse_int(conf, "output_type", &par->output_type, COFFE_TRUE);
     parse_string_array(conf, "output_background", &par->type_bg, &par->type_bg_len);
     parse_int(conf, "background_sampling", &par->background_bins, COFFE_TRUE);
+    if (par->background_bins < 2){
+        print_error_verbose(PROG_VALUE_ERROR, "background_sampling");
+        exit(EXIT_FAILURE);
+    }
+    par->background_z_max = 0;
+    parse_double(conf, "background_z_max", &par->background_z_max, COFFE_FALSE);
+    if (par->background_z_max < 0){
+        print_error_verbose(PROG_VALUE_ERROR, "background_z_max");
+        exit(EXIT_FAILURE);
+    }
 
     /* cosmological parameters */
     parse_double(conf, "omega_m", &par->Omega0_m, COFFE_TRUE);
@@ -294,9 +375,63 @@ int coffe_parser_init(
         parse_double(conf, "z_max", &par->z_max, COFFE_TRUE);
     }
 
+    /* optional: a batch of redshift bins computed in one go */
+    par->batch_len = 0;
+    if (
+        (
+            par->output_type == 0 ||
+            par->output_type == 1 ||
+            par->output_type == 2 ||
+            par->output_type == 6
+        ) &&
+        config_lookup(conf, "batch_z_mean") != NULL
+    ){
+        parse_double_array(conf, "batch_z_mean", &par->batch_z_mean, &par->batch_len);
+        if (par->output_type == 1 || par->output_type == 2){
+            int len;
+            parse_double_array(conf, "batch_deltaz", &par->batch_deltaz, &len);
+            if (len != par->batch_len){
+                fprintf(
+                    stderr,
+                    "ERROR: batch_z_mean and batch_deltaz have mismatching lengths; "
+                    "please ensure they have the same length!\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        for (int i = 0; i<par->batch_len; ++i){
+            if (par->batch_z_mean[i] <= 0){
+                print_error_verbose(PROG_VALUE_ERROR, "batch_z_mean");
+                exit(EXIT_FAILURE);
+            }
+            if (
+                (par->output_type == 1 || par->output_type == 2) &&
+                (par->batch_deltaz[i] <= 0 || par->batch_deltaz[i] > par->batch_z_mean[i])
+            ){
+                print_error_verbose(PROG_VALUE_ERROR, "batch_deltaz");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    else if (par->output_type == 3 && config_lookup(conf, "batch_z_min") != NULL){
+        int len;
+        parse_double_array(conf, "batch_z_min", &par->batch_z_min, &par->batch_len);
+        parse_double_array(conf, "batch_z_max", &par->batch_z_max, &len);
+        if (len != par->batch_len){
+            fprintf(
+                stderr,
+                "ERROR: batch_z_min and batch_z_max have mismatching lengths; "
+                "please ensure they have the same length!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
     /* the interpolation method for GSL */
     parse_int(conf, "interpolation", &par->interp_method, COFFE_FALSE);
 
+    /* optional: uniform cubic tables for the background */
+    par->fast_interpolation = 0;
+    parse_int(conf, "fast_interpolation", &par->fast_interpolation, COFFE_FALSE);
+
     /* the cosine of the angle for the full sky correlation function */
     if (par->output_type == 1){
         parse_double_array(conf, "mu", &par->mu, &par->mu_len);
@@ -325,10 +460,24 @@ int coffe_parser_init(
     /* number of points to sample the integral of the Bessel function */
     parse_int(conf, "bessel_sampling", &par->bessel_bins, COFFE_TRUE);
 
+    /* optional: planner flag for the FFTs of the Bessel integrals */
+    par->fftw_flag = 0;
+    parse_int(conf, "fftw_flag", &par->fftw_flag, COFFE_FALSE);
+    if (par->fftw_flag < 0 || par->fftw_flag > 3){
+        print_error_verbose(PROG_VALUE_ERROR, "fftw_flag");
+        exit(EXIT_FAILURE);
+    }
+
+    /* optional: file with FFTW wisdom, relative to the settings file */
+    parse_path(conf, filename, "fftw_wisdom", par->fftw_wisdom);
+
+    /* optional: directory for caching the integrals, relative to the settings file */
+    parse_path(conf, filename, "integrals_cache", par->integrals_cache);
+
 #ifndef HAVE_CUBA
     /* parsing the integration method */
     parse_int(conf, "integration_method", &par->integration_method, COFFE_TRUE);
-    if (par->integration_method < 0 || par->integration_method > 2){
+    if (par->integration_method < 0 || par->integration_method > 4){
         print_error_verbose(PROG_VALUE_ERROR, "integration_method");
         exit(EXIT_FAILURE);
     }
@@ -337,6 +486,39 @@ int coffe_parser_init(
     /* number of points for the 2-3-4D integration */
     parse_int(conf, "integration_sampling", &par->integration_bins, COFFE_TRUE);
 
+    /* optional: target relative accuracy of the multipoles, 0 to disable */
+    par->integration_accuracy = 0;
+    parse_double(conf, "integration_accuracy", &par->integration_accuracy, COFFE_FALSE);
+    if (par->integration_accuracy < 0){
+        print_error_verbose(PROG_VALUE_ERROR, "integration_accuracy");
+        exit(EXIT_FAILURE);
+    }
+#ifndef HAVE_CUBA
+    if (par->integration_accuracy > 0 && par->integration_method == 4){
+        fprintf(
+            stderr,
+            "WARNING: the Gauss-Legendre rule has no error estimate, "
+            "integration_accuracy will have no effect!\n"
+        );
+    }
+#endif
+
+    /* optional: the flat-sky approximation of the multipoles, 0 to disable */
+    par->flatsky_threshold = 0;
+    parse_double(conf, "flatsky_threshold", &par->flatsky_threshold, COFFE_FALSE);
+    if (par->flatsky_threshold < 0){
+        print_error_verbose(PROG_VALUE_ERROR, "flatsky_threshold");
+        exit(EXIT_FAILURE);
+    }
+
+    /* optional: the nonintegrated multipoles from a fixed rule in mu, 0 to disable */
+    par->nonintegrated_projection = 0;
+    parse_int(conf, "nonintegrated_projection", &par->nonintegrated_projection, COFFE_FALSE);
+    if (par->nonintegrated_projection < 0){
+        print_error_verbose(PROG_VALUE_ERROR, "nonintegrated_projection");
+        exit(EXIT_FAILURE);
+    }
+
     /* parsing the w parameter */
     parse_double(conf, "w0", &par->w0, COFFE_TRUE);
     parse_double(conf, "wa", &par->wa, COFFE_TRUE);
@@ -344,18 +526,8 @@ int coffe_parser_init(
     /* parsing the matter bias */
     parse_int(conf, "read_matter_bias1", &par->read_matter_bias1, COFFE_FALSE);
     if (par->read_matter_bias1 == COFFE_TRUE){
-        double *bias_z, *bias_value;
-        size_t bias_len;
         parse_string(conf, "input_matter_bias1", par->file_matter_bias1, COFFE_TRUE);
-        read_2col(
-            par->file_matter_bias1,
-            &bias_z,
-            &bias_value,
-            &bias_len
-        );
-        init_spline(&par->matter_bias1, bias_z, bias_value, bias_len, par->interp_method);
-        free(bias_z);
-        free(bias_value);
+        parse_spline(par->file_matter_bias1, &par->matter_bias1, par->interp_method);
     }
     else{
         double bias;
@@ -368,18 +540,8 @@ int coffe_parser_init(
 
     parse_int(conf, "read_matter_bias2", &par->read_matter_bias2, COFFE_FALSE);
     if (par->read_matter_bias2 == COFFE_TRUE){
-        double *bias_z, *bias_value;
-        size_t bias_len;
         parse_string(conf, "input_matter_bias2", par->file_matter_bias2, COFFE_TRUE);
-        read_2col(
-            par->file_matter_bias2,
-            &bias_z,
-            &bias_value,
-            &bias_len
-        );
-        init_spline(&par->matter_bias2, bias_z, bias_value, bias_len, par->interp_method);
-        free(bias_z);
-        free(bias_value);
+        parse_spline(par->file_matter_bias2, &par->matter_bias2, par->interp_method);
     }
     else{
         double bias;
@@ -394,27 +556,13 @@ int coffe_parser_init(
     /* parsing the magnification bias (s) */
     parse_int(conf, "read_magnification_bias1", &par->read_magnification_bias1, COFFE_FALSE);
     if (par->read_magnification_bias1 == COFFE_TRUE){
-        double *s_z, *s_value;
-        size_t s_len;
         parse_string(
             conf,
             "input_magnification_bias1",
             par->file_magnification_bias1,
             COFFE_TRUE
         );
-        read_2col(
-            par->file_magnification_bias1,
-            &s_z,
-            &s_value,
-            &s_len
-        );
-        init_spline(
-            &par->magnification_bias1,
-            s_z, s_value, s_len,
-            par->interp_method
-        );
-        free(s_z);
-        free(s_value);
+        parse_spline(par->file_magnification_bias1, &par->magnification_bias1, par->interp_method);
     }
     else{
         double s;
@@ -427,18 +575,8 @@ int coffe_parser_init(
 
     parse_int(conf, "read_magnification_bias2", &par->read_magnification_bias2, COFFE_FALSE);
     if (par->read_magnification_bias2 == COFFE_TRUE){
-        double *s_z, *s_value;
-        size_t s_len;
         parse_string(conf, "input_magnification_bias2", par->file_magnification_bias2, COFFE_TRUE);
-        read_2col(
-            par->file_magnification_bias2,
-            &s_z,
-            &s_value,
-            &s_len
-        );
-        init_spline(&par->magnification_bias2, s_z, s_value, s_len, par->interp_method);
-        free(s_z);
-        free(s_value);
+        parse_spline(par->file_magnification_bias2, &par->magnification_bias2, par->interp_method);
     }
     else{
         double s;
@@ -452,18 +590,8 @@ int coffe_parser_init(
     /* parsing the evolution_bias (f_evo) */
     parse_int(conf, "read_evolution_bias1", &par->read_evolution_bias1, COFFE_FALSE);
     if (par->read_evolution_bias1 == COFFE_TRUE){
-        double *f_evo_z, *f_evo_value;
-        size_t f_evo_len;
         parse_string(conf, "input_evolution_bias1", par->file_evolution_bias1, COFFE_TRUE);
-        read_2col(
-            par->file_evolution_bias1,
-            &f_evo_z,
-            &f_evo_value,
-            &f_evo_len
-        );
-        init_spline(&par->evolution_bias1, f_evo_z, f_evo_value, f_evo_len, par->interp_method);
-        free(f_evo_z);
-        free(f_evo_value);
+        parse_spline(par->file_evolution_bias1, &par->evolution_bias1, par->interp_method);
     }
     else{
         double f_evo;
@@ -476,18 +604,8 @@ int coffe_parser_init(
 
     parse_int(conf, "read_evolution_bias2", &par->read_evolution_bias2, COFFE_FALSE);
     if (par->read_evolution_bias2 == COFFE_TRUE){
-        double *f_evo_z, *f_evo_value;
-        size_t f_evo_len;
         parse_string(conf, "input_evolution_bias2", par->file_evolution_bias2, COFFE_TRUE);
-        read_2col(
-            par->file_evolution_bias2,
-            &f_evo_z,
-            &f_evo_value,
-            &f_evo_len
-        );
-        init_spline(&par->evolution_bias2, f_evo_z, f_evo_value, f_evo_len, par->interp_method);
-        free(f_evo_z);
-        free(f_evo_value);
+        parse_spline(par->file_evolution_bias2, &par->evolution_bias2, par->interp_method);
     }
     else{
         double f_evo;
@@ -518,6 +636,19 @@ int coffe_parser_init(
             &par->covariance_pixelsize,
             COFFE_TRUE
         );
+
+        /* optional: computing the covariance in tiles within a memory budget */
+        par->covariance_memory = 0;
+        parse_double(
+            conf,
+            "covariance_memory",
+            &par->covariance_memory,
+            COFFE_FALSE
+        );
+        if (par->covariance_memory < 0){
+            print_error_verbose(PROG_VALUE_ERROR, "covariance_memory");
+            exit(EXIT_FAILURE);
+        }
     }
 
     if (par->output_type == 4){
@@ -588,14 +719,13 @@ int coffe_parser_init(
         struct transfers ptr;
         struct lensing ple;
 
-        clock_t class_start, class_end;
 
         parse_double(conf, "k_min", &par->k_min, COFFE_TRUE);
         parse_double(conf, "k_max", &par->k_max, COFFE_TRUE);
 
         printf("Launching CLASS...\n");
 
-        class_start = clock();
+        coffe_profile_start(COFFE_PROFILE_CLASS);
 
         input_default_precision(&ppr);
         input_default_params(
@@ -673,10 +803,9 @@ int coffe_parser_init(
                 ];
         }
 
-        class_end = clock();
         printf(
             "CLASS finished in %.2f s\n",
-            (double)(class_end - class_start) / CLOCKS_PER_SEC
+            coffe_profile_stop(COFFE_PROFILE_CLASS)
         );
     }
     else{
@@ -686,21 +815,12 @@ int coffe_parser_init(
             par->file_power_spectrum,
             COFFE_TRUE
         );
-        double *k, *pk;
-        size_t pk_len;
-
-        read_2col(
+        parse_spline(
             par->file_power_spectrum,
-            &k,
-            &pk,
-            &pk_len
+            &par->power_spectrum,
+            par->interp_method
         );
 
-        init_spline(&par->power_spectrum, k, pk, pk_len, par->interp_method);
-
-        free(k);
-        free(pk);
-
         parse_double(conf, "k_min", &par->k_min, COFFE_FALSE);
 
         if (par->k_min < par->power_spectrum.spline->x[0]){
@@ -737,19 +857,12 @@ int coffe_parser_init(
         par->file_power_spectrum,
         COFFE_TRUE
     );
-    double *k, *pk;
-    size_t pk_len;
-
-    read_2col(
+    parse_spline(
         par->file_power_spectrum,
-        &k, &pk, &pk_len
+        &par->power_spectrum,
+        par->interp_method
     );
 
-    init_spline(&par->power_spectrum, k, pk, pk_len, par->interp_method);
-
-    free(k);
-    free(pk);
-
     /* the lower limit of integration for P(k) */
     parse_double(conf, "k_min", &par->k_min, COFFE_FALSE);
 
@@ -829,21 +942,39 @@ int coffe_parser_init(
             = {"den", "rsd", "d1", "d2", "g1", "g2", "g3", "g4", "g5", "len"};
 
         int counter = 0;
-        char temp_input[10];
-        for (int i = 0; i<par->correlation_sources_len*(par->correlation_sources_len + 1)/2; ++i){
-            strcpy(par->corr_terms[i], "\0");
+        int sources[COFFE_MAX_STRLEN], all_terms[COFFE_MAX_STRLEN];
+
+        /* resolving the names of the sources into their labels */
+        for (int i = 0; i<par->correlation_sources_len; ++i){
+            sources[i] = -1;
+            for (int l = 0; l<10; ++l){
+                if (strcmp(par->correlation_sources[i], possible_inputs[l]) == 0)
+                    sources[i] = l;
+            }
+            if (sources[i] < 0){
+                print_error_verbose(PROG_VALUE_ERROR, "correlation_contributions");
+                exit(EXIT_FAILURE);
+            }
         }
 
+        par->nonintegrated_terms.len = 0;
+        par->single_terms.len = 0;
+        par->double_terms.len = 0;
+
         /* input of the possible correlation terms */
         for (int i = 0; i<par->correlation_sources_len; ++i){
             for (int j = i; j<par->correlation_sources_len; ++j){
-                for (int l = 0; l<10; ++l){
-                    sprintf(temp_input, "%d", l);
-                    if (strcmp(par->correlation_sources[i], possible_inputs[l]) == 0)
-                        strcat(par->corr_terms[counter], temp_input);
-                    if (strcmp(par->correlation_sources[j], possible_inputs[l]) == 0)
-                        strcat(par->corr_terms[counter], temp_input);
-                }
+                sprintf(par->corr_terms[counter], "%d%d", sources[i], sources[j]);
+                all_terms[counter] = COFFE_TERM(sources[i], sources[j]);
+
+                /* sorting the term by the number of integrals along the line of sight */
+                int integrated = (sources[i] >= COFFE_G4) + (sources[j] >= COFFE_G4);
+                struct coffe_corr_terms *terms =
+                    integrated == 0 ? &par->nonintegrated_terms :
+                    integrated == 1 ? &par->single_terms : &par->double_terms;
+                terms->value[terms->len] = all_terms[counter];
+                ++terms->len;
+
                 ++counter;
             }
         }
@@ -861,29 +992,25 @@ int coffe_parser_init(
 
         /* isolating the term requiring renormalization */
         for (int i = 0; i<counter; ++i){
-            if (
-                strcmp(par->corr_terms[i], "33") == 0 || // d2-d2 term
-                strcmp(par->corr_terms[i], "44") == 0 || // g1-g1 term
-                strcmp(par->corr_terms[i], "55") == 0 || // g2-g2 term
-                strcmp(par->corr_terms[i], "66") == 0 || // g3-g3 term
-                strcmp(par->corr_terms[i], "77") == 0 || // g4-g4 term
-                strcmp(par->corr_terms[i], "88") == 0 || // g5-g5 term
+            switch (all_terms[i]){
+                case COFFE_TERM(COFFE_D2, COFFE_D2):
+                case COFFE_TERM(COFFE_G1, COFFE_G1):
+                case COFFE_TERM(COFFE_G2, COFFE_G2):
+                case COFFE_TERM(COFFE_G3, COFFE_G3):
+                case COFFE_TERM(COFFE_G4, COFFE_G4):
+                case COFFE_TERM(COFFE_G5, COFFE_G5):
                 /* I don't think these are necessary anymore */
-                strcmp(par->corr_terms[i], "34") == 0 ||
-                strcmp(par->corr_terms[i], "43") == 0 ||
-                strcmp(par->corr_terms[i], "35") == 0 ||
-                strcmp(par->corr_terms[i], "53") == 0 ||
-                strcmp(par->corr_terms[i], "36") == 0 ||
-                strcmp(par->corr_terms[i], "63") == 0 ||
-                strcmp(par->corr_terms[i], "45") == 0 ||
-                strcmp(par->corr_terms[i], "54") == 0 ||
-                strcmp(par->corr_terms[i], "46") == 0 ||
-                strcmp(par->corr_terms[i], "64") == 0 ||
-                strcmp(par->corr_terms[i], "56") == 0 ||
-                strcmp(par->corr_terms[i], "65") == 0
-            ){
-                par->nonzero_terms[8].n = 4, par->nonzero_terms[8].l = 0;
-                par->divergent = 1;
+                case COFFE_TERM(COFFE_D2, COFFE_G1):
+                case COFFE_TERM(COFFE_D2, COFFE_G2):
+                case COFFE_TERM(COFFE_D2, COFFE_G3):
+                case COFFE_TERM(COFFE_G1, COFFE_G2):
+                case COFFE_TERM(COFFE_G1, COFFE_G3):
+                case COFFE_TERM(COFFE_G2, COFFE_G3):
+                    par->nonzero_terms[8].n = 4, par->nonzero_terms[8].l = 0;
+                    par->divergent = 1;
+                    break;
+                default:
+                    break;
             }
         }
     }
@@ -894,17 +1021,99 @@ int coffe_parser_init(
     /* the prefix for the output files */
     parse_string(conf, "output_prefix", par->output_prefix, COFFE_TRUE);
 
+    /* optional: text or binary output files */
+    par->output_format = 0;
+    parse_int(conf, "output_format", &par->output_format, COFFE_FALSE);
+    if (par->output_format != 0 && par->output_format != 1){
+        print_error_verbose(PROG_VALUE_ERROR, "output_format");
+        exit(EXIT_FAILURE);
+    }
+
+    /* optional: reporting the progress of the multipoles, 0 to disable */
+    par->progress_interval = 0;
+    parse_double(conf, "progress_interval", &par->progress_interval, COFFE_FALSE);
+    if (par->progress_interval < 0){
+        print_error_verbose(PROG_VALUE_ERROR, "progress_interval");
+        exit(EXIT_FAILURE);
+    }
+
+    /* optional: checkpointing the finished jobs of the multipoles */
+    par->checkpoint = 0;
+    parse_int(conf, "checkpoint", &par->checkpoint, COFFE_FALSE);
+
+    /* the tiles of the covariance are streamed into the binary files */
+    if (
+        (par->output_type == 4 || par->output_type == 5) &&
+        par->covariance_memory > 0 && par->output_format != 1
+    ){
+        fprintf(
+            stderr,
+            "ERROR: covariance_memory requires output_format = 1!\n");
+        exit(EXIT_FAILURE);
+    }
+
     /* saving the timestamp */
     sprintf(par->timestamp, "%s", coffe_get_time());
 
     par->conf = conf;
 
-    end = clock();
 
     printf(
         "Settings file \"%s\" parsed in %.2f s\n",
         filename,
-        (double)(end - start) / CLOCKS_PER_SEC
+        coffe_profile_stop(COFFE_PROFILE_PARSER)
     );
     return EXIT_SUCCESS;
 }
+
+
+/**
+    frees the settings and everything the parser allocated in <par>
+**/
+
+int coffe_parser_free(
+    struct coffe_parameters_t *par
+)
+{
+    if (par->conf != NULL){
+        config_destroy(par->conf);
+        free(par->conf);
+        par->conf = NULL;
+    }
+    free_spline(&par->matter_bias1);
+    free_spline(&par->matter_bias2);
+    free_spline(&par->magnification_bias1);
+    free_spline(&par->magnification_bias2);
+    free_spline(&par->evolution_bias1);
+    free_spline(&par->evolution_bias2);
+    free_spline(&par->power_spectrum);
+    free_spline(&par->power_spectrum_norm);
+
+    if (par->output_type == 1){
+        free(par->mu);
+        par->mu = NULL;
+    }
+    if (
+        par->output_type == 2 ||
+        par->output_type == 3 ||
+        par->output_type == 4 ||
+        par->output_type == 5
+    ){
+        free(par->multipole_values);
+        par->multipole_values = NULL;
+    }
+    if (par->output_type == 1 || par->output_type == 2 || par->output_type == 3){
+        free(par->sep);
+        par->sep = NULL;
+    }
+    if (par->batch_len > 0){
+        free(par->batch_z_mean);
+        free(par->batch_deltaz);
+        free(par->batch_z_min);
+        free(par->batch_z_max);
+        par->batch_z_mean = par->batch_deltaz = NULL;
+        par->batch_z_min = par->batch_z_max = NULL;
+        par->batch_len = 0;
+    }
+    return EXIT_SUCCESS;
+}
@@ -24,4 +24,8 @@ int coffe_parser_init(
     struct coffe_parameters_t *par
 );
 
+int coffe_parser_free(
+    struct coffe_parameters_t *par
+);
+
 #endif
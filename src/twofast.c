@@ -181,6 +181,119 @@ static double twofast_selectqnu(int l, double nu)
     return q;
 }
 
+/**
+    cache of FFTW plans together with the arrays they were planned on,
+    keyed on the length and direction of the transform; every thread
+    has its own cache, so the arrays are never shared between threads
+**/
+
+#ifndef TWOFAST_MAX_PLANS
+#define TWOFAST_MAX_PLANS 8
+#endif
+
+struct twofast_plan
+{
+    size_t len;
+    int direction; /* FFTW_FORWARD for r2c, FFTW_BACKWARD for c2r */
+    unsigned flag;
+    fftw_plan plan;
+    double *real; /* of length len */
+    fftw_complex *fourier; /* of length len/2 + 1 */
+};
+
+static struct twofast_plan twofast_plans[TWOFAST_MAX_PLANS];
+static size_t twofast_plans_len = 0;
+#ifdef _OPENMP
+#pragma omp threadprivate(twofast_plans, twofast_plans_len)
+#endif
+
+/**
+    returns the cached plan for the transform, creating it if needed;
+    the FFTW planner is not thread safe, so planning is serialized
+**/
+
+static struct twofast_plan *twofast_get_plan(
+    size_t len,
+    int direction,
+    unsigned flag
+)
+{
+    for (size_t i = 0; i<twofast_plans_len; ++i){
+        if (
+            twofast_plans[i].len == len &&
+            twofast_plans[i].direction == direction &&
+            twofast_plans[i].flag == flag
+        )
+            return &twofast_plans[i];
+    }
+
+    /* cache full, evict the oldest entry */
+    if (twofast_plans_len == TWOFAST_MAX_PLANS){
+        #pragma omp critical(twofast_planner)
+        {
+            fftw_destroy_plan(twofast_plans[0].plan);
+        }
+        fftw_free(twofast_plans[0].real);
+        fftw_free(twofast_plans[0].fourier);
+        for (size_t i = 1; i<TWOFAST_MAX_PLANS; ++i)
+            twofast_plans[i - 1] = twofast_plans[i];
+        --twofast_plans_len;
+    }
+
+    struct twofast_plan *entry = &twofast_plans[twofast_plans_len];
+    entry->len = len;
+    entry->direction = direction;
+    entry->flag = flag;
+    entry->real = (double *)fftw_malloc(sizeof(double)*len);
+    entry->fourier = (fftw_complex *)fftw_malloc(sizeof(fftw_complex)*(len/2 + 1));
+    if (entry->real == NULL || entry->fourier == NULL){
+        fprintf(stderr, "ERROR: file %s, function %s\n", __FILE__, __func__);
+        exit(EXIT_FAILURE);
+    }
+    #pragma omp critical(twofast_planner)
+    {
+        if (direction == FFTW_FORWARD)
+            entry->plan = fftw_plan_dft_r2c_1d(len, entry->real, entry->fourier, flag);
+        else
+            entry->plan = fftw_plan_dft_c2r_1d(len, entry->fourier, entry->real, flag);
+    }
+    ++twofast_plans_len;
+    return entry;
+}
+
+void twofast_free_plans(void)
+{
+    for (size_t i = 0; i<twofast_plans_len; ++i){
+        #pragma omp critical(twofast_planner)
+        {
+            fftw_destroy_plan(twofast_plans[i].plan);
+        }
+        fftw_free(twofast_plans[i].real);
+        fftw_free(twofast_plans[i].fourier);
+    }
+    twofast_plans_len = 0;
+}
+
+int twofast_import_wisdom(const char *filename)
+{
+    int status;
+    #pragma omp critical(twofast_planner)
+    {
+        status = fftw_import_wisdom_from_filename(filename);
+    }
+    return status;
+}
+
+int twofast_export_wisdom(const char *filename)
+{
+    int status;
+    #pragma omp critical(twofast_planner)
+    {
+        status = fftw_export_wisdom_to_filename(filename);
+    }
+    return status;
+}
+
 static void twofast_fft_input(
     fftw_complex *output_y,
     size_t output_len,
@@ -196,10 +309,9 @@ static void twofast_fft_input(
     const size_t N2 = output_len/2 + 1;
     const double L = 2*M_PI*output_len/log(kmax/kmin);
     double *input_x_mod = (double *)malloc(sizeof(double)*output_len);
-    double *input_y_mod = (double *)fftw_malloc(sizeof(double)*output_len);
-    fftw_complex *input_y_fft = (fftw_complex *)fftw_malloc(sizeof(fftw_complex)*N2);
-    fftw_plan p =
-        fftw_plan_dft_r2c_1d(output_len, input_y_mod, input_y_fft, flag);
+    struct twofast_plan *p = twofast_get_plan(output_len, FFTW_FORWARD, flag);
+    double *input_y_mod = p->real;
+    fftw_complex *input_y_fft = p->fourier;
 
     for (size_t i = 0; i<output_len; ++i){
         input_x_mod[i] = k0*pow(kmax/kmin, (double)i/output_len);
@@ -218,8 +330,7 @@ static void twofast_fft_input(
             );
     }
 
-    fftw_execute(p);
-    fftw_destroy_plan(p);
+    fftw_execute(p->plan);
 
     for (size_t i = 0; i<N2; ++i){
         output_y[i] =
@@ -234,8 +345,6 @@ static void twofast_fft_input(
     }
 
     free(input_x_mod);
-    fftw_free(input_y_mod);
-    fftw_free(input_y_fft);
 }
 
 void twofast_1bessel(
@@ -300,45 +409,23 @@ void twofast_1bessel(
             k0*k0*k0*pow(kmax/kmin, -((qnu + nu)*i/output_len))/M_PI/pow(r0*k0, nu)/G;
     }
 
-    fftw_complex *temp_input = (fftw_complex *)fftw_malloc(sizeof(fftw_complex)*N2);
-    double *t_array = (double *)malloc(sizeof(double)*N2);
-
-    for (size_t i = 0; i<N2; ++i){
-        t_array[i] = 2*M_PI*i/G;
-    }
+    /* the cached plan was made on its own arrays, so the input is not destroyed by planning */
+    struct twofast_plan *p = twofast_get_plan(output_len, FFTW_BACKWARD, flag);
 
     for (size_t i = 0; i<N2; ++i){
-        // copying the input as it's destroyed by the planner
-        temp_input[i] =
+        p->fourier[i] =
             input_y_fft[i]
            *twofast_mql(2*M_PI*i/G, qnu, l, k0*r0);
     }
 
-    double *temp_output_y = (double *)fftw_malloc(sizeof(double)*output_len);
-
-    fftw_plan p =
-        fftw_plan_dft_c2r_1d(output_len, input_y_fft, temp_output_y, flag);
-
-    for (size_t i = 0; i<N2; ++i){
-        input_y_fft[i] = temp_input[i]; // putting it back
-    }
-
-    fftw_execute(p);
-    fftw_destroy_plan(p);
+    fftw_execute(p->plan);
 
     for (size_t i = 0; i<output_len; ++i){
-        temp_output_y[i] *= prefactors[i];
-    }
-
-    for (size_t i = 0; i<output_len; ++i){
-        output_y[i] = temp_output_y[i];
+        output_y[i] = p->real[i]*prefactors[i];
     }
 
     fftw_free(prefactors);
     fftw_free(input_y_fft);
-    fftw_free(temp_input);
-    free(t_array);
-    fftw_free(temp_output_y);
 }
 
 #ifdef HAVE_ARB
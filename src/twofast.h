@@ -57,6 +57,21 @@ void twofast_1bessel(
     unsigned flag
 );
 
+/*****
+    frees the FFTW plans (and their arrays) cached by the calling thread
+    in twofast_1bessel
+*****/
+void twofast_free_plans(void);
+
+/*****
+    imports (exports) FFTW wisdom from (to) the file <filename>,
+    so plans better than FFTW_ESTIMATE can be reused between runs;
+    return nonzero on success
+*****/
+int twofast_import_wisdom(const char *filename);
+
+int twofast_export_wisdom(const char *filename);
+
 /**** DEPRACATED ****/
 /*****
     computes the integral of the form 2/pi k^2 P(k) j_l1(k chi1) j_l2(k chi2)